@@ -335,7 +335,6 @@ int main( int argc, char *argv[] )
     {
       /** dense spd matrix format */
       hmlp::gofmm::SPDMatrix<T> K;
-      K.resize( n, n );
       K.read( n, n, user_matrix_filename );
       /** (optional) provide neighbors, leave uninitialized otherwise */
       hmlp::Data<std::pair<T, std::size_t>> NN;
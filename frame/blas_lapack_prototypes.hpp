@@ -107,6 +107,18 @@ void sgecon_(
     float *anorm, 
     float *rcond, 
     float *work, int *iwork, int *info );
+void dsyev_(
+    const char *jobz, const char *uplo,
+    int *n,
+    double *A, int *lda, 
+    double *w, 
+    double *work, int *lwork, int *info );
+void ssyev_(
+    const char *jobz, const char *uplo,
+    int *n,
+    float *A, int *lda, 
+    float *w, 
+    float *work, int *lwork, int *info );
 void dgeqrf_(
     int *m, int *n, 
     double *A, int *lda, 
@@ -30,6 +30,9 @@
 #include <hbw_allocator.h>
 #endif
 
+/** vectorized exp, tanh, sqrt and pow for the fused epilogue */
+#include <hmlp_vmath.hpp>
+
 /** kernel matrix uses VirtualMatrix<T> as base */
 #include <containers/VirtualMatrix.hpp>
 
@@ -56,6 +59,7 @@ class KernelMatrix : public VirtualMatrix<T, Allocator>, ReadWrite
     {
       this->d = d;
       this->kernel = kernel;
+      ComputeSquareNorms();
     };
 
     /** unsymmetric kernel matrix */
@@ -65,8 +69,70 @@ class KernelMatrix : public VirtualMatrix<T, Allocator>, ReadWrite
     {
       this->d = d;
       this->kernel = kernel;
+      ComputeSquareNorms();
     };
 
+
+    /**
+     *  @brief (Optional) keep a copy of the points in the order of gids,
+     *         e.g. the leaf order of a tree. Leaf and node blocks are then
+     *         contiguous, which makes packing a streaming copy and lets
+     *         xgemm read them in place. Only for the symmetric matrix.
+     */ 
+    void Permute( std::vector<size_t> &gids )
+    {
+      if ( &sources != &targets ) return;
+      assert( gids.size() == sources.col() );
+
+      tree_points.resize( d, gids.size() );
+      tree_position.resize( gids.size() );
+
+      #pragma omp parallel for
+      for ( size_t i = 0; i < gids.size(); i ++ )
+      {
+        for ( size_t p = 0; p < d; p ++ ) 
+          tree_points[ i * d + p ] = sources[ gids[ i ] * d + p ];
+        tree_position[ gids[ i ] ] = i;
+      }
+    }; /** end Permute() */
+
+
+    /** 
+     *  @brief (Optional) evaluate blocks with the fast hmlp::vmath routines
+     *         (relative error about 1E-7) instead of the ulp-bounded ones.
+     */ 
+    void SetFastMath( bool fast_math ) { this->fast_math = fast_math; };
+
+    /** 
+     *  @brief Square norms of all targets and sources, computed once in
+     *         the constructor. Call again if the coordinates are changed
+     *         after construction.
+     */
+    void ComputeSquareNorms()
+    {
+      target_sqnorms.resize( targets.col() );
+      source_sqnorms.resize( sources.col() );
+
+      #pragma omp parallel for
+      for ( size_t i = 0; i < targets.col(); i ++ )
+      {
+        T x2 = 0.0;
+        for ( size_t p = 0; p < d; p ++ ) 
+          x2 += targets[ i * d + p ] * targets[ i * d + p ];
+        target_sqnorms[ i ] = x2;
+      }
+
+      #pragma omp parallel for
+      for ( size_t j = 0; j < sources.col(); j ++ )
+      {
+        T y2 = 0.0;
+        for ( size_t p = 0; p < d; p ++ ) 
+          y2 += sources[ j * d + p ] * sources[ j * d + p ];
+        source_sqnorms[ j ] = y2;
+      }
+    }; /** end ComputeSquareNorms() */
+
+
     ~KernelMatrix() {};
 
     /** ESSENTIAL: return  K( i, j ) */
@@ -100,24 +166,40 @@ class KernelMatrix : public VirtualMatrix<T, Allocator>, ReadWrite
     //};
 
 
-		/** ESSENTIAL: override the virtual function */
+		/** 
+     *  ESSENTIAL: override the virtual function. A single entry uses the 
+     *  exact ( x - y )^2, which does not cancel for nearby points.
+     */
     T operator()( std::size_t i, std::size_t j )
     {
-      T Kij = 0.0;
+      T xty = 0.0, r2 = 0.0;
+
+      for ( size_t k = 0; k < d; k++ )
+      {
+				T tar = targets[ i * d + k ];
+				T src = sources[ j * d + k ];
+        xty += tar * src;
+        r2  += ( tar - src ) * ( tar - src );
+      }
 
       switch ( kernel.type )
       {
         case KS_GAUSSIAN:
-        {
-          for ( size_t k = 0; k < d; k++ )
-          {
-						T tar = targets[ i * d + k ];
-						T src = sources[ j * d + k ];
-            Kij += ( tar - src ) * ( tar - src );
-          }
-          Kij = exp( kernel.scal * Kij );
-          break;
-        }
+          return Element<KS_GAUSSIAN>( xty, r2, i, j );
+        case KS_POLYNOMIAL:
+          return Element<KS_POLYNOMIAL>( xty, r2, i, j );
+        case KS_LAPLACE:
+          return Element<KS_LAPLACE>( xty, r2, i, j );
+        case KS_GAUSSIAN_VAR_BANDWIDTH:
+          return Element<KS_GAUSSIAN_VAR_BANDWIDTH>( xty, r2, i, j );
+        case KS_TANH:
+          return Element<KS_TANH>( xty, r2, i, j );
+        case KS_QUARTIC:
+          return Element<KS_QUARTIC>( xty, r2, i, j );
+        case KS_MULTIQUADRATIC:
+          return Element<KS_MULTIQUADRATIC>( xty, r2, i, j );
+        case KS_EPANECHNIKOV:
+          return Element<KS_EPANECHNIKOV>( xty, r2, i, j );
         default:
         {
           printf( "invalid kernel type\n" );
@@ -125,7 +207,7 @@ class KernelMatrix : public VirtualMatrix<T, Allocator>, ReadWrite
           break;
         }
 			}
-      return Kij;
+      return 0.0;
 		};
 
     /** ESSENTIAL: return K( imap, jmap ) */
@@ -137,79 +219,32 @@ class KernelMatrix : public VirtualMatrix<T, Allocator>, ReadWrite
 
       if ( !submatrix.size() ) return submatrix;
 
-      // Get coordinates of sources and targets
-      hmlp::Data<T> itargets = targets( imap );
-      hmlp::Data<T> jsources = sources( jmap );
-
-      assert( itargets.col() == submatrix.row() );
-      assert( itargets.row() == d );
-      assert( jsources.col() == submatrix.col() );
-      assert( jsources.row() == d );
-
-      /** compute inner products */
-      xgemm
-      (
-        "T", "N",
-        imap.size(), jmap.size(), d,
-        -2.0, itargets.data(),   itargets.row(),
-              jsources.data(),   jsources.row(),
-         0.0, submatrix.data(), submatrix.row()
-      );
-
-      /** compute square norms */
-      std::vector<T> target_sqnorms( imap.size() );
-      std::vector<T> source_sqnorms( jmap.size() );
-      #pragma omp parallel for
-      for ( TINDEX i = 0; i < imap.size(); i ++ )
-      {
-        target_sqnorms[ i ] = xdot
-                              (
-                                d,
-                                itargets.data() + i * d, 1,
-                                itargets.data() + i * d, 1
-                              );
-      }
-      #pragma omp parallel for
-      for ( TINDEX j = 0; j < jmap.size(); j ++ )
-      {
-        source_sqnorms[ j ] = xdot
-                              (
-                                d,
-                                jsources.data() + j * d, 1,
-                                jsources.data() + j * d, 1
-                              );
-      }
-
-      /** add square norms to inner products to get pairwise square distances
-       * */
-      #pragma omp parallel for
-      for ( TINDEX j = 0; j < jmap.size(); j ++ )
-      {
-        for ( TINDEX i = 0; i < imap.size(); i ++ )
-        {
-          submatrix[ j * imap.size() + i ] += target_sqnorms[ i ] + source_sqnorms[ j ];
-        }
-      }
-
       switch ( kernel.type )
       {
         case KS_GAUSSIAN:
-          {
-            // Apply the scaling factor and exponentiate
-            #pragma omp parallel for
-            for ( TINDEX i = 0; i < submatrix.size(); i ++ )
-            {
-              submatrix[ i ] = std::exp( kernel.scal * submatrix[ i ] );
-            }
-
-            // gemm: 2 * i * j * d
-            // compute sqnorms: 2 * ( i + j ) * d
-            // add sqnorms: 2 * i * j
-            // scale and exponentiate: 2 * i * j
-            //flopcount += 2 * ( imap.size() * jmap.size() + imap.size() + jmap.size() ) * d
-            //           + 4 * imap.size() * jmap.size();
-            break;
-          }
+          Fused<KS_GAUSSIAN>( imap, jmap, submatrix ); 
+          break;
+        case KS_POLYNOMIAL:
+          Fused<KS_POLYNOMIAL>( imap, jmap, submatrix ); 
+          break;
+        case KS_LAPLACE:
+          Fused<KS_LAPLACE>( imap, jmap, submatrix ); 
+          break;
+        case KS_GAUSSIAN_VAR_BANDWIDTH:
+          Fused<KS_GAUSSIAN_VAR_BANDWIDTH>( imap, jmap, submatrix ); 
+          break;
+        case KS_TANH:
+          Fused<KS_TANH>( imap, jmap, submatrix ); 
+          break;
+        case KS_QUARTIC:
+          Fused<KS_QUARTIC>( imap, jmap, submatrix ); 
+          break;
+        case KS_MULTIQUADRATIC:
+          Fused<KS_MULTIQUADRATIC>( imap, jmap, submatrix ); 
+          break;
+        case KS_EPANECHNIKOV:
+          Fused<KS_EPANECHNIKOV>( imap, jmap, submatrix ); 
+          break;
         default:
           {
             printf( "invalid kernel type\n" );
@@ -256,13 +291,41 @@ class KernelMatrix : public VirtualMatrix<T, Allocator>, ReadWrite
     {
       double flopcount = 0.0;
 
+      /** the same costs as test_gsks (exp 35, tanh 89 ...) */
       switch ( kernel.type )
       {
         case KS_GAUSSIAN:
+        case KS_GAUSSIAN_VAR_BANDWIDTH:
           {
             flopcount = na * nb * ( 2.0 * d + 35.0 );
             break;
           }
+        case KS_POLYNOMIAL:
+        case KS_MULTIQUADRATIC:
+          {
+            flopcount = na * nb * ( 2.0 * d + 6.0 );
+            break;
+          }
+        case KS_LAPLACE:
+          {
+            flopcount = na * nb * ( 2.0 * d + 60.0 );
+            break;
+          }
+        case KS_TANH:
+          {
+            flopcount = na * nb * ( 2.0 * d + 89.0 );
+            break;
+          }
+        case KS_QUARTIC:
+          {
+            flopcount = na * nb * ( 2.0 * d + 8.0 );
+            break;
+          }
+        case KS_EPANECHNIKOV:
+          {
+            flopcount = na * nb * ( 2.0 * d + 7.0 );
+            break;
+          }
         default:
           {
             printf( "invalid kernel type\n" );
@@ -275,6 +338,369 @@ class KernelMatrix : public VirtualMatrix<T, Allocator>, ReadWrite
 
   private:
 
+    /** register block of the fused Kab microkernel (same as d8x4) */
+    static const size_t MR = 8;
+    static const size_t NR = 4;
+
+    /** beyond this dimension inner products go to xgemm */
+    static const size_t KC = 256;
+
+    /** whether KS depends on the square distance (else on x' * y) */
+    template<ks_type KS>
+    static constexpr bool IsDistance()
+    {
+      return KS != KS_POLYNOMIAL && KS != KS_TANH;
+    };
+
+
+    /**
+     *  @brief Kernel value from the inner product xty = x' * y and the
+     *         square distance r2 of target i and source j. KS is a
+     *         template parameter, so the fused loops have no branches.
+     */ 
+    template<ks_type KS>
+    inline T Element( T xty, T r2, size_t i, size_t j )
+    {
+      if ( r2 < 0.0 ) r2 = 0.0;
+
+      switch ( KS )
+      {
+        case KS_GAUSSIAN:
+          return std::exp( kernel.scal * r2 );
+        case KS_POLYNOMIAL:
+          return std::pow( kernel.scal * xty + kernel.cons, kernel.powe );
+        case KS_LAPLACE:
+          return std::exp( kernel.scal * std::sqrt( r2 ) );
+        case KS_GAUSSIAN_VAR_BANDWIDTH:
+          return std::exp( -0.5 * kernel.hi[ i ] * kernel.hj[ j ] * r2 );
+        case KS_TANH:
+          return std::tanh( kernel.scal * xty + kernel.cons );
+        case KS_QUARTIC:
+        {
+          T u2 = kernel.scal * r2;
+          return ( u2 < 1.0 ) ? ( 1.0 - u2 ) * ( 1.0 - u2 ) : 0.0;
+        }
+        case KS_MULTIQUADRATIC:
+          return std::sqrt( r2 + kernel.cons * kernel.cons );
+        case KS_EPANECHNIKOV:
+        {
+          T u2 = kernel.scal * r2;
+          return ( u2 < 1.0 ) ? 1.0 - u2 : 0.0;
+        }
+        default:
+          return 0.0;
+      }
+    }; /** end Element() */
+
+
+    /** coordinates of target (or source) gid */
+    inline T *Point( bool target, size_t gid )
+    {
+      if ( tree_position.size() ) 
+        return tree_points.data() + tree_position[ gid ] * d;
+      return ( target ? targets.data() : sources.data() ) + gid * d;
+    };
+
+
+    /** 
+     *  @brief Return the d-by-map.size() coordinates of map. A run of
+     *         consecutive points in tree order is returned in place,
+     *         otherwise the points are gathered into buff.
+     */ 
+    template<typename TINDEX>
+    T *Block( bool target, std::vector<TINDEX> &map, Data<T> &buff )
+    {
+      bool contiguous = ( tree_position.size() > 0 );
+      for ( size_t i = 1; contiguous && i < map.size(); i ++ )
+        contiguous = ( tree_position[ map[ i ] ] == tree_position[ map[ 0 ] ] + i );
+
+      if ( contiguous ) return Point( target, map[ 0 ] );
+
+      buff.resize( d, map.size() );
+      for ( size_t i = 0; i < map.size(); i ++ )
+        for ( size_t p = 0; p < d; p ++ )
+          buff[ i * d + p ] = Point( target, map[ i ] )[ p ];
+      return buff.data();
+    }; /** end Block() */
+
+
+    /**
+     *  @brief Pack the points of map into R-by-d panels (padded with 
+     *         zeros). D > 0 is the dimension d known at compile time.
+     */ 
+    template<size_t R, size_t D, typename TINDEX>
+    void Pack( bool target, std::vector<TINDEX> &map, std::vector<T> &packX )
+    {
+      const size_t d = D ? D : this->d;
+      size_t npanel = ( map.size() + R - 1 ) / R;
+
+      packX.resize( npanel * R * d );
+
+      #pragma omp parallel for
+      for ( size_t ib = 0; ib < npanel; ib ++ )
+      {
+        T *panel = packX.data() + ib * R * d;
+        for ( size_t i = 0; i < R; i ++ )
+        {
+          if ( ib * R + i < map.size() )
+          {
+            T *x = Point( target, map[ ib * R + i ] );
+            for ( size_t p = 0; p < d; p ++ ) panel[ p * R + i ] = x[ p ];
+          }
+          else
+          {
+            for ( size_t p = 0; p < d; p ++ ) panel[ p * R + i ] = 0.0;
+          }
+        }
+      }
+    }; /** end Pack() */
+
+
+    /**
+     *  @brief C = a' * b for an mr-by-nr block of C (ldc), where a is 
+     *         k-by-MR and b is k-by-NR (packed). With DIST the block of
+     *         square distances ( a_i - b_j )' * ( a_i - b_j ) is formed
+     *         instead, which does not cancel for close points. With 
+     *         D > 0 the loop over k = D is fully unrolled.
+     */ 
+    template<size_t D, bool DIST>
+    static inline void RankD( size_t k, const T *a, const T *b, 
+        size_t mr, size_t nr, T *C, size_t ldc )
+    {
+      if ( D ) k = D;
+      T c[ MR * NR ] = { 0.0 };
+      for ( size_t p = 0; p < k; p ++, a += MR, b += NR )
+      {
+        for ( size_t j = 0; j < NR; j ++ )
+        {
+          for ( size_t i = 0; i < MR; i ++ )
+          {
+            if ( DIST )
+            {
+              T tmp = a[ i ] - b[ j ];
+              c[ j * MR + i ] += tmp * tmp;
+            }
+            else c[ j * MR + i ] += a[ i ] * b[ j ];
+          }
+        }
+      }
+      if ( mr == MR && nr == NR )
+      {
+        for ( size_t j = 0; j < NR; j ++ )
+          for ( size_t i = 0; i < MR; i ++ )
+            C[ j * ldc + i ] = c[ j * MR + i ];
+        return;
+      }
+      for ( size_t j = 0; j < nr; j ++ )
+        for ( size_t i = 0; i < mr; i ++ )
+          C[ j * ldc + i ] = c[ j * MR + i ];
+    }; /** end RankD() */
+
+
+    /**
+     *  @brief Apply the kernel to one column of a block. On entry Kj[ i ]
+     *         holds the square distance of target imap[ i ] and source
+     *         jgid if IsDistance<KS>(), otherwise their inner product.
+     *         The arguments are formed in place, then exp, tanh, sqrt and
+     *         pow run over the whole column in hmlp::vmath.
+     */ 
+    template<ks_type KS, bool FAST, typename TINDEX>
+    inline void Epilogue( size_t m, T *Kj, const TINDEX *imap, size_t jgid )
+    {
+      switch ( KS )
+      {
+        case KS_GAUSSIAN:
+        {
+          for ( size_t i = 0; i < m; i ++ ) Kj[ i ] *= kernel.scal;
+          vmath::Exp<FAST>( m, Kj, Kj );
+          break;
+        }
+        case KS_POLYNOMIAL:
+        {
+          for ( size_t i = 0; i < m; i ++ ) 
+            Kj[ i ] = kernel.scal * Kj[ i ] + kernel.cons;
+          vmath::Pow<FAST>( m, Kj, kernel.powe, Kj );
+          break;
+        }
+        case KS_LAPLACE:
+        {
+          vmath::Sqrt<FAST>( m, Kj, Kj );
+          for ( size_t i = 0; i < m; i ++ ) Kj[ i ] *= kernel.scal;
+          vmath::Exp<FAST>( m, Kj, Kj );
+          break;
+        }
+        case KS_GAUSSIAN_VAR_BANDWIDTH:
+        {
+          for ( size_t i = 0; i < m; i ++ ) 
+            Kj[ i ] *= -0.5 * kernel.hi[ imap[ i ] ] * kernel.hj[ jgid ];
+          vmath::Exp<FAST>( m, Kj, Kj );
+          break;
+        }
+        case KS_TANH:
+        {
+          for ( size_t i = 0; i < m; i ++ ) 
+            Kj[ i ] = kernel.scal * Kj[ i ] + kernel.cons;
+          vmath::Tanh<FAST>( m, Kj, Kj );
+          break;
+        }
+        case KS_MULTIQUADRATIC:
+        {
+          for ( size_t i = 0; i < m; i ++ ) 
+            Kj[ i ] += kernel.cons * kernel.cons;
+          vmath::Sqrt<FAST>( m, Kj, Kj );
+          break;
+        }
+        default:
+        {
+          /** polynomial kernels with compact support (of r2 only) */
+          for ( size_t i = 0; i < m; i ++ ) 
+            Kj[ i ] = Element<KS>( 0.0, Kj[ i ], imap[ i ], jgid );
+          break;
+        }
+      }
+    }; /** end Epilogue() */
+
+
+    /** pack buffers of the calling thread, shared by all Packed() */
+    static std::vector<T> *PackBuffers()
+    {
+      static thread_local std::vector<T> buff[ 2 ];
+      return buff;
+    };
+
+
+    /**
+     *  @brief The packed path of Fused() for d <= KC. D > 0 is the 
+     *         dimension d known at compile time (1 to 8), D = 0 reads d.
+     */ 
+    template<ks_type KS, size_t D, typename TINDEX>
+    void Packed( std::vector<TINDEX> &imap, std::vector<TINDEX> &jmap, Data<T> &K )
+    {
+      const size_t d = D ? D : this->d;
+      size_t m = imap.size();
+      size_t n = jmap.size();
+
+      /** 
+       *  packed panels. The buffers are reused by the calling thread; 
+       *  bind them here so that the omp threads below share the caller's
+       *  buffers instead of their own thread_local.
+       */
+      std::vector<T> *buff = PackBuffers();
+      auto &packA = buff[ 0 ];
+      auto &packB = buff[ 1 ];
+      Pack<MR, D>( true,  imap, packA );
+      Pack<NR, D>( false, jmap, packB );
+
+      size_t mpanel = ( m + MR - 1 ) / MR;
+      size_t npanel = ( n + NR - 1 ) / NR;
+
+      #pragma omp parallel for
+      for ( size_t jb = 0; jb < npanel; jb ++ )
+      {
+        T *b = packB.data() + jb * NR * d;
+        size_t nr = std::min( NR, n - jb * NR );
+
+        for ( size_t ib = 0; ib < mpanel; ib ++ )
+        {
+          T *a = packA.data() + ib * MR * d;
+          size_t mr = std::min( MR, m - ib * MR );
+
+          /** rank-d update in registers, then store r2 (or x' * y) */
+          RankD<D, IsDistance<KS>()>( d, a, b, mr, nr, K.data() + jb * NR * m + ib * MR, m );
+        }
+
+        /** apply the kernel while the m-by-NR panel is still in cache */
+        for ( size_t j = jb * NR; j < jb * NR + nr; j ++ )
+        {
+          T *Kj = K.data() + j * m;
+          if ( fast_math ) Epilogue<KS, true>( m, Kj, imap.data(), jmap[ j ] );
+          else             Epilogue<KS, false>( m, Kj, imap.data(), jmap[ j ] );
+        }
+      }
+    }; /** end Packed() */
+
+
+    /**
+     *  @brief K = kernel( targets( imap ), sources( jmap ) ). Coordinates
+     *         are packed into MR-by-d and NR-by-d panels, each MR-by-NR 
+     *         block of inner products is accumulated in registers like
+     *         the gkmm_mrxnr microkernel, and the kernel is applied to 
+     *         each m-by-NR panel while it is in cache. Kernels of the
+     *         distance accumulate ( x - y )' * ( x - y ) instead of x' * y.
+     *         For large d the inner products go to xgemm and only the 
+     *         epilogue is fused; r2 = x'x + y'y - 2x'y is then summed 
+     *         directly where it cancels.
+     */ 
+    template<ks_type KS, typename TINDEX>
+    void Fused( std::vector<TINDEX> &imap, std::vector<TINDEX> &jmap, Data<T> &K )
+    {
+      size_t m = imap.size();
+      size_t n = jmap.size();
+
+      if ( d > KC )
+      {
+        /** coordinates in place (tree order) or gathered */
+        Data<T> itargets, jsources;
+        T *A = Block( true,  imap, itargets );
+        T *B = Block( false, jmap, jsources );
+
+        /** inner products */
+        xgemm( "T", "N", m, n, d,
+          1.0,        A, d,
+                      B, d,
+          0.0, K.data(), m );
+
+        /** one pass to form r2 (if needed) and apply the kernel */
+        std::vector<T> A2( m );
+        for ( size_t i = 0; i < m; i ++ ) A2[ i ] = target_sqnorms[ imap[ i ] ];
+
+        #pragma omp parallel for
+        for ( size_t j = 0; j < n; j ++ )
+        {
+          T *Kj = K.data() + j * m;
+          T b2 = source_sqnorms[ jmap[ j ] ];
+          if ( IsDistance<KS>() )
+          {
+            for ( size_t i = 0; i < m; i ++ )
+            {
+              /** 
+               *  r2 = x'x + y'y - 2x'y loses digits when r2 is small 
+               *  compared to x'x + y'y; such pairs are summed directly
+               */
+              T r2 = A2[ i ] + b2 - 2 * Kj[ i ];
+              if ( r2 < 0.25 * ( A2[ i ] + b2 ) )
+              {
+                const T *x = A + i * d, *y = B + j * d;
+                r2 = 0.0;
+                for ( size_t p = 0; p < d; p ++ ) 
+                  r2 += ( x[ p ] - y[ p ] ) * ( x[ p ] - y[ p ] );
+              }
+              Kj[ i ] = r2;
+            }
+          }
+          if ( fast_math ) Epilogue<KS, true>( m, Kj, imap.data(), jmap[ j ] );
+          else             Epilogue<KS, false>( m, Kj, imap.data(), jmap[ j ] );
+        }
+
+        return;
+      }
+
+      /** low dimensions get fully unrolled panels */
+      switch ( d )
+      {
+        case 1: Packed<KS, 1>( imap, jmap, K ); break;
+        case 2: Packed<KS, 2>( imap, jmap, K ); break;
+        case 3: Packed<KS, 3>( imap, jmap, K ); break;
+        case 4: Packed<KS, 4>( imap, jmap, K ); break;
+        case 5: Packed<KS, 5>( imap, jmap, K ); break;
+        case 6: Packed<KS, 6>( imap, jmap, K ); break;
+        case 7: Packed<KS, 7>( imap, jmap, K ); break;
+        case 8: Packed<KS, 8>( imap, jmap, K ); break;
+        default: Packed<KS, 0>( imap, jmap, K );
+      }
+    }; /** end Fused() */
+
+
     std::size_t d;
 
     Data<T> &sources;
@@ -283,6 +709,19 @@ class KernelMatrix : public VirtualMatrix<T, Allocator>, ReadWrite
 
     kernel_s<T> kernel;
 
+    /** use the fast hmlp::vmath routines in the block epilogue */
+    bool fast_math = false;
+
+    /** square norms of all targets and sources */
+    std::vector<T> target_sqnorms;
+
+    std::vector<T> source_sqnorms;
+
+    /** (optional) points in tree order, and the position of each gid */
+    Data<T> tree_points;
+
+    std::vector<size_t> tree_position;
+
 }; /** end class KernelMatrix */
 
 }; /** end namespace hmlp */
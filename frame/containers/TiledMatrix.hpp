@@ -0,0 +1,472 @@
+/**
+ *  HMLP (High-Performance Machine Learning Primitives)
+ *
+ *  Copyright (C) 2014-2017, The University of Texas at Austin
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program. If not, see the LICENSE file.
+ *
+ **/
+
+
+
+
+#ifndef TILEDMATRIX_HPP
+#define TILEDMATRIX_HPP
+
+#include <stdint.h>
+#include <string.h>
+
+/** use hmlp::Data<T> and hmlp::TileCache<T> */
+#include <containers/data.hpp>
+
+
+namespace hmlp
+{
+
+/** how tiles are stored on disk */
+typedef enum { TILE_RAW, TILE_SKIP_ZERO } TileCompression;
+
+/**
+ *  @brief Header of the tiled format. It is followed by n uint64_t
+ *         ids if permuted (file position p holds the original id
+ *         ids[ p ]), ntiles + 1 uint64_t byte offsets, and the tiles.
+ *         Tile ( ib, jb ) is the column-major block of rows
+ *         [ ib * tile, ib * tile + tile ) and columns [ jb * tile,
+ *         jb * tile + tile ) in file positions; its id is
+ *         jb * ntile_m + ib. With TILE_SKIP_ZERO, all-zero tiles
+ *         take no space (offsets[ tid ] == offsets[ tid + 1 ]).
+ */
+struct TiledHeader
+{
+  char magic[ 8 ];
+
+  uint64_t version;
+
+  uint64_t m;
+
+  uint64_t n;
+
+  /** sizeof(T) */
+  uint64_t dtype;
+
+  uint64_t tile;
+
+  uint64_t compression;
+
+  uint64_t permuted;
+};
+
+
+/**
+ *  @brief An m-by-n (SPD) matrix in the tiled on-disk format. A
+ *         submatrix K( amap, bmap ) only reads the tiles it touches,
+ *         through a TileCache (sharded LRU, byte budget). After tree
+ *         partitioning, Permute( gids ) rewrites the tiles in the
+ *         order of gids, such that tree nodes touch few tiles.
+ */
+template<typename T>
+class TiledMatrix : public ReadWrite
+{
+  public:
+
+    typedef typename TileCache<T>::TILE TILE;
+
+    TiledMatrix( std::string filename, size_t cache_bytes = ( 1UL << 30 ) )
+    {
+      this->cache_bytes = cache_bytes;
+      Open( filename );
+    };
+
+    ~TiledMatrix() { Close(); };
+
+    /**
+     *  @brief Write a tiled file. panel( jbeg, jend, P ) fills the
+     *         m-by-( jend - jbeg ) column-major P with the columns
+     *         [ jbeg, jend ) in file positions.
+     */
+    static void Write
+    (
+      std::string filename, size_t m, size_t n, size_t tile,
+      TileCompression compression, std::vector<size_t> &ids,
+      std::function<void(size_t, size_t, T*)> panel
+    )
+    {
+      size_t ntile_m = ( m + tile - 1 ) / tile;
+      size_t ntile_n = ( n + tile - 1 ) / tile;
+      std::vector<uint64_t> offsets( ntile_m * ntile_n + 1 );
+
+      TiledHeader header;
+      memcpy( header.magic, "HMLPTILE", 8 );
+      header.version = 1;
+      header.m = m;
+      header.n = n;
+      header.dtype = sizeof(T);
+      header.tile = tile;
+      header.compression = compression;
+      header.permuted = ids.size() ? 1 : 0;
+
+      std::ofstream file( filename.data(), std::ios::out|std::ios::binary );
+      if ( !file.is_open() )
+      {
+        printf( "TiledMatrix: fail to create %s\n", filename.data() );
+        exit( 1 );
+      }
+      file.write( (char*)&header, sizeof(TiledHeader) );
+      for ( auto id : ids )
+      {
+        uint64_t id64 = id;
+        file.write( (char*)&id64, sizeof(uint64_t) );
+      }
+      /** offsets are written again once all tiles are placed */
+      size_t offsets_pos = file.tellp();
+      file.write( (char*)offsets.data(), offsets.size() * sizeof(uint64_t) );
+      offsets[ 0 ] = file.tellp();
+
+      std::vector<T> P( m * tile ), buff( tile * tile );
+      for ( size_t jb = 0; jb < ntile_n; jb ++ )
+      {
+        size_t jbeg = jb * tile, nb = std::min( tile, n - jbeg );
+        panel( jbeg, jbeg + nb, P.data() );
+        for ( size_t ib = 0; ib < ntile_m; ib ++ )
+        {
+          size_t ibeg = ib * tile, mb = std::min( tile, m - ibeg );
+          bool iszero = true;
+          for ( size_t j = 0; j < nb; j ++ )
+          {
+            for ( size_t i = 0; i < mb; i ++ )
+            {
+              buff[ j * mb + i ] = P[ j * m + ibeg + i ];
+              if ( buff[ j * mb + i ] != 0 ) iszero = false;
+            }
+          }
+          size_t tid = jb * ntile_m + ib;
+          if ( compression == TILE_SKIP_ZERO && iszero )
+          {
+            offsets[ tid + 1 ] = offsets[ tid ];
+          }
+          else
+          {
+            file.write( (char*)buff.data(), mb * nb * sizeof(T) );
+            offsets[ tid + 1 ] = offsets[ tid ] + mb * nb * sizeof(T);
+          }
+        }
+      }
+
+      file.seekp( offsets_pos );
+      file.write( (char*)offsets.data(), offsets.size() * sizeof(uint64_t) );
+      file.close();
+    }; /** end Write() */
+
+
+    /**
+     *  @brief Convert a raw column-major binary (the format of
+     *         Data::read) into the tiled format, tile columns at a time.
+     */
+    static void Convert
+    (
+      size_t m, size_t n, std::string raw, std::string tiled,
+      size_t tile = 512, TileCompression compression = TILE_RAW
+    )
+    {
+      std::ifstream file( raw.data(), std::ios::in|std::ios::binary|std::ios::ate );
+      if ( !file.is_open() || (size_t)file.tellg() < m * n * sizeof(T) )
+      {
+        printf( "TiledMatrix: %s is not a %lu-by-%lu matrix\n", raw.data(), m, n );
+        exit( 1 );
+      }
+      std::vector<size_t> ids;
+      Write( tiled, m, n, tile, compression, ids,
+          [ & ] ( size_t jbeg, size_t jend, T *P )
+          {
+            file.seekg( jbeg * m * sizeof(T) );
+            file.read( (char*)P, ( jend - jbeg ) * m * sizeof(T) );
+          } );
+    }; /** end Convert() */
+
+
+    /**
+     *  @brief Rewrite the matrix as K( gids, gids ) into filename.tree
+     *         and continue with that file. Entries are still accessed
+     *         with the original ids. Only for the square matrix.
+     *
+     *         The new tile columns are assembled in blocks of columns
+     *         that fit in cache_bytes. Each block streams the tile 
+     *         columns it needs in file order (tile rows in parallel)
+     *         and scatters them into place. The file is read about
+     *         m * n * sizeof(T) / cache_bytes times, instead of once per
+     *         tile column.
+     */
+    void Permute( std::vector<size_t> &gids )
+    {
+      if ( m != n ) return;
+      assert( gids.size() == n );
+
+      /** file row (column) of the original id gids[ q ] goes to q */
+      std::vector<size_t> target( n );
+      for ( size_t q = 0; q < n; q ++ ) target[ Position( gids[ q ] ) ] = q;
+
+      /** columns per block, a multiple of tile */
+      size_t block = std::max( (size_t)1, cache_bytes / ( m * tile * sizeof(T) ) ) * tile;
+      std::vector<T> B;
+      size_t bbeg = 0, bend = 0;
+
+      /** write aside first, since we may be reading filename.tree */
+      std::string treefile = original + ".tree";
+      Write( treefile + ".tmp", m, n, tile, compression, gids,
+          [ & ] ( size_t jbeg, size_t jend, T *P )
+          {
+            if ( jbeg >= bend )
+            {
+              bbeg = jbeg;
+              bend = std::min( n, bbeg + block );
+              B.assign( m * ( bend - bbeg ), 0 );
+              /** the tile columns of the file that hold the new columns */
+              std::vector<size_t> jblocks;
+              for ( size_t q = bbeg; q < bend; q ++ ) 
+                jblocks.push_back( Position( gids[ q ] ) / tile );
+              std::sort( jblocks.begin(), jblocks.end() );
+              jblocks.erase( std::unique( jblocks.begin(), jblocks.end() ), jblocks.end() );
+              for ( auto jb : jblocks )
+              {
+                size_t nb = std::min( tile, n - jb * tile );
+                /** tile rows scatter to disjoint rows of B */
+                #pragma omp parallel for schedule(dynamic)
+                for ( size_t ib = 0; ib < ntile_m; ib ++ )
+                {
+                  auto t = ReadTile( jb * ntile_m + ib );
+                  size_t mb = Rows( ib );
+                  for ( size_t j = 0; j < nb; j ++ )
+                  {
+                    size_t q = target[ jb * tile + j ];
+                    if ( q < bbeg || q >= bend ) continue;
+                    T *Bq = B.data() + ( q - bbeg ) * m;
+                    for ( size_t i = 0; i < mb; i ++ )
+                      Bq[ target[ ib * tile + i ] ] = (*t)[ j * mb + i ];
+                  }
+                }
+              }
+            }
+            std::copy( B.begin() + ( jbeg - bbeg ) * m, 
+                       B.begin() + ( jend - bbeg ) * m, P );
+          } );
+
+      Close();
+      std::rename( ( treefile + ".tmp" ).data(), treefile.data() );
+      std::string keep = original;
+      Open( treefile );
+      original = keep;
+    }; /** end Permute() */
+
+
+    template<typename TINDEX>
+    inline T operator()( TINDEX i, TINDEX j )
+    {
+      size_t pi = Position( i ), pj = Position( j );
+      auto t = cache->Get( ( pj / tile ) * ntile_m + pi / tile );
+      return (*t)[ ( pj % tile ) * Rows( pi / tile ) + pi % tile ];
+    };
+
+    template<typename TINDEX>
+    inline hmlp::Data<T> operator()( std::vector<TINDEX> &imap, std::vector<TINDEX> &jmap )
+    {
+      hmlp::Data<T> submatrix( imap.size(), jmap.size() );
+      std::vector<size_t> pimap( imap.size() );
+      for ( size_t i = 0; i < imap.size(); i ++ ) pimap[ i ] = Position( imap[ i ] );
+
+      #pragma omp parallel
+      {
+        /** tiles of the current tile column stay pinned */
+        std::vector<TILE> pinned( ntile_m );
+        std::vector<size_t> touched;
+        size_t pinned_jb = ntile_n;
+
+        #pragma omp for
+        for ( size_t j = 0; j < jmap.size(); j ++ )
+        {
+          size_t pj = Position( jmap[ j ] ), jb = pj / tile;
+          if ( jb != pinned_jb )
+          {
+            for ( auto ib : touched ) pinned[ ib ].reset();
+            touched.clear();
+            pinned_jb = jb;
+          }
+          for ( size_t i = 0; i < imap.size(); i ++ )
+          {
+            size_t ib = pimap[ i ] / tile;
+            if ( !pinned[ ib ] )
+            {
+              pinned[ ib ] = cache->Get( jb * ntile_m + ib );
+              touched.push_back( ib );
+            }
+            submatrix[ j * imap.size() + i ] =
+              (*pinned[ ib ])[ ( pj % tile ) * Rows( ib ) + pimap[ i ] % tile ];
+          }
+        }
+      }
+
+      return submatrix;
+    };
+
+    /** start reading the tiles of K( imap, jmap ) in the background */
+    template<typename TINDEX>
+    void Prefetch( std::vector<TINDEX> &imap, std::vector<TINDEX> &jmap )
+    {
+      std::vector<size_t> iblocks, jblocks, tids;
+      for ( auto i : imap ) iblocks.push_back( Position( i ) / tile );
+      for ( auto j : jmap ) jblocks.push_back( Position( j ) / tile );
+      std::sort( iblocks.begin(), iblocks.end() );
+      std::sort( jblocks.begin(), jblocks.end() );
+      iblocks.erase( std::unique( iblocks.begin(), iblocks.end() ), iblocks.end() );
+      jblocks.erase( std::unique( jblocks.begin(), jblocks.end() ), jblocks.end() );
+      for ( auto jb : jblocks )
+        for ( auto ib : iblocks )
+          tids.push_back( jb * ntile_m + ib );
+      cache->Prefetch( tids );
+    };
+
+    template<typename TINDEX>
+    std::pair<T, TINDEX> ImportantSample( TINDEX j )
+    {
+      TINDEX i = std::rand() % m;
+      std::pair<T, TINDEX> sample( (*this)( i, j ), i );
+      return sample;
+    };
+
+    /** 
+     *  (Optional) let the tree order (Configuration::SetTreeOrder) 
+     *  write the permuted copy filename.tree; off by default.
+     */
+    bool TreeOrderCopy() { return tree_order_copy; };
+
+    void SetTreeOrderCopy( bool copy ) { tree_order_copy = copy; };
+
+    std::size_t row() { return m; };
+
+    std::size_t col() { return n; };
+
+    template<typename TINDEX>
+    double flops( TINDEX na, TINDEX nb ) { return 0.0; };
+
+  private:
+
+    void Open( std::string filename )
+    {
+      this->filename = filename;
+      this->original = filename;
+
+      fd = open( filename.data(), O_RDONLY, 0 );
+      if ( fd == -1 )
+      {
+        printf( "TiledMatrix: fail to open %s\n", filename.data() );
+        exit( 1 );
+      }
+
+      TiledHeader header;
+      ReadFromDisk( fd, 0, sizeof(TiledHeader), (char*)&header );
+      if ( memcmp( header.magic, "HMLPTILE", 8 ) || header.version != 1 )
+      {
+        printf( "TiledMatrix: %s is not a tiled matrix\n", filename.data() );
+        exit( 1 );
+      }
+      if ( header.dtype != sizeof(T) )
+      {
+        printf( "TiledMatrix: %s stores %lu-byte entries, expect %lu\n",
+            filename.data(), (size_t)header.dtype, sizeof(T) );
+        exit( 1 );
+      }
+
+      m = header.m;
+      n = header.n;
+      tile = header.tile;
+      compression = (TileCompression)header.compression;
+      ntile_m = ( m + tile - 1 ) / tile;
+      ntile_n = ( n + tile - 1 ) / tile;
+
+      size_t offset = sizeof(TiledHeader);
+      position.clear();
+      if ( header.permuted )
+      {
+        std::vector<uint64_t> ids( n );
+        ReadFromDisk( fd, offset, n * sizeof(uint64_t), (char*)ids.data() );
+        offset += n * sizeof(uint64_t);
+        position.resize( n );
+        for ( size_t p = 0; p < n; p ++ ) position[ ids[ p ] ] = p;
+      }
+      offsets.resize( ntile_m * ntile_n + 1 );
+      ReadFromDisk( fd, offset, offsets.size() * sizeof(uint64_t), (char*)offsets.data() );
+
+      cache.reset( new TileCache<T>() );
+      cache->Setup( cache_bytes, tile * tile * sizeof(T),
+          [ this ] ( size_t tid ) { return ReadTile( tid ); } );
+    };
+
+    void Close()
+    {
+      if ( cache ) cache->Stop();
+      cache.reset();
+      close( fd );
+    };
+
+    /** file position of the original id i */
+    inline size_t Position( size_t i ) { return position.size() ? position[ i ] : i; };
+
+    /** number of rows of tiles in the ib-th tile row */
+    inline size_t Rows( size_t ib ) { return std::min( tile, m - ib * tile ); };
+
+    TILE ReadTile( size_t tid )
+    {
+      size_t ib = tid % ntile_m, jb = tid / ntile_m;
+      size_t mb = Rows( ib ), nb = std::min( tile, n - jb * tile );
+      TILE t = std::make_shared<std::vector<T>>( mb * nb, 0 );
+      size_t bytes = offsets[ tid + 1 ] - offsets[ tid ];
+      if ( bytes ) ReadFromDisk( fd, offsets[ tid ], bytes, (char*)t->data() );
+      return t;
+    };
+
+    std::size_t m;
+
+    std::size_t n;
+
+    /** the file in use and the file the user opened */
+    std::string filename;
+
+    std::string original;
+
+    int fd = -1;
+
+    size_t tile;
+
+    size_t ntile_m;
+
+    size_t ntile_n;
+
+    TileCompression compression;
+
+    /** original id to file position (empty if not permuted) */
+    std::vector<size_t> position;
+
+    std::vector<uint64_t> offsets;
+
+    size_t cache_bytes;
+
+    /** (default) Compress() does not write filename.tree */
+    bool tree_order_copy = false;
+
+    std::unique_ptr<TileCache<T>> cache;
+
+}; /** end class TiledMatrix */
+
+}; /** end namespace hmlp */
+
+#endif /** define TILEDMATRIX_HPP */
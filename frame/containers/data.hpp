@@ -31,6 +31,8 @@
 #include <sys/stat.h>
 #include <unistd.h>
 #include <fcntl.h>
+#include <stdint.h>
+#include <string.h>
 
 /** stl */
 #include <cassert>
@@ -41,10 +43,18 @@
 
 #include <set>
 #include <map>
+#include <list>
 #include <vector>
 #include <deque>
-#include <map>
 #include <string>
+#include <memory>
+#include <functional>
+#include <unordered_map>
+
+/** OOC background reads */
+#include <thread>
+#include <mutex>
+#include <condition_variable>
 
 /** std::istringstream */
 #include <iostream>
@@ -112,6 +122,172 @@ class managed_allocator
 namespace hmlp
 {
 
+/** pread() exactly bytes from offset, or exit */
+inline void ReadFromDisk( int fd, size_t offset, size_t bytes, char *buff )
+{
+  while ( bytes )
+  {
+    ssize_t nread = pread( fd, buff, bytes, offset );
+    if ( nread <= 0 )
+    {
+      printf( "ReadFromDisk: fail to read %lu bytes at %lu\n", bytes, offset );
+      exit( 1 );
+    }
+    buff += nread;
+    offset += nread;
+    bytes -= nread;
+  }
+}; /** end ReadFromDisk() */
+
+
+/**
+ *  @brief std::allocator, except that it can adopt one file mapping.
+ *         After Adopt(), the next allocate( n ) of the same n returns
+ *         the mapped array, and default construction is skipped (the
+ *         elements stay as in the file) until Constructed() is called;
+ *         deallocate() unmaps it. Copies of a container do not inherit
+ *         the mapping.
+ */
+template<class T>
+class mmap_allocator
+{
+  public:
+
+    typedef T value_type;
+    typedef T* pointer;
+    typedef const T* const_pointer;
+    typedef T& reference;
+    typedef const T& const_reference;
+    typedef std::size_t size_type;
+    typedef std::ptrdiff_t difference_type;
+
+    typedef std::true_type propagate_on_container_move_assignment;
+    typedef std::true_type propagate_on_container_swap;
+
+    template<class U> struct rebind { typedef mmap_allocator<U> other; };
+
+    mmap_allocator() {};
+
+    /** a rebound allocator starts without a mapping */
+    template<class U> mmap_allocator( const mmap_allocator<U> &other ) {};
+
+    mmap_allocator select_on_container_copy_construction() const 
+    { 
+      return mmap_allocator(); 
+    };
+
+    /** base[ 0, bytes ) is a mapping; data[ 0, n ) lies in it */
+    void Adopt( char *base, size_t bytes, T *data, size_t n )
+    {
+      region = std::make_shared<Region>();
+      region->base = base;
+      region->bytes = bytes;
+      region->data = data;
+      region->n = n;
+      region->keep = true;
+    };
+
+    /** the container now holds the mapped array */
+    void Constructed() { if ( region ) region->keep = false; };
+
+    T* allocate( size_t n )
+    {
+      if ( region && !region->adopted && n == region->n )
+      {
+        region->adopted = true;
+        return region->data;
+      }
+      return std::allocator<T>().allocate( n );
+    };
+
+    void deallocate( T *ptr, size_t n )
+    {
+      if ( region && ptr == region->data )
+      {
+        munmap( region->base, region->bytes );
+        region->data = NULL;
+        return;
+      }
+      std::allocator<T>().deallocate( ptr, n );
+    };
+
+    /** keep the mapped values instead of value-initializing them */
+    template<class U>
+    void construct( U *ptr )
+    {
+      if ( region && region->keep ) return;
+      ::new( (void*)ptr ) U();
+    };
+
+    template<class U, class... Args>
+    void construct( U *ptr, Args&&... args )
+    {
+      ::new( (void*)ptr ) U( std::forward<Args>( args )... );
+    };
+
+    template<class U>
+    void destroy( U *ptr ) { ptr->~U(); };
+
+    template<class U>
+    bool operator == ( const mmap_allocator<U> &other ) const 
+    { 
+      return (void*)region.get() == (void*)other.region.get(); 
+    };
+
+    template<class U>
+    bool operator != ( const mmap_allocator<U> &other ) const 
+    { 
+      return !( *this == other ); 
+    };
+
+  private:
+
+    template<class U> friend class mmap_allocator;
+
+    struct Region
+    {
+      char *base = NULL;
+
+      size_t bytes = 0;
+
+      T *data = NULL;
+
+      size_t n = 0;
+
+      bool adopted = false;
+
+      bool keep = false;
+    };
+
+    std::shared_ptr<Region> region;
+
+}; /** end class mmap_allocator */
+
+
+/**
+ *  @brief Optional header of a Data<T> binary file. The column-major
+ *         m-by-n array starts at byte offset. Files without the header
+ *         are raw arrays of exactly m * n elements.
+ */
+struct DataHeader
+{
+  char magic[ 8 ];
+
+  uint64_t version;
+
+  uint64_t m;
+
+  uint64_t n;
+
+  /** sizeof(T) */
+  uint64_t dtype;
+
+  uint64_t offset;
+
+  uint64_t reserved[ 2 ];
+};
+
+
 #ifdef HMLP_MIC_AVX512
 /** use hbw::allocator for Intel Xeon Phi */
 template<class T, class Allocator = hbw::allocator<T> >
@@ -119,8 +295,8 @@ template<class T, class Allocator = hbw::allocator<T> >
 /** use pinned (page-lock) memory for NVIDIA GPUs */
 template<class T, class Allocator = thrust::system::cuda::experimental::pinned_allocator<T> >
 #else
-/** use default stl allocator */
-template<class T, class Allocator = std::allocator<T> >
+/** use the stl allocator, which can also adopt a mapped file */
+template<class T, class Allocator = mmap_allocator<T> >
 #endif
 class Data : public ReadWrite, public std::vector<T, Allocator>
 #ifdef HMLP_USE_CUDA
@@ -148,7 +324,6 @@ class Data : public ReadWrite, public std::vector<T, Allocator>
     };
 
     Data( std::size_t m, std::size_t n, std::string &filename ) 
-      : std::vector<T, Allocator>( m * n )
     {
       this->m = m;
       this->n = n;
@@ -167,6 +342,12 @@ class Data : public ReadWrite, public std::vector<T, Allocator>
       //}
     };
 
+    /** the shape is taken from the DataHeader of the file */
+    Data( std::string &filename ) : m( 0 ), n( 0 )
+    {
+      this->read( filename );
+    };
+
     void resize( std::size_t m, std::size_t n )
     { 
       this->m = m;
@@ -186,23 +367,90 @@ class Data : public ReadWrite, public std::vector<T, Allocator>
       std::vector<T, Allocator>::reserve( m * n );
     };
 
+    /**
+     *  @brief Read an m-by-n matrix from a binary file, either a raw 
+     *         column-major array or one with a DataHeader. With the 
+     *         default mmap_allocator the file is mapped copy-on-write
+     *         instead of copied: opening is instant, pages are read 
+     *         on first touch (readahead is requested), and writes 
+     *         never reach the file.
+     */ 
     void read( std::size_t m, std::size_t n, std::string &filename )
     {
-      assert( this->m == m );
-      assert( this->n == n );
-      assert( this->size() == m * n );
-
       std::cout << filename << std::endl;
 
-      std::ifstream file( filename.data(), std::ios::in|std::ios::binary|std::ios::ate );
-      if ( file.is_open() )
+      int fd = open( filename.data(), O_RDONLY );
+      if ( fd == -1 )
       {
-        auto size = file.tellg();
-        assert( size == m * n * sizeof(T) );
-        file.seekg( 0, std::ios::beg );
-        file.read( (char*)this->data(), size );
-        file.close();
+        printf( "Data::read: fail to open %s\n", filename.data() );
+        exit( 1 );
       }
+      struct stat st;
+      fstat( fd, &st );
+      size_t bytes = st.st_size;
+
+      /** optional header */
+      size_t offset = 0;
+      DataHeader header;
+      if ( bytes >= sizeof(DataHeader) 
+           && pread( fd, &header, sizeof(DataHeader), 0 ) == sizeof(DataHeader)
+           && !memcmp( header.magic, "HMLPDATA", 8 ) )
+      {
+        if ( header.m != m || header.n != n || header.dtype != sizeof(T) )
+        {
+          printf( "Data::read: %s is %lu-by-%lu with %lu-byte entries, not %lu-by-%lu with %lu\n",
+              filename.data(), header.m, header.n, header.dtype, m, n, sizeof(T) );
+          exit( 1 );
+        }
+        offset = header.offset;
+      }
+      if ( bytes != offset + m * n * sizeof(T) )
+      {
+        printf( "Data::read: %s has %lu bytes, expect %lu\n", 
+            filename.data(), bytes, offset + m * n * sizeof(T) );
+        exit( 1 );
+      }
+
+      this->m = m;
+      this->n = n;
+      if ( !Map( this->get_allocator(), fd, bytes, offset ) )
+      {
+        std::vector<T, Allocator>::resize( m * n );
+        ReadFromDisk( fd, offset, m * n * sizeof(T), (char*)this->data() );
+      }
+      close( fd );
+    };
+
+    /** read a file with a DataHeader, which provides the shape */
+    void read( std::string &filename )
+    {
+      DataHeader header;
+      std::ifstream file( filename.data(), std::ios::in|std::ios::binary );
+      if ( !file.read( (char*)&header, sizeof(DataHeader) ) 
+           || memcmp( header.magic, "HMLPDATA", 8 ) )
+      {
+        printf( "Data::read: %s has no header\n", filename.data() );
+        exit( 1 );
+      }
+      file.close();
+      read( header.m, header.n, filename );
+    };
+
+    /** write with a DataHeader, such that read( filename ) can map it */
+    void write( std::string &filename )
+    {
+      DataHeader header;
+      memset( &header, 0, sizeof(DataHeader) );
+      memcpy( header.magic, "HMLPDATA", 8 );
+      header.version = 1;
+      header.m = m;
+      header.n = n;
+      header.dtype = sizeof(T);
+      header.offset = sizeof(DataHeader);
+      std::ofstream file( filename.data(), std::ios::out|std::ios::binary );
+      file.write( (char*)&header, sizeof(DataHeader) );
+      file.write( (char*)this->data(), m * n * sizeof(T) );
+      file.close();
     };
 
     std::tuple<size_t, size_t> shape()
@@ -476,6 +724,24 @@ class Data : public ReadWrite, public std::vector<T, Allocator>
 
   private:
 
+    /** other allocators cannot adopt a mapping; read the file instead */
+    template<typename ALLOCATOR>
+    bool Map( ALLOCATOR alloc, int fd, size_t bytes, size_t offset ) { return false; };
+
+    /** replace the storage by the mapped file */
+    bool Map( mmap_allocator<T> alloc, int fd, size_t bytes, size_t offset )
+    {
+      if ( !m || !n ) return false;
+      char *base = (char*)mmap( NULL, bytes, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0 );
+      if ( base == MAP_FAILED ) return false;
+      madvise( base, bytes, MADV_WILLNEED );
+      alloc.Adopt( base, bytes, (T*)( base + offset ), m * n );
+      std::vector<T, Allocator> mapped( m * n, alloc );
+      alloc.Constructed();
+      std::vector<T, Allocator>::swap( mapped );
+      return true;
+    };
+
     std::size_t m;
 
     std::size_t n;
@@ -483,6 +749,39 @@ class Data : public ReadWrite, public std::vector<T, Allocator>
 }; // end class Data
 
 
+/**
+ *  @brief Header of the binary CSC cache that CSC::readmtx writes next
+ *         to a .mtx file. It is followed by col_ptr[ n + 1 ] and 
+ *         row_ind[ nnz ] (uint64_t) and val[ nnz ] (T), such that the
+ *         whole file can be mapped and used in place. The cache is
+ *         only valid for the same source (size and mtime), dtype and
+ *         readmtx options.
+ */
+struct CSCCacheHeader
+{
+  char magic[ 8 ];
+
+  uint64_t version;
+
+  uint64_t m;
+
+  uint64_t n;
+
+  /** nnz of the full storage (after mirroring and dropping zeros) */
+  uint64_t nnz;
+
+  /** sizeof(T) */
+  uint64_t dtype;
+
+  /** SYMMETRIC | LOWERTRIANGULAR << 1 | ISZEROBASE << 2 | IJONLY << 3 */
+  uint64_t options;
+
+  uint64_t source_bytes;
+
+  int64_t source_mtime;
+};
+
+
 #ifdef HMLP_MIC_AVX512
 template<bool SYMMETRIC, typename T, class Allocator = hbw::allocator<T> >
 #else
@@ -498,9 +797,10 @@ class CSC : public ReadWrite
       this->m = m;
       this->n = n;
       this->nnz = nnz;
-      this->val.resize( nnz, 0.0 );
-      this->row_ind.resize( nnz, 0 );
-      this->col_ptr.resize( n + 1, 0 );
+      this->val_buff.resize( nnz, 0.0 );
+      this->row_ind_buff.resize( nnz, 0 );
+      this->col_ptr_buff.resize( n + 1, 0 );
+      BindBuffers();
     };
 
     // Construct from three arrays.
@@ -522,9 +822,22 @@ class CSC : public ReadWrite
       {
         this->col_ptr[ j ] = col_ptr[ j ];
       }
+      SortRows();
     };
 
-    ~CSC() {};
+    /** copies always own their arrays, even if other is mapped */
+    CSC( const CSC &other )
+    : m( other.m ), n( other.n ), nnz( other.nnz ),
+      val_buff( other.val, other.val + other.nnz ),
+      row_ind_buff( other.row_ind, other.row_ind + other.nnz ),
+      col_ptr_buff( other.col_ptr, other.col_ptr + other.n + 1 )
+    {
+      BindBuffers();
+    };
+
+    CSC &operator=( const CSC &other ) = delete;
+
+    ~CSC() { Unmap(); };
 
     template<typename TINDEX>
     inline T operator()( TINDEX i, TINDEX j )
@@ -534,13 +847,13 @@ class CSC : public ReadWrite
       size_t row_end = col_ptr[ j + 1 ];
       auto lower = std::lower_bound
                    ( 
-                     row_ind.begin() + row_beg, 
-                     row_ind.begin() + row_end,
+                     row_ind + row_beg, 
+                     row_ind + row_end,
                      i
                    );
-      if ( *lower == i )
+      if ( lower != row_ind + row_end && *lower == i )
       {
-        return val[ std::distance( row_ind.begin(), lower ) ];
+        return val[ lower - row_ind ];
       }
       else
       {
@@ -548,18 +861,40 @@ class CSC : public ReadWrite
       }
     };
 
+    /**
+     *  @brief Submatrix K( imap, jmap ) by merge-joining the (sorted)
+     *         nonzeros of each column jmap[ j ] with imap sorted once,
+     *         instead of a binary search per entry. In the symmetric 
+     *         case only i >= j is stored; entries above the diagonal
+     *         are gathered from columns imap[ i ] against sorted jmap.
+     */ 
     template<typename TINDEX>
     inline hmlp::Data<T> operator()( std::vector<TINDEX> &imap, std::vector<TINDEX> &jmap )
     {
-      hmlp::Data<T> submatrix( imap.size(), jmap.size() );
-      #pragma omp parallel for
-      for ( int j = 0; j < jmap.size(); j ++ )
+      size_t ms = imap.size(), ns = jmap.size();
+      hmlp::Data<T> submatrix( ms, ns );
+
+      auto simap = SortWithPositions( imap );
+
+      #pragma omp parallel for schedule( dynamic, 16 )
+      for ( size_t j = 0; j < ns; j ++ )
       {
-        for ( int i = 0; i < imap.size(); i ++ )
+        GatherColumn( jmap[ j ], SYMMETRIC ? jmap[ j ] : 0, simap, 
+            submatrix.data() + j * ms, 1 );
+      }
+
+      if ( SYMMETRIC )
+      {
+        /** K( imap[ i ], jmap[ j ] ) = K( jmap[ j ], imap[ i ] ) for imap[ i ] < jmap[ j ] */
+        auto sjmap = SortWithPositions( jmap );
+        #pragma omp parallel for schedule( dynamic, 16 )
+        for ( size_t i = 0; i < ms; i ++ )
         {
-          submatrix[ j * imap.size() + i ] = (*this)( imap[ i ], jmap[ j ] );
+          GatherColumn( imap[ i ], imap[ i ] + 1, sjmap, 
+              submatrix.data() + i, ms );
         }
       }
+
       return submatrix;
     }; 
 
@@ -597,69 +932,99 @@ class CSC : public ReadWrite
 
     /** 
      *  @brief Read matrix market format (ijv) format. Only lower triangular
-     *         part is stored
+     *         part is stored. The file is mapped and split into one chunk
+     *         of lines per thread; each thread parses its chunk, then
+     *         col_ptr is built with a parallel prefix sum over the column
+     *         counts and the entries are scattered. Unless cache is false,
+     *         the result is written to filename + ".csc", which later
+     *         calls map and use in place instead of parsing again.
      */ 
     template<bool LOWERTRIANGULAR, bool ISZEROBASE, bool IJONLY = false>
-    void readmtx( std::string &filename )
+    void readmtx( std::string &filename, bool cache = true )
     {
-      size_t m_mtx, n_mtx, nnz_mtx;
-
-      std::vector<std::deque<size_t>> full_row_ind( n );
-      std::vector<std::deque<T>> full_val( n );
+      std::string cachename = filename + ".csc";
+      auto header = CacheHeader<LOWERTRIANGULAR, ISZEROBASE, IJONLY>( filename );
 
-      // Read all tuples.
       printf( "%s ", filename.data() ); fflush( stdout );
-      std::ifstream file( filename.data() );
-      std::string line;
-      if ( file.is_open() )
+
+      if ( cache && LoadCache( cachename, header ) )
       {
-        size_t nnz_count = 0;
+        printf( "finish readmatrix %s (cached)\n", cachename.data() ); fflush( stdout );
+        return;
+      }
 
-        while ( std::getline( file, line ) )
+      int fd = open( filename.data(), O_RDONLY );
+      if ( fd == -1 )
+      {
+        printf( "readmtx: fail to open %s\n", filename.data() );
+        exit( 1 );
+      }
+      size_t bytes = header.source_bytes;
+      const char *text = NULL, *eof = NULL;
+      if ( bytes )
+      {
+        text = (const char*)mmap( NULL, bytes, PROT_READ, MAP_PRIVATE, fd, 0 );
+        if ( text == MAP_FAILED )
         {
-          if ( line.size() )
-          {
-            if ( line[ 0 ] != '%' )
-            {
-              std::istringstream iss( line );
-              iss >> m_mtx >> n_mtx >> nnz_mtx;
-              assert( this->m == m_mtx );
-              assert( this->n == n_mtx );
-              assert( this->nnz == nnz_mtx );
-              break;
-            }
-          }
+          printf( "readmtx: fail to mmap %s\n", filename.data() );
+          exit( 1 );
         }
+        madvise( (void*)text, bytes, MADV_SEQUENTIAL );
+        eof = text + bytes;
+      }
 
-        while ( std::getline( file, line ) )
+      /** skip comments; the first other line is m n nnz */
+      const char *body = text;
+      size_t m_mtx = 0, n_mtx = 0, nnz_mtx = 0;
+      while ( body < eof )
+      {
+        const char *p = SkipBlanks( body, eof );
+        if ( p < eof && *p != '%' && *p != '\n' )
         {
-          if ( nnz_count % ( nnz / 10 ) == 0 )
-          {
-            printf( "%lu%% ", ( nnz_count * 100 ) / nnz ); fflush( stdout );
-          }
+          p = ParseIndex( p, eof, m_mtx );
+          p = ParseIndex( p, eof, n_mtx );
+          p = ParseIndex( p, eof, nnz_mtx );
+          body = NextLine( body, eof );
+          break;
+        }
+        body = NextLine( body, eof );
+      }
+      assert( this->m == m_mtx );
+      assert( this->n == n_mtx );
+      assert( this->nnz == nnz_mtx );
+
+      /** per-thread entries; chunk boundaries move to the next line start */
+      int nt = omp_get_max_threads();
+      std::vector<std::vector<size_t>> ti( nt ), tj( nt );
+      std::vector<std::vector<T>> tv( nt );
+      std::vector<size_t> lines( nt, 0 ), illegal( nt, 0 );
+      size_t len = eof - body;
+      auto boundary = [&] ( int t ) -> const char*
+      {
+        size_t offset = ( len * t ) / nt;
+        if ( t == nt ) return eof;
+        return offset ? NextLine( body + offset - 1, eof ) : body;
+      };
 
-          std::istringstream iss( line );
+      #pragma omp parallel for num_threads( nt ) schedule( static, 1 )
+      for ( int t = 0; t < nt; t ++ )
+      {
+        const char *p = boundary( t ), *end = boundary( t + 1 );
+        ti[ t ].reserve( ( nnz / nt ) * 11 / 10 );
+        tj[ t ].reserve( ( nnz / nt ) * 11 / 10 );
+        tv[ t ].reserve( ( nnz / nt ) * 11 / 10 );
 
-					size_t i, j;
-          T v;
+        for ( ; p < end; p = NextLine( p, eof ) )
+        {
+          const char *q = SkipBlanks( p, eof );
+          if ( q == eof || *q == '\n' || *q == '%' ) continue;
 
-          if ( IJONLY )
-          {
-            if ( !( iss >> i >> j ) )
-            {
-              printf( "line %lu has illegle format\n", nnz_count );
-              break;
-            }
-            v = 1;
-          }
-          else
-          {
-            if ( !( iss >> i >> j >> v ) )
-            {
-              printf( "line %lu has illegle format\n", nnz_count );
-              break;
-            }
-          }
+          size_t i = m, j = n;
+          T v = 1;
+          q = ParseIndex( q, eof, i );
+          q = ParseIndex( q, eof, j );
+          if ( !IJONLY && q ) q = ParseValue( q, eof, v );
+          lines[ t ] ++;
 
           if ( !ISZEROBASE )
           {
@@ -667,95 +1032,610 @@ class CSC : public ReadWrite
             j -= 1;
           }
 
-          if ( v != 0.0 )
+          if ( !q || i >= m || j >= n )
           {
-            full_row_ind[ j ].push_back( i );
-            full_val[ j ].push_back( v );
+            illegal[ t ] ++;
+            continue;
+          }
 
-            if ( !SYMMETRIC && LOWERTRIANGULAR && i > j  )
-            {
-              full_row_ind[ i ].push_back( j );
-              full_val[ i ].push_back( v );
-            }
+          if ( v != 0.0 )
+          {
+            ti[ t ].push_back( i );
+            tj[ t ].push_back( j );
+            tv[ t ].push_back( v );
           }
-          nnz_count ++;
         }
-        assert( nnz_count == nnz );
       }
+
+      if ( text ) munmap( (void*)text, bytes );
+      close( fd );
+
+      size_t nnz_count = 0, nillegal = 0;
+      for ( int t = 0; t < nt; t ++ )
+      {
+        nnz_count += lines[ t ];
+        nillegal += illegal[ t ];
+      }
+      if ( nillegal )
+      {
+        printf( "readmtx: %lu lines have illegle format\n", nillegal );
+        exit( 1 );
+      }
+      assert( nnz_count == nnz );
       printf( "Done.\n" ); fflush( stdout );
-      // Close the file.
-      file.close();
 
-      //printf( "Here nnz %lu\n", nnz );
+      /** count the full storage of each column in col_ptr[ j + 1 ] */
+      Unmap();
+      col_ptr_buff.assign( n + 1, 0 );
+      BindBuffers();
 
-      // Recount nnz for the full storage.
-      size_t full_nnz = 0;
-      for ( size_t j = 0; j < n; j ++ )
+      #pragma omp parallel for num_threads( nt ) schedule( static, 1 )
+      for ( int t = 0; t < nt; t ++ )
       {
-        col_ptr[ j ] = full_nnz;
-        full_nnz += full_row_ind[ j ].size();
+        for ( size_t p = 0; p < ti[ t ].size(); p ++ )
+        {
+          size_t i = ti[ t ][ p ], j = tj[ t ][ p ];
+          #pragma omp atomic update
+          col_ptr[ j + 1 ] ++;
+          if ( !SYMMETRIC && LOWERTRIANGULAR && i > j )
+          {
+            #pragma omp atomic update
+            col_ptr[ i + 1 ] ++;
+          }
+        }
       }
-      nnz = full_nnz;
-      col_ptr[ n ] = full_nnz;
-      row_ind.resize( full_nnz );
-      val.resize( full_nnz );
 
-      //printf( "Here nnz %lu\n", nnz );
+      InclusiveScan( col_ptr_buff );
+      nnz = col_ptr[ n ];
+      row_ind_buff.resize( nnz );
+      val_buff.resize( nnz );
+      BindBuffers();
 
-      //full_nnz = 0;
-      //for ( size_t j = 0; j < n; j ++ )
-      //{
-      //  for ( size_t i = 0; i < full_row_ind[ j ].size(); i ++ )
-      //  {
-      //    row_ind[ full_nnz ] = full_row_ind[ j ][ i ];
-      //    val[ full_nnz ] = full_val[ j ][ i ];
-      //    full_nnz ++;
-      //  }
-      //}
+      /** scatter, recording the file order of each entry */
+      std::vector<size_t> next( col_ptr, col_ptr + n ), order( nnz ), base( nt + 1, 0 );
+      for ( int t = 0; t < nt; t ++ ) base[ t + 1 ] = base[ t ] + ti[ t ].size();
 
-      //printf( "Close the file. Reformat.\n" );
+      #pragma omp parallel for num_threads( nt ) schedule( static, 1 )
+      for ( int t = 0; t < nt; t ++ )
+      {
+        for ( size_t p = 0; p < ti[ t ].size(); p ++ )
+        {
+          size_t i = ti[ t ][ p ], j = tj[ t ][ p ], dst;
+          #pragma omp atomic capture
+          dst = next[ j ] ++;
+          row_ind[ dst ] = i;
+          val[ dst ] = tv[ t ][ p ];
+          order[ dst ] = base[ t ] + p;
+          if ( !SYMMETRIC && LOWERTRIANGULAR && i > j )
+          {
+            #pragma omp atomic capture
+            dst = next[ i ] ++;
+            row_ind[ dst ] = j;
+            val[ dst ] = tv[ t ][ p ];
+            order[ dst ] = base[ t ] + p;
+          }
+        }
+        std::vector<size_t>().swap( ti[ t ] );
+        std::vector<size_t>().swap( tj[ t ] );
+        std::vector<T>().swap( tv[ t ] );
+      }
 
-      #pragma omp parallel for
+      /** 
+       *  lookups and merge-joins need sorted rows in each column; 
+       *  duplicated entries keep their file order as before
+       */
+      #pragma omp parallel for schedule( dynamic, 64 )
       for ( size_t j = 0; j < n; j ++ )
       {
-        for ( size_t i = 0; i < full_row_ind[ j ].size(); i ++ )
+        size_t beg = col_ptr[ j ], end = col_ptr[ j + 1 ];
+        std::vector<std::pair<std::pair<size_t, size_t>, T>> column( end - beg );
+        for ( size_t p = beg; p < end; p ++ ) 
+          column[ p - beg ] = std::make_pair( std::make_pair( row_ind[ p ], order[ p ] ), val[ p ] );
+        std::sort( column.begin(), column.end() );
+        for ( size_t p = beg; p < end; p ++ )
         {
-          row_ind[ col_ptr[ j ] + i ] = full_row_ind[ j ][ i ];
-          val[ col_ptr[ j ] + i ] = full_val[ j ][ i ];
+          row_ind[ p ] = column[ p - beg ].first.first;
+          val[ p ] = column[ p - beg ].second;
         }
       }
 
+      if ( cache )
+      {
+        header.nnz = nnz;
+        StoreCache( cachename, header );
+      }
+
       printf( "finish readmatrix %s\n", filename.data() ); fflush( stdout );
     };
 
 
+    /** sort the row indices (and values) of every unsorted column */
+    void SortRows()
+    {
+      #pragma omp parallel for schedule( dynamic, 64 )
+      for ( size_t j = 0; j < n; j ++ )
+      {
+        size_t beg = col_ptr[ j ], end = col_ptr[ j + 1 ];
+        if ( std::is_sorted( row_ind + beg, row_ind + end ) ) continue;
+        std::vector<std::pair<size_t, T>> column( end - beg );
+        for ( size_t p = beg; p < end; p ++ ) column[ p - beg ] = std::make_pair( row_ind[ p ], val[ p ] );
+        std::sort( column.begin(), column.end() );
+        for ( size_t p = beg; p < end; p ++ )
+        {
+          row_ind[ p ] = column[ p - beg ].first;
+          val[ p ] = column[ p - beg ].second;
+        }
+      }
+    }; /** end SortRows() */
+
     std::size_t row() { return m; };
 
     std::size_t col() { return n; };
 
+    /** true if the arrays map the binary cache written by readmtx */
+    bool IsMapped() { return mapped != NULL; };
+
     template<typename TINDEX>
     double flops( TINDEX na, TINDEX nb ) { return 0.0; };
 
   private:
 
+    /** point val, row_ind and col_ptr to the owned buffers */
+    void BindBuffers()
+    {
+      val = val_buff.data();
+      row_ind = row_ind_buff.data();
+      col_ptr = col_ptr_buff.data();
+    };
+
+    void Unmap()
+    {
+      if ( mapped ) munmap( mapped, mapped_bytes );
+      mapped = NULL;
+      mapped_bytes = 0;
+    };
+
+    template<bool LOWERTRIANGULAR, bool ISZEROBASE, bool IJONLY>
+    CSCCacheHeader CacheHeader( std::string &filename )
+    {
+      struct stat st;
+      if ( stat( filename.data(), &st ) == -1 )
+      {
+        printf( "readmtx: fail to open %s\n", filename.data() );
+        exit( 1 );
+      }
+      CSCCacheHeader header;
+      memset( &header, 0, sizeof(CSCCacheHeader) );
+      memcpy( header.magic, "HMLPCSC", 8 );
+      header.version = 1;
+      header.m = m;
+      header.n = n;
+      header.dtype = sizeof(T);
+      header.options = SYMMETRIC | ( LOWERTRIANGULAR << 1 ) 
+                     | ( ISZEROBASE << 2 ) | ( IJONLY << 3 );
+      header.source_bytes = st.st_size;
+      header.source_mtime = st.st_mtime;
+      return header;
+    };
+
+    /** map a valid cache and use it in place (copy-on-write) */
+    bool LoadCache( std::string &cachename, CSCCacheHeader &expected )
+    {
+      int fd = open( cachename.data(), O_RDONLY );
+      if ( fd == -1 ) return false;
+
+      CSCCacheHeader header;
+      struct stat st;
+      bool valid = ( fstat( fd, &st ) == 0 ) 
+        && ( (size_t)st.st_size >= sizeof(CSCCacheHeader) )
+        && ( pread( fd, &header, sizeof(CSCCacheHeader), 0 ) == sizeof(CSCCacheHeader) );
+      valid = valid
+        && !memcmp( header.magic, expected.magic, 8 )
+        && header.version == expected.version
+        && header.m == expected.m
+        && header.n == expected.n
+        && header.dtype == expected.dtype
+        && header.options == expected.options
+        && header.source_bytes == expected.source_bytes
+        && header.source_mtime == expected.source_mtime;
+      size_t bytes = sizeof(CSCCacheHeader) + ( header.n + 1 ) * sizeof(uint64_t)
+                   + header.nnz * ( sizeof(uint64_t) + sizeof(T) );
+      valid = valid && ( (size_t)st.st_size == bytes );
+
+      char *addr = valid ? (char*)mmap( NULL, bytes, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0 ) 
+                         : (char*)MAP_FAILED;
+      close( fd );
+      if ( addr == MAP_FAILED ) return false;
+
+      Unmap();
+      mapped = addr;
+      mapped_bytes = bytes;
+      nnz = header.nnz;
+      col_ptr = (std::size_t*)( mapped + sizeof(CSCCacheHeader) );
+      row_ind = col_ptr + n + 1;
+      val = (T*)( row_ind + nnz );
+      std::vector<T, Allocator>().swap( val_buff );
+      std::vector<std::size_t>().swap( row_ind_buff );
+      std::vector<std::size_t>().swap( col_ptr_buff );
+      return true;
+    };
+
+    /** write to a temporary file first, such that a cache is never partial */
+    void StoreCache( std::string &cachename, CSCCacheHeader &header )
+    {
+      std::string tmpname = cachename + ".tmp";
+      std::ofstream file( tmpname.data(), std::ios::out|std::ios::binary );
+      if ( !file.is_open() ) 
+      {
+        printf( "readmtx: cannot write cache %s\n", tmpname.data() );
+        return;
+      }
+      file.write( (char*)&header, sizeof(CSCCacheHeader) );
+      file.write( (char*)col_ptr, ( n + 1 ) * sizeof(std::size_t) );
+      file.write( (char*)row_ind, nnz * sizeof(std::size_t) );
+      file.write( (char*)val, nnz * sizeof(T) );
+      file.close();
+      if ( file.fail() ) 
+      {
+        printf( "readmtx: cannot write cache %s\n", tmpname.data() );
+        std::remove( tmpname.data() );
+        return;
+      }
+      std::rename( tmpname.data(), cachename.data() );
+    };
+
+    /** spaces and tabs (not newlines) */
+    static const char *SkipBlanks( const char *p, const char *eof )
+    {
+      while ( p < eof && ( *p == ' ' || *p == '\t' || *p == '\r' ) ) p ++;
+      return p;
+    };
+
+    /** the position after the next newline */
+    static const char *NextLine( const char *p, const char *eof )
+    {
+      const char *q = (const char*)memchr( p, '\n', eof - p );
+      return q ? q + 1 : eof;
+    };
+
+    /** parse an unsigned integer; NULL on failure */
+    static const char *ParseIndex( const char *p, const char *eof, size_t &x )
+    {
+      if ( !p ) return NULL;
+      p = SkipBlanks( p, eof );
+      if ( p == eof || *p < '0' || *p > '9' ) return NULL;
+      for ( x = 0; p < eof && *p >= '0' && *p <= '9'; p ++ ) x = x * 10 + ( *p - '0' );
+      return p;
+    };
+
+    /** parse a real number; the mapped file is not null-terminated */
+    static const char *ParseValue( const char *p, const char *eof, T &v )
+    {
+      if ( !p ) return NULL;
+      p = SkipBlanks( p, eof );
+      char token[ 64 ];
+      size_t len = 0;
+      while ( p + len < eof && len < 63 && p[ len ] > ' ' ) len ++;
+      if ( !len ) return NULL;
+      memcpy( token, p, len );
+      token[ len ] = '\0';
+      char *end;
+      v = strtod( token, &end );
+      return ( end == token + len ) ? p + len : NULL;
+    };
+
+    /** parallel in-place inclusive prefix sum */
+    static void InclusiveScan( std::vector<std::size_t> &A )
+    {
+      int nt = omp_get_max_threads();
+      std::vector<std::size_t> partial( nt, 0 );
+      #pragma omp parallel num_threads( nt )
+      {
+        int t = omp_get_thread_num(), p = omp_get_num_threads();
+        size_t beg = ( A.size() * t ) / p, end = ( A.size() * ( t + 1 ) ) / p;
+        for ( size_t i = beg + 1; i < end; i ++ ) A[ i ] += A[ i - 1 ];
+        partial[ t ] = ( end > beg ) ? A[ end - 1 ] : 0;
+        #pragma omp barrier
+        size_t offset = 0;
+        for ( int s = 0; s < t; s ++ ) offset += partial[ s ];
+        for ( size_t i = beg; i < end; i ++ ) A[ i ] += offset;
+      }
+    };
+
+    /** (row, position) pairs sorted by row */
+    template<typename TINDEX>
+    std::vector<std::pair<size_t, size_t>> SortWithPositions( std::vector<TINDEX> &ids )
+    {
+      std::vector<std::pair<size_t, size_t>> sorted( ids.size() );
+      for ( size_t p = 0; p < ids.size(); p ++ ) sorted[ p ] = std::make_pair( ids[ p ], p );
+      std::sort( sorted.begin(), sorted.end() );
+      return sorted;
+    };
+
+    /**
+     *  @brief For every nonzero ( r, col ) with r >= rmin and every 
+     *         query ( r, p ) in the sorted queries, out[ p * stride ]
+     *         = K( r, col ). A plain merge walks both lists; if one
+     *         side is more than 16 times longer, the shorter side
+     *         binary searches the longer one instead (e.g. very 
+     *         dense columns against a small imap).
+     */ 
+    void GatherColumn
+    ( 
+      size_t col, size_t rmin, 
+      std::vector<std::pair<size_t, size_t>> &queries, 
+      T *out, size_t stride 
+    )
+    {
+      auto rbeg = row_ind + col_ptr[ col ];
+      auto rend = row_ind + col_ptr[ col + 1 ];
+      if ( rmin ) rbeg = std::lower_bound( rbeg, rend, rmin );
+      auto qbeg = std::lower_bound( queries.begin(), queries.end(), 
+          std::make_pair( rmin, (size_t)0 ) );
+      auto qend = queries.end();
+
+      size_t nnz_col = rend - rbeg;
+      size_t nq = qend - qbeg;
+      if ( !nnz_col || !nq ) return;
+
+      if ( 16 * nnz_col < nq )
+      {
+        /** sparse column: find each nonzero in the queries */
+        for ( auto r = rbeg; r != rend; r ++ )
+        {
+          auto q = std::lower_bound( qbeg, qend, std::make_pair( *r, (size_t)0 ) );
+          for ( ; q != qend && q->first == *r; q ++ )
+            out[ q->second * stride ] = val[ r - row_ind ];
+        }
+      }
+      else if ( 16 * nq < nnz_col )
+      {
+        /** dense column: find each query in the nonzeros */
+        for ( auto q = qbeg; q != qend; q ++ )
+        {
+          auto r = std::lower_bound( rbeg, rend, q->first );
+          if ( r != rend && *r == q->first )
+            out[ q->second * stride ] = val[ r - row_ind ];
+        }
+      }
+      else
+      {
+        /** branch-free merge; imap may repeat a row, so only q moves on a match */
+        auto r = rbeg;
+        auto q = qbeg;
+        T unmatched;
+        while ( r != rend && q != qend )
+        {
+          size_t a = *r, b = q->first;
+          T *dst = ( a == b ) ? out + q->second * stride : &unmatched;
+          *dst = val[ r - row_ind ];
+          r += ( a < b );
+          q += ( b <= a );
+        }
+      }
+    }; /** end GatherColumn() */
+
     std::size_t m;
 
     std::size_t n;
 
     std::size_t nnz;
 
-    std::vector<T, Allocator> val;
+    std::vector<T, Allocator> val_buff;
 
     //std::vector<std::size_t, Allocator> row_ind;
-    std::vector<std::size_t> row_ind;
+    std::vector<std::size_t> row_ind_buff;
    
     //std::vector<std::size_t, Allocator> col_ptr;
-    std::vector<std::size_t> col_ptr;
+    std::vector<std::size_t> col_ptr_buff;
+
+    /** the arrays in use: either the buffers above or a mapped cache */
+    T *val = NULL;
+
+    std::size_t *row_ind = NULL;
+
+    std::size_t *col_ptr = NULL;
+
+    /** mapped binary cache (see readmtx) */
+    char *mapped = NULL;
+
+    std::size_t mapped_bytes = 0;
 
 }; // end class CSC
 
 
 
+/**
+ *  @brief A sharded LRU cache of tiles (std::vector<T>) bounded by a
+ *         byte budget. Each shard has its own lock, which is only held
+ *         to look up, insert or evict; reads of missing tiles (with the
+ *         user-provided reader) and accesses to tiles run concurrently.
+ *         Tiles are shared_ptr, so eviction never invalidates a reader.
+ *
+ *         Prefetch( tids ) queues missing tiles to background I/O 
+ *         threads, which are only created on the first call.
+ */
+template<typename T>
+class TileCache
+{
+  public:
+
+    typedef std::shared_ptr<std::vector<T>> TILE;
+
+    TileCache() : shards( n_shards ) {};
+
+    ~TileCache() { Stop(); };
+
+    /** the budget is at least one tile of tile_bytes per shard */
+    void Setup( size_t cache_bytes, size_t tile_bytes, std::function<TILE(size_t)> reader )
+    {
+      shard_bytes = std::max( cache_bytes / n_shards, tile_bytes );
+      this->reader = reader;
+    };
+
+    /** join the I/O threads; call before the reader becomes invalid */
+    void Stop()
+    {
+      {
+        std::lock_guard<std::mutex> guard( io_mutex );
+        io_stop = true;
+      }
+      io_ready.notify_all();
+      for ( auto &t : io_threads ) t.join();
+      io_threads.clear();
+    };
+
+    /** return tile tid from the cache or read it */
+    TILE Get( size_t tid )
+    {
+      TILE tile = Lookup( tid );
+      if ( !tile ) tile = Insert( tid, reader( tid ) );
+      return tile;
+    };
+
+    /** return the cached tile tid (and mark it recent) or NULL */
+    TILE Lookup( size_t tid )
+    {
+      auto &shard = shards[ tid % n_shards ];
+      TILE tile;
+      shard.lock.Acquire();
+      {
+        auto it = shard.index.find( tid );
+        if ( it != shard.index.end() )
+        {
+          shard.lru.splice( shard.lru.begin(), shard.lru, it->second );
+          tile = it->second->second;
+        }
+      }
+      shard.lock.Release();
+      return tile;
+    };
+
+    /** queue the tiles that are not cached and return immediately */
+    void Prefetch( std::vector<size_t> &tids )
+    {
+      std::vector<size_t> missing;
+      for ( auto tid : tids ) if ( !Lookup( tid ) ) missing.push_back( tid );
+      if ( !missing.size() ) return;
+
+      {
+        std::lock_guard<std::mutex> guard( io_mutex );
+        if ( io_stop ) return;
+        if ( !io_threads.size() )
+          for ( size_t p = 0; p < n_io_threads; p ++ )
+            io_threads.emplace_back( &TileCache::IOLoop, this );
+        for ( auto tid : missing )
+          if ( io_pending.insert( tid ).second ) io_queue.push_back( tid );
+      }
+      io_ready.notify_all();
+    };
+
+  private:
+
+    /** one shard of the cache, front of lru is the most recent */
+    struct Shard
+    {
+      hmlp::Lock lock;
+
+      std::list<std::pair<size_t, TILE>> lru;
+
+      std::unordered_map<size_t, typename std::list<std::pair<size_t, TILE>>::iterator> index;
+
+      size_t bytes = 0;
+    };
+
+    /**
+     *  @brief Insert tile tid and evict the least recently used tiles.
+     *         Two threads missing on the same tile may both read it;
+     *         the first insertion wins and is returned to both.
+     */ 
+    TILE Insert( size_t tid, TILE tile )
+    {
+      auto &shard = shards[ tid % n_shards ];
+      shard.lock.Acquire();
+      {
+        auto it = shard.index.find( tid );
+        if ( it != shard.index.end() )
+        {
+          tile = it->second->second;
+        }
+        else
+        {
+          shard.lru.emplace_front( tid, tile );
+          shard.index[ tid ] = shard.lru.begin();
+          shard.bytes += tile->size() * sizeof(T);
+          while ( shard.bytes > shard_bytes && shard.lru.size() > 1 )
+          {
+            auto &victim = shard.lru.back();
+            shard.bytes -= victim.second->size() * sizeof(T);
+            shard.index.erase( victim.first );
+            shard.lru.pop_back();
+          }
+        }
+      }
+      shard.lock.Release();
+      return tile;
+    };
+
+    /** I/O threads read the queued tiles into the cache */
+    void IOLoop()
+    {
+      while ( 1 )
+      {
+        size_t tid;
+        {
+          std::unique_lock<std::mutex> guard( io_mutex );
+          io_ready.wait( guard, [ this ] { return io_stop || io_queue.size(); } );
+          if ( io_stop ) return;
+          tid = io_queue.front();
+          io_queue.pop_front();
+        }
+        if ( !Lookup( tid ) ) Insert( tid, reader( tid ) );
+        {
+          std::lock_guard<std::mutex> guard( io_mutex );
+          io_pending.erase( tid );
+        }
+      }
+    };
+
+    static const size_t n_shards = 64;
+
+    /** byte budget per shard */
+    size_t shard_bytes = 0;
+
+    std::vector<Shard> shards;
+
+    std::function<TILE(size_t)> reader;
+
+    /** background readers and their queue of tile ids */
+    static const size_t n_io_threads = 2;
+
+    std::vector<std::thread> io_threads;
+
+    std::deque<size_t> io_queue;
+
+    std::set<size_t> io_pending;
+
+    std::mutex io_mutex;
+
+    std::condition_variable io_ready;
+
+    bool io_stop = false;
+
+}; // end class TileCache
+
+
+/**
+ *  @brief Out-of-core m-by-n matrix stored column-major in a binary
+ *         file. The file is read in column tiles (tile_m contiguous
+ *         rows of one column) with pread() through a TileCache.
+ *
+ *         With use_mmap = true the whole file is mapped instead and
+ *         the page cache of the OS plays the role of the tile cache.
+ *
+ *         Prefetch( imap, jmap ) queues the missing tiles of a block
+ *         to background I/O threads (madvise for the mmap backend).
+ */
 #ifdef HMLP_MIC_AVX512
 template<class T, class Allocator = hbw::allocator<T> >
 #else
@@ -765,76 +1645,153 @@ class OOC : public ReadWrite
 {
   public:
 
+    typedef typename TileCache<T>::TILE TILE;
+
     template<typename TINDEX>
-    OOC( TINDEX m, TINDEX n, std::string filename ) :
-      file( filename.data(), std::ios::in|std::ios::binary|std::ios::ate )
+    OOC( TINDEX m, TINDEX n, std::string filename, 
+        size_t cache_bytes = ( 1UL << 30 ), bool use_mmap = false )
     {
       this->m = m;
       this->n = n;
       this->filename = filename;
+      this->use_mmap = use_mmap;
 
-      //if ( file.is_open() )
-      //{
-      //  auto size = file.tellg();
-      //  assert( size == m * n * sizeof(T) );
-      //}
+      fd = open( filename.data(), O_RDONLY, 0 );
+      if ( fd == -1 )
+      {
+        printf( "OOC: fail to open %s\n", filename.data() );
+        exit( 1 );
+      }
 
-      cache.resize( n );
+      struct stat st;
+      fstat( fd, &st );
+      if ( (size_t)st.st_size < this->m * this->n * sizeof(T) )
+      {
+        printf( "OOC: %s has %lu bytes, expect %lu\n", filename.data(),
+            (size_t)st.st_size, this->m * this->n * sizeof(T) );
+        exit( 1 );
+      }
 
-      fd = open( filename.data(), O_RDONLY, 0 ); assert( fd != -1 );
-//#ifdef __APPLE__
-//      mmappedData = (T*)mmap( NULL, m * n * sizeof(T), PROT_READ, MAP_PRIVATE, fd, 0 );
-//#else /** assume linux */
-//      mmappedData = (T*)mmap( NULL, m * n * sizeof(T), PROT_READ, MAP_PRIVATE | MAP_POPULATE, fd, 0 );
-//#endif
-//
-//      assert( mmappedData != MAP_FAILED );
+      /** tiles of 64KB (or a whole column if it is shorter) */
+      tile_m = std::min( this->m, std::max( (size_t)1, ( 1UL << 16 ) / sizeof(T) ) );
+      ntile_m = ( this->m + tile_m - 1 ) / tile_m;
+      cache.Setup( cache_bytes, tile_m * sizeof(T), 
+          [ this ] ( size_t tid ) { return ReadTile( tid ); } );
 
-      std::cout << filename << std::endl;
+      if ( use_mmap )
+      {
+        mmappedData = (T*)mmap( NULL, this->m * this->n * sizeof(T), PROT_READ, MAP_SHARED, fd, 0 );
+        if ( mmappedData == MAP_FAILED )
+        {
+          printf( "OOC: fail to mmap %s, fall back to pread\n", filename.data() );
+          mmappedData = NULL;
+          this->use_mmap = false;
+        }
+        else
+        {
+          /** GOFMM touches K( gids, gids ) blocks in no particular order */
+          madvise( mmappedData, this->m * this->n * sizeof(T), MADV_RANDOM );
+        }
+      }
     };
 
     ~OOC()
     {
-      //if ( file.is_open() ) file.close();
-      /** unmap */
-      //int rc = munmap( mmappedData, m * n * sizeof(T) );
-      //assert( rc == 0 );
+      cache.Stop();
+      if ( mmappedData ) munmap( mmappedData, m * n * sizeof(T) );
       close( fd );
-      printf( "finish readmatrix %s\n", filename.data() );
     };
 
 
     template<typename TINDEX>
     inline T operator()( TINDEX i, TINDEX j )
     {
-      T Kij;
+      if ( use_mmap ) return mmappedData[ (size_t)j * m + i ];
+      auto tile = cache.Get( (size_t)j * ntile_m + i / tile_m );
+      return (*tile)[ i % tile_m ];
+    };
 
-      if ( !read_from_cache( i, j, &Kij ) )
+    template<typename TINDEX>
+    inline hmlp::Data<T> operator()( std::vector<TINDEX> &imap, std::vector<TINDEX> &jmap )
+    {
+      hmlp::Data<T> submatrix( imap.size(), jmap.size() );
+
+      if ( use_mmap )
+      {
+        #pragma omp parallel for
+        for ( size_t j = 0; j < jmap.size(); j ++ )
+          for ( size_t i = 0; i < imap.size(); i ++ )
+            submatrix[ j * imap.size() + i ] = mmappedData[ (size_t)jmap[ j ] * m + imap[ i ] ];
+        return submatrix;
+      }
+
+      #pragma omp parallel
       {
-        if ( !read_from_disk( i, j, &Kij ) )
+        /** tiles of the current column stay pinned during the gather */
+        std::vector<TILE> pinned( ntile_m );
+        std::vector<size_t> touched;
+
+        #pragma omp for
+        for ( size_t j = 0; j < jmap.size(); j ++ )
         {
-          printf( "Accessing disk fail\n" );
-          exit( 1 );
+          for ( size_t i = 0; i < imap.size(); i ++ )
+          {
+            size_t ib = imap[ i ] / tile_m;
+            if ( !pinned[ ib ] ) 
+            {
+              pinned[ ib ] = cache.Get( (size_t)jmap[ j ] * ntile_m + ib );
+              touched.push_back( ib );
+            }
+            submatrix[ j * imap.size() + i ] = (*pinned[ ib ])[ imap[ i ] % tile_m ];
+          }
+          for ( auto ib : touched ) pinned[ ib ].reset();
+          touched.clear();
         }
       }
 
-      return Kij;
-    };
+      return submatrix;
+    }; 
 
+    /**
+     *  @brief Start reading the tiles of K( imap, jmap ) in the 
+     *         background and return immediately. Tasks call this
+     *         (through their Prefetch()) before they are dequeued,
+     *         such that disk reads overlap the running tasks.
+     */ 
     template<typename TINDEX>
-    inline hmlp::Data<T> operator()( std::vector<TINDEX> &imap, std::vector<TINDEX> &jmap )
+    void Prefetch( std::vector<TINDEX> &imap, std::vector<TINDEX> &jmap )
     {
-      hmlp::Data<T> submatrix( imap.size(), jmap.size() );
-      #pragma omp parallel for
-      for ( int j = 0; j < jmap.size(); j ++ )
+      if ( !imap.size() || !jmap.size() ) return;
+
+      if ( use_mmap )
       {
-        for ( int i = 0; i < imap.size(); i ++ )
+        /** let the kernel read ahead the row range of each column */
+        size_t ibeg = *std::min_element( imap.begin(), imap.end() );
+        size_t iend = *std::max_element( imap.begin(), imap.end() ) + 1;
+        size_t page = sysconf( _SC_PAGESIZE );
+        for ( auto j : jmap )
         {
-          submatrix[ j * imap.size() + i ] = (*this)( imap[ i ], jmap[ j ] );
+          size_t lo = ( (size_t)j * m + ibeg ) * sizeof(T);
+          size_t hi = ( (size_t)j * m + iend ) * sizeof(T);
+          lo -= lo % page;
+          madvise( (char*)mmappedData + lo, hi - lo, MADV_WILLNEED );
         }
+        return;
       }
-      return submatrix;
-    }; 
+
+      /** distinct row tiles touched by imap */
+      std::vector<size_t> iblocks;
+      iblocks.reserve( imap.size() );
+      for ( auto i : imap ) iblocks.push_back( i / tile_m );
+      std::sort( iblocks.begin(), iblocks.end() );
+      iblocks.erase( std::unique( iblocks.begin(), iblocks.end() ), iblocks.end() );
+
+      std::vector<size_t> tids;
+      for ( auto j : jmap )
+        for ( auto ib : iblocks )
+          tids.push_back( (size_t)j * ntile_m + ib );
+      cache.Prefetch( tids );
+    };
 
     template<typename TINDEX>
     std::pair<T, TINDEX> ImportantSample( TINDEX j )
@@ -853,56 +1810,15 @@ class OOC : public ReadWrite
 
   private:
 
-    template<typename TINDEX>
-    bool read_from_cache( TINDEX i, TINDEX j, T *Kij )
-    {
-      // Need some method to search in the caahe.
-      auto it = cache[ j ].find( i );
-
-      if ( it != cache[ j ].end() ) 
-      {
-        *Kij = it->second;
-        return true;
-      }
-      else return false;
-    };
-
-    /**
-     *  @brief We need a lock here.
-     */ 
-    template<typename TINDEX>
-    bool read_from_disk( TINDEX i, TINDEX j, T *Kij )
+    /** read tile tid (rows [ i, i + mb ) of column j) */
+    TILE ReadTile( size_t tid )
     {
-      if ( file.is_open() )
-      {
-        //printf( "try %4lu, %4lu ", i, j );
-        T K015j[ 16 ];
-        size_t batch_size = 1;
-        if ( i + batch_size >= m ) batch_size = 1;
-        #pragma omp critical
-        {
-          file.seekg( ( j * m + i ) * sizeof(T) );
-          file.read( (char*)K015j, batch_size * sizeof(T) );
-        }
-        *Kij = K015j[ 0 ];
-        for ( size_t p = 0; p < batch_size; p ++ )
-        {
-          if ( cache[ j ].size() < 16384 )
-          {
-            #pragma omp critical
-            {
-              cache[ j ][ i + p ] = K015j[ p ];
-            }
-          }
-        }
-        // printf( "read %4lu, %4lu, %E\n", i, j, *Kij );
-        // TODO: Need some method to cache the data.
-        return true;
-      }
-      else
-      {
-        return false;
-      }
+      size_t j  = tid / ntile_m;
+      size_t i  = ( tid % ntile_m ) * tile_m;
+      size_t mb = std::min( tile_m, m - i );
+      TILE tile = std::make_shared<std::vector<T>>( mb );
+      ReadFromDisk( fd, ( j * m + i ) * sizeof(T), mb * sizeof(T), (char*)tile->data() );
+      return tile;
     };
 
     std::size_t m;
@@ -911,15 +1827,18 @@ class OOC : public ReadWrite
 
     std::string filename;
 
-    std::ifstream file;
+    int fd;
+
+    bool use_mmap = false;
 
-    // Use mmp
-    T *mmappedData;
+    T *mmappedData = NULL;
 
-    /** */
-    std::vector<std::map<size_t, T>> cache;
+    /** tile size (rows) and number of tiles per column */
+    size_t tile_m;
 
-    int fd;
+    size_t ntile_m;
+
+    TileCache<T> cache;
 
 }; // end class OOC
 
@@ -142,6 +142,18 @@ class SplitTask : public hmlp::Task
       arg = user_arg;
       // Need an accurate cost model.
       cost = 1.0;
+      /** the splitter is linear in the number of points */
+      if ( arg ) cost += arg->n / 1E+5;
+    };
+
+    void DependencyAnalysis()
+    {
+      /** only depends on the parent split */
+      if ( arg->parent && arg->parent->recent_task ) 
+        Scheduler::DependencyAdd( arg->parent->recent_task, this );
+      else 
+        this->Enqueue();
+      arg->recent_task = this;
     };
 
     void Execute( Worker* user_worker )
@@ -397,11 +409,34 @@ struct centersplit
     std::vector<std::size_t>& gids,
     std::vector<std::size_t>& lids
   ) const 
+  {
+    /** low dimensions get fully unrolled distance and projection loops */
+    switch ( Coordinate->row() )
+    {
+      case 1: return Split<1>( gids, lids );
+      case 2: return Split<2>( gids, lids );
+      case 3: return Split<3>( gids, lids );
+      case 4: return Split<4>( gids, lids );
+      case 5: return Split<5>( gids, lids );
+      case 6: return Split<6>( gids, lids );
+      case 7: return Split<7>( gids, lids );
+      case 8: return Split<8>( gids, lids );
+      default: return Split<0>( gids, lids );
+    }
+  };
+
+  /** D > 0 fixes the dimension at compile time; D = 0 reads X.row() */
+  template<size_t D>
+  inline std::vector<std::vector<std::size_t> > Split
+  ( 
+    std::vector<std::size_t>& gids,
+    std::vector<std::size_t>& lids
+  ) const 
   {
     assert( N_SPLIT == 2 );
 
     hmlp::Data<T> &X = *Coordinate;
-    size_t d = X.row();
+    const size_t d = D ? D : X.row();
     size_t n = lids.size();
 
     T rcx0 = 0.0, rx01 = 0.0;
@@ -499,7 +534,7 @@ struct centersplit
     // Parallel median search
     // T median = Select( n, n / 2, projection );
     auto proj_copy = projection;
-    std::sort( proj_copy.begin(), proj_copy.end() );
+    std::nth_element( proj_copy.begin(), proj_copy.begin() + n / 2, proj_copy.end() );
     T median = proj_copy[ n / 2 ];
 
     split[ 0 ].reserve( n / 2 + 1 );
@@ -561,11 +596,34 @@ struct randomsplit
     std::vector<std::size_t>& gids,
     std::vector<std::size_t>& lids
   ) const 
+  {
+    /** low dimensions get fully unrolled distance and projection loops */
+    switch ( Coordinate->row() )
+    {
+      case 1: return Split<1>( gids, lids );
+      case 2: return Split<2>( gids, lids );
+      case 3: return Split<3>( gids, lids );
+      case 4: return Split<4>( gids, lids );
+      case 5: return Split<5>( gids, lids );
+      case 6: return Split<6>( gids, lids );
+      case 7: return Split<7>( gids, lids );
+      case 8: return Split<8>( gids, lids );
+      default: return Split<0>( gids, lids );
+    }
+  };
+
+  /** D > 0 fixes the dimension at compile time; D = 0 reads X.row() */
+  template<size_t D>
+  inline std::vector<std::vector<std::size_t> > Split
+  ( 
+    std::vector<std::size_t>& gids,
+    std::vector<std::size_t>& lids
+  ) const 
   {
     assert( N_SPLIT == 2 );
 
     hmlp::Data<T> &X = *Coordinate;
-    size_t d = X.row();
+    const size_t d = D ? D : X.row();
     size_t n = lids.size();
 
     std::vector<std::vector<std::size_t> > split( N_SPLIT );
@@ -591,7 +649,7 @@ struct randomsplit
     // Parallel median search
     // T median = Select( n, n / 2, projection );
     auto proj_copy = projection;
-    std::sort( proj_copy.begin(), proj_copy.end() );
+    std::nth_element( proj_copy.begin(), proj_copy.begin() + n / 2, proj_copy.end() );
     T median = proj_copy[ n / 2 ];
 
     split[ 0 ].reserve( n / 2 + 1 );
@@ -633,6 +691,22 @@ struct randomsplit
 };
 
 
+/** reset NODEDATA in place if it provides Reset() */
+template<typename NODEDATA>
+auto ResetNodeData( NODEDATA &data, int ) -> decltype( data.Reset(), void() )
+{
+  data.Reset();
+}; /** end ResetNodeData() */
+
+/** otherwise construct it again */
+template<typename NODEDATA>
+void ResetNodeData( NODEDATA &data, long )
+{
+  data.~NODEDATA();
+  new ( &data ) NODEDATA();
+}; /** end ResetNodeData() */
+
+
 /**
  *  @brief 
  */ 
@@ -689,6 +763,39 @@ class Node : public ReadWrite
 
     ~Node() {};
 
+    /**
+     *  @brief Reinitialize a node for a new partition. gids and lids keep
+     *         their capacity, such that nodes can be reused as an arena.
+     */ 
+    void Reset( size_t n, size_t l, Node *parent )
+    {
+      this->n = n;
+      this->l = l;
+      this->morton = 0;
+      this->treelist_id = 0;
+      this->gids.resize( n );
+      this->lids.resize( n );
+      this->isleaf = false;
+      this->parent = parent;
+      this->lchild = NULL;
+      this->rchild = NULL;
+      this->recent_task = NULL;
+      for ( int i = 0; i < N_CHILDREN; i++ ) kids[ i ] = NULL;
+      FarIDs.clear();
+      FarNodes.clear();
+      NearIDs.clear();
+      NearNodes.clear();
+      NNFarIDs.clear();
+      NNFarNodes.clear();
+      NNNearIDs.clear();
+      NNNearNodes.clear();
+      FarList.clear();
+      NearList.clear();
+      NNFarList.clear();
+      NNNearList.clear();
+      ResetNodeData( data, 0 );
+    };
+
     void Resize( int n )
     {
       this->n = n;
@@ -856,6 +963,13 @@ class Node : public ReadWrite
     std::set<size_t> NNNearIDs;
     std::set<Node*>  NNNearNodes;
 
+    // Flat copies of the node lists above in the same order, frozen
+    // once the lists are final (see gofmm::FreezeInteractionLists).
+    std::vector<Node*> FarList;
+    std::vector<Node*> NearList;
+    std::vector<Node*> NNFarList;
+    std::vector<Node*> NNNearList;
+
     Node *parent;
 
     Node *kids[ N_CHILDREN ];
@@ -899,6 +1013,9 @@ class Setup
     /** neighbors<distance, gid> (accessed with lids) */
     hmlp::Data<std::pair<T, std::size_t>> *NN;
 
+    /** (optional) lock stripes, column j of NN is guarded by j % size */
+    std::vector<hmlp::Lock> *NNlocks = NULL;
+
     /** morton ids */
     std::vector<size_t> morton;
 
@@ -1044,9 +1161,10 @@ class Tree
 
       beg = omp_get_wtime();
 
-      /** reset the warning flag and clean up the treelist */
+      /** reset the warning flag and reuse the previous nodes as an arena */
       has_uneven_split = false;
-      treelist.clear();
+      std::vector<NODE*> arena;
+      arena.swap( treelist );
       treequeue.clear();
       treelist.reserve( ( n / m ) * N_CHILDREN );
 
@@ -1083,7 +1201,24 @@ class Tree
       //printf( "n %lu m %lu n_per_node %lu depth %lu n_nodes %lu\n", 
       //    n, m, n_per_node, depth, n_node );
 
-      auto *root = new NODE( &setup, n, 0, gids, lids, NULL );
+      /** nodes are created in level order, the same as the arena */
+      size_t n_created = 0;
+      auto NewNode = [&] ( size_t n, size_t l, NODE *parent ) -> NODE*
+      {
+        NODE *node;
+        if ( n_created < arena.size() )
+        {
+          node = arena[ n_created ];
+          node->Reset( n, l, parent );
+        }
+        else node = new NODE( &setup, n, l, parent );
+        n_created ++;
+        return node;
+      };
+
+      auto *root = NewNode( n, 0, NULL );
+      root->gids = gids;
+      root->lids = lids;
       treequeue.push_back( root );
       while ( auto *node = treequeue.front() )
       {
@@ -1092,7 +1227,7 @@ class Tree
         {
           for ( int i = 0; i < N_CHILDREN; i ++ )
           {
-            node->kids[ i ] = new NODE( &setup, node->n / N_CHILDREN, node->l + 1, node );
+            node->kids[ i ] = NewNode( node->n / N_CHILDREN, node->l + 1, node );
             treequeue.push_back( node->kids[ i ] );
           }
         }
@@ -1104,12 +1239,61 @@ class Tree
         treequeue.pop_front();
       }
 
+      /** release the rest of the arena */
+      for ( size_t i = n_created; i < arena.size(); i ++ ) delete arena[ i ];
+
       alloc_time = omp_get_wtime() - beg;
 
 
       beg = omp_get_wtime();
-      SplitTask<NODE> splittask;
-      TraverseDown<false, false>( splittask );
+      /** 
+       *  Top levels (fewer nodes than threads) are split one node at 
+       *  a time, such that Split() and the splitter use all threads.
+       */
+      size_t n_top = 0;
+      while ( n_top <= depth && ( 1 << n_top ) < omp_get_max_threads() ) 
+      {
+        size_t n_nodes = 1 << n_top;
+        for ( size_t i = n_nodes - 1; i < 2 * n_nodes - 1; i ++ )
+        {
+          treelist[ i ]->template Split<true>( 0 );
+          treelist[ i ]->recent_task = NULL;
+        }
+        n_top ++;
+      }
+
+      /** 
+       *  The rest of the tree is a DAG of SplitTasks. Each one only 
+       *  depends on its parent, so there is no barrier per level. 
+       */
+      if ( n_top <= depth )
+      {
+        if ( !hmlp_is_in_epoch_session() && !omp_in_parallel() )
+        {
+          hmlp_init();
+          for ( size_t i = ( 1 << n_top ) - 1; i < treelist.size(); i ++ )
+          {
+            auto *task = new SplitTask<NODE>();
+            task->Submit();
+            task->Set( treelist[ i ] );
+            task->DependencyAnalysis();
+          }
+          hmlp_run();
+        }
+        else /** nested in another epoch or region, split level by level */
+        {
+          for ( size_t l = n_top; l <= depth; l ++ )
+          {
+            int n_nodes = 1 << l;
+            auto level_beg = treelist.begin() + n_nodes - 1;
+            #pragma omp parallel for schedule( dynamic )
+            for ( int node_ind = 0; node_ind < n_nodes; node_ind ++ )
+            {
+              (*(level_beg + node_ind))->template Split<true>( 0 );
+            }
+          }
+        }
+      }
       split_time = omp_get_wtime() - beg;
 
 
@@ -1377,7 +1561,8 @@ class Tree
       std::vector<std::size_t> &gids,
       std::vector<std::size_t> &lids,
       std::pair<T, std::size_t> initNN,
-      KNNTASK &dummy
+      KNNTASK &dummy,
+      std::size_t n_concurrent = 2
     )
     {
       /** k-by-N */
@@ -1388,61 +1573,111 @@ class Tree
       if ( setup.m < 32 ) setup.m = 32;
       setup.NN = &NN;
 
-      /** Clean the treelist. */
-      #pragma omp parallel for
-      for ( int i = 0; i < treelist.size(); i ++ ) delete treelist[ i ];
-      treelist.clear();
+      /** leaves of concurrent trees merge into NN with lock stripes */
+      std::vector<hmlp::Lock> NNlocks( 1024 );
+      setup.NNlocks = &NNlocks;
+
+      /** 
+       *  Trees are processed in rounds of n_concurrent. The trees of a
+       *  round are partitioned concurrently (with the same growing leaf 
+       *  sizes as sequential iterations), each by its own share of the
+       *  threads, and then all leaves of the round are searched together. 
+       *  Each tree reuses its nodes in the next round.
+       */
+      n_concurrent = std::max( std::min( n_tree, n_concurrent ), (size_t)1 );
+      if ( omp_get_max_threads() == 1 ) n_concurrent = 1;
+      std::vector<Tree*> forest( n_concurrent, this );
+      for ( size_t p = 1; p < n_concurrent; p ++ ) forest[ p ] = new Tree();
 
       double flops= 0.0; 
       double mops= 0.0;
+      size_t leaf_m = setup.m;
 
-      // This loop has to be sequential to prevent from race condiditon on NN.
       printf( "========================================================\n");
-      for ( int t = 0; t < n_tree; t ++ )      
+      for ( size_t t = 0; t < n_tree; t += n_concurrent )      
       {
-        //TreePartition( 2 * k, max_depth, gids, lids );
+        size_t n_round = std::min( n_concurrent, n_tree - t );
+        std::vector<NODE*> leaves;
+
+        for ( size_t p = 0; p < n_round; p ++ )
+        {
+          auto *tree = forest[ p ];
+          if ( tree != this ) tree->setup = setup;
+          tree->setup.m = leaf_m;
 
-        //Flops/Mops for tree partitioning
-        flops += std::log( gids.size() / setup.m ) * gids.size();
-        mops  += std::log( gids.size() / setup.m ) * gids.size();
+          //Flops/Mops for tree partitioning
+          flops += std::log( gids.size() / leaf_m ) * gids.size();
+          mops  += std::log( gids.size() / leaf_m ) * gids.size();
 
-        TreePartition( gids, lids );
-        TraverseLeafs<false, false>( dummy );
+          /** increase leaf size for the next tree */
+          if ( 2.0 * leaf_m < 2048 ) leaf_m = 2.0 * leaf_m;
+        }
 
-        /** TODO: need to redo the way without using dummy */
-        flops += dummy.event.GetFlops();
-        mops  += dummy.event.GetMops();
+        /** 
+         *  Partition the trees of this round concurrently. Each tree gets 
+         *  a nested team of n_thd / n_round threads, such that the 
+         *  splitters and the level-by-level splits of TreePartition() 
+         *  still run in parallel within each tree.
+         */
+        if ( n_round == 1 ) forest[ 0 ]->TreePartition( gids, lids );
+        else
+        {
+          int n_thd = omp_get_max_threads();
+          int max_levels = omp_get_max_active_levels();
+          omp_set_max_active_levels( std::max( max_levels, 2 ) );
+          #pragma omp parallel for num_threads( n_round ) schedule( static, 1 )
+          for ( size_t p = 0; p < n_round; p ++ )
+          {
+            omp_set_num_threads( std::max( n_thd / (int)n_round, 1 ) );
+            forest[ p ]->TreePartition( gids, lids );
+          }
+          omp_set_max_active_levels( max_levels );
+        }
+
+        for ( size_t p = 0; p < n_round; p ++ )
+        {
+          auto *tree = forest[ p ];
+          std::size_t n_nodes = 1 << tree->depth;
+          leaves.insert( leaves.end(), tree->treelist.end() - n_nodes, 
+                                       tree->treelist.end() );
+        }
+
+        /** search all leaves of this round concurrently */
+        double round_flops = 0.0, round_mops = 0.0;
+        #pragma omp parallel for schedule( dynamic ) reduction( +:round_flops,round_mops )
+        for ( size_t i = 0; i < leaves.size(); i ++ )
+        {
+          auto *task = new KNNTASK();
+          task->Set( leaves[ i ] );
+          task->Execute( NULL );
+          round_flops += task->event.GetFlops();
+          round_mops  += task->event.GetMops();
+          delete task;
+        }
+
+        /** dummy collects the flops and mops of all KNNTASKs */
+        dummy.event.AddFlopsMops( round_flops, round_mops );
+        flops += round_flops;
+        mops  += round_mops;
 
         /** Report accuracy */
         double knn_acc = 0.0;
         size_t num_acc = 0;
 
-        std::size_t n_nodes = 1 << depth;
-        auto level_beg = treelist.begin() + n_nodes - 1;
-        for ( std::size_t node_ind = 0; node_ind < n_nodes; node_ind ++ )
+        for ( size_t i = 0; i < leaves.size(); i ++ )
         {
-          auto *node = *(level_beg + node_ind);
-          knn_acc += node->data.knn_acc;
-          num_acc += node->data.num_acc;
+          knn_acc += leaves[ i ]->data.knn_acc;
+          num_acc += leaves[ i ]->data.num_acc;
         }
-        printf( "ANN iter %2d, average accuracy %.2lf%% (over %4lu samples)\n", 
+        printf( "ANN iter %2lu, average accuracy %.2lf%% (over %4lu samples)\n", 
             t, knn_acc / num_acc, num_acc );
 
-        /** clean up for the new iteration */
-        #pragma omp parallel for
-        for ( int i = 0; i < treelist.size(); i ++ ) delete treelist[ i ];
-        treelist.clear();
-
-        /** increase leaf size */
-        if ( knn_acc / num_acc < 0.8 )
-        { 
-          if ( 2.0 * setup.m < 2048 ) setup.m = 2.0 * setup.m;
-        }
-        else break;
+        /** stop if accurate enough */
+        if ( num_acc && knn_acc / num_acc >= 0.8 ) break;
 
 
 #ifdef DEBUG_TREE
-        printf( "Iter %2d NN 0 ", t );
+        printf( "Iter %2lu NN 0 ", t );
         for ( size_t i = 0; i < NN.row(); i ++ )
         {
           printf( "%E(%lu) ", NN[ i ].first, NN[ i ].second );
@@ -1450,6 +1685,14 @@ class Tree
         printf( "\n" );
 #endif
       }
+
+      /** clean up */
+      for ( size_t p = 1; p < n_concurrent; p ++ ) delete forest[ p ];
+      #pragma omp parallel for
+      for ( int i = 0; i < treelist.size(); i ++ ) delete treelist[ i ];
+      treelist.clear();
+      setup.NNlocks = NULL;
+
       printf( "========================================================\n\n");
 
       
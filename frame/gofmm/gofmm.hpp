@@ -41,6 +41,8 @@
 #include <stdio.h>
 #include <omp.h>
 #include <time.h>
+#include <type_traits>
+#include <utility>
 
 /** hmlp */
 #include <hmlp.h>
@@ -52,6 +54,8 @@
 
 #include <containers/tree.hpp>
 #include <containers/data.hpp>
+#include <containers/KernelMatrix.hpp>
+#include <containers/TiledMatrix.hpp>
 #include <gofmm/hfamily.hpp>
 
 /** gpu related */
@@ -107,7 +111,7 @@ class Configuration
 	  ( 
 		  DistanceMetric metric,
 		  size_t n, size_t m, size_t k, size_t s, 
-			T stol, T budget 
+			T stol, T budget, bool mixed = false
 	  ) 
 		{
 			this->metric = metric;
@@ -117,6 +121,7 @@ class Configuration
 			this->s = s;
 			this->stol = stol;
 			this->budget = budget;
+			this->mixed = mixed;
 		};
 
 		DistanceMetric MetricType() { return metric; };
@@ -133,6 +138,24 @@ class Configuration
 
 		T Budget() { return budget; };
 
+		bool MixedPrecision() { return mixed; };
+
+		size_t CacheBudget() { return cache_budget; };
+
+		void SetCacheBudget( size_t bytes ) { cache_budget = bytes; };
+
+		bool TreeOrder() { return tree_order; };
+
+		void SetTreeOrder( bool tree_order ) { this->tree_order = tree_order; };
+
+		size_t ConcurrentTrees() { return n_concurrent; };
+
+		void SetConcurrentTrees( size_t n_concurrent ) { this->n_concurrent = n_concurrent; };
+
+		bool Verbose() { return verbose; };
+
+		void SetVerbose( bool verbose ) { this->verbose = verbose; };
+
 	private:
 
 		/** (default) metric type */
@@ -155,9 +178,46 @@ class Configuration
 
 		/** (default) user computation budget */
 		T budget = 0.03;
+
+		/** (default) store bases and cached Kab in T */
+		bool mixed = false;
+
+		/** (default) bytes of cached NearKab and FarKab, 0 to cache all */
+		size_t cache_budget = 0;
+
+		/** (default) let K keep its points in the leaf order of the tree */
+		bool tree_order = false;
+
+		/** (default) randomized trees searched concurrently by the neighbor search */
+		size_t n_concurrent = 2;
+
+		/** (default) print statistics of the mixed precision, cache and solvers */
+		bool verbose = false;
 }; /** end class Configuration */
 
 
+/**
+ *  @brief Let K store its points in the order of gids (the leaf order
+ *         of the tree). KernelMatrix permutes its points and 
+ *         TiledMatrix its tiles, if it allows a copy on disk (see
+ *         TiledMatrix::SetTreeOrderCopy); others ignore it.
+ */ 
+template<typename SPDMATRIX>
+void PermuteMatrix( SPDMATRIX &K, std::vector<size_t> &gids ) {};
+
+template<typename T>
+void PermuteMatrix( hmlp::KernelMatrix<T> &K, std::vector<size_t> &gids )
+{
+  K.Permute( gids );
+}; /** end PermuteMatrix() */
+
+template<typename T>
+void PermuteMatrix( hmlp::TiledMatrix<T> &K, std::vector<size_t> &gids )
+{
+  if ( K.TreeOrderCopy() ) K.Permute( gids );
+}; /** end PermuteMatrix() */
+
+
 /**
  *  @brief These are data that shared by the whole tree.
  *
@@ -195,9 +255,227 @@ class Setup : public hmlp::tree::Setup<SPLITTER, T>
     /** regularization */
     T lambda = 0.0;
 
+    /** hfamily leaves use Kaa = Q * Sigma * Q' (cheap to refactorize) */
+    bool leaf_eig = false;
+
+    /** whether proj, w_skel, u_skel and cached Kab are in low precision */
+    bool mixed = false;
+
+    /** bytes of cached NearKab and FarKab (0: cache all at compression) */
+    size_t cache_budget = 0;
+
+    /** print statistics of the mixed precision, Kab cache and solvers */
+    bool verbose = false;
+
+    /**
+     *  Panel (buffer slot) of the evaluation tasks being created. Panel 0
+     *  uses w and u; panel p > 0 uses panel_w[ p - 1 ] and panel_u[ p - 1 ].
+     */
+    size_t panel = 0;
+    std::vector<hmlp::Data<T>*> panel_w;
+    std::vector<hmlp::Data<T>*> panel_u;
+
+    hmlp::Data<T> &Weights( size_t p ) { return p ? *panel_w[ p - 1 ] : *w; };
+    hmlp::Data<T> &Potentials( size_t p ) { return p ? *panel_u[ p - 1 ] : *u; };
+
 }; // end class Setup
 
 
+/**
+ *  @brief In the mixed-precision mode, proj, w_skel, u_skel, NearKab and
+ *         FarKab are stored in LowPrecision<T>::type, while potentials
+ *         are still accumulated in T. Only double is demoted (to float).
+ */ 
+template<typename T>
+struct LowPrecision { typedef T type; };
+
+template<>
+struct LowPrecision<double> { typedef float type; };
+
+
+/**
+ *  @brief C = alpha * op( A ) * op( B ) + beta * C, where all operands
+ *         have the same type. This is a plain xgemm.
+ */ 
+template<typename T>
+void MixedGemm
+(
+  const char *transA, const char *transB,
+  size_t m, size_t n, size_t k,
+  T alpha, T *A, size_t lda,
+           T *B, size_t ldb,
+  T beta,  T *C, size_t ldc
+)
+{
+  xgemm( transA, transB, m, n, k, alpha, A, lda, B, ldb, beta, C, ldc );
+}; /** end MixedGemm() */
+
+
+/** X itself if it is already in TP */
+template<typename TP>
+TP *AsType( TP *X, size_t ldx, size_t m, size_t n, std::vector<TP> &buff, size_t &ld )
+{
+  ld = ldx;
+  return X;
+}; /** end AsType() */
+
+/** copy the m-by-n X into buff in TP (ld = m) */
+template<typename TP, typename TX>
+TP *AsType( TX *X, size_t ldx, size_t m, size_t n, std::vector<TP> &buff, size_t &ld )
+{
+  if ( buff.size() < m * n ) buff.resize( m * n );
+  ld = std::max( m, (size_t)1 );
+  for ( size_t j = 0; j < n; j ++ )
+    for ( size_t i = 0; i < m; i ++ )
+      buff[ j * m + i ] = X[ j * ldx + i ];
+  return buff.data();
+}; /** end AsType() */
+
+
+/**
+ *  @brief C = alpha * op( A ) * op( B ) + beta * C with operands in 
+ *         different precisions. A is the stored matrix (proj or the
+ *         cached Kab), so the product runs in TA and A is read once 
+ *         as is: op( B ) is converted to TA and the m-by-n product 
+ *         goes into per-thread workspace, which is then accumulated 
+ *         into C in TC (e.g. a float lNearKab times the weights is an
+ *         sgemm added to the double potentials).
+ */ 
+template<typename TA, typename TB, typename TC>
+void MixedGemm
+(
+  const char *transA, const char *transB,
+  size_t m, size_t n, size_t k,
+  TA alpha, TA *A, size_t lda,
+            TB *B, size_t ldb,
+  TC beta,  TC *C, size_t ldc
+)
+{
+  static thread_local std::vector<TA> Bbuff, Pbuff;
+
+  if ( !m || !n ) return;
+
+  /** op( B ) is k-by-n */
+  size_t mb = ( *transB == 'N' ) ? k : n, nb = ( *transB == 'N' ) ? n : k;
+  size_t ldbw;
+  TA *Bw = AsType( B, ldb, mb, nb, Bbuff, ldbw );
+
+  if ( Pbuff.size() < m * n ) Pbuff.resize( m * n );
+  xgemm( transA, transB, m, n, k, 
+      alpha, A, lda, Bw, ldbw, (TA)0.0, Pbuff.data(), m );
+
+  for ( size_t j = 0; j < n; j ++ )
+  {
+    TC *Cj = C + j * ldc;
+    TA *Pj = Pbuff.data() + j * m;
+    if ( beta == (TC)0.0 ) for ( size_t i = 0; i < m; i ++ ) Cj[ i ] = Pj[ i ];
+    else for ( size_t i = 0; i < m; i ++ ) Cj[ i ] = beta * Cj[ i ] + Pj[ i ];
+  }
+}; /** end MixedGemm() */
+
+
+/**
+ *  @brief Pack [ B_0; B_1; ... ] into the k-by-n panel P (ld = k). B_i 
+ *         is karray[ i ]-by-n with ld = karray[ i ] and lands at row 
+ *         offsets[ i ] of P, the column offset of its block in the 
+ *         cached NearKab or FarKab (see FreezeInteractionLists).
+ */ 
+template<typename TB, typename TP>
+void PackPanel
+(
+  size_t k, size_t n,
+  std::vector<TB*> &Barray, std::vector<size_t> &karray,
+  const std::vector<size_t> &offsets,
+  TP *P
+)
+{
+  assert( Barray.size() == karray.size() );
+  assert( Barray.size() == offsets.size() );
+
+  for ( size_t j = 0; j < n; j ++ )
+  {
+    for ( size_t i = 0; i < Barray.size(); i ++ )
+    {
+      TB *Bj = Barray[ i ] + j * karray[ i ];
+      TP *Pj = P + j * k + offsets[ i ];
+      for ( size_t p = 0; p < karray[ i ]; p ++ ) Pj[ p ] = Bj[ p ];
+    }
+  }
+}; /** end PackPanel() */
+
+
+/**
+ *  @brief Grouped gemm C += sum_i A_i * B_i for products sharing C.
+ *         A_i are consecutive column blocks of A (as in the cached 
+ *         NearKab and FarKab) starting at offsets[ i ], and B_i is 
+ *         k_i-by-n with ld = k_i. All B_i are packed into one panel,
+ *         so the whole group is issued as a single gemm with 
+ *         k = sum k_i instead of many tiny ones. The panel is packed
+ *         in TA, the type the product runs in (see MixedGemm), and
+ *         lives in per-thread workspace that is reused across calls.
+ */ 
+template<typename TA, typename TB, typename TC>
+void GroupedGemm
+(
+  size_t m, size_t n,
+  TA *A, size_t lda,
+  std::vector<TB*> &Barray, std::vector<size_t> &karray,
+  const std::vector<size_t> &offsets,
+  TC *C, size_t ldc
+)
+{
+  static thread_local std::vector<TA> packB;
+
+  size_t k = 0;
+  for ( size_t i = 0; i < karray.size(); i ++ ) k += karray[ i ];
+  if ( !m || !n || !k ) return;
+
+  /** pack [ B_0; B_1; ... ] into a k-by-n panel in TW */
+  if ( packB.size() < k * n ) packB.resize( k * n );
+  PackPanel( k, n, Barray, karray, offsets, packB.data() );
+
+  MixedGemm
+  (
+    "N", "N",
+    m, n, k,
+    (TA)1.0,     A,          lda,
+             packB.data(),     k,
+    (TC)1.0,     C,          ldc
+  );
+}; /** end GroupedGemm() */
+
+
+/**
+ *  @brief Usage record of one NearKab or FarKab block in the budgeted
+ *         Kab cache (see RebalanceKabCache).
+ */ 
+class KabCacheEntry
+{
+  public:
+
+    /** seconds to evaluate the block (measured when not cached) */
+    double cost = 0.0;
+
+    /** allocated and filled by the next evaluation */
+    bool admit = false;
+
+}; /** end class KabCacheEntry */
+
+
+/**
+ *  @brief Copy the m-by-n block B into rows [ rbeg, rbeg + m ) of A,
+ *         converting to the precision of A.
+ */ 
+template<typename TA, typename TB>
+void CopyRows( hmlp::Data<TA> &A, size_t rbeg, hmlp::Data<TB> &B )
+{
+  assert( rbeg + B.row() <= A.row() && B.col() == A.col() );
+  for ( size_t j = 0; j < B.col(); j ++ )
+    for ( size_t i = 0; i < B.row(); i ++ )
+      A( rbeg + i, j ) = B( i, j );
+}; /** end CopyRows() */
+
+
 /**
  *  @brief This class contains all GOFMM related data.
  *         For Inv-GOFMM, all factors are inherit from hfamily::Factor<T>.
@@ -234,11 +512,11 @@ class Data : public hmlp::hfamily::Factor<T>
     /** s-by-2s */
     hmlp::Data<T> proj;
 
-    /** sampling neighbors ids */
-    std::map<std::size_t, T> snids; 
+    /** sampling neighbors ids and distances (sorted by id) */
+    std::vector<std::pair<std::size_t, T>> snids; 
 
-    /* pruning neighbors ids */
-    std::unordered_set<std::size_t> pnids; 
+    /* pruning neighbors ids (sorted) */
+    std::vector<std::size_t> pnids; 
 
     /** skeleton weights and potentials */
     hmlp::Data<T> w_skel;
@@ -246,13 +524,79 @@ class Data : public hmlp::hfamily::Factor<T>
 
     /** permuted weights and potentials (buffer) */
     hmlp::Data<T> w_leaf;
+#ifdef HMLP_USE_CUDA
+    /** per-thread copies written by gpu::LeavesToLeavesVer2Task */
     hmlp::Data<T> u_leaf[ 20 ];
+#else
+    /** L2L and S2N accumulate directly into u_leaf[ 0 ] */
+    hmlp::Data<T> u_leaf[ 1 ];
+#endif
+
+    /** dependencies on the four row panels of u_leaf[ 0 ] written by L2L */
+    hmlp::MatrixReadWrite u_leaf_panels;
 
     /** cached Kab */
     hmlp::Data<std::size_t> Nearbmap;
     hmlp::Data<T> NearKab;
     hmlp::Data<T> FarKab;
 
+    /** packed [ w_leaf ] of Near( node ), shared by the L2L subtasks */
+    hmlp::Data<T> NearWb;
+
+    /** column offsets of each Near/Far list entry in NearKab and FarKab */
+    std::vector<std::size_t> NearOffset;
+    std::vector<std::size_t> FarOffset;
+
+    /** usage of NearKab and FarKab when the cache has a byte budget */
+    KabCacheEntry NearCache;
+    KabCacheEntry FarCache;
+
+    /** 
+     *  (mixed precision) low-precision proj, w_skel, u_skel and cached Kab.
+     *  Dependencies are still tracked on w_skel and u_skel.
+     */
+    typedef typename LowPrecision<T>::type TL;
+    hmlp::Data<TL> lproj;
+    hmlp::Data<TL> lw_skel;
+    hmlp::Data<TL> lu_skel;
+    hmlp::Data<TL> lNearKab;
+    hmlp::Data<TL> lFarKab;
+    hmlp::Data<TL> lNearWb;
+
+    /**
+     *  Per-panel copies of the evaluation buffers for EvaluatePanels(),
+     *  such that several rhs panels can be in the same task graph. Panel 0
+     *  uses the members above; panel p > 0 uses panels[ p - 1 ].
+     */
+    class PanelBuffers
+    {
+      public:
+        hmlp::Data<T> w_skel;
+        hmlp::Data<T> u_skel;
+        hmlp::Data<T> w_leaf;
+        hmlp::Data<T> u_leaf;
+        hmlp::MatrixReadWrite u_leaf_panels;
+        hmlp::Data<T> NearWb;
+        hmlp::Data<TL> lw_skel;
+        hmlp::Data<TL> lu_skel;
+        hmlp::Data<TL> lNearWb;
+    };
+
+    std::vector<PanelBuffers> panels;
+
+    hmlp::Data<T> &WSkel( size_t p ) { return p ? panels[ p - 1 ].w_skel : w_skel; };
+    hmlp::Data<T> &USkel( size_t p ) { return p ? panels[ p - 1 ].u_skel : u_skel; };
+    hmlp::Data<T> &WLeaf( size_t p ) { return p ? panels[ p - 1 ].w_leaf : w_leaf; };
+    hmlp::Data<T> &ULeaf( size_t p ) { return p ? panels[ p - 1 ].u_leaf : u_leaf[ 0 ]; };
+    hmlp::Data<T> &NearWeights( size_t p ) { return p ? panels[ p - 1 ].NearWb : NearWb; };
+    hmlp::Data<TL> &LWSkel( size_t p ) { return p ? panels[ p - 1 ].lw_skel : lw_skel; };
+    hmlp::Data<TL> &LUSkel( size_t p ) { return p ? panels[ p - 1 ].lu_skel : lu_skel; };
+    hmlp::Data<TL> &LNearWeights( size_t p ) { return p ? panels[ p - 1 ].lNearWb : lNearWb; };
+    hmlp::MatrixReadWrite &ULeafPanels( size_t p )
+    {
+      return p ? panels[ p - 1 ].u_leaf_panels : u_leaf_panels;
+    };
+
     /** Kij evaluation counter counters */
     std::pair<double, std::size_t> kij_skel;
     std::pair<double, std::size_t> kij_s2s;
@@ -275,6 +619,48 @@ class Data : public hmlp::hfamily::Factor<T>
     double knn_acc = 0.0;
     size_t num_acc = 0;
 
+    /** 
+     *  @brief Clear the state of a previous partition in place (keeping
+     *         the capacity), such that tree nodes can be reused.
+     */ 
+    void Reset()
+    {
+      isskel = false;
+      hasproj = false;
+      skels.clear();
+      jpvt.clear();
+      proj.resize( 0, 0 );
+      snids.clear();
+      pnids.clear();
+      w_skel.resize( 0, 0 );
+      u_skel.resize( 0, 0 );
+      w_leaf.resize( 0, 0 );
+      for ( auto &u : u_leaf ) u.resize( 0, 0 );
+      u_leaf_panels.DependencyCleanUp();
+      Nearbmap.resize( 0, 0 );
+      NearKab.resize( 0, 0 );
+      FarKab.resize( 0, 0 );
+      NearWb.resize( 0, 0 );
+      NearOffset.clear();
+      FarOffset.clear();
+      NearCache = KabCacheEntry();
+      FarCache = KabCacheEntry();
+      lproj.resize( 0, 0 );
+      lw_skel.resize( 0, 0 );
+      lu_skel.resize( 0, 0 );
+      lNearKab.resize( 0, 0 );
+      lFarKab.resize( 0, 0 );
+      lNearWb.resize( 0, 0 );
+      panels.clear();
+      kij_skel = std::make_pair( 0.0, 0 );
+      kij_s2s = std::make_pair( 0.0, 0 );
+      kij_s2n = std::make_pair( 0.0, 0 );
+      merge_neighbors_time = 0.0;
+      id_time = 0.0;
+      knn_acc = 0.0;
+      num_acc = 0;
+    }; /** end Reset() */
+
 }; /** end class Data */
 
 
@@ -730,6 +1116,137 @@ struct randomsplit
 }; // end struct randomsplit
 
 
+/**
+ *  @brief Low-dimensional leaf kNN with the dimension K fixed at
+ *         compile time. Square distances are accumulated directly
+ *         (no GEMM, no -2ab cancellation) into one column at a time.
+ */
+template<size_t K, typename T>
+void LeafGSKNN
+(
+  int m, int n, int r,
+  T *A,
+  T *B,
+  T *D, int *I
+)
+{
+  std::vector<T> At( K * m );
+  std::vector<int> amap( m );
+  for ( int i = 0; i < m; i ++ ) amap[ i ] = i;
+
+  /** references are transposed to m-by-K such that i is unit stride */
+  for ( int i = 0; i < m; i ++ )
+    for ( size_t p = 0; p < K; p ++ )
+      At[ p * m + i ] = A[ (size_t)i * K + p ];
+
+  #pragma omp parallel
+  {
+    std::vector<T> C( m );
+
+    #pragma omp for
+    for ( int j = 0; j < n; j ++ )
+    {
+      T b[ K ];
+      for ( size_t p = 0; p < K; p ++ ) b[ p ] = B[ (size_t)j * K + p ];
+      for ( int i = 0; i < m; i ++ )
+      {
+        T dij = 0.0;
+        for ( size_t p = 0; p < K; p ++ )
+        {
+          T tmp = At[ p * m + i ] - b[ p ];
+          dij += tmp * tmp;
+        }
+        C[ i ] = dij;
+      }
+      hmlp::heap_select<T>( m, r, C.data(), amap.data(),
+          &D[ (size_t)j * r ], &I[ (size_t)j * r ] );
+    }
+  }
+}; /** end LeafGSKNN() */
+
+
+/**
+ *  @brief Exact geometric kNN of n queries B against m references A
+ *         (the dgsknn convention). Both are packed k-by-m and k-by-n
+ *         with square 2-norms A2 and B2. D and I are r-by-n max heaps
+ *         that must be initialized (max, -1) by the caller; I returns
+ *         the local index of the reference in A.
+ *
+ *         This is the reference version (GEMM + heap select) for
+ *         architectures without a GSKNN package or T != double.
+ *         For k <= 8 the GEMM does not pay off; distances are 
+ *         then computed directly with a compile-time k.
+ */
+template<typename T>
+void LeafGSKNN
+(
+  int m, int n, int k, int r,
+  T *A, T *A2,
+  T *B, T *B2,
+  T *D, int *I
+)
+{
+  switch ( k )
+  {
+    case 1: return LeafGSKNN<1>( m, n, r, A, B, D, I );
+    case 2: return LeafGSKNN<2>( m, n, r, A, B, D, I );
+    case 3: return LeafGSKNN<3>( m, n, r, A, B, D, I );
+    case 4: return LeafGSKNN<4>( m, n, r, A, B, D, I );
+    case 5: return LeafGSKNN<5>( m, n, r, A, B, D, I );
+    case 6: return LeafGSKNN<6>( m, n, r, A, B, D, I );
+    case 7: return LeafGSKNN<7>( m, n, r, A, B, D, I );
+    case 8: return LeafGSKNN<8>( m, n, r, A, B, D, I );
+    default: break;
+  }
+
+  std::vector<T> C( (size_t)m * n );
+  std::vector<int> amap( m );
+  for ( int i = 0; i < m; i ++ ) amap[ i ] = i;
+
+  /** C = -2 * A' * B + A2 + B2, one column per query */
+  xgemm( "T", "N", m, n, k,
+      -2.0, A, k,
+            B, k,
+       0.0, C.data(), m );
+
+  #pragma omp parallel for
+  for ( int j = 0; j < n; j ++ )
+  {
+    T *Cj = &C[ (size_t)j * m ];
+    for ( int i = 0; i < m; i ++ ) Cj[ i ] += A2[ i ] + B2[ j ];
+    hmlp::heap_select<T>( m, r, Cj, amap.data(),
+        &D[ (size_t)j * r ], &I[ (size_t)j * r ] );
+  }
+}; /** end LeafGSKNN() */
+
+
+#ifdef HMLP_USE_GSKNN
+/**
+ *  @brief Double precision goes through the fused dgsknn kernel,
+ *         which never forms the m-by-n distance matrix. Its micro-kernel
+ *         (rnn_r_int_d8x4_row) keeps one heap per point of the first 
+ *         operand and selects over the second, so the queries B go
+ *         first to get the r-by-n heaps of the convention above.
+ */
+inline void LeafGSKNN
+(
+  int m, int n, int k, int r,
+  double *A, double *A2,
+  double *B, double *B2,
+  double *D, int *I
+)
+{
+  /** low dimensions take the direct-distance path */
+  if ( k <= 8 ) return LeafGSKNN<double>( m, n, k, r, A, A2, B, B2, D, I );
+
+  std::vector<int> amap( m ), bmap( n );
+  for ( int i = 0; i < m; i ++ ) amap[ i ] = i;
+  for ( int j = 0; j < n; j ++ ) bmap[ j ] = j;
+  dgsknn( n, m, k, r, B, B2, bmap.data(), A, A2, amap.data(), D, I );
+}; /** end LeafGSKNN() */
+#endif
+
+
 /**
  *  @brief This is the task wrapper of the exact KNN search we
  *         perform in the leaf node of the randomized tree.
@@ -787,67 +1304,133 @@ class KNNTask : public hmlp::Task
       auto &X = *arg->setup->X;
       auto &NN = *arg->setup->NN;
       auto &gids = arg->gids;
+      auto *NNlocks = arg->setup->NNlocks;
+      size_t n = gids.size();
+      size_t r = NN.row();
 
-      #pragma omp parallel for
-      for ( size_t j = 0; j < gids.size(); j ++ )
-      {
-        std::set<size_t> NNset;
+      /** candidates of this leaf are selected locally without locks */
+      std::vector<std::pair<T, size_t>> candidates( r * n, 
+          std::make_pair( std::numeric_limits<T>::max(), NN.col() ) );
 
-        for ( size_t i = 0; i < NN.row(); i ++ )
+      if ( metric == GEOMETRY_DISTANCE && arg->setup->X )
+      {
+        /** pack the leaf coordinates and their square 2-norms */
+        size_t d = X.row();
+        std::vector<T> Xl( d * n ), X2( n, 0.0 ), D( r * n, std::numeric_limits<T>::max() );
+        std::vector<int> I( r * n, -1 );
+        for ( size_t j = 0; j < n; j ++ )
         {
-          size_t jgid = gids[ j ];
-          NNset.insert( NN[ jgid * NN.row() + i ].second );
+          for ( size_t p = 0; p < d; p ++ )
+          {
+            T xjp = X[ gids[ j ] * d + p ];
+            Xl[ j * d + p ] = xjp;
+            X2[ j ] += xjp * xjp;
+          }
         }
 
-        for ( size_t i = 0; i < gids.size(); i ++ )
+        /** all-to-all exact kNN within the leaf */
+        LeafGSKNN( n, n, d, r, 
+            Xl.data(), X2.data(), Xl.data(), X2.data(), D.data(), I.data() );
+
+        /** unused slots keep I = -1 */
+        for ( size_t j = 0; j < n; j ++ )
+        {
+          for ( size_t i = 0; i < r; i ++ )
+          {
+            int ilid = I[ j * r + i ];
+            if ( ilid < 0 ) continue;
+            candidates[ j * r + i ] = std::make_pair( D[ j * r + i ], gids[ ilid ] );
+          }
+        }
+      }
+      else
+      {
+        /** 
+         *  kernel-induced distances read one leaf block K( gids, gids ),
+         *  which is evaluated by the fused (vectorized) block path 
+         *  instead of n * n entry calls
+         */
+        hmlp::Data<T> Kll;
+        if ( metric != GEOMETRY_DISTANCE ) Kll = K( gids, gids );
+
+        #pragma omp parallel for
+        for ( size_t j = 0; j < n; j ++ )
         {
-          size_t igid = gids[ i ];
           size_t jgid = gids[ j ];
 
-          if ( !NNset.count( igid ) )
+          for ( size_t i = 0; i < n; i ++ )
           {
-            T dist = 0;
-            switch ( metric )
-            {
-              case GEOMETRY_DISTANCE:
-              {
-                size_t d = X.row();
-                for ( size_t p = 0; p < d; p ++ )
-								{
-									T xip = X[ igid * d + p ];
-									T xjp = X[ jgid * d + p ];
-									dist += ( xip - xjp ) * ( xip - xjp );
-								}
-                break;
-              }
-              case KERNEL_DISTANCE:
-              {
-                dist = K( igid, igid ) + K( jgid, jgid ) - 2.0 * K( igid, jgid );
-                break;
-              }
-              case ANGLE_DISTANCE:
-              {
-                T kij = K( igid, jgid );
-                T kii = K( igid, igid );
-                T kjj = K( jgid, jgid );
+            size_t igid = gids[ i ];
 
-                dist = ( 1.0 - ( kij * kij ) / ( kii * kjj ) );
-                break;
-              }
-              default:
+            /** duplicates are removed when merging into NN */
+            {
+              T dist = 0;
+              switch ( metric )
               {
-                printf( "KNNTask() invalid splitting scheme\n" ); fflush( stdout );
-                exit( 1 );
+                case GEOMETRY_DISTANCE:
+                {
+                  size_t d = X.row();
+                  for ( size_t p = 0; p < d; p ++ )
+                  {
+                    T xip = X[ igid * d + p ];
+                    T xjp = X[ jgid * d + p ];
+                    dist += ( xip - xjp ) * ( xip - xjp );
+                  }
+                  break;
+                }
+                case KERNEL_DISTANCE:
+                {
+                  dist = Kll( i, i ) + Kll( j, j ) - 2.0 * Kll( i, j );
+                  break;
+                }
+                case ANGLE_DISTANCE:
+                {
+                  T kij = Kll( i, j );
+                  T kii = Kll( i, i );
+                  T kjj = Kll( j, j );
+
+                  dist = ( 1.0 - ( kij * kij ) / ( kii * kjj ) );
+                  break;
+                }
+                default:
+                {
+                  printf( "KNNTask() invalid splitting scheme\n" ); fflush( stdout );
+                  exit( 1 );
+                }
               }
+              std::pair<T, size_t> query( dist, igid );
+              hmlp::HeapSelect( 1, r, &query, candidates.data() + j * r );
             }
-            std::pair<T, size_t> query( dist, igid );
-            hmlp::HeapSelect( 1, NN.row(), &query, NN.data() + jgid * NN.row() );
           }
-          else
+        }
+      }
+
+      #pragma omp parallel for
+      for ( size_t j = 0; j < n; j ++ )
+      {
+        size_t jgid = gids[ j ];
+
+        /** merge into NN( :, jgid ), which may be shared by other trees */
+        hmlp::Lock *lock = NULL;
+        if ( NNlocks ) lock = &(*NNlocks)[ jgid % NNlocks->size() ];
+        if ( lock ) lock->Acquire();
+        {
+          std::set<size_t> NNset;
+          for ( size_t i = 0; i < r; i ++ )
           {
-            /** ignore duplication */
+            NNset.insert( NN[ jgid * r + i ].second );
+          }
+          for ( size_t i = 0; i < r; i ++ )
+          {
+            auto &query = candidates[ j * r + i ];
+            /** ignore duplication and unused slots */
+            if ( query.second >= NN.col() ) continue;
+            if ( NNset.count( query.second ) ) continue;
+            hmlp::HeapSelect( 1, r, &query, NN.data() + jgid * r );
+            NNset.insert( query.second );
           }
         }
+        if ( lock ) lock->Release();
 
       } /** end omp parallel for */
 
@@ -863,13 +1446,19 @@ class KNNTask : public hmlp::Task
 
         std::set<size_t> NNset;
         hmlp::Data<std::pair<T, size_t>> nn_test( NN.row(), 1 );
+        hmlp::Data<std::pair<T, size_t>> nn_snapshot( NN.row(), 1 );
 
         /** initialize nn_test to be the same as NN */
+        hmlp::Lock *lock = NULL;
+        if ( NNlocks ) lock = &(*NNlocks)[ gids[ j ] % NNlocks->size() ];
+        if ( lock ) lock->Acquire();
         for ( size_t i = 0; i < NN.row(); i ++ )
         {
           nn_test[ i ] = NN( i, gids[ j ] );
+          nn_snapshot[ i ] = nn_test[ i ];
           NNset.insert( nn_test[ i ].second );
         }
+        if ( lock ) lock->Release();
 
         /** loop over all references */
         for ( size_t i = 0; i < K.row(); i ++ )
@@ -924,7 +1513,7 @@ class KNNTask : public hmlp::Task
         for ( size_t i = 0; i < NN.row(); i ++ ) NNset.insert( nn_test[ i ].second );
         for ( size_t i = 0; i < NN.row(); i ++ ) 
         {
-          if ( NNset.count( NN( i, gids[ j ] ).second ) ) correct ++;
+          if ( NNset.count( nn_snapshot[ i ].second ) ) correct ++;
         }
         knn_acc += (double)correct / NN.row();
         num_acc ++;
@@ -1051,7 +1640,20 @@ std::multimap<TB, TA> flip_map( const std::map<TA, TB> &src )
 
 
 /**
- *  @brief Building neighbors for each tree node.
+ *  @brief Sort and remove duplicated ids.
+ */ 
+template<typename T>
+void SortedUnique( std::vector<T> &ids )
+{
+  std::sort( ids.begin(), ids.end() );
+  ids.erase( std::unique( ids.begin(), ids.end() ), ids.end() );
+}; /** end SortedUnique() */
+
+
+/**
+ *  @brief Building neighbors for each tree node. Both snids and
+ *         pnids are flat vectors sorted by id, so children are
+ *         merged and pruned with linear passes.
  */ 
 template<typename NODE, typename T>
 void BuildNeighbors( NODE *node, size_t nsamples )
@@ -1063,49 +1665,60 @@ void BuildNeighbors( NODE *node, size_t nsamples )
   auto &pnids = node->data.pnids;
   int n = node->n;
   int k = NN->row();
+
+  /** "own" points, sorted for linear exclusion */
+  std::vector<size_t> own( gids.begin(), gids.end() );
+  std::sort( own.begin(), own.end() );
+
   if ( node->isleaf )
   {
     // Pruning neighbor lists/sets:
-    pnids = std::unordered_set<size_t>();
+    std::vector<size_t> candidates;
+    candidates.reserve( ( k / 2 ) * n );
     for ( int ii = 0; ii < k / 2; ii ++ )
     {
       for ( int jj = 0; jj < n; jj ++ )
       {
-        pnids.insert( NN->data()[ lids[ jj ] * k + ii ].second );
-        //printf("%lu;",NN->data()[ gids[jj] * k + ii].second); 
+        candidates.push_back( NN->data()[ lids[ jj ] * k + ii ].second );
       }
     }
+    SortedUnique( candidates );
     /** remove "own" points */
-    for ( int i = 0; i < n; i ++ )
-    {
-      pnids.erase( gids[ i ] );
-    }
+    pnids.clear();
+    std::set_difference( candidates.begin(), candidates.end(), 
+        own.begin(), own.end(), std::back_inserter( pnids ) );
     //printf("Size of pruning neighbor set: %lu \n", pnids.size());
     // Sampling neighbors
     // To think about: Make building sampling neighbor adaptive.  
     // E.g. request 0-100 closest neighbors, 
     // if additional 100 neighbors are requested, return sneighbors 100-200 
-    snids = std::map<size_t, T>(); 
-    std::vector<std::pair<T, size_t>> tmp ( k / 2 * n ); 
-    std::set<size_t> nodeIdx( gids.begin() , gids.end() );    
-    // Allocate array for sorting 
+    std::vector<std::pair<size_t, T>> tmp;
+    tmp.reserve( k / 2 * n );
     for ( int ii = (k+1) / 2; ii < k; ii ++ )
     {
       for ( int jj = 0; jj < n; jj ++ )
       {
-        tmp [ (ii-(k+1)/2) * n + jj ] = NN->data()[ lids[ jj ] * k + ii ];
+        auto &query = NN->data()[ lids[ jj ] * k + ii ];
+        if ( std::binary_search( pnids.begin(), pnids.end(), query.second ) ) continue;
+        if ( std::binary_search( own.begin(), own.end(), query.second ) ) continue;
+        tmp.push_back( std::make_pair( query.second, query.first ) );
       }
     }
-    std::sort( tmp.begin() , tmp.end() );
-    int i = 0;
-    while ( snids.size() < nsamples && i <  (k-1) * n / 2 )
+    /** keep the closest distance of each id */
+    std::sort( tmp.begin(), tmp.end() );
+    tmp.erase( std::unique( tmp.begin(), tmp.end(), 
+          []( const std::pair<size_t, T> &a, const std::pair<size_t, T> &b )
+          { return a.first == b.first; } ), tmp.end() );
+    /** keep the nsamples closest ids */
+    if ( tmp.size() > nsamples )
     {
-      if ( !pnids.count( tmp[i].second ) && !nodeIdx.count( tmp[i].second ) )
-      {
-        snids.insert( std::pair<size_t,T>( tmp[i].second , tmp[i].first ) );
-      }
-      i++;
-    } 
+      std::nth_element( tmp.begin(), tmp.begin() + nsamples, tmp.end(), 
+          []( const std::pair<size_t, T> &a, const std::pair<size_t, T> &b )
+          { return std::make_pair( a.second, a.first ) < std::make_pair( b.second, b.first ); } );
+      tmp.resize( nsamples );
+      std::sort( tmp.begin(), tmp.end() );
+    }
+    snids.swap( tmp );
     //printf("Size of sampling neighbor list: %lu \n", snids.size());
   }
   else
@@ -1116,39 +1729,47 @@ void BuildNeighbors( NODE *node, size_t nsamples )
     auto &lpnids = node->lchild->data.pnids;
     auto &rpnids = node->rchild->data.pnids;
 
-    // Merge children's sampling neighbors...    
-    // Start with left sampling neighbor list 
-    snids = lsnids;
-    // Add right sampling neighbor list. If duplicate update distace if nec.
-    //std::pair<std::map<size_t, T>::iterator, bool> ret;
-    for ( auto cur = rsnids.begin(); cur != rsnids.end(); cur ++ )
+    // Merge children's sampling neighbors. If duplicate keep the 
+    // closer distance.
+    snids.clear();
+    snids.reserve( lsnids.size() + rsnids.size() );
+    auto lit = lsnids.begin(), rit = rsnids.begin();
+    while ( lit != lsnids.end() || rit != rsnids.end() )
     {
-      auto ret = snids.insert( *cur );
-      if ( ret.second == false )
+      if ( rit == rsnids.end() || ( lit != lsnids.end() && lit->first < rit->first ) ) 
       {
-        // Update distance?
-        if ( ret.first->second > (*cur).first)
-        {
-          ret.first->second = (*cur).first;
-        }
+        snids.push_back( *lit ++ );
+      }
+      else if ( lit == lsnids.end() || rit->first < lit->first ) 
+      {
+        snids.push_back( *rit ++ );
+      }
+      else
+      {
+        snids.push_back( *lit );
+        if ( rit->second < lit->second ) snids.back().second = rit->second;
+        lit ++; rit ++;
       }
     }
 
-    // Remove "own" points
-    for (int i = 0; i < n; i ++ )
-    {
-      snids.erase( gids[ i ] );
-    }
-
-    // Remove pruning neighbors from left and right
-    for (auto cur = lpnids.begin(); cur != lpnids.end(); cur++ )
-    {
-      snids.erase( *cur );
-    }
-    for (auto cur = rpnids.begin(); cur != rpnids.end(); cur++ )
+    // Remove "own" points and pruning neighbors from left and right
+    std::vector<size_t> excluded( lpnids.size() + rpnids.size() );
+    std::merge( lpnids.begin(), lpnids.end(), rpnids.begin(), rpnids.end(), 
+        excluded.begin() );
+    std::vector<size_t> tmp( excluded.size() + own.size() );
+    std::merge( excluded.begin(), excluded.end(), own.begin(), own.end(), 
+        tmp.begin() );
+    excluded.swap( tmp );
+
+    size_t nkeep = 0;
+    auto eit = excluded.begin();
+    for ( size_t i = 0; i < snids.size(); i ++ )
     {
-      snids.erase( *cur );
+      while ( eit != excluded.end() && *eit < snids[ i ].first ) eit ++;
+      if ( eit != excluded.end() && *eit == snids[ i ].first ) continue;
+      snids[ nkeep ++ ] = snids[ i ];
     }
+    snids.resize( nkeep );
 
     //printf("Interior sampling neighbor size: %lu\n", snids.size());
   }
@@ -1283,6 +1904,37 @@ class InterpolateTask : public hmlp::Task
 
 
 
+/**
+ *  @brief Ask K to start reading K( amap, bmap ) ahead of time. Only
+ *         matrices with a Prefetch() method (e.g. hmlp::OOC) do
+ *         anything; the overload below is picked for all others.
+ */ 
+template<typename SPDMATRIX>
+auto PrefetchKab( SPDMATRIX &K, std::vector<size_t> &amap, std::vector<size_t> &bmap, int )
+  -> decltype( K.Prefetch( amap, bmap ), void() )
+{
+  K.Prefetch( amap, bmap );
+}; /** end PrefetchKab() */
+
+template<typename SPDMATRIX>
+void PrefetchKab( SPDMATRIX &K, std::vector<size_t> &amap, std::vector<size_t> &bmap, long ) {};
+
+/** whether PrefetchKab() does anything for SPDMATRIX */
+template<typename SPDMATRIX>
+struct PrefetchSupport
+{
+  template<typename M>
+  static auto test( int ) -> decltype( std::declval<M&>().Prefetch( 
+        std::declval<std::vector<size_t>&>(), std::declval<std::vector<size_t>&>() ),
+        std::true_type() );
+
+  template<typename M>
+  static std::false_type test( long );
+
+  static const bool value = decltype( test<SPDMATRIX>( 0 ) )::value;
+}; /** end struct PrefetchSupport */
+
+
 /**
  *  @brief Skeletonization with interpolative decomposition.
  */ 
@@ -1363,7 +2015,11 @@ void Skeletonize( NODE *node )
 
   auto &snids = data.snids;
   // Order snids by distance
-  std::multimap<T, size_t > ordered_snids = flip_map( snids );
+  std::vector<std::pair<T, size_t>> ordered_snids;
+  ordered_snids.reserve( snids.size() );
+  for ( auto &it : snids ) 
+    ordered_snids.push_back( std::make_pair( it.second, it.first ) );
+  std::sort( ordered_snids.begin(), ordered_snids.end() );
   if ( nsamples < K.col() - node->n )
   {
     amap.reserve( nsamples );
@@ -1374,6 +2030,16 @@ void Skeletonize( NODE *node )
     // Uniform samples.
     if ( amap.size() < nsamples )
     {
+      /** O(1) membership tests for amap and "own" points (by morton) */
+      std::unordered_set<size_t> amapset( amap.begin(), amap.end() );
+      auto &morton = node->setup->morton;
+      std::vector<size_t> own;
+      if ( !morton.size() )
+      {
+        own = lids;
+        std::sort( own.begin(), own.end() );
+      }
+
       while ( amap.size() < nsamples )
       {
         size_t sample;
@@ -1388,8 +2054,11 @@ void Skeletonize( NODE *node )
           sample = rand() % K.col();
         }
 
-        if ( std::find( amap.begin(), amap.end(), sample ) == amap.end() &&
-            std::find( lids.begin(), lids.end(), sample ) == lids.end() )
+        bool isown = morton.size() ? 
+          hmlp::tree::IsMyParent( morton[ sample ], node->morton ) :
+          std::binary_search( own.begin(), own.end(), sample );
+
+        if ( !isown && amapset.insert( sample ).second )
         {
           amap.push_back( sample );
         }
@@ -1398,12 +2067,10 @@ void Skeletonize( NODE *node )
   }
   else // Use all off-diagonal blocks without samples.
   {
+    amap.reserve( K.col() );
     for ( int sample = 0; sample < K.col(); sample ++ )
     {
-      if ( std::find( amap.begin(), amap.end(), sample ) == amap.end() )
-      {
-        amap.push_back( sample );
-      }
+      amap.push_back( sample );
     }
   }
 
@@ -1468,9 +2135,10 @@ void Skeletonize( NODE *node )
   {
     for ( int jj = 0; jj < NN.row() / 2; jj ++ )
     {
-      data.pnids.insert( NN.data()[ skels[ ii ] * NN.row() + jj ].second );
+      data.pnids.push_back( NN.data()[ skels[ ii ] * NN.row() + jj ].second );
     }
   }
+  SortedUnique( data.pnids );
 }; /** end void Skeletonize() */
 
 
@@ -1546,7 +2214,34 @@ class SkeletonizeTask : public hmlp::Task
       }
     };
 
-    void Execute( Worker* user_worker )
+    /** 
+     *  The children are done, so the columns bmap are known. The rows
+     *  are sampled in Skeletonize(); guess them from the neighbors.
+     */
+    void Prefetch( Worker* user_worker )
+    {
+      auto &K = *arg->setup->K;
+      auto &NN = *arg->setup->NN;
+      typedef typename std::decay<decltype( K )>::type SPDMATRIX;
+      if ( !PrefetchSupport<SPDMATRIX>::value ) return;
+      std::vector<size_t> amap, bmap;
+      if ( arg->isleaf ) bmap = arg->lids;
+      else
+      {
+        auto &lskels = arg->lchild->data.skels;
+        auto &rskels = arg->rchild->data.skels;
+        bmap = lskels;
+        bmap.insert( bmap.end(), rskels.begin(), rskels.end() );
+      }
+      for ( auto b : bmap )
+        for ( size_t jj = 0; jj < NN.row() / 2; jj ++ )
+          if ( NN[ b * NN.row() + jj ].second < K.col() )
+            amap.push_back( NN[ b * NN.row() + jj ].second );
+      SortedUnique( amap );
+      PrefetchKab( K, amap, bmap, 0 );
+    };
+
+    void Execute( Worker* user_worker )
     {
       //printf( "%lu Skel beg\n", arg->treelist_id );
       Skeletonize<ADAPTIVE, LEVELRESTRICTION, NODE, T>( arg );
@@ -1564,7 +2259,7 @@ class SkeletonizeTask : public hmlp::Task
  *  @brief 
  */
 template<typename NODE>
-void UpdateWeights( NODE *node )
+void UpdateWeights( NODE *node, size_t panel = 0 )
 {
 #ifdef DEBUG_SPDASKIT
   printf( "%lu UpdateWeight\n", node->treelist_id ); fflush( stdout );
@@ -1577,17 +2272,61 @@ void UpdateWeights( NODE *node )
   //if ( node->l < 4 ) omp_set_num_threads( 4 );
 
   /** gather shared data and create reference */
-  auto &w = *node->setup->w;
+  auto &w = node->setup->Weights( panel );
 
   /** gather per node data and create reference */
   auto &data = node->data;
   auto &proj = data.proj;
   auto &skels = data.skels;
-  auto &w_skel = data.w_skel;
-  auto &w_leaf = data.w_leaf;
+  auto &w_skel = data.WSkel( panel );
+  auto &w_leaf = data.WLeaf( panel );
   auto *lchild = node->lchild;
   auto *rchild = node->rchild;
 
+  /** mixed precision: lw_skel = lproj * w_leaf is computed in float */
+  if ( node->setup->mixed )
+  {
+    using TL = typename decltype( node->data )::TL;
+    auto &lproj = data.lproj;
+    auto &lw_skel = data.LWSkel( panel );
+    lw_skel.resize( skels.size(), w.row() );
+    if ( node->isleaf )
+    {
+      MixedGemm
+      (
+        "N", "N",
+        lw_skel.row(), lw_skel.col(), w_leaf.row(),
+        (TL)1.0, lproj.data(),   lproj.row(),
+                 w_leaf.data(),  w_leaf.row(),
+        (TL)0.0, lw_skel.data(), lw_skel.row()
+      );
+    }
+    else
+    {
+      auto &lw_lskel = lchild->data.LWSkel( panel );
+      auto &lw_rskel = rchild->data.LWSkel( panel );
+      auto &lskel = lchild->data.skels;
+      auto &rskel = rchild->data.skels;
+      MixedGemm
+      (
+        "N", "N",
+        lw_skel.row(), lw_skel.col(), lskel.size(),
+        (TL)1.0,    lproj.data(),    lproj.row(),
+                 lw_lskel.data(), lw_lskel.row(),
+        (TL)0.0,  lw_skel.data(),  lw_skel.row()
+      );
+      MixedGemm
+      (
+        "N", "N",
+        lw_skel.row(), lw_skel.col(), rskel.size(),
+        (TL)1.0,    lproj.data() + lproj.row() * lskel.size(), lproj.row(),
+                 lw_rskel.data(), lw_rskel.row(),
+        (TL)1.0,  lw_skel.data(),  lw_skel.row()
+      );
+    }
+    return;
+  }
+
   /** w_skel is s-by-nrhs, initial values are not important */
   w_skel.resize( skels.size(), w.row() );
 
@@ -1623,8 +2362,8 @@ void UpdateWeights( NODE *node )
   else
   {
     //double beg = omp_get_wtime();
-    auto &w_lskel = lchild->data.w_skel;
-    auto &w_rskel = rchild->data.w_skel;
+    auto &w_lskel = lchild->data.WSkel( panel );
+    auto &w_rskel = rchild->data.WSkel( panel );
     auto &lskel = lchild->data.skels;
     auto &rskel = rchild->data.skels;
     xgemm
@@ -1665,9 +2404,13 @@ class UpdateWeightsTask : public hmlp::Task
 
     NODE *arg;
 
+    /** rhs panel (buffer slot) of this task */
+    size_t panel = 0;
+
     void Set( NODE *user_arg )
     {
       arg = user_arg;
+      panel = arg->setup->panel;
       name = std::string( "n2s" );
       {
         //label = std::to_string( arg->treelist_id );
@@ -1680,7 +2423,7 @@ class UpdateWeightsTask : public hmlp::Task
       double flops, mops;
       auto &lids = arg->lids;
       auto &skels = arg->data.skels;
-      auto &w = *arg->setup->w;
+      auto &w = arg->setup->Weights( panel );
       if ( arg->isleaf )
       {
         auto m = skels.size();
@@ -1714,18 +2457,18 @@ class UpdateWeightsTask : public hmlp::Task
     {
       auto &proj = arg->data.proj;
       __builtin_prefetch( proj.data() );
-      auto &w_skel = arg->data.w_skel;
+      auto &w_skel = arg->data.WSkel( panel );
       __builtin_prefetch( w_skel.data() );
       if ( arg->isleaf )
       {
-        auto &w_leaf = arg->data.w_leaf;
+        auto &w_leaf = arg->data.WLeaf( panel );
         __builtin_prefetch( w_leaf.data() );
       }
       else
       {
-        auto &w_lskel = arg->lchild->data.w_skel;
+        auto &w_lskel = arg->lchild->data.WSkel( panel );
         __builtin_prefetch( w_lskel.data() );
-        auto &w_rskel = arg->rchild->data.w_skel;
+        auto &w_rskel = arg->rchild->data.WSkel( panel );
         __builtin_prefetch( w_rskel.data() );
       }
 #ifdef HMLP_USE_CUDA
@@ -1737,16 +2480,16 @@ class UpdateWeightsTask : public hmlp::Task
         proj.PrefetchH2D( device, 1 );
         if ( arg->isleaf )
         {
-          auto &w_leaf = arg->data.w_leaf;
+          auto &w_leaf = arg->data.WLeaf( panel );
           w_leaf.CacheD( device );
           w_leaf.PrefetchH2D( device, 1 );
         }
         else
         {
-          auto &w_lskel = arg->lchild->data.w_skel;
+          auto &w_lskel = arg->lchild->data.WSkel( panel );
           w_lskel.CacheD( device );
           w_lskel.PrefetchH2D( device, 1 );
-          auto &w_rskel = arg->rchild->data.w_skel;
+          auto &w_rskel = arg->rchild->data.WSkel( panel );
           w_rskel.CacheD( device );
           w_rskel.PrefetchH2D( device, 1 );
         }
@@ -1767,13 +2510,13 @@ class UpdateWeightsTask : public hmlp::Task
         return;
       }
 
-      auto &w_skel = arg->data.w_skel;
+      auto &w_skel = arg->data.WSkel( panel );
       w_skel.DependencyAnalysis( hmlp::ReadWriteType::W, this );
 
       if ( !arg->isleaf )
       {
-        auto &w_lskel = arg->lchild->data.w_skel;
-        auto &w_rskel = arg->rchild->data.w_skel;
+        auto &w_lskel = arg->lchild->data.WSkel( panel );
+        auto &w_rskel = arg->rchild->data.WSkel( panel );
         w_lskel.DependencyAnalysis( hmlp::ReadWriteType::R, this );
         w_rskel.DependencyAnalysis( hmlp::ReadWriteType::R, this );
       }
@@ -1788,10 +2531,12 @@ class UpdateWeightsTask : public hmlp::Task
 #ifdef HMLP_USE_CUDA 
       hmlp::Device *device = NULL;
       if ( user_worker ) device = user_worker->GetDevice();
-      if ( device ) gpu::UpdateWeights( device, arg );
-      else               UpdateWeights( arg );
+      if ( device && !arg->setup->mixed && !panel ) 
+        gpu::UpdateWeights( device, arg );
+      else                                
+        UpdateWeights( arg, panel );
 #else
-      UpdateWeights( arg );
+      UpdateWeights( arg, panel );
 #endif
     };
 
@@ -1806,7 +2551,7 @@ class UpdateWeightsTask : public hmlp::Task
  *
  */ 
 template<bool NNPRUNE, typename NODE>
-void SkeletonsToSkeletons( NODE *node )
+void SkeletonsToSkeletons( NODE *node, size_t panel = 0 )
 {
 #ifdef DEBUG_SPDASKIT
   printf( "%lu Skel2Skel \n", node->treelist_id ); fflush( stdout );
@@ -1816,66 +2561,141 @@ void SkeletonsToSkeletons( NODE *node )
 
   double beg, kij_s2s_time = 0.0, u_skel_time, s2s_time;
 
-  std::set<NODE*> *FarNodes;
-  if ( NNPRUNE ) FarNodes = &node->NNFarNodes;
-  else           FarNodes = &node->FarNodes;
+  auto &FarNodes = NNPRUNE ? node->NNFarList : node->FarList;
 
   auto &K = *node->setup->K;
   auto &data = node->data;
   auto &amap = node->data.skels;
-  auto &u_skel = node->data.u_skel;
+  auto &u_skel = node->data.USkel( panel );
   auto &FarKab = node->data.FarKab;
 
-  /** initilize u_skel to be zeros( s, nrhs ). */
-  beg = omp_get_wtime();
-  u_skel.resize( 0, 0 );
-  u_skel.resize( amap.size(), node->setup->w->row(), 0.0 );
-  u_skel_time = omp_get_wtime() - beg;
-
-  size_t offset = 0;
-
-  /** reduce all u_skel */
-  for ( auto it = FarNodes->begin(); it != FarNodes->end(); it ++ )
+  /** the block was admitted by the Kab cache, evaluate and keep it */
+  if ( data.FarCache.admit )
   {
-    auto &bmap = (*it)->data.skels;
-    auto &w_skel = (*it)->data.w_skel;
-    assert( w_skel.col() == u_skel.col() );
+    std::vector<size_t> bmap;
+    for ( size_t i = 0; i < FarNodes.size(); i ++ )
+      bmap.insert( bmap.end(), FarNodes[ i ]->data.skels.begin(), 
+                               FarNodes[ i ]->data.skels.end() );
+    beg = omp_get_wtime();
+    auto Kab = K( amap, bmap );
+    kij_s2s_time = omp_get_wtime() - beg;
+    data.kij_s2s.first  += kij_s2s_time;
+    data.kij_s2s.second += amap.size() * bmap.size();
+    data.FarCache.cost = kij_s2s_time;
+    if ( node->setup->mixed ) CopyRows( data.lFarKab, 0, Kab );
+    else                      CopyRows( FarKab, 0, Kab );
+  }
 
-    if ( FarKab.size() ) /** Kab is cached */
+  /** mixed precision: lu_skel += lFarKab * lw_skel in float */
+  if ( node->setup->mixed )
+  {
+    using TL = typename decltype( node->data )::TL;
+    auto &lu_skel = data.LUSkel( panel );
+    auto &lFarKab = data.lFarKab;
+    lu_skel.resize( 0, 0 );
+    lu_skel.resize( amap.size(), node->setup->Weights( panel ).row(), 0.0 );
+    if ( lFarKab.size() ) /** Kab is cached, one grouped gemm */
     {
-      xgemm
-      (
-        "N", "N",
-        u_skel.row(), u_skel.col(), w_skel.row(),
-        1.0, FarKab.data() + offset, FarKab.row(),
-             w_skel.data(),          w_skel.row(),
-        1.0, u_skel.data(),          u_skel.row()
+      std::vector<TL*> Barray( FarNodes.size() );
+      std::vector<size_t> karray( FarNodes.size() );
+      for ( size_t i = 0; i < FarNodes.size(); i ++ )
+      {
+        Barray[ i ] = FarNodes[ i ]->data.LWSkel( panel ).data();
+        karray[ i ] = FarNodes[ i ]->data.LWSkel( panel ).row();
+      }
+      GroupedGemm
+      ( 
+        lu_skel.row(), lu_skel.col(),
+        lFarKab.data(), lFarKab.row(),
+        Barray, karray, data.FarOffset,
+        lu_skel.data(), lu_skel.row() 
       );
-      /** move to the next submatrix Kab */
-      offset += u_skel.row() * w_skel.row();
+      return;
     }
-    else
+    /** Kab is evaluated in T and used as is */
+    using TH = typename decltype( data.proj )::value_type;
+    for ( size_t i = 0; i < FarNodes.size(); i ++ )
     {
-      /** get submatrix Kad from K */
+      auto &bmap = FarNodes[ i ]->data.skels;
+      auto &lw_skel = FarNodes[ i ]->data.LWSkel( panel );
       beg = omp_get_wtime();
       auto Kab = K( amap, bmap );
       kij_s2s_time = omp_get_wtime() - beg;
-
-      /** update kij counter */
+      #pragma omp atomic update
       data.kij_s2s.first  += kij_s2s_time;
+      #pragma omp atomic update
       data.kij_s2s.second += amap.size() * bmap.size();
-
-      //printf( "%lu (%lu, %lu), ", (*it)->treelist_id, w_skel.row(), w_skel.num() );
-      //fflush( stdout );
-      xgemm
+      if ( !panel ) data.FarCache.cost += kij_s2s_time;
+      MixedGemm
       (
         "N", "N",
-        u_skel.row(), u_skel.col(), w_skel.row(),
-        1.0, Kab.data(),       Kab.row(),
-             w_skel.data(), w_skel.row(),
-        1.0, u_skel.data(), u_skel.row()
+        lu_skel.row(), lu_skel.col(), lw_skel.row(),
+        (TH)1.0,     Kab.data(),     Kab.row(),
+                 lw_skel.data(), lw_skel.row(),
+        (TL)1.0, lu_skel.data(), lu_skel.row()
       );
     }
+    return;
+  }
+
+  /** initilize u_skel to be zeros( s, nrhs ). */
+  beg = omp_get_wtime();
+  u_skel.resize( 0, 0 );
+  u_skel.resize( amap.size(), node->setup->Weights( panel ).row(), 0.0 );
+  u_skel_time = omp_get_wtime() - beg;
+
+  /** Kab is cached, reduce all u_skel with one grouped gemm */
+  if ( FarKab.size() )
+  {
+    std::vector<decltype( FarKab.data() )> Barray( FarNodes.size() );
+    std::vector<size_t> karray( FarNodes.size() );
+    for ( size_t i = 0; i < FarNodes.size(); i ++ )
+    {
+      assert( FarNodes[ i ]->data.WSkel( panel ).col() == u_skel.col() );
+      Barray[ i ] = FarNodes[ i ]->data.WSkel( panel ).data();
+      karray[ i ] = FarNodes[ i ]->data.WSkel( panel ).row();
+    }
+    GroupedGemm
+    ( 
+      u_skel.row(), u_skel.col(),
+      FarKab.data(), FarKab.row(),
+      Barray, karray, data.FarOffset,
+      u_skel.data(), u_skel.row() 
+    );
+    return;
+  }
+
+  /** reduce all u_skel */
+  for ( size_t i = 0; i < FarNodes.size(); i ++ )
+  {
+    auto &bmap = FarNodes[ i ]->data.skels;
+    auto &w_skel = FarNodes[ i ]->data.WSkel( panel );
+    assert( w_skel.col() == u_skel.col() );
+
+    /** get submatrix Kad from K */
+    beg = omp_get_wtime();
+    auto Kab = K( amap, bmap );
+    kij_s2s_time = omp_get_wtime() - beg;
+
+    /** update kij counter (S2S of other panels may run concurrently) */
+    #pragma omp atomic update
+    data.kij_s2s.first  += kij_s2s_time;
+    #pragma omp atomic update
+    data.kij_s2s.second += amap.size() * bmap.size();
+
+    /** the cost of Kab is measured once per evaluation (by panel 0) */
+    if ( !panel ) data.FarCache.cost += kij_s2s_time;
+
+    //printf( "%lu (%lu, %lu), ", (*it)->treelist_id, w_skel.row(), w_skel.num() );
+    //fflush( stdout );
+    xgemm
+    (
+      "N", "N",
+      u_skel.row(), u_skel.col(), w_skel.row(),
+      1.0, Kab.data(),       Kab.row(),
+           w_skel.data(), w_skel.row(),
+      1.0, u_skel.data(), u_skel.row()
+    );
   }
   s2s_time = omp_get_wtime() - beg;
 
@@ -1902,9 +2722,13 @@ class SkeletonsToSkeletonsTask : public hmlp::Task
 
     NODE *arg;
 
+    /** rhs panel (buffer slot) of this task */
+    size_t panel = 0;
+
     void Set( NODE *user_arg )
     {
       arg = user_arg;
+      panel = arg->setup->panel;
       name = std::string( "s2s" );
       {
         //label = std::to_string( arg->treelist_id );
@@ -1915,15 +2739,13 @@ class SkeletonsToSkeletonsTask : public hmlp::Task
 
       /** compute flops and mops */
       double flops = 0.0, mops = 0.0;
-      auto &w = *arg->setup->w;
+      auto &w = arg->setup->Weights( panel );
       size_t m = arg->data.skels.size();
       size_t n = w.row();
 
-      std::set<NODE*> *FarNodes;
-      if ( NNPRUNE ) FarNodes = &arg->NNFarNodes;
-      else           FarNodes = &arg->FarNodes;
+      auto &FarNodes = NNPRUNE ? arg->NNFarList : arg->FarList;
 
-      for ( auto it = FarNodes->begin(); it != FarNodes->end(); it ++ )
+      for ( auto it = FarNodes.begin(); it != FarNodes.end(); it ++ )
       {
         size_t k = (*it)->data.skels.size();
         flops += 2.0 * m * n * k;
@@ -1943,7 +2765,7 @@ class SkeletonsToSkeletonsTask : public hmlp::Task
 
     void Prefetch( Worker* user_worker )
     {
-      auto &u_skel = arg->data.u_skel;
+      auto &u_skel = arg->data.USkel( panel );
       __builtin_prefetch( u_skel.data() );
     };
 
@@ -1954,18 +2776,17 @@ class SkeletonsToSkeletonsTask : public hmlp::Task
 
     void DependencyAnalysis()
     {
-      auto &u_skel = arg->data.u_skel;
-      std::set<NODE*> *FarNodes;
-      FarNodes = &arg->NNFarNodes;
+      auto &u_skel = arg->data.USkel( panel );
+      auto &FarNodes = arg->NNFarList;
 
-      if ( !arg->parent || !FarNodes->size() ) this->Enqueue();
+      if ( !arg->parent || !FarNodes.size() ) this->Enqueue();
 
       //printf( "node %lu write u_skel ", arg->treelist_id );
       u_skel.DependencyAnalysis( hmlp::ReadWriteType::W, this );
-      for ( auto it = FarNodes->begin(); it != FarNodes->end(); it ++ )
+      for ( auto it = FarNodes.begin(); it != FarNodes.end(); it ++ )
       {
         //printf( "%lu ", (*it)->treelist_id );
-        auto &w_skel = (*it)->data.w_skel;
+        auto &w_skel = (*it)->data.WSkel( panel );
         w_skel.DependencyAnalysis( hmlp::ReadWriteType::R, this );
       }
       //printf( "\n" );
@@ -1973,7 +2794,7 @@ class SkeletonsToSkeletonsTask : public hmlp::Task
 
     void Execute( Worker* user_worker )
     {
-      SkeletonsToSkeletons<NNPRUNE, NODE>( arg );
+      SkeletonsToSkeletons<NNPRUNE, NODE>( arg, panel );
     };
 }; // end class SkeletonsToSkeletonsTask
 
@@ -1984,54 +2805,56 @@ class SkeletonsToSkeletonsTask : public hmlp::Task
  *         
  */ 
 template<bool NNPRUNE, typename NODE, typename T>
-void SkeletonsToNodes( NODE *node )
+void SkeletonsToNodes( NODE *node, size_t panel = 0 )
 {
 #ifdef DEBUG_SPDASKIT
   printf( "%lu Skel2Node u_skel.row() %lu\n", node->treelist_id, node->data.u_skel.row() ); fflush( stdout );
 #endif
 
-  double beg, kij_s2n_time = 0.0, u_leaf_time, before_writeback_time, after_writeback_time;
-
   /** gather shared data and create reference */
   auto &K = *node->setup->K;
-  auto &w = *node->setup->w;
-  auto &u = *node->setup->u;
+  auto &w = node->setup->Weights( panel );
+  auto &u = node->setup->Potentials( panel );
 
   /** Gather per node data and create reference */
   auto &lids = node->lids;
   auto &data = node->data;
   auto &proj = data.proj;
   auto &skels = data.skels;
-  auto &u_skel = data.u_skel;
+  auto &u_skel = data.USkel( panel );
   auto *lchild = node->lchild;
   auto *rchild = node->rchild;
 
   if ( node->isleaf )
   {
-    std::set<NODE*> *NearNodes;
-    if ( NNPRUNE ) NearNodes = &node->NNNearNodes;
-    else           NearNodes = &node->NearNodes;
+    auto *NearNodes = NNPRUNE ? &node->NNNearList : &node->NearList;
     auto &amap = node->lids;
-    auto &u_leaf = node->data.u_leaf[ 0 ];
-    //beg = omp_get_wtime();
-    //u_leaf.resize( w.row(), lids.size(), 0.0 );
+    auto &u_leaf = node->data.ULeaf( panel );
+#ifdef HMLP_USE_CUDA
+    /** direct interactions live in u_leaf[ 1:20 ] and are reduced later */
     u_leaf.resize( 0, 0 );
     u_leaf.resize( lids.size(), w.row(), 0.0 );
-    //u_leaf_time = omp_get_wtime() - beg;
+#endif
+    /** otherwise u_leaf already holds the direct interactions from L2L */
 
     assert( u_leaf.size() == w.row() * lids.size() );
 
-//    /** reduce direct iteractions from 4 copies */
-//    for ( size_t p = 1; p < 4; p ++ )
-//    {
-//      for ( size_t i = 0; i < u_leaf.size(); i ++ )
-//      {
-//        u_leaf[ i ] += node->data.u_leaf[ p ][ i ];
-//      }
-//    }
-
     /** accumulate far interactions */
-    if ( data.isskel )
+    if ( data.isskel && node->setup->mixed )
+    {
+      using TL = typename decltype( node->data )::TL;
+      auto &lproj = data.lproj;
+      auto &lu_skel = data.LUSkel( panel );
+      MixedGemm
+      (
+        "T", "N",
+        u_leaf.row(), u_leaf.col(), lu_skel.row(),
+        (TL)1.0,   lproj.data(),   lproj.row(),
+                 lu_skel.data(), lu_skel.row(),
+         (T)1.0,  u_leaf.data(),  u_leaf.row()
+      );
+    }
+    else if ( data.isskel )
     {
       //xgemm
       //(
@@ -2052,26 +2875,49 @@ void SkeletonsToNodes( NODE *node )
       );
     }
 
-//    /** assemble u_leaf back to u */
-//    for ( size_t j = 0; j < amap.size(); j ++ )
-//    {
-//      for ( size_t i = 0; i < u.row(); i ++ )
-//      {
-//        //u[ amap[ j ] * u.row() + i ] = u_leaf[ j * u.row() + i ];
-//        u[ amap[ j ] * u.row() + i ] = u_leaf( j, i );
-//      }
-//    }
-    after_writeback_time = omp_get_wtime() - beg;
-
-    //printf( "u_leaf %.3E before %.3E after %.3E\n",
-    //    u_leaf_time, before_writeback_time, after_writeback_time );
+#ifndef HMLP_USE_CUDA
+    /** 
+     *  u_leaf is complete (near + far), assemble it back to u. Each gid 
+     *  belongs to exactly one leaf, so this replaces the backward permute.
+     */
+    for ( size_t j = 0; j < amap.size(); j ++ )
+      for ( size_t i = 0; i < u.row(); i ++ )
+        u[ amap[ j ] * u.row() + i ] = u_leaf( j, i );
+#endif
   }
   else
   {
     if ( !node->parent || !node->data.isskel ) return;
 
-    auto &u_lskel = lchild->data.u_skel;
-    auto &u_rskel = rchild->data.u_skel;
+    if ( node->setup->mixed )
+    {
+      using TL = typename decltype( node->data )::TL;
+      auto &lproj = data.lproj;
+      auto &lu_skel = data.LUSkel( panel );
+      auto &lu_lskel = lchild->data.LUSkel( panel );
+      auto &lu_rskel = rchild->data.LUSkel( panel );
+      auto &lskel = lchild->data.skels;
+      MixedGemm
+      (
+        "T", "N",
+        lu_lskel.row(), lu_lskel.col(), lproj.row(),
+        (TL)1.0, lproj.data(),    lproj.row(),
+                 lu_skel.data(),  lu_skel.row(),
+        (TL)1.0, lu_lskel.data(), lu_lskel.row()
+      );
+      MixedGemm
+      (
+        "T", "N",
+        lu_rskel.row(), lu_rskel.col(), lproj.row(),
+        (TL)1.0, lproj.data() + lproj.row() * lskel.size(), lproj.row(),
+                 lu_skel.data(),  lu_skel.row(),
+        (TL)1.0, lu_rskel.data(), lu_rskel.row()
+      );
+      return;
+    }
+
+    auto &u_lskel = lchild->data.USkel( panel );
+    auto &u_rskel = rchild->data.USkel( panel );
     auto &lskel = lchild->data.skels;
     auto &rskel = rchild->data.skels;
     xgemm
@@ -2103,9 +2949,13 @@ class SkeletonsToNodesTask : public hmlp::Task
 
     NODE *arg;
 
+    /** rhs panel (buffer slot) of this task */
+    size_t panel = 0;
+
     void Set( NODE *user_arg )
     {
       arg = user_arg;
+      panel = arg->setup->panel;
       name = std::string( "s2n" );
       {
         //label = std::to_string( arg->treelist_id );
@@ -2120,13 +2970,17 @@ class SkeletonsToNodesTask : public hmlp::Task
       auto &data = arg->data;
       auto &proj = data.proj;
       auto &skels = data.skels;
-      auto &w = *arg->setup->w;
+      auto &w = arg->setup->Weights( panel );
+
+      /** proj is s-by-m, which is stored in lproj in the mixed mode */
+      size_t proj_m = arg->setup->mixed ? data.lproj.col() : proj.col();
+      size_t proj_s = arg->setup->mixed ? data.lproj.row() : proj.row();
 
       if ( arg->isleaf )
       {
-        size_t m = proj.col();
+        size_t m = proj_m;
         size_t n = w.row();
-        size_t k = proj.row();
+        size_t k = proj_s;
         flops += 2.0 * m * n * k;
         mops  += 2.0 * ( m * n + n * k + m * k );
       }
@@ -2138,9 +2992,9 @@ class SkeletonsToNodesTask : public hmlp::Task
         }
         else
         {
-          size_t m = proj.col();
+          size_t m = proj_m;
           size_t n = w.row();
-          size_t k = proj.row();
+          size_t k = proj_s;
           flops += 2.0 * m * n * k;
           mops  += 2.0 * ( m * n + n * k + m * k );
         }
@@ -2160,7 +3014,7 @@ class SkeletonsToNodesTask : public hmlp::Task
     {
       auto &proj = arg->data.proj;
       __builtin_prefetch( proj.data() );
-      auto &u_skel = arg->data.u_skel;
+      auto &u_skel = arg->data.USkel( panel );
       __builtin_prefetch( u_skel.data() );
       if ( arg->isleaf )
       {
@@ -2171,9 +3025,9 @@ class SkeletonsToNodesTask : public hmlp::Task
       }
       else
       {
-        auto &u_lskel = arg->lchild->data.u_skel;
+        auto &u_lskel = arg->lchild->data.USkel( panel );
         __builtin_prefetch( u_lskel.data() );
-        auto &u_rskel = arg->rchild->data.u_skel;
+        auto &u_rskel = arg->rchild->data.USkel( panel );
         __builtin_prefetch( u_rskel.data() );
       }
 #ifdef HMLP_USE_CUDA
@@ -2191,10 +3045,10 @@ class SkeletonsToNodesTask : public hmlp::Task
         }
         else
         {
-          auto &u_lskel = arg->lchild->data.u_skel;
+          auto &u_lskel = arg->lchild->data.USkel( panel );
           u_lskel.CacheD( device );
           u_lskel.PrefetchH2D( device, stream_id );
-          auto &u_rskel = arg->rchild->data.u_skel;
+          auto &u_rskel = arg->rchild->data.USkel( panel );
           u_rskel.CacheD( device );
           u_rskel.PrefetchH2D( device, stream_id );
         }
@@ -2212,31 +3066,29 @@ class SkeletonsToNodesTask : public hmlp::Task
 #ifdef DEBUG_SPDASKIT
       printf( "Skel2Node DepenencyAnalysis %lu\n", arg->treelist_id );
 #endif
+      /** leaf potentials are completed after all L2L subtasks */
+      if ( arg->isleaf ) 
+      {
+        for ( size_t p = 0; p < 4; p ++ )
+          arg->data.ULeafPanels( panel ).DependencyAnalysis( p, 0, hmlp::ReadWriteType::RW, this );
+      }
+
       if ( !arg->parent ) 
       {
-        this->Enqueue();
+        this->TryEnqueue();
         return;
       }
 
-      auto &u_skel = arg->data.u_skel;
+      auto &u_skel = arg->data.USkel( panel );
       u_skel.DependencyAnalysis( hmlp::ReadWriteType::R, this );
 
       if ( !arg->isleaf )
       {
-        auto &u_lskel = arg->lchild->data.u_skel;
-        auto &u_rskel = arg->rchild->data.u_skel;
+        auto &u_lskel = arg->lchild->data.USkel( panel );
+        auto &u_rskel = arg->rchild->data.USkel( panel );
         u_lskel.DependencyAnalysis( hmlp::ReadWriteType::RW, this );
         u_rskel.DependencyAnalysis( hmlp::ReadWriteType::RW, this );
       }
-      else
-      {
-        /** impose rw dependencies on multiple copies */
-        //for ( size_t p = 0; p < 4; p ++ )
-        //{
-        //  auto &u_leaf = arg->data.u_leaf[ p ];
-        //  u_leaf.DependencyAnalysis( hmlp::ReadWriteType::RW, this );
-        //}
-      }
     };
 
     void Execute( Worker* user_worker )
@@ -2244,10 +3096,12 @@ class SkeletonsToNodesTask : public hmlp::Task
 #ifdef HMLP_USE_CUDA 
       hmlp::Device *device = NULL;
       if ( user_worker ) device = user_worker->GetDevice();
-      if ( device ) gpu::SkeletonsToNodes<NNPRUNE, NODE, T>( device, arg );
-      else               SkeletonsToNodes<NNPRUNE, NODE, T>( arg );
+      if ( device && !arg->setup->mixed && !panel ) 
+        gpu::SkeletonsToNodes<NNPRUNE, NODE, T>( device, arg );
+      else
+        SkeletonsToNodes<NNPRUNE, NODE, T>( arg, panel );
 #else
-      SkeletonsToNodes<NNPRUNE, NODE, T>( arg );
+      SkeletonsToNodes<NNPRUNE, NODE, T>( arg, panel );
 #endif
     };
 
@@ -2255,104 +3109,166 @@ class SkeletonsToNodesTask : public hmlp::Task
 
 
 
+/**
+ *  @brief Pack the weights of Near( node ) into NearWb (lNearWb if
+ *         mixed) once per evaluation when the near Kab is (or will be)
+ *         cached, such that the four L2L row-panel subtasks share one 
+ *         panel. This must run after all w_leaf are gathered.
+ */ 
+template<bool NNPRUNE, typename NODE, typename T>
+void PackNearWeights( NODE *node, size_t panel = 0 )
+{
+  auto &data = node->data;
+  auto &NearWb = data.NearWeights( panel );
+  auto &lNearWb = data.LNearWeights( panel );
+  auto &NearNodes = NNPRUNE ? node->NNNearList : node->NearList;
+  bool cached = data.NearKab.size() || data.lNearKab.size() || data.NearCache.admit;
+
+  NearWb.resize( 0, 0 );
+  lNearWb.resize( 0, 0 );
+  if ( !cached || !NearNodes.size() ) return;
+
+  std::vector<T*> Barray( NearNodes.size() );
+  std::vector<size_t> karray( NearNodes.size() );
+  for ( size_t i = 0; i < NearNodes.size(); i ++ )
+  {
+    Barray[ i ] = NearNodes[ i ]->data.WLeaf( panel ).data();
+    karray[ i ] = NearNodes[ i ]->data.WLeaf( panel ).row();
+  }
+  size_t k = data.NearOffset.back() + karray.back();
+  size_t n = data.WLeaf( panel ).col();
+  if ( node->setup->mixed )
+  {
+    lNearWb.resize( k, n );
+    PackPanel( k, n, Barray, karray, data.NearOffset, lNearWb.data() );
+  }
+  else
+  {
+    NearWb.resize( k, n );
+    PackPanel( k, n, Barray, karray, data.NearOffset, NearWb.data() );
+  }
+}; /** end PackNearWeights() */
+
+
+/**
+ *  @brief Direct (near) interactions of rows [ rbeg, rend ) of the leaf.
+ *         Each L2L subtask owns a disjoint row panel of u_leaf[ 0 ], so
+ *         there is no private copy to reduce afterwards.
+ */ 
 template<int SUBTASKID, bool NNPRUNE, typename NODE, typename T>
-void LeavesToLeaves( NODE *node, size_t itbeg, size_t itend )
+void LeavesToLeaves( NODE *node, size_t rbeg, size_t rend, size_t panel = 0 )
 {
   assert( node->isleaf );
 
-  double beg, kij_s2n_time = 0.0, u_leaf_time, before_writeback_time, after_writeback_time;
+  double beg, kij_s2n_time = 0.0;
 
   /** gather shared data and create reference */
   auto &K = *node->setup->K;
-  auto &w = *node->setup->w;
-  auto &u = *node->setup->u;
 
   auto &lids = node->lids;
   auto &data = node->data;
-  auto &amap = node->lids;
   auto &NearKab = data.NearKab;
+  auto &lNearKab = data.lNearKab;
+  auto &u_leaf = data.ULeaf( panel );
 
-  std::set<NODE*> *NearNodes;
-  if ( NNPRUNE ) NearNodes = &node->NNNearNodes;
-  else           NearNodes = &node->NearNodes;
-
-  /** TODO: I think there may be a performance bug here. 
-   *        Overall there will be 4 task
-   **/
-  auto &u_leaf = data.u_leaf[ SUBTASKID ];
-  u_leaf.resize( 0, 0 );
+  auto &NearNodes = NNPRUNE ? node->NNNearList : node->NearList;
 
   /** early return if nothing to do */
-  if ( itbeg == itend ) 
-  {
-    return;
-  }
-  else
+  if ( rbeg == rend ) return;
+
+  size_t m = rend - rbeg;
+
+  /** the block was admitted by the Kab cache, evaluate my rows and keep them */
+  if ( data.NearCache.admit )
   {
-    u_leaf.resize( lids.size(), w.row(), 0.0 );
+    std::vector<size_t> amap( lids.begin() + rbeg, lids.begin() + rend ), bmap;
+    for ( size_t i = 0; i < NearNodes.size(); i ++ )
+      bmap.insert( bmap.end(), NearNodes[ i ]->lids.begin(), 
+                               NearNodes[ i ]->lids.end() );
+    beg = omp_get_wtime();
+    auto Kab = K( amap, bmap );
+    kij_s2n_time = omp_get_wtime() - beg;
+    #pragma omp atomic update
+    data.kij_s2n.first  += kij_s2n_time;
+    #pragma omp atomic update
+    data.kij_s2n.second += amap.size() * bmap.size();
+    #pragma omp atomic update
+    data.NearCache.cost += kij_s2n_time;
+    if ( node->setup->mixed ) CopyRows( lNearKab, rbeg, Kab );
+    else                      CopyRows(  NearKab, rbeg, Kab );
   }
 
-  if ( NearKab.size() ) /** Kab is cached */
+  if ( lNearKab.size() || NearKab.size() ) /** Kab is cached */
   {
-    size_t itptr = 0;
-    size_t offset = 0;
-
-    for ( auto it = NearNodes->begin(); it != NearNodes->end(); it ++ )
+    /** 
+     *  all near nodes form one group: Kab( rbeg:rend, : ) * NearWb, where
+     *  NearWb = [ wb_0; wb_1; ... ] was packed once for all subtasks 
+     */
+    auto &NearWb = data.NearWeights( panel );
+    auto &lNearWb = data.LNearWeights( panel );
+
+    /** mixed: a float product of lNearKab and lNearWb, added to u_leaf in T */
+    if ( lNearKab.size() )
     {
-      if ( itbeg <= itptr && itptr < itend )
-      {
-        //auto &bmap = (*it)->lids;
-        //auto wb = w( bmap );
-        auto wb = (*it)->data.w_leaf;
-
-        /** Kab * wb */
-        xgemm
-        (
-          "N", "N",
-          u_leaf.row(), u_leaf.col(), wb.row(),
-          1.0, NearKab.data() + offset * NearKab.row(), NearKab.row(),
-                    wb.data(),                               wb.row(),
-          1.0,  u_leaf.data(),                           u_leaf.row()
-        );
-      }
-      offset += (*it)->lids.size();
-      itptr ++;
+      using TL = typename decltype( node->data )::TL;
+      assert( lNearWb.row() == lNearKab.col() );
+      MixedGemm
+      (
+        "N", "N",
+        m, u_leaf.col(), lNearWb.row(),
+        (TL)1.0, lNearKab.data() + rbeg, lNearKab.row(),
+                  lNearWb.data(),         lNearWb.row(),
+         (T)1.0,   u_leaf.data() + rbeg,   u_leaf.row()
+      );
+    }
+    else
+    {
+      assert( NearWb.row() == NearKab.col() );
+      xgemm
+      (
+        "N", "N",
+        m, u_leaf.col(), NearWb.row(),
+        1.0, NearKab.data() + rbeg, NearKab.row(),
+              NearWb.data(),         NearWb.row(),
+        1.0,  u_leaf.data() + rbeg,  u_leaf.row()
+      );
     }
   }
-  else /** TODO: make xgemm into NN instead of NT. Kab is not cached */
+  else /** Kab is not cached */
   {
-    size_t itptr = 0;
-    for ( auto it = NearNodes->begin(); it != NearNodes->end(); it ++ )
-    {
-      if ( itbeg <= itptr && itptr < itend )
-      {
-        auto &bmap = (*it)->lids;
-        //auto wb = w( bmap );
-        auto wb = (*it)->data.w_leaf;
+    std::vector<size_t> amap( lids.begin() + rbeg, lids.begin() + rend );
 
-        /** evaluate the submatrix */
-        beg = omp_get_wtime();
-        auto Kab = K( amap, bmap );
-        kij_s2n_time = omp_get_wtime() - beg;
-
-        /** update kij counter */
-        data.kij_s2n.first  += kij_s2n_time;
-        data.kij_s2n.second += amap.size() * bmap.size();
+    for ( size_t i = 0; i < NearNodes.size(); i ++ )
+    {
+      auto &bmap = NearNodes[ i ]->lids;
+      auto &wb = NearNodes[ i ]->data.WLeaf( panel );
 
-        /** ( Kab * wb )' = wb' * Kab' */
-        xgemm
-        (
-          "N", "N",
-          u_leaf.row(), u_leaf.col(), wb.row(),
-          1.0,    Kab.data(),    Kab.row(),
-                   wb.data(),     wb.row(),
-          1.0, u_leaf.data(), u_leaf.row()
-        );
+      /** evaluate the submatrix */
+      beg = omp_get_wtime();
+      auto Kab = K( amap, bmap );
+      kij_s2n_time = omp_get_wtime() - beg;
+
+      /** update kij counter (rows are disjoint, but the counter is shared) */
+      #pragma omp atomic update
+      data.kij_s2n.first  += kij_s2n_time;
+      #pragma omp atomic update
+      data.kij_s2n.second += amap.size() * bmap.size();
+      if ( !panel )
+      {
+        #pragma omp atomic update
+        data.NearCache.cost += kij_s2n_time;
       }
-      itptr ++;
+
+      xgemm
+      (
+        "N", "N",
+        m, u_leaf.col(), wb.row(),
+        1.0,    Kab.data(),           Kab.row(),
+                 wb.data(),            wb.row(),
+        1.0, u_leaf.data() + rbeg, u_leaf.row()
+      );
     }
   }
-  before_writeback_time = omp_get_wtime() - beg;
 
 }; /** end LeavesToLeaves() */
 
@@ -2364,13 +3280,23 @@ class LeavesToLeavesTask : public hmlp::Task
 
     NODE *arg;
 
-    size_t itbeg;
+    /** row panel [ rbeg, rend ) of u_leaf owned by this subtask */
+    size_t rbeg;
+
+    size_t rend;
 
-	size_t itend;
+    /** the uncached Kab block to read ahead, decided before dispatch */
+    std::vector<size_t> prefetch_amap;
+
+    std::vector<size_t> prefetch_bmap;
+
+    /** rhs panel (buffer slot) of this task */
+    size_t panel = 0;
 
     void Set( NODE *user_arg )
     {
       arg = user_arg;
+      panel = arg->setup->panel;
       name = std::string( "l2l" );
       {
         //label = std::to_string( arg->treelist_id );
@@ -2379,48 +3305,36 @@ class LeavesToLeavesTask : public hmlp::Task
         label = ss.str();
       }
 
-      /** TODO: fill in flops and mops */
       //--------------------------------------
       double flops = 0.0, mops = 0.0;
       auto &lids = arg->lids;
       auto &data = arg->data;
-      auto &proj = data.proj;
-      auto &skels = data.skels;
-      auto &w = *arg->setup->w;
+      auto &w = arg->setup->Weights( panel );
       auto &K = *arg->setup->K;
       auto &NearKab = data.NearKab;
 
       assert( arg->isleaf );
 
-      size_t m = lids.size();
-      size_t n = w.row();
+      /** split the rows into 4 panels */ 
+      size_t rrange = ( lids.size() + 3 ) / 4;
+      rbeg = std::min( ( SUBTASKID - 1 ) * rrange, lids.size() );
+      rend = std::min( ( SUBTASKID + 0 ) * rrange, lids.size() );
+      if ( SUBTASKID == 4 ) rend = lids.size();
 
-      std::set<NODE*> *NearNodes;
-      if ( NNPRUNE ) NearNodes = &arg->NNNearNodes;
-      else           NearNodes = &arg->NearNodes;
+      size_t m = rend - rbeg;
+      size_t n = w.row();
 
-      /** TODO: need to better decide the range [itbeg itend] */ 
-      size_t itptr = 0;
-      size_t itrange = ( NearNodes->size() + 3 ) / 4;
-      if ( itrange < 1 ) itrange = 1;
-      itbeg = ( SUBTASKID - 1 ) * itrange;
-      itend = ( SUBTASKID + 0 ) * itrange;
-      if ( itbeg > NearNodes->size() ) itbeg = NearNodes->size();
-      if ( itend > NearNodes->size() ) itend = NearNodes->size();
-      if ( SUBTASKID == 4 ) itend = NearNodes->size();
+      auto &NearNodes = NNPRUNE ? arg->NNNearList : arg->NearList;
 
-      for ( auto it = NearNodes->begin(); it != NearNodes->end(); it ++ )
+      for ( size_t i = 0; i < NearNodes.size(); i ++ )
       {
-        if ( itbeg <= itptr && itptr < itend )
-        {
-          size_t k = (*it)->lids.size();
-          flops += 2.0 * m * n * k;
-          mops += m * k;
-          mops += 2.0 * ( m * n + n * k + m * k );
-          /** the cost of Kab */
-          if ( !NearKab.size() ) flops += K.flops( m, k );
-        }
-        itptr ++;
+        size_t k = NearNodes[ i ]->lids.size();
+        flops += 2.0 * m * n * k;
+        mops += m * k;
+        mops += 2.0 * ( m * n + n * k + m * k );
+        /** the cost of Kab */
+        if ( !NearKab.size() && !data.lNearKab.size() ) 
+          flops += K.flops( m, k );
       }
 
       /** setup the event */
@@ -2428,12 +3342,32 @@ class LeavesToLeavesTask : public hmlp::Task
 
       /** asuume computation bound */
       cost = flops / 1E+9;
+
+      /** 
+       *  The Kab cache is rebalanced before the tasks are created and
+       *  does not change until all of them are done; other subtasks of
+       *  this leaf fill NearKab concurrently, so Prefetch() must not
+       *  read the cache state itself.
+       */
+      typedef typename std::decay<decltype( K )>::type SPDMATRIX;
+      if ( PrefetchSupport<SPDMATRIX>::value && rbeg < rend && 
+           ( data.NearCache.admit || ( !NearKab.size() && !data.lNearKab.size() ) ) )
+      {
+        prefetch_amap.assign( lids.begin() + rbeg, lids.begin() + rend );
+        for ( size_t i = 0; i < NearNodes.size(); i ++ )
+          prefetch_bmap.insert( prefetch_bmap.end(), 
+              NearNodes[ i ]->lids.begin(), NearNodes[ i ]->lids.end() );
+      }
     };
 
     void Prefetch( Worker* user_worker )
     {
-      auto &u_leaf = arg->data.u_leaf[ SUBTASKID ];
-      __builtin_prefetch( u_leaf.data() );
+      auto &u_leaf = arg->data.ULeaf( panel );
+      __builtin_prefetch( u_leaf.data() + rbeg );
+
+      /** start reading Kab unless it is already cached */
+      if ( prefetch_amap.size() && prefetch_bmap.size() )
+        PrefetchKab( *arg->setup->K, prefetch_amap, prefetch_bmap, 0 );
     };
 
     void GetEventRecord()
@@ -2445,17 +3379,19 @@ class LeavesToLeavesTask : public hmlp::Task
     void DependencyAnalysis()
     {
       assert( arg->isleaf );
-      /** depends on nothing */
-      this->Enqueue();
-
-      /** impose rw dependencies on multiple copies */
-      //auto &u_leaf = arg->data.u_leaf[ SUBTASKID ];
-      //u_leaf.DependencyAnalysis( hmlp::ReadWriteType::W, this );
+      /** 
+       *  Subtasks write disjoint row panels of u_leaf[ 0 ], each tracked
+       *  as its own object (no order among them). SkeletonsToNodes() of 
+       *  the leaf updates all panels (RW) and hence waits for all of them.
+       */
+      arg->data.ULeafPanels( panel ).DependencyAnalysis( 
+          SUBTASKID - 1, 0, hmlp::ReadWriteType::RW, this );
+      this->TryEnqueue();
     };
 
     void Execute( Worker* user_worker )
     {
-      LeavesToLeaves<SUBTASKID, NNPRUNE, NODE, T>( arg, itbeg, itend );
+      LeavesToLeaves<SUBTASKID, NNPRUNE, NODE, T>( arg, rbeg, rend, panel );
     };
 
 }; /** end class LeavesToLeaves */
@@ -2735,47 +3671,39 @@ void FindNearNodes( TREE &tree, double budget )
   size_t n_nodes = ( 1 << tree.depth );
   auto level_beg = tree.treelist.begin() + n_nodes - 1;
 
+  /** the budget (number of leaf nodes) includes myself */
+  size_t n_budget = std::ceil( n_nodes * budget );
+  if ( n_budget < 1 ) n_budget = 1;
+
   //printf( "NN( %lu, %lu ) depth %lu n_nodes %lu treelist.size() %lu\n", 
   //    NN.row(), NN.col(),      
   //    tree.depth, n_nodes, tree.treelist.size() );
 
+  /** flat Near( node ) lists of leaf indices, sorted */
+  std::vector<std::vector<size_t>> near( n_nodes );
 
   /** 
-   * traverse all leaf nodes. 
-   *
-   * TODO: the following omp parallel for will result in segfault on KNL.
-   *       Not sure why.
+   * traverse all leaf nodes. Each leaf only reads the tree and
+   * writes to its own flat list, so leaves are independent.
    **/
-  //#pragma omp parallel for
+  #pragma omp parallel for schedule( dynamic )
   for ( size_t node_ind = 0; node_ind < n_nodes; node_ind ++ )
   {
     auto *node = *(level_beg + node_ind);
-    auto &data = node->data;
+    auto &list = near[ node_ind ];
 
     /** if no skeletons, then add every leaf nodes */
     /** TODO: this is not affected by the BUDGET */
     if ( !node->data.isskel )
     {
-      for ( size_t i = 0; i < n_nodes; i ++ )
-      {
-        node->NearNodes.insert(   *(level_beg + i) );
-        node->NNNearNodes.insert( *(level_beg + i) );
-      }
-    }
-    
-    /** add myself to the list. */
-    node->NearNodes.insert( node );
-    node->NNNearNodes.insert( node );
- 
-    /** ballot table */
-    std::vector<std::pair<size_t, size_t>> ballot( n_nodes );
-    for ( size_t i = 0; i < n_nodes; i ++ )
-    {
-      ballot[ i ].first  = 0;
-      ballot[ i ].second = i;
+      list.resize( n_nodes );
+      std::iota( list.begin(), list.end(), 0 );
+      continue;
     }
 
-    //printf( "before Neighbor\n" ); fflush( stdout );
+    /** sparse votes: leaf indices of all neighbors (second half) */
+    std::vector<size_t> votes;
+    votes.reserve( node->lids.size() * ( NN.row() - NN.row() / 2 ) );
 
     /** traverse all points and their neighbors. NN is stored as k-by-N */
     for ( size_t j = 0; j < node->lids.size(); j ++ )
@@ -2789,12 +3717,10 @@ void FindNearNodes( TREE &tree, double budget )
         /** if this gid is valid, then compute its morton */
         if ( neighbor_gid >= 0 && neighbor_gid < NN.col() )
         {
-          //printf( "lid %lu i %lu neighbor_gid %lu\n", lid, i, neighbor_gid );
           size_t neighbor_lid = tree.Getlid( neighbor_gid );
           size_t neighbor_morton = setup.morton[ neighbor_lid ];
-          //printf( "neighborlid %lu morton %lu\n", neighbor_lid, neighbor_morton );
           auto *target = tree.Morton2Node( neighbor_morton );
-          ballot[ target->treelist_id - ( n_nodes - 1 ) ].first += 1;
+          votes.push_back( target->treelist_id - ( n_nodes - 1 ) );
         }
         else
         {
@@ -2803,62 +3729,90 @@ void FindNearNodes( TREE &tree, double budget )
       }
     }
 
-    //printf( "after Neighbor\n" ); fflush( stdout );
-
-    /** sort the ballot list */
-    struct 
+    /** ballot table ( #votes, leaf index ) of voted leaves only */
+    std::sort( votes.begin(), votes.end() );
+    std::vector<std::pair<size_t, size_t>> ballot;
+    for ( size_t i = 0; i < votes.size(); )
     {
-      bool operator () ( std::pair<size_t, size_t> a, std::pair<size_t, size_t> b )
-      {   
-        return a.first > b.first;
-      }   
-    } BallotMore;
+      size_t j = i;
+      while ( j < votes.size() && votes[ j ] == votes[ i ] ) j ++;
+      ballot.push_back( std::make_pair( j - i, votes[ i ] ) );
+      i = j;
+    }
 
-    //printf( "before sorting\n" ); fflush( stdout );
-    std::sort( ballot.begin(), ballot.end(), BallotMore );
-    //printf( "after sorting\n" ); fflush( stdout );
+    /** top-k selection; myself may be among the top n_budget */
+    auto BallotMore = []( const std::pair<size_t, size_t> &a, 
+                          const std::pair<size_t, size_t> &b )
+    {
+      return a.first > b.first || ( a.first == b.first && a.second < b.second );
+    };
+    size_t n_top = std::min( ballot.size(), n_budget );
+    std::partial_sort( ballot.begin(), ballot.begin() + n_top, ballot.end(), 
+        BallotMore );
 
-    /** add leaf nodes with the highest votes util reach the budget */
-    for ( size_t i = 0; i < n_nodes; i ++ )
+    /** add myself and leaf nodes with the highest votes util reach the budget */
+    list.push_back( node_ind );
+    for ( size_t i = 0; i < n_top && list.size() < n_budget; i ++ )
     {
-      if ( ballot[ i ].first && node->NNNearNodes.size() < n_nodes * budget )
-      {
-        //printf( "add %lu ", ballot[ i ].second + ( n_nodes - 1 ) ); fflush( stdout );
-        node->NNNearNodes.insert( tree.treelist[ ballot[ i ].second + ( n_nodes - 1 ) ] );
-      }
-      //printf( "\n" );
+      if ( ballot[ i ].second != node_ind ) list.push_back( ballot[ i ].second );
     }
-
-    //printf( "After ballot\n" ); fflush( stdout );
+    std::sort( list.begin(), list.end() );
   }
 
   /** symmetrinize Near( node ) */
   if ( SYMMETRIC )
   {
+    /** transpose the lists; transpose[ i ] is sorted by construction */
+    std::vector<std::vector<size_t>> transpose( n_nodes );
+    for ( size_t node_ind = 0; node_ind < n_nodes; node_ind ++ )
+    {
+      for ( auto it : near[ node_ind ] ) transpose[ it ].push_back( node_ind );
+    }
+
     /** make Near( node ) symmetric */
-    for ( int node_ind = 0; node_ind < n_nodes; node_ind ++ )
+    #pragma omp parallel for schedule( dynamic )
+    for ( size_t node_ind = 0; node_ind < n_nodes; node_ind ++ )
     {
-      auto *node = *(level_beg + node_ind);
-      auto &NNNearNodes = node->NNNearNodes;
-      for ( auto it = NNNearNodes.begin(); it != NNNearNodes.end(); it ++ )
-      {
-        (*it)->NNNearNodes.insert( node );
-      }
+      std::vector<size_t> list;
+      list.reserve( near[ node_ind ].size() + transpose[ node_ind ].size() );
+      std::set_union( 
+          near[ node_ind ].begin(), near[ node_ind ].end(),
+          transpose[ node_ind ].begin(), transpose[ node_ind ].end(),
+          std::back_inserter( list ) );
+      near[ node_ind ].swap( list );
+    }
+  }
+
+  /** write the flat lists into NNNearNodes (and NearNodes) */
+  #pragma omp parallel for schedule( dynamic )
+  for ( size_t node_ind = 0; node_ind < n_nodes; node_ind ++ )
+  {
+    auto *node = *(level_beg + node_ind);
+    for ( auto it : near[ node_ind ] ) 
+    {
+      node->NNNearNodes.insert( node->NNNearNodes.end(), *(level_beg + it) );
+    }
+    if ( !node->data.isskel )
+    {
+      for ( size_t i = 0; i < n_nodes; i ++ )
+        node->NearNodes.insert( *(level_beg + i) );
     }
+    node->NearNodes.insert( node );
+  }
+
 #ifdef DEBUG_SPDASKIT
-    for ( int node_ind = 0; node_ind < n_nodes; node_ind ++ )
+  for ( int node_ind = 0; node_ind < n_nodes; node_ind ++ )
+  {
+    auto *node = *(level_beg + node_ind);
+    auto &NNNearNodes = node->NNNearNodes;
+    printf( "Node %lu NearNodes ", node->treelist_id );
+    for ( auto it = NNNearNodes.begin(); it != NNNearNodes.end(); it ++ )
     {
-      auto *node = *(level_beg + node_ind);
-      auto &NNNearNodes = node->NNNearNodes;
-      printf( "Node %lu NearNodes ", node->treelist_id );
-      for ( auto it = NNNearNodes.begin(); it != NNNearNodes.end(); it ++ )
-      {
-        printf( "%lu, ", (*it)->treelist_id );
-      }
-      printf( "\n" );
+      printf( "%lu, ", (*it)->treelist_id );
     }
-#endif
+    printf( "\n" );
   }
+#endif
 
 }; /** end FindNearNodes() */
 
@@ -2985,7 +3939,9 @@ class CacheNearNodesTask : public hmlp::Task
       {
         bmap.insert( bmap.end(), (*it)->lids.begin(), (*it)->lids.end() );
       }
+      double beg = omp_get_wtime();
       data.NearKab = K( amap, bmap );
+      data.NearCache.cost = omp_get_wtime() - beg;
 
       /** */
       data.Nearbmap.resize( bmap.size(), 1 );
@@ -3245,8 +4201,56 @@ void MergeFarNodes( TREE &tree )
 
 
 /**
- *  @brief Evaluate and store all submatrices Kba used in the Far 
- *         interaction.
+ *  @brief Freeze Near( node ) and Far( node ) into flat arrays once
+ *         MergeFarNodes() is done. Evaluation walks these arrays and
+ *         the offset of each entry in the columns of the cached NearKab
+ *         and FarKab (which is also its row offset in the packed weight
+ *         panel of GroupedGemm). The std::set are released afterwards;
+ *         the frozen lists are the only copy from then on.
+ */
+template<bool NNPRUNE, typename TREE>
+void FreezeInteractionLists( TREE &tree )
+{
+  #pragma omp parallel for schedule( dynamic )
+  for ( size_t i = 0; i < tree.treelist.size(); i ++ )
+  {
+    auto *node = tree.treelist[ i ];
+    auto &data = node->data;
+
+    node->FarList.assign(    node->FarNodes.begin(),    node->FarNodes.end() );
+    node->NearList.assign(   node->NearNodes.begin(),   node->NearNodes.end() );
+    node->NNFarList.assign(  node->NNFarNodes.begin(),  node->NNFarNodes.end() );
+    node->NNNearList.assign( node->NNNearNodes.begin(), node->NNNearNodes.end() );
+
+    node->FarNodes.clear();
+    node->NearNodes.clear();
+    node->NNFarNodes.clear();
+    node->NNNearNodes.clear();
+
+    /** offsets follow the same order as CacheNearNodes and CacheFarNodes */
+    auto &NearList = NNPRUNE ? node->NNNearList : node->NearList;
+    auto &FarList  = NNPRUNE ? node->NNFarList  : node->FarList;
+    size_t offset = 0;
+    data.NearOffset.resize( NearList.size() );
+    for ( size_t j = 0; j < NearList.size(); j ++ )
+    {
+      data.NearOffset[ j ] = offset;
+      offset += NearList[ j ]->lids.size();
+    }
+    offset = 0;
+    data.FarOffset.resize( FarList.size() );
+    for ( size_t j = 0; j < FarList.size(); j ++ )
+    {
+      data.FarOffset[ j ] = offset;
+      offset += FarList[ j ]->data.skels.size();
+    }
+  }
+}; /** end FreezeInteractionLists() */
+
+
+/**
+ *  @brief Evaluate and store all submatrices Kba used in the Far 
+ *         interaction.
  *
  *  @TODO  Take care the HSS case i.e. (!NNPRUNE)
  *        
@@ -3262,35 +4266,240 @@ void CacheFarNodes( TREE &tree )
     if ( node->isleaf )
     {
       node->data.w_leaf.reserve( node->lids.size(), MAX_NRHS );
-      node->data.u_leaf[ 0 ].reserve( MAX_NRHS, node->lids.size() );
+      node->data.u_leaf[ 0 ].reserve( node->lids.size(), MAX_NRHS );
     }
   }
 
-  /** cache Kab by request */
-  if ( CACHE )
+  /** cache Kab by request (with a byte budget, see RebalanceKabCache) */
+  if ( CACHE && !tree.setup.cache_budget )
   {
     /** cache FarKab */
     #pragma omp parallel for schedule( dynamic )
     for ( size_t i = 0; i < tree.treelist.size(); i ++ )
     {
       auto *node = tree.treelist[ i ];
-      auto *FarNodes = &node->FarNodes;
-      if ( NNPRUNE ) FarNodes = &node->NNFarNodes;
+      auto &FarNodes = NNPRUNE ? node->NNFarList : node->FarList;
       auto &K = *node->setup->K;
       auto &data = node->data;
       auto &amap = data.skels;
       std::vector<size_t> bmap;
-      for ( auto it = FarNodes->begin(); it != FarNodes->end(); it ++ )
+      for ( auto it = FarNodes.begin(); it != FarNodes.end(); it ++ )
       {
         bmap.insert( bmap.end(), (*it)->data.skels.begin(), 
                                  (*it)->data.skels.end() );
       }
+      double beg = omp_get_wtime();
       data.FarKab = K( amap, bmap );
+      data.FarCache.cost = omp_get_wtime() - beg;
     }
   }
 }; /** end CacheFarNodes() */
 
 
+/**
+ *  @brief Decide which NearKab and FarKab blocks to keep within the byte
+ *         budget setup.cache_budget. Every evaluation uses every block 
+ *         once, so a block scores cost / bytes (seconds of Kij evaluation
+ *         saved per byte and evaluation), where cost is measured whenever
+ *         the block is computed (at compression or by an evaluation), or 
+ *         estimated with K.flops() at 1 GFLOPS before that. Blocks are
+ *         kept by score (ties go to the smaller block) until the budget 
+ *         is filled; the rest are evicted. Newly admitted blocks are allocated here
+ *         and filled on demand by the next L2L and S2S tasks, which
+ *         evaluate uncached blocks anyway. Called by Evaluate().
+ */ 
+template<bool NNPRUNE, class SETUP, class NODEDATA, int N_SPLIT, typename T>
+void RebalanceKabCache
+( 
+  hmlp::tree::Tree<SETUP, NODEDATA, N_SPLIT, T> &tree 
+)
+{
+  using TL = typename NODEDATA::TL;
+
+  struct Block
+  {
+    double score;
+    size_t m;
+    size_t n;
+    KabCacheEntry *entry;
+    hmlp::Data<T> *Kab;
+    hmlp::Data<TL> *lKab;
+  };
+
+  auto &K = *tree.setup.K;
+  size_t budget = tree.setup.cache_budget;
+  size_t element = tree.setup.mixed ? sizeof(TL) : sizeof(T);
+  std::vector<Block> blocks;
+
+  /** collect all blocks that L2L and S2S may cache */
+  for ( size_t i = 0; i < tree.treelist.size(); i ++ )
+  {
+    auto *node = tree.treelist[ i ];
+    auto &data = node->data;
+    auto &NearList = NNPRUNE ? node->NNNearList : node->NearList;
+    auto &FarList  = NNPRUNE ? node->NNFarList  : node->FarList;
+
+    if ( node->isleaf && NearList.size() )
+    {
+      size_t n = 0;
+      for ( size_t j = 0; j < NearList.size(); j ++ ) n += NearList[ j ]->lids.size();
+      blocks.push_back( { 0.0, node->lids.size(), n, 
+          &data.NearCache, &data.NearKab, &data.lNearKab } );
+    }
+    if ( node->parent && data.isskel && FarList.size() )
+    {
+      size_t n = 0;
+      for ( size_t j = 0; j < FarList.size(); j ++ ) n += FarList[ j ]->data.skels.size();
+      blocks.push_back( { 0.0, data.skels.size(), n, 
+          &data.FarCache, &data.FarKab, &data.lFarKab } );
+    }
+  }
+
+  /** score */
+  for ( auto &b : blocks )
+  {
+    double cost = b.entry->cost;
+    if ( cost == 0.0 ) cost = K.flops( b.m, b.n ) / 1E+9;
+    b.score = cost / ( b.m * b.n * element + 1 );
+    /** favor blocks in the cache to damp churn caused by timing noise */
+    if ( b.Kab->size() || b.lKab->size() ) b.score *= 1.5;
+  }
+  std::sort( blocks.begin(), blocks.end(), 
+      []( const Block &a, const Block &b ) 
+      { 
+        if ( a.score != b.score ) return a.score > b.score;
+        return a.m * a.n < b.m * b.n;
+      } );
+
+  /** keep the highest scores within the budget, evict the rest */
+  size_t used = 0, n_cached = 0, n_admitted = 0, n_evicted = 0;
+  for ( auto &b : blocks )
+  {
+    size_t bytes = b.m * b.n * element;
+    bool cached = b.Kab->size() || b.lKab->size();
+    if ( used + bytes <= budget )
+    {
+      used += bytes;
+      if ( cached ) 
+      {
+        n_cached ++;
+      }
+      else
+      {
+        if ( tree.setup.mixed ) b.lKab->resize( b.m, b.n );
+        else                    b.Kab->resize( b.m, b.n );
+        b.entry->admit = true;
+        b.entry->cost = 0.0;
+        n_admitted ++;
+      }
+    }
+    else
+    {
+      if ( cached )
+      {
+        b.Kab->clear();  b.Kab->shrink_to_fit();  b.Kab->resize( 0, 0 );
+        b.lKab->clear(); b.lKab->shrink_to_fit(); b.lKab->resize( 0, 0 );
+        n_evicted ++;
+      }
+      /** measured again by the next evaluation */
+      b.entry->admit = false;
+      b.entry->cost = 0.0;
+    }
+  }
+
+  if ( tree.setup.verbose )
+  {
+    printf( "Kab cache: %lu kept %lu admitted %lu evicted of %lu blocks, %.1lfMB / %.1lfMB\n",
+        n_cached, n_admitted, n_evicted, blocks.size(), 
+        used / 1E+6, budget / 1E+6 ); fflush( stdout );
+  }
+}; /** end RebalanceKabCache() */
+
+
+/**
+ *  @brief Change the Kab cache budget (in bytes) of a compressed tree,
+ *         see Configuration::SetCacheBudget(). The next Evaluate() 
+ *         rebalances the cached blocks; 0 stops rebalancing and keeps
+ *         whatever is cached.
+ */ 
+template<typename TREE>
+void SetCacheBudget( TREE &tree, size_t bytes )
+{
+  tree.setup.cache_budget = bytes;
+}; /** end SetCacheBudget() */
+
+
+/**
+ *  @brief Copy A to B in the precision of B, and release A.
+ */ 
+template<typename TA, typename TB>
+void Demote( hmlp::Data<TA> &A, hmlp::Data<TB> &B )
+{
+  B.resize( A.row(), A.col() );
+  for ( size_t i = 0; i < A.size(); i ++ ) B[ i ] = A[ i ];
+  A.clear();
+  A.shrink_to_fit();
+  A.resize( 0, 0 );
+}; /** end Demote() */
+
+
+/**
+ *  @brief Switch a compressed tree to the mixed-precision mode. proj,
+ *         NearKab and FarKab are demoted to LowPrecision<T>::type and
+ *         their T copies are released. Later Evaluate() keeps w_skel
+ *         and u_skel in low precision. Products with the demoted
+ *         matrices run in low precision and are accumulated in T by
+ *         MixedGemm(). Use ComputeError() to examine the accuracy loss.
+ */ 
+template<class SETUP, class NODEDATA, int N_SPLIT, typename T>
+void ConvertToMixedPrecision
+( 
+  hmlp::tree::Tree<SETUP, NODEDATA, N_SPLIT, T> &tree 
+)
+{
+  using TL = typename NODEDATA::TL;
+
+  /** nothing to do if T is already the low precision */
+  if ( std::is_same<T, TL>::value || tree.setup.mixed ) return;
+
+  double before = 0.0, after = 0.0;
+
+  #pragma omp parallel for schedule( dynamic ) reduction( +:before,after )
+  for ( size_t i = 0; i < tree.treelist.size(); i ++ )
+  {
+    auto &data = tree.treelist[ i ]->data;
+    auto &skels = data.skels;
+
+    before += sizeof(T) * ( data.proj.size() + 
+        data.NearKab.size() + data.FarKab.size() );
+
+    Demote( data.proj, data.lproj );
+    Demote( data.NearKab, data.lNearKab );
+    Demote( data.FarKab, data.lFarKab );
+
+    /** move the MAX_NRHS reservation to low precision */
+    data.w_skel.shrink_to_fit();
+    data.u_skel.shrink_to_fit();
+    if ( data.isskel )
+    {
+      data.lw_skel.reserve( skels.size(), MAX_NRHS );
+      data.lu_skel.reserve( skels.size(), MAX_NRHS );
+    }
+
+    after += sizeof(TL) * ( data.lproj.size() + 
+        data.lNearKab.size() + data.lFarKab.size() );
+  }
+
+  tree.setup.mixed = true;
+
+  if ( tree.setup.verbose )
+  {
+    printf( "Mixed precision: proj, NearKab and FarKab %.1lfMB -> %.1lfMB\n",
+        before / 1E+6, after / 1E+6 ); fflush( stdout );
+  }
+}; /** end ConvertToMixedPrecision() */
+
+
 /**
  *  @brief 
  */ 
@@ -3320,8 +4529,8 @@ double DrawInteraction( TREE &tree )
 
       if ( NNPRUNE )
       {
-        auto &pNearNodes = node->NNNearNodes;
-        auto &pFarNodes = node->NNFarNodes;
+        auto &pNearNodes = node->NNNearList;
+        auto &pFarNodes = node->NNFarList;
         for ( auto it = pFarNodes.begin(); it != pFarNodes.end(); it ++ )
         {
           double gb = (double)std::min( node->l, (*it)->l ) / tree.depth;
@@ -3514,82 +4723,88 @@ void Evaluate
 
 
 /**
- *  @brief ComputeAll
+ *  @brief Prepare panel (buffer slot) p of an evaluation before its tasks
+ *         are created: clean up the read/write records left by the 
+ *         previous evaluation, permute weights into w_leaf, zero u_leaf
+ *         and pack the near weights of each leaf. The Kab cache must be
+ *         rebalanced before.
  */ 
-template<
-  bool     USE_RUNTIME = true, 
-  bool     USE_OMP_TASK = false, 
-  bool     SYMMETRIC_PRUNE = true, 
-  bool     NNPRUNE = true, 
-  bool     CACHE = true, 
-  typename TREE, 
-  typename T>
-hmlp::Data<T> Evaluate
-( 
-  TREE &tree,
-  hmlp::Data<T> &weights
-)
+template<bool SYMMETRIC_PRUNE, bool NNPRUNE, typename TREE, typename T>
+void SetupPanel( TREE &tree, hmlp::Data<T> &weights, size_t panel )
 {
-  const bool AUTO_DEPENDENCY = true;
-
-  /** get type NODE = TREE::NODE */
   using NODE = typename TREE::NODE;
 
-  /** all timers */
-  double beg, time_ratio, evaluation_time = 0.0;
-  double allocate_time, computeall_time;
-  double forward_permute_time, backward_permute_time;
-
-  /** nrhs-by-n initialize potentials */
-  beg = omp_get_wtime();
-  hmlp::Data<T> potentials( weights.row(), weights.col(), 0.0 );
-  tree.setup.w = &weights;
-  tree.setup.u = &potentials;
-  allocate_time = omp_get_wtime() - beg;
-
+  for ( size_t i = 0; i < tree.treelist.size(); i ++ )
+  {
+    auto &data = tree.treelist[ i ]->data;
+    if ( data.panels.size() < panel ) data.panels.resize( panel );
+    data.WSkel( panel ).DependencyCleanUp();
+    data.USkel( panel ).DependencyCleanUp();
+  }
 
-  /** permute weights into w_leaf */
-  printf( "Forward permute ...\n" ); fflush( stdout );
-  beg = omp_get_wtime();
   int n_nodes = ( 1 << tree.depth );
   auto level_beg = tree.treelist.begin() + n_nodes - 1;
   #pragma omp parallel for
   for ( int node_ind = 0; node_ind < n_nodes; node_ind ++ )
   {
     auto *node = *(level_beg + node_ind);
-    weights.GatherColumns( true, node->lids, node->data.w_leaf );
+    auto &data = node->data;
+    weights.GatherColumns( true, node->lids, data.WLeaf( panel ) );
+    /** zero the leaf potentials that L2L and S2N accumulate into */
+    auto &u_leaf = data.ULeaf( panel );
+    u_leaf.DependencyCleanUp();
+    if ( !data.ULeafPanels( panel ).HasBeenSetup() ) 
+      data.ULeafPanels( panel ).Setup( 4, 1 );
+    data.ULeafPanels( panel ).DependencyCleanUp();
+    u_leaf.resize( 0, 0 );
+    u_leaf.resize( node->lids.size(), weights.row(), 0.0 );
   }
-  forward_permute_time = omp_get_wtime() - beg;
+  /** all w_leaf are ready, pack the near weights of each leaf */
+  if ( SYMMETRIC_PRUNE )
+  {
+    #pragma omp parallel for
+    for ( int node_ind = 0; node_ind < n_nodes; node_ind ++ )
+      PackNearWeights<NNPRUNE, NODE, T>( *(level_beg + node_ind), panel );
+  }
+}; /** end SetupPanel() */
 
 
+/**
+ *  @brief Create the L2L, N2S, S2S and S2N tasks of panel p (prepared by
+ *         SetupPanel). Tasks of different panels touch different buffers,
+ *         so the tasks of several panels can share one hmlp_run(). Only
+ *         panel 0 may run on the GPU.
+ */ 
+template<bool USE_RUNTIME, bool NNPRUNE, bool CACHE, typename T, typename TREE>
+void SubmitPanel( TREE &tree, size_t panel )
+{
+  const bool AUTO_DEPENDENCY = true;
+
+  /** get type NODE = TREE::NODE */
+  using NODE = typename TREE::NODE;
 
-  /** Compute all N2S, S2S, S2N, L2L */
-  printf( "N2S, S2S, S2N, L2L (HMLP Runtime) ...\n" ); fflush( stdout );
-  if ( SYMMETRIC_PRUNE )
-  {
-    beg = omp_get_wtime();
 #ifdef HMLP_USE_CUDA
-    potentials.AllocateD( hmlp_get_device( 0 ) );
-    using LEAFTOLEAFVER2TASK = gpu::LeavesToLeavesVer2Task<CACHE, NNPRUNE, NODE, T>;
-    LEAFTOLEAFVER2TASK leaftoleafver2task;
+  assert( !panel );
+  using LEAFTOLEAFVER2TASK = gpu::LeavesToLeavesVer2Task<CACHE, NNPRUNE, NODE, T>;
+  LEAFTOLEAFVER2TASK leaftoleafver2task;
 #endif
-    using LEAFTOLEAFTASK1 = LeavesToLeavesTask<1, NNPRUNE, NODE, T>;
-    using LEAFTOLEAFTASK2 = LeavesToLeavesTask<2, NNPRUNE, NODE, T>;
-    using LEAFTOLEAFTASK3 = LeavesToLeavesTask<3, NNPRUNE, NODE, T>;
-    using LEAFTOLEAFTASK4 = LeavesToLeavesTask<4, NNPRUNE, NODE, T>;
+  using LEAFTOLEAFTASK1 = LeavesToLeavesTask<1, NNPRUNE, NODE, T>;
+  using LEAFTOLEAFTASK2 = LeavesToLeavesTask<2, NNPRUNE, NODE, T>;
+  using LEAFTOLEAFTASK3 = LeavesToLeavesTask<3, NNPRUNE, NODE, T>;
+  using LEAFTOLEAFTASK4 = LeavesToLeavesTask<4, NNPRUNE, NODE, T>;
 
-    using NODETOSKELTASK  = UpdateWeightsTask<NODE>;
-    using SKELTOSKELTASK  = SkeletonsToSkeletonsTask<NNPRUNE, NODE>;
-    using SKELTONODETASK  = SkeletonsToNodesTask<NNPRUNE, NODE, T>;
+  using NODETOSKELTASK  = UpdateWeightsTask<NODE>;
+  using SKELTOSKELTASK  = SkeletonsToSkeletonsTask<NNPRUNE, NODE>;
+  using SKELTONODETASK  = SkeletonsToNodesTask<NNPRUNE, NODE, T>;
 
-    LEAFTOLEAFTASK1 leaftoleaftask1;
-    LEAFTOLEAFTASK2 leaftoleaftask2;
-    LEAFTOLEAFTASK3 leaftoleaftask3;
-    LEAFTOLEAFTASK4 leaftoleaftask4;
+  LEAFTOLEAFTASK1 leaftoleaftask1;
+  LEAFTOLEAFTASK2 leaftoleaftask2;
+  LEAFTOLEAFTASK3 leaftoleaftask3;
+  LEAFTOLEAFTASK4 leaftoleaftask4;
 
-    NODETOSKELTASK  nodetoskeltask;
-    SKELTOSKELTASK  skeltoskeltask;
-    SKELTONODETASK  skeltonodetask;
+  NODETOSKELTASK  nodetoskeltask;
+  SKELTOSKELTASK  skeltoskeltask;
+  SKELTONODETASK  skeltonodetask;
 
 
 //    if ( USE_OMP_TASK )
@@ -3638,20 +4853,107 @@ hmlp::Data<T> Evaluate
 
 
 
-    /** CPU-GPU hybrid uses a different kind of L2L task */
+  /** tasks capture the panel in Set() */
+  tree.setup.panel = panel;
+
+  /** CPU-GPU hybrid uses a different kind of L2L task */
 #ifdef HMLP_USE_CUDA
-    tree.template TraverseLeafs    <AUTO_DEPENDENCY, USE_RUNTIME>( leaftoleafver2task );
+  tree.template TraverseLeafs    <AUTO_DEPENDENCY, USE_RUNTIME>( leaftoleafver2task );
 #else
-    tree.template TraverseLeafs    <AUTO_DEPENDENCY, USE_RUNTIME>( leaftoleaftask1 );
-    tree.template TraverseLeafs    <AUTO_DEPENDENCY, USE_RUNTIME>( leaftoleaftask2 );
-    tree.template TraverseLeafs    <AUTO_DEPENDENCY, USE_RUNTIME>( leaftoleaftask3 );
-    tree.template TraverseLeafs    <AUTO_DEPENDENCY, USE_RUNTIME>( leaftoleaftask4 );
+  tree.template TraverseLeafs    <AUTO_DEPENDENCY, USE_RUNTIME>( leaftoleaftask1 );
+  tree.template TraverseLeafs    <AUTO_DEPENDENCY, USE_RUNTIME>( leaftoleaftask2 );
+  tree.template TraverseLeafs    <AUTO_DEPENDENCY, USE_RUNTIME>( leaftoleaftask3 );
+  tree.template TraverseLeafs    <AUTO_DEPENDENCY, USE_RUNTIME>( leaftoleaftask4 );
+#endif
+  tree.template TraverseUp       <AUTO_DEPENDENCY, USE_RUNTIME>( nodetoskeltask );
+  tree.template TraverseUnOrdered<AUTO_DEPENDENCY, USE_RUNTIME>( skeltoskeltask );
+  tree.template TraverseDown     <AUTO_DEPENDENCY, USE_RUNTIME>( skeltonodetask );
+  tree.setup.panel = 0;
+
+}; /** end SubmitPanel() */
+
+
+/**
+ *  @brief ComputeAll potentials = K * weights into a caller-owned buffer.
+ *         potentials is only reallocated when its shape differs from
+ *         weights, so iterative solvers can reuse it across calls.
+ */ 
+template<
+  bool     USE_RUNTIME = true, 
+  bool     USE_OMP_TASK = false, 
+  bool     SYMMETRIC_PRUNE = true, 
+  bool     NNPRUNE = true, 
+  bool     CACHE = true, 
+  typename TREE, 
+  typename T>
+void Evaluate
+( 
+  TREE &tree,
+  hmlp::Data<T> &weights,
+  hmlp::Data<T> &potentials
+)
+{
+  /** get type NODE = TREE::NODE */
+  using NODE = typename TREE::NODE;
+
+  /** all timers */
+  double beg, time_ratio, evaluation_time = 0.0;
+  double allocate_time, computeall_time;
+  double forward_permute_time, backward_permute_time;
+
+  /** nrhs-by-n initialize potentials */
+  beg = omp_get_wtime();
+  if ( potentials.row() != weights.row() || potentials.col() != weights.col() )
+  {
+    potentials.resize( 0, 0 );
+    potentials.resize( weights.row(), weights.col(), 0.0 );
+  }
+  else
+  {
+    /** S2N overwrites every entry, otherwise potentials are accumulated */
+    bool overwrite = SYMMETRIC_PRUNE;
+#ifdef HMLP_USE_CUDA
+    overwrite = false;
+#endif
+    if ( !overwrite ) std::fill( potentials.begin(), potentials.end(), 0.0 );
+  }
+  tree.setup.w = &weights;
+  tree.setup.u = &potentials;
+  allocate_time = omp_get_wtime() - beg;
+
+  /** choose the cached Kab blocks within the byte budget */
+  if ( SYMMETRIC_PRUNE && tree.setup.cache_budget )
+    RebalanceKabCache<NNPRUNE>( tree );
+
+
+  /** permute weights into w_leaf */
+  printf( "Forward permute ...\n" ); fflush( stdout );
+  beg = omp_get_wtime();
+  int n_nodes = ( 1 << tree.depth );
+  auto level_beg = tree.treelist.begin() + n_nodes - 1;
+  SetupPanel<SYMMETRIC_PRUNE, NNPRUNE>( tree, weights, 0 );
+  forward_permute_time = omp_get_wtime() - beg;
+
+
+
+  /** Compute all N2S, S2S, S2N, L2L */
+  printf( "N2S, S2S, S2N, L2L (HMLP Runtime) ...\n" ); fflush( stdout );
+  if ( SYMMETRIC_PRUNE )
+  {
+    beg = omp_get_wtime();
+#ifdef HMLP_USE_CUDA
+    potentials.AllocateD( hmlp_get_device( 0 ) );
 #endif
-    tree.template TraverseUp       <AUTO_DEPENDENCY, USE_RUNTIME>( nodetoskeltask );
-    tree.template TraverseUnOrdered<AUTO_DEPENDENCY, USE_RUNTIME>( skeltoskeltask );
-    tree.template TraverseDown     <AUTO_DEPENDENCY, USE_RUNTIME>( skeltonodetask );
+    SubmitPanel<USE_RUNTIME, NNPRUNE, CACHE, T>( tree, 0 );
     hmlp_run();
 
+    /** admitted Kab blocks are filled now */
+    for ( size_t i = 0; i < tree.treelist.size(); i ++ )
+    {
+      tree.treelist[ i ]->data.NearCache.admit = false;
+      tree.treelist[ i ]->data.FarCache.admit = false;
+    }
+
 #ifdef HMLP_USE_CUDA
       hmlp::Device *device = hmlp_get_device( 0 );
       for ( int stream_id = 0; stream_id < 10; stream_id ++ )
@@ -3660,14 +4962,14 @@ hmlp::Data<T> Evaluate
       potentials.FetchD2H( device );
 #endif
 
-
-    /** reduce direct iteractions from 4 copies */
+#ifdef HMLP_USE_CUDA
+    /** reduce direct iteractions from per-thread copies */
     #pragma omp parallel for
     for ( int node_ind = 0; node_ind < n_nodes; node_ind ++ )
     {
       auto *node = *(level_beg + node_ind);
       auto &u_leaf = node->data.u_leaf[ 0 ];
-      /** reduce all u_leaf[0:4] */
+      /** reduce all u_leaf[0:20] */
       for ( size_t p = 1; p < 20; p ++ )
       {
         for ( size_t i = 0; i < node->data.u_leaf[ p ].size(); i ++ )
@@ -3675,30 +4977,24 @@ hmlp::Data<T> Evaluate
       }
     }
  
-#ifdef HMLP_USE_CUDA
-    hmlp::Device *device = hmlp_get_device( 0 );
     device->wait( 0 );
 #endif
     computeall_time = omp_get_wtime() - beg;
   }
-  else // TODO: implement unsymmetric prunning
+  else 
   {
-    using NODETOSKELTASK = UpdateWeightsTask<NODE>;
-
-    NODETOSKELTASK nodetoskeltask;
-
-    tree.template TraverseUp<false, USE_RUNTIME>( nodetoskeltask );
-    if ( USE_RUNTIME ) hmlp_run();
-
-    // Not yet implemented.
-    printf( "Non symmetric ComputeAll is not yet implemented\n" );
+    /** K( targets, sources ) is evaluated through CrossKernel */
+    printf( "Evaluate(): unsymmetric pruning is not supported, use CrossKernel\n" ); 
+    fflush( stdout );
+    exit( 1 );
   }
 
 
 
-  /** permute back */
-  printf( "Backward permute ...\n" ); fflush( stdout );
+  /** permute back (on CPU this is fused into SkeletonsToNodes) */
   beg = omp_get_wtime();
+#ifdef HMLP_USE_CUDA
+  printf( "Backward permute ...\n" ); fflush( stdout );
   #pragma omp parallel for
   for ( int node_ind = 0; node_ind < n_nodes; node_ind ++ )
   {
@@ -3710,6 +5006,7 @@ hmlp::Data<T> Evaluate
       for ( size_t i = 0; i < potentials.row(); i ++ )
         potentials[ amap[ j ] * potentials.row() + i ] += u_leaf( j, i );
   }
+#endif
   backward_permute_time = omp_get_wtime() - beg;
 
   evaluation_time += allocate_time;
@@ -3733,24 +5030,839 @@ hmlp::Data<T> Evaluate
       evaluation_time, evaluation_time * time_ratio );
   printf( "========================================================\n\n");
 
+}; /** end Evaluate() */
+
 
-  /** return nrhs-by-N outputs */
+/**
+ *  @brief ComputeAll and return nrhs-by-N potentials.
+ */ 
+template<
+  bool     USE_RUNTIME = true, 
+  bool     USE_OMP_TASK = false, 
+  bool     SYMMETRIC_PRUNE = true, 
+  bool     NNPRUNE = true, 
+  bool     CACHE = true, 
+  typename TREE, 
+  typename T>
+hmlp::Data<T> Evaluate
+( 
+  TREE &tree,
+  hmlp::Data<T> &weights
+)
+{
+  hmlp::Data<T> potentials;
+  Evaluate<USE_RUNTIME, USE_OMP_TASK, SYMMETRIC_PRUNE, NNPRUNE, CACHE>
+    ( tree, weights, potentials );
+  /** setup.u pointed to the local buffer */
+  tree.setup.u = NULL;
   return potentials;
 
 }; /** end Evaluate() */
 
 
 
-
-
 /**
- *  @brielf template of the compress routine
+ *  @brief Evaluate many right hand sides in panels of at most 
+ *         panel_size rows of weights, so the per-node buffers stay 
+ *         bounded no matter how large nrhs is, and the same compression
+ *         serves any nrhs. Up to n_inflight panels use their own buffer
+ *         slots (see SetupPanel) and share one task graph, such that the
+ *         L2L of one panel overlaps the N2S, S2S and S2N of the next. The
+ *         Kab cache is rebalanced once; a panel that fills admitted 
+ *         blocks runs alone. On the GPU panels are evaluated one by one.
+ *         setup.w and setup.u are restored on return.
  */ 
 template<
-  bool        ADAPTIVE, 
-  bool        LEVELRESTRICTION, 
-  typename    SPLITTER, 
-  typename    RKDTSPLITTER, 
+  bool     USE_RUNTIME = true, 
+  bool     USE_OMP_TASK = false, 
+  bool     SYMMETRIC_PRUNE = true, 
+  bool     NNPRUNE = true, 
+  bool     CACHE = true, 
+  typename TREE, 
+  typename T>
+hmlp::Data<T> EvaluatePanels
+( 
+  TREE &tree,
+  hmlp::Data<T> &weights,
+  size_t panel_size = MAX_NRHS,
+  size_t n_inflight = 2
+)
+{
+  size_t nrhs = weights.row();
+  size_t n = weights.col();
+
+  /** Evaluate() redirects setup.w and setup.u to each panel */
+  auto *w_setup = tree.setup.w;
+  auto *u_setup = tree.setup.u;
+
+  if ( panel_size < 1 ) panel_size = 1;
+  if ( panel_size > MAX_NRHS ) panel_size = MAX_NRHS;
+  if ( n_inflight < 1 ) n_inflight = 1;
+
+  /** only the CPU tasks know about panels other than 0 */
+  bool pipelined = SYMMETRIC_PRUNE && USE_RUNTIME;
+#ifdef HMLP_USE_CUDA
+  pipelined = false;
+#endif
+
+  hmlp::Data<T> potentials;
+
+  if ( nrhs <= panel_size ) 
+  {
+    /** small enough to go in one pass */
+    potentials = Evaluate<USE_RUNTIME, USE_OMP_TASK, SYMMETRIC_PRUNE, NNPRUNE, CACHE>
+                 ( tree, weights );
+  }
+  else if ( !pipelined )
+  {
+    potentials.resize( nrhs, n, 0.0 );
+    hmlp::Data<T> wpanel;
+
+    for ( size_t pbeg = 0; pbeg < nrhs; pbeg += panel_size )
+    {
+      size_t pb = std::min( panel_size, nrhs - pbeg );
+
+      /** gather rows [ pbeg, pbeg + pb ) of weights */
+      wpanel.resize( pb, n );
+      #pragma omp parallel for
+      for ( size_t j = 0; j < n; j ++ )
+        for ( size_t i = 0; i < pb; i ++ )
+          wpanel( i, j ) = weights( pbeg + i, j );
+
+      auto upanel = Evaluate<USE_RUNTIME, USE_OMP_TASK, SYMMETRIC_PRUNE, NNPRUNE, CACHE>
+                    ( tree, wpanel );
+
+      /** scatter the panel back to potentials */
+      #pragma omp parallel for
+      for ( size_t j = 0; j < n; j ++ )
+        for ( size_t i = 0; i < pb; i ++ )
+          potentials( pbeg + i, j ) = upanel( i, j );
+    }
+  }
+  else
+  {
+    double beg = omp_get_wtime();
+    size_t n_panels = 0, n_runs = 0;
+
+    potentials.resize( nrhs, n, 0.0 );
+
+    /** slot s holds the weights and potentials of one panel in flight */
+    std::vector<hmlp::Data<T>> wpanel( n_inflight );
+    std::vector<hmlp::Data<T>> upanel( n_inflight );
+    std::vector<size_t> pbeg_of( n_inflight ), pb_of( n_inflight );
+    tree.setup.w = &wpanel[ 0 ];
+    tree.setup.u = &upanel[ 0 ];
+    tree.setup.panel_w.resize( n_inflight - 1 );
+    tree.setup.panel_u.resize( n_inflight - 1 );
+    for ( size_t s = 1; s < n_inflight; s ++ )
+    {
+      tree.setup.panel_w[ s - 1 ] = &wpanel[ s ];
+      tree.setup.panel_u[ s - 1 ] = &upanel[ s ];
+    }
+
+    /** choose the cached Kab blocks once for all panels */
+    if ( tree.setup.cache_budget ) RebalanceKabCache<NNPRUNE>( tree );
+
+    /** L2L and S2S of an admitted block fill it, which must not race */
+    bool admitted = false;
+    for ( size_t i = 0; i < tree.treelist.size(); i ++ )
+    {
+      auto &data = tree.treelist[ i ]->data;
+      if ( data.NearCache.admit || data.FarCache.admit ) admitted = true;
+    }
+
+    for ( size_t pbeg = 0; pbeg < nrhs; )
+    {
+      size_t n_slots = admitted ? 1 : n_inflight;
+
+      /** gather the panels of this group and prepare their slots */
+      size_t n_group = 0;
+      for ( ; n_group < n_slots && pbeg < nrhs; n_group ++ )
+      {
+        size_t pb = std::min( panel_size, nrhs - pbeg );
+        auto &w = wpanel[ n_group ];
+        auto &u = upanel[ n_group ];
+        w.resize( pb, n );
+        #pragma omp parallel for
+        for ( size_t j = 0; j < n; j ++ )
+          for ( size_t i = 0; i < pb; i ++ )
+            w( i, j ) = weights( pbeg + i, j );
+        /** S2N overwrites every entry */
+        u.resize( pb, n );
+        SetupPanel<SYMMETRIC_PRUNE, NNPRUNE>( tree, w, n_group );
+        pbeg_of[ n_group ] = pbeg;
+        pb_of[ n_group ] = pb;
+        pbeg += pb;
+      }
+
+      /** one task graph for all panels of the group */
+      for ( size_t s = 0; s < n_group; s ++ )
+        SubmitPanel<USE_RUNTIME, NNPRUNE, CACHE, T>( tree, s );
+      hmlp_run();
+      n_panels += n_group;
+      n_runs ++;
+
+      /** admitted Kab blocks are filled now */
+      if ( admitted )
+      {
+        for ( size_t i = 0; i < tree.treelist.size(); i ++ )
+        {
+          tree.treelist[ i ]->data.NearCache.admit = false;
+          tree.treelist[ i ]->data.FarCache.admit = false;
+        }
+        admitted = false;
+      }
+
+      /** scatter the panels back to potentials */
+      for ( size_t s = 0; s < n_group; s ++ )
+      {
+        auto &u = upanel[ s ];
+        #pragma omp parallel for
+        for ( size_t j = 0; j < n; j ++ )
+          for ( size_t i = 0; i < pb_of[ s ]; i ++ )
+            potentials( pbeg_of[ s ] + i, j ) = u( i, j );
+      }
+    }
+
+    /** release the buffers of the extra slots */
+    for ( size_t i = 0; i < tree.treelist.size(); i ++ )
+      tree.treelist[ i ]->data.panels.clear();
+    tree.setup.panel_w.clear();
+    tree.setup.panel_u.clear();
+
+    if ( tree.setup.verbose )
+    {
+      printf( "EvaluatePanels: %lu panels of %lu rhs in %lu runs, %.2lfs\n",
+          n_panels, panel_size, n_runs, omp_get_wtime() - beg ); 
+      fflush( stdout );
+    }
+  }
+
+  tree.setup.w = w_setup;
+  tree.setup.u = u_setup;
+
+  return potentials;
+
+}; /** end EvaluatePanels() */
+
+
+
+/**
+ *  @brief Ax = ( K + lambda * I ) * x with the compressed matvec. Ax is
+ *         reused as the potential buffer of Evaluate().
+ */ 
+template<typename TREE, typename T>
+void ShiftedEvaluate( TREE &tree, T lambda, hmlp::Data<T> &x, hmlp::Data<T> &Ax )
+{
+  Evaluate( tree, x, Ax );
+  #pragma omp parallel for
+  for ( size_t i = 0; i < x.size(); i ++ ) Ax[ i ] += lambda * x[ i ];
+}; /** end ShiftedEvaluate() */
+
+
+/**
+ *  @brief z = inv( K + lambda * I ) * r with the hfamily factorization
+ *         (hfamily::Factorize<LU>( tree, lambda ) must have been called).
+ *         r and z are nrhs-by-n; buff holds the n-by-nrhs transpose.
+ */ 
+template<bool LU, typename TREE, typename T>
+void Precondition( TREE &tree, hmlp::Data<T> &r, hmlp::Data<T> &z, hmlp::Data<T> &buff )
+{
+  using NODE = typename TREE::NODE;
+  size_t nrhs = r.row();
+  size_t n = r.col();
+
+  buff.resize( n, nrhs );
+  for ( size_t j = 0; j < n; j ++ )
+    for ( size_t i = 0; i < nrhs; i ++ ) 
+      buff( j, i ) = r( i, j );
+
+  hmlp::hfamily::Solve<LU, NODE, T>( tree, buff );
+
+  z.resize( nrhs, n );
+  for ( size_t j = 0; j < n; j ++ )
+    for ( size_t i = 0; i < nrhs; i ++ ) 
+      z( i, j ) = buff( j, i );
+}; /** end Precondition() */
+
+
+/**
+ *  @brief dot[ i ] = X( i, : ) * Y( i, : )' for each rhs i.
+ */ 
+template<typename T>
+void RowDot( hmlp::Data<T> &X, hmlp::Data<T> &Y, std::vector<T> &dot )
+{
+  dot.assign( X.row(), 0.0 );
+  for ( size_t j = 0; j < X.col(); j ++ )
+    for ( size_t i = 0; i < X.row(); i ++ )
+      dot[ i ] += X( i, j ) * Y( i, j );
+}; /** end RowDot() */
+
+
+/**
+ *  @brief Stop if the preconditioner tree was not factorized by 
+ *         hfamily::Factorize<false>(), since the LU factors are not 
+ *         symmetric and CG needs an SPD M^{-1}.
+ */ 
+template<typename PTREE>
+void AssertSymmetricPreconditioner( PTREE &ptree, const char *solver )
+{
+  if ( ptree.treelist[ 0 ]->data.ipiv.size() )
+  {
+    printf( "%s(): the preconditioner must be hfamily::Factorize<false>(), use GMRES for LU\n", 
+        solver );
+    exit( 1 );
+  }
+}; /** end AssertSymmetricPreconditioner() */
+
+
+/**
+ *  @brief Preconditioned conjugate gradient for ( K + lambda * I ) x = b.
+ *         b is nrhs-by-n (the layout of weights). All right hand sides
+ *         iterate together with one Evaluate() per iteration, each with
+ *         its own step sizes, until every relative residual is below tol
+ *         or maxit iterations. tree gives the matvec, and ptree (if not
+ *         NULL) the preconditioner M^{-1} = inv( W' ) * inv( W ) from
+ *         hfamily::Factorize<false>( ptree, mu ), which is SPD for any mu.
+ *         ptree may be tree itself, or e.g. a looser compression. A rhs
+ *         stops with a warning if p'Ap or r'z is not positive (breakdown).
+ *         All work vectors are allocated once.
+ */ 
+template<typename TREE, typename PTREE, typename T>
+hmlp::Data<T> PCG
+( 
+  TREE &tree, PTREE *ptree, T lambda, hmlp::Data<T> &b, 
+  T tol = 1E-7, size_t maxit = 100 
+)
+{
+  size_t nrhs = b.row();
+  size_t n = b.col();
+
+  if ( ptree ) AssertSymmetricPreconditioner( *ptree, "PCG" );
+
+  hmlp::Data<T> x( nrhs, n, 0.0 ), r = b, z = b, p, Ap( nrhs, n ), buff;
+  std::vector<T> bnrm, rnrm, rz, rz_new, pAp;
+  std::vector<T> alpha( nrhs, 0.0 ), beta( nrhs, 0.0 );
+  std::vector<bool> done( nrhs, false );
+  bool breakdown = false;
+
+  RowDot( b, b, bnrm );
+  for ( size_t i = 0; i < nrhs; i ++ ) 
+  {
+    bnrm[ i ] = std::sqrt( bnrm[ i ] );
+    if ( bnrm[ i ] == 0.0 ) done[ i ] = true;
+  }
+
+  /** z = M^{-1} r and p = z */
+  if ( ptree ) Precondition<false>( *ptree, r, z, buff );
+  p = z;
+  RowDot( r, z, rz );
+
+  size_t iter = 0;
+  T relres = 0.0;
+  for ( iter = 0; iter < maxit; iter ++ )
+  {
+    /** stop if all rhs converged (or broke down) */
+    if ( std::find( done.begin(), done.end(), false ) == done.end() ) break;
+
+    ShiftedEvaluate( tree, lambda, p, Ap );
+    RowDot( p, Ap, pAp );
+
+    /** x += alpha * p, r -= alpha * Ap */
+    for ( size_t i = 0; i < nrhs; i ++ )
+    {
+      alpha[ i ] = 0.0;
+      if ( done[ i ] ) continue;
+      /** !( a > 0 ) also catches NaN */
+      if ( !( pAp[ i ] > 0.0 ) || !( rz[ i ] > 0.0 ) )
+      {
+        printf( "Warning! PCG breakdown of rhs %lu, p'Ap %3.1E r'z %3.1E\n", 
+            i, pAp[ i ], rz[ i ] );
+        done[ i ] = true;
+        breakdown = true;
+        continue;
+      }
+      alpha[ i ] = rz[ i ] / pAp[ i ];
+    }
+    #pragma omp parallel for
+    for ( size_t j = 0; j < n; j ++ )
+    {
+      for ( size_t i = 0; i < nrhs; i ++ )
+      {
+        x( i, j ) += alpha[ i ] * p( i, j );
+        r( i, j ) -= alpha[ i ] * Ap( i, j );
+      }
+    }
+
+    /** check convergence */
+    RowDot( r, r, rnrm );
+    relres = 0.0;
+    for ( size_t i = 0; i < nrhs; i ++ )
+    {
+      if ( done[ i ] ) continue;
+      T res = std::sqrt( rnrm[ i ] ) / bnrm[ i ];
+      if ( res < tol ) done[ i ] = true;
+      relres = std::max( relres, res );
+    }
+    if ( tree.setup.verbose )
+    {
+      printf( "PCG iteration %3lu max relative residual %3.1E\n", iter, relres );
+      fflush( stdout );
+    }
+
+    /** z = M^{-1} r, p = z + beta * p */
+    if ( ptree ) Precondition<false>( *ptree, r, z, buff );
+    else         z = r;
+    RowDot( r, z, rz_new );
+    for ( size_t i = 0; i < nrhs; i ++ )
+      beta[ i ] = done[ i ] ? 0.0 : rz_new[ i ] / rz[ i ];
+    #pragma omp parallel for
+    for ( size_t j = 0; j < n; j ++ )
+      for ( size_t i = 0; i < nrhs; i ++ )
+        p( i, j ) = z( i, j ) + beta[ i ] * p( i, j );
+    rz = rz_new;
+  }
+
+  /** report the residual of all rhs, including those that broke down */
+  RowDot( r, r, rnrm );
+  relres = 0.0;
+  for ( size_t i = 0; i < nrhs; i ++ )
+    if ( bnrm[ i ] > 0.0 ) relres = std::max( relres, std::sqrt( rnrm[ i ] ) / bnrm[ i ] );
+  printf( "PCG %s in %lu iterations, max relative residual %3.1E\n", 
+      breakdown ? "broke down" : ( relres < tol ? "converged" : "stopped" ), 
+      iter, relres ); fflush( stdout );
+
+  return x;
+
+}; /** end PCG() */
+
+
+/** @brief PCG with the hfamily factorization of ptree as preconditioner. */
+template<typename TREE, typename PTREE, typename T>
+hmlp::Data<T> PCG
+( 
+  TREE &tree, PTREE &ptree, T lambda, hmlp::Data<T> &b, 
+  T tol = 1E-7, size_t maxit = 100 
+)
+{
+  return PCG( tree, &ptree, lambda, b, tol, maxit );
+}; /** end PCG() */
+
+
+/** @brief CG without preconditioner. */
+template<typename TREE, typename T>
+hmlp::Data<T> PCG
+( 
+  TREE &tree, T lambda, hmlp::Data<T> &b, 
+  T tol = 1E-7, size_t maxit = 100 
+)
+{
+  return PCG( tree, (TREE*)NULL, lambda, b, tol, maxit );
+}; /** end PCG() */
+
+
+/**
+ *  @brief Solve G * X = B in place for an SPD k-by-k G (overwritten by its 
+ *         Cholesky factor) and a k-by-k B. Return false if G is not SPD.
+ */ 
+template<typename T>
+bool SolveSPD( hmlp::Data<T> &G, hmlp::Data<T> &B )
+{
+  size_t k = G.row();
+  if ( xpotrf( "L", k, G.data(), k ) ) return false;
+  xtrsm( "L", "L", "N", "N", k, B.col(), 1.0, G.data(), k, B.data(), k );
+  xtrsm( "L", "L", "T", "N", k, B.col(), 1.0, G.data(), k, B.data(), k );
+  return true;
+}; /** end SolveSPD() */
+
+
+/**
+ *  @brief G( a, a ) = X( a, : ) * Y( a, : )' for the active rhs a, i.e. 
+ *         the k-by-k block inner product X'Y in the column layout.
+ */ 
+template<typename T>
+void BlockDot( hmlp::Data<T> &X, hmlp::Data<T> &Y, std::vector<size_t> &a, 
+    hmlp::Data<T> &G )
+{
+  G.resize( a.size(), a.size() );
+  for ( size_t q = 0; q < a.size(); q ++ )
+  {
+    for ( size_t l = 0; l < a.size(); l ++ )
+    {
+      T dot = 0.0;
+      for ( size_t j = 0; j < X.col(); j ++ ) dot += X( a[ l ], j ) * Y( a[ q ], j );
+      G( l, q ) = dot;
+    }
+  }
+}; /** end BlockDot() */
+
+
+/**
+ *  @brief Block preconditioned conjugate gradient (O'Leary) for 
+ *         ( K + lambda * I ) X = B with the same arguments as PCG(). 
+ *         The Krylov space is shared by all right hand sides, so it needs
+ *         fewer iterations when they are related, and each step solves 
+ *         the k-by-k systems P'AP * alpha = R'Z and R'Z * beta = R'Z_new. 
+ *         Converged rhs are dropped from the block. If P'AP or R'Z is not
+ *         SPD (the block is rank deficient), it stops with a warning.
+ */ 
+template<typename TREE, typename PTREE, typename T>
+hmlp::Data<T> BlockPCG
+( 
+  TREE &tree, PTREE *ptree, T lambda, hmlp::Data<T> &b, 
+  T tol = 1E-7, size_t maxit = 100 
+)
+{
+  size_t nrhs = b.row();
+  size_t n = b.col();
+
+  if ( ptree ) AssertSymmetricPreconditioner( *ptree, "BlockPCG" );
+
+  hmlp::Data<T> x( nrhs, n, 0.0 ), r = b, z = b, p, Ap( nrhs, n ), pnew, buff;
+  hmlp::Data<T> PAP, RZ, RZ_new, alpha, beta;
+  std::vector<T> bnrm, rnrm;
+  std::vector<size_t> active;
+  bool breakdown = false;
+
+  RowDot( b, b, bnrm );
+  for ( size_t i = 0; i < nrhs; i ++ ) 
+  {
+    bnrm[ i ] = std::sqrt( bnrm[ i ] );
+    if ( bnrm[ i ] > 0.0 ) active.push_back( i );
+  }
+
+  /** Z = M^{-1} R and P = Z */
+  if ( ptree ) Precondition<false>( *ptree, r, z, buff );
+  p = z;
+  BlockDot( r, z, active, RZ );
+
+  size_t iter = 0;
+  T relres = 0.0;
+  for ( iter = 0; iter < maxit && active.size(); iter ++ )
+  {
+    size_t k = active.size();
+
+    /** alpha = inv( P'AP ) * R'Z */
+    ShiftedEvaluate( tree, lambda, p, Ap );
+    BlockDot( p, Ap, active, PAP );
+    alpha = RZ;
+    if ( !SolveSPD( PAP, alpha ) )
+    {
+      printf( "Warning! BlockPCG breakdown, P'AP is not SPD\n" );
+      breakdown = true;
+      break;
+    }
+
+    /** X += P * alpha, R -= AP * alpha */
+    #pragma omp parallel for
+    for ( size_t j = 0; j < n; j ++ )
+    {
+      for ( size_t q = 0; q < k; q ++ )
+      {
+        for ( size_t l = 0; l < k; l ++ )
+        {
+          x( active[ q ], j ) += alpha( l, q ) * p( active[ l ], j );
+          r( active[ q ], j ) -= alpha( l, q ) * Ap( active[ l ], j );
+        }
+      }
+    }
+
+    /** check convergence and drop converged rhs */
+    RowDot( r, r, rnrm );
+    relres = 0.0;
+    std::vector<size_t> keep;
+    for ( size_t q = 0; q < k; q ++ )
+    {
+      T res = std::sqrt( rnrm[ active[ q ] ] ) / bnrm[ active[ q ] ];
+      if ( res >= tol ) keep.push_back( q );
+      relres = std::max( relres, res );
+    }
+    if ( tree.setup.verbose )
+    {
+      printf( "BlockPCG iteration %3lu max relative residual %3.1E, %lu active\n", 
+          iter, relres, keep.size() );
+      fflush( stdout );
+    }
+    if ( !keep.size() ) { iter ++; active.clear(); break; }
+
+    /** restrict R'Z and P to the remaining rhs */
+    hmlp::Data<T> RZ_keep( keep.size(), keep.size() );
+    for ( size_t q = 0; q < keep.size(); q ++ )
+      for ( size_t l = 0; l < keep.size(); l ++ )
+        RZ_keep( l, q ) = RZ( keep[ l ], keep[ q ] );
+    std::vector<size_t> next( keep.size() );
+    for ( size_t q = 0; q < keep.size(); q ++ ) next[ q ] = active[ keep[ q ] ];
+    active = next;
+    k = active.size();
+
+    /** Z = M^{-1} R, beta = inv( R'Z ) * R'Z_new */
+    if ( ptree ) Precondition<false>( *ptree, r, z, buff );
+    else         z = r;
+    BlockDot( r, z, active, RZ_new );
+    beta = RZ_new;
+    if ( !SolveSPD( RZ_keep, beta ) )
+    {
+      printf( "Warning! BlockPCG breakdown, R'Z is not SPD\n" );
+      breakdown = true;
+      break;
+    }
+
+    /** P = Z + P * beta (only the active rows, the others stay unused) */
+    pnew = p;
+    #pragma omp parallel for
+    for ( size_t j = 0; j < n; j ++ )
+    {
+      for ( size_t q = 0; q < k; q ++ )
+      {
+        T sum = z( active[ q ], j );
+        for ( size_t l = 0; l < k; l ++ )
+          sum += beta( l, q ) * p( active[ l ], j );
+        pnew( active[ q ], j ) = sum;
+      }
+    }
+    /** the dropped rows of P must not contribute to AP */
+    std::vector<bool> isactive( nrhs, false );
+    for ( auto i : active ) isactive[ i ] = true;
+    for ( size_t j = 0; j < n; j ++ )
+      for ( size_t i = 0; i < nrhs; i ++ )
+        if ( !isactive[ i ] ) pnew( i, j ) = 0.0;
+    std::swap( p, pnew );
+    RZ = RZ_new;
+  }
+
+  /** report the residual of all rhs */
+  RowDot( r, r, rnrm );
+  relres = 0.0;
+  for ( size_t i = 0; i < nrhs; i ++ )
+    if ( bnrm[ i ] > 0.0 ) relres = std::max( relres, std::sqrt( rnrm[ i ] ) / bnrm[ i ] );
+  printf( "BlockPCG %s in %lu iterations, max relative residual %3.1E\n", 
+      breakdown ? "broke down" : ( relres < tol ? "converged" : "stopped" ), 
+      iter, relres ); fflush( stdout );
+
+  return x;
+
+}; /** end BlockPCG() */
+
+
+/** @brief BlockPCG with the hfamily factorization of ptree as preconditioner. */
+template<typename TREE, typename PTREE, typename T>
+hmlp::Data<T> BlockPCG
+( 
+  TREE &tree, PTREE &ptree, T lambda, hmlp::Data<T> &b, 
+  T tol = 1E-7, size_t maxit = 100 
+)
+{
+  return BlockPCG( tree, &ptree, lambda, b, tol, maxit );
+}; /** end BlockPCG() */
+
+
+/**
+ *  @brief Restarted right-preconditioned GMRES( restart ) for 
+ *         ( K + lambda * I ) x = b. b is nrhs-by-n. All right hand sides
+ *         share one Evaluate() per Arnoldi step, while each rhs keeps its
+ *         own Hessenberg matrix and Givens rotations and drops out once 
+ *         its residual is below tol. The Krylov space is built on 
+ *         ( K + lambda * I ) * M^{-1}, where tree gives the matvec and 
+ *         ptree (if not NULL) holds M from hfamily::Factorize<LU>, so the
+ *         monitored residual is the true one. Unlike PCG(), M does not have
+ *         to be symmetric. The restart + 1 basis vectors are allocated once.
+ */ 
+template<bool LU = true, typename TREE, typename PTREE, typename T>
+hmlp::Data<T> GMRES
+( 
+  TREE &tree, PTREE *ptree, T lambda, hmlp::Data<T> &b, 
+  T tol = 1E-7, size_t maxit = 100, size_t restart = 30 
+)
+{
+  size_t nrhs = b.row();
+  size_t n = b.col();
+  size_t mk = std::max( restart, (size_t)1 );
+
+  hmlp::Data<T> x( nrhs, n, 0.0 ), r( nrhs, n ), w( nrhs, n ), z( nrhs, n ), buff;
+  std::vector<hmlp::Data<T>> V( mk + 1, hmlp::Data<T>( nrhs, n ) );
+
+  /** per rhs Hessenberg ( mk + 1 )-by-mk, rotations and residual vector */
+  std::vector<hmlp::Data<T>> H( nrhs, hmlp::Data<T>( mk + 1, mk ) );
+  std::vector<std::vector<T>> cs( nrhs ), sn( nrhs ), g( nrhs );
+  std::vector<size_t> kdim( nrhs );
+  std::vector<bool> active( nrhs );
+  std::vector<T> bnrm, beta, dot;
+
+  RowDot( b, b, bnrm );
+  for ( size_t i = 0; i < nrhs; i ++ ) bnrm[ i ] = std::sqrt( bnrm[ i ] );
+
+  size_t iter = 0;
+  T relres = 0.0;
+  while ( iter < maxit )
+  {
+    /** r = b - ( K + lambda * I ) x */
+    if ( iter ) 
+    {
+      ShiftedEvaluate( tree, lambda, x, w );
+      for ( size_t i = 0; i < r.size(); i ++ ) r[ i ] = b[ i ] - w[ i ];
+    }
+    else r = b;
+
+    RowDot( r, r, beta );
+    relres = 0.0;
+    for ( size_t i = 0; i < nrhs; i ++ )
+    {
+      beta[ i ] = std::sqrt( beta[ i ] );
+      T res = bnrm[ i ] ? beta[ i ] / bnrm[ i ] : 0.0;
+      active[ i ] = ( res >= tol );
+      relres = std::max( relres, res );
+      cs[ i ].assign( mk, 0.0 );
+      sn[ i ].assign( mk, 0.0 );
+      g[ i ].assign( mk + 1, 0.0 );
+      g[ i ][ 0 ] = beta[ i ];
+      kdim[ i ] = 0;
+    }
+    if ( std::find( active.begin(), active.end(), true ) == active.end() ) break;
+
+    /** V[ 0 ] = r / beta */
+    for ( size_t j = 0; j < n; j ++ )
+      for ( size_t i = 0; i < nrhs; i ++ )
+        V[ 0 ]( i, j ) = active[ i ] ? r( i, j ) / beta[ i ] : 0.0;
+
+    for ( size_t k = 0; k < mk && iter < maxit; k ++, iter ++ )
+    {
+      /** w = ( K + lambda * I ) * M^{-1} * V[ k ] */
+      if ( ptree ) 
+      {
+        Precondition<LU>( *ptree, V[ k ], z, buff );
+        ShiftedEvaluate( tree, lambda, z, w );
+      }
+      else ShiftedEvaluate( tree, lambda, V[ k ], w );
+
+      /** modified Gram-Schmidt */
+      for ( size_t l = 0; l <= k; l ++ )
+      {
+        RowDot( w, V[ l ], dot );
+        for ( size_t i = 0; i < nrhs; i ++ ) H[ i ]( l, k ) = dot[ i ];
+        #pragma omp parallel for
+        for ( size_t j = 0; j < n; j ++ )
+          for ( size_t i = 0; i < nrhs; i ++ )
+            w( i, j ) -= dot[ i ] * V[ l ]( i, j );
+      }
+      RowDot( w, w, dot );
+
+      relres = 0.0;
+      for ( size_t i = 0; i < nrhs; i ++ )
+      {
+        auto &h = H[ i ];
+        h( k + 1, k ) = std::sqrt( dot[ i ] );
+        if ( !active[ i ] ) continue;
+
+        /** apply previous rotations to the new column */
+        for ( size_t l = 0; l < k; l ++ )
+        {
+          T tmp = cs[ i ][ l ] * h( l, k ) + sn[ i ][ l ] * h( l + 1, k );
+          h( l + 1, k ) = -sn[ i ][ l ] * h( l, k ) + cs[ i ][ l ] * h( l + 1, k );
+          h( l, k ) = tmp;
+        }
+        /** new rotation to eliminate h( k + 1, k ) */
+        T rho = std::sqrt( h( k, k ) * h( k, k ) + h( k + 1, k ) * h( k + 1, k ) );
+        cs[ i ][ k ] = rho ? h( k, k ) / rho : 1.0;
+        sn[ i ][ k ] = rho ? h( k + 1, k ) / rho : 0.0;
+        T hnext = h( k + 1, k );
+        h( k, k ) = rho;
+        h( k + 1, k ) = 0.0;
+        g[ i ][ k + 1 ] = -sn[ i ][ k ] * g[ i ][ k ];
+        g[ i ][ k ] = cs[ i ][ k ] * g[ i ][ k ];
+        kdim[ i ] = k + 1;
+
+        T res = std::fabs( g[ i ][ k + 1 ] ) / bnrm[ i ];
+        relres = std::max( relres, res );
+        /** converged or lucky breakdown */
+        if ( res < tol || hnext == 0.0 ) active[ i ] = false;
+        else dot[ i ] = hnext;
+      }
+
+      /** V[ k + 1 ] = w / h( k + 1, k ) for active rhs */
+      #pragma omp parallel for
+      for ( size_t j = 0; j < n; j ++ )
+        for ( size_t i = 0; i < nrhs; i ++ )
+          V[ k + 1 ]( i, j ) = active[ i ] ? w( i, j ) / dot[ i ] : 0.0;
+
+      if ( tree.setup.verbose )
+      {
+        printf( "GMRES iteration %3lu max relative residual %3.1E\n", iter, relres );
+        fflush( stdout );
+      }
+
+      if ( std::find( active.begin(), active.end(), true ) == active.end() ) 
+      {
+        iter ++;
+        break;
+      }
+    }
+
+    /** y = inv( H ) * g and w = V * y */
+    std::fill( w.begin(), w.end(), 0.0 );
+    for ( size_t i = 0; i < nrhs; i ++ )
+    {
+      auto &h = H[ i ];
+      std::vector<T> y( kdim[ i ], 0.0 );
+      for ( size_t l = kdim[ i ]; l -- > 0; )
+      {
+        T sum = g[ i ][ l ];
+        for ( size_t q = l + 1; q < kdim[ i ]; q ++ ) sum -= h( l, q ) * y[ q ];
+        y[ l ] = sum / h( l, l );
+      }
+      for ( size_t l = 0; l < kdim[ i ]; l ++ )
+        for ( size_t j = 0; j < n; j ++ )
+          w( i, j ) += y[ l ] * V[ l ]( i, j );
+    }
+
+    /** x += M^{-1} * w */
+    if ( ptree ) Precondition<LU>( *ptree, w, z, buff );
+    else         z = w;
+    for ( size_t i = 0; i < x.size(); i ++ ) x[ i ] += z[ i ];
+  }
+
+  printf( "GMRES %s in %lu iterations, max relative residual %3.1E\n", 
+      relres < tol ? "converged" : "stopped", iter, relres ); fflush( stdout );
+
+  return x;
+
+}; /** end GMRES() */
+
+
+/** @brief GMRES with the hfamily factorization of ptree as preconditioner. */
+template<bool LU = true, typename TREE, typename PTREE, typename T>
+hmlp::Data<T> GMRES
+( 
+  TREE &tree, PTREE &ptree, T lambda, hmlp::Data<T> &b, 
+  T tol = 1E-7, size_t maxit = 100, size_t restart = 30 
+)
+{
+  return GMRES<LU>( tree, &ptree, lambda, b, tol, maxit, restart );
+}; /** end GMRES() */
+
+
+/** @brief GMRES without preconditioner. */
+template<typename TREE, typename T>
+hmlp::Data<T> GMRES
+( 
+  TREE &tree, T lambda, hmlp::Data<T> &b, 
+  T tol = 1E-7, size_t maxit = 100, size_t restart = 30 
+)
+{
+  return GMRES( tree, (TREE*)NULL, lambda, b, tol, maxit, restart );
+}; /** end GMRES() */
+
+
+
+
+
+/**
+ *  @brielf template of the compress routine
+ */ 
+template<
+  bool        ADAPTIVE, 
+  bool        LEVELRESTRICTION, 
+  typename    SPLITTER, 
+  typename    RKDTSPLITTER, 
   typename    T, 
   typename    SPDMATRIX>
 hmlp::tree::Tree<
@@ -3840,7 +5952,7 @@ hmlp::tree::Tree<
   if ( NN.size() != n * k )
   {
     NN = rkdt.template AllNearestNeighbor<SORTED>
-         ( n_iter, k, 10, gids, lids, initNN, knntask );
+         ( n_iter, k, 10, gids, lids, initNN, knntask, config.ConcurrentTrees() );
   }
   else
   {
@@ -3879,9 +5991,12 @@ hmlp::tree::Tree<
   tree.setup.k = k;
   tree.setup.s = s;
   tree.setup.stol = stol;
+  tree.setup.cache_budget = config.CacheBudget();
+  tree.setup.verbose = config.Verbose();
   printf( "TreePartitioning ...\n" ); fflush( stdout );
   beg = omp_get_wtime();
   tree.TreePartition( gids, lids );
+  if ( config.TreeOrder() ) PermuteMatrix( K, tree.treelist[ 0 ]->gids );
   tree_time = omp_get_wtime() - beg;
 
 
@@ -3915,7 +6030,7 @@ hmlp::tree::Tree<
   tree.template TraverseUp       <AUTODEPENDENCY, true>( skeltask );
   nearnodestask->DependencyAnalysis();
   tree.template TraverseUnOrdered<AUTODEPENDENCY, true>( projtask );
-  if ( CACHE )
+  if ( CACHE && !config.CacheBudget() )
     tree.template TraverseLeafs  <AUTODEPENDENCY, true>( cachenearnodestask );
   printf( "before run\n" ); fflush( stdout );
   other_time += omp_get_wtime() - beg;
@@ -3940,7 +6055,7 @@ hmlp::tree::Tree<
     printf( "Skeletonization (Level-By-Level) ...\n" ); fflush( stdout );
     tree.template TraverseUp       <false, false>( skeltask );
     tree.template TraverseUnOrdered<false, false>( projtask );
-    if ( CACHE )
+    if ( CACHE && !config.CacheBudget() )
       tree.template TraverseLeafs  <false, false>( cachenearnodestask );
   }
   ref_time = omp_get_wtime() - beg;
@@ -3953,7 +6068,7 @@ hmlp::tree::Tree<
     printf( "Skeletonization (Recursive OpenMP tasks) ...\n" ); fflush( stdout );
     tree.template PostOrder<true>( tree.treelist[ 0 ], skeltask );
     tree.template TraverseUnOrdered<false, false>( projtask );
-    if ( CACHE )
+    if ( CACHE && !config.CacheBudget() )
       tree.template TraverseLeafs  <false, false>( cachenearnodestask );
   }
   omptask_time = omp_get_wtime() - beg;
@@ -3964,7 +6079,7 @@ hmlp::tree::Tree<
   {
     printf( "Skeletonization (OpenMP-4.5 Dependency tasks) ...\n" ); fflush( stdout );
     tree.template UpDown<true, true, false>( skeltask, projtask, projtask );
-    if ( CACHE )
+    if ( CACHE && !config.CacheBudget() )
       tree.template TraverseLeafs  <false, false>( cachenearnodestask );
   }
   omptask45_time = omp_get_wtime() - beg;
@@ -3974,12 +6089,15 @@ hmlp::tree::Tree<
   beg = omp_get_wtime();
   printf( "MergeFarNodes ...\n" ); fflush( stdout );
   hmlp::gofmm::MergeFarNodes<SYMMETRIC>( tree );
+  hmlp::gofmm::FreezeInteractionLists<NNPRUNE>( tree );
   mergefarnodes_time = omp_get_wtime() - beg;
 
   /** CacheFarNodes */
   beg = omp_get_wtime();
   printf( "CacheFarNodes ...\n" ); fflush( stdout );
   hmlp::gofmm::CacheFarNodes<NNPRUNE, CACHE>( tree );
+  if ( config.MixedPrecision() ) 
+    hmlp::gofmm::ConvertToMixedPrecision( tree );
   cachefarnodes_time = omp_get_wtime() - beg;
 
   /** plot iteraction matrix */  
@@ -4125,6 +6243,439 @@ hmlp::tree::Tree<
 
 
 
+/**
+ *  @brief Non-symmetric (cross) kernel summation u = K( targets, sources ) * w,
+ *         e.g. test points against training points.
+ *
+ *         Targets and sources are partitioned by two trees, rtree (rows)
+ *         and ctree (columns), with the geometric splitter. A dual-tree
+ *         traversal puts well-separated pairs ( alpha, beta ) in the 
+ *         FarList of the row node alpha (and alpha in the FarList of the
+ *         column node beta); the remaining leaf pairs go to NearList.
+ *         Column nodes are skeletonized by the ID of K( targets, cands ),
+ *         row nodes by the ID of K( cands, sources )', both nested like
+ *         Skeletonize(). The rows (columns) are sampled from the far 
+ *         targets (sources) of the node and its ancestors, which are the
+ *         only ones its skeletons have to represent. Near and far Kab are
+ *         cached, and Evaluate() runs N2S on ctree, S2S and L2L, and S2N
+ *         on rtree level by level, so a matvec costs O( M + N ).
+ *         Only KernelMatrix is supported (the traversal needs coordinates).
+ */ 
+template<typename T>
+class CrossKernel
+{
+  public:
+
+    using MATRIX   = hmlp::KernelMatrix<T>;
+    using SPLITTER = hmlp::tree::centersplit<N_CHILDREN, T>;
+    using TREE     = hmlp::tree::Tree<
+      hmlp::gofmm::Setup<MATRIX, SPLITTER, T>, hmlp::gofmm::Data<T>, N_CHILDREN, T>;
+    using NODE     = typename TREE::NODE;
+
+    CrossKernel
+    ( 
+      kernel_s<T> &kernel, 
+      hmlp::Data<T> &user_targets, hmlp::Data<T> &user_sources,
+      size_t m, size_t s, T stol
+    )
+    : M( user_targets.col() ), N( user_sources.col() ), d( user_sources.row() ),
+      targets( user_targets ), sources( user_sources ),
+      K( user_targets.col(), user_sources.col(), user_sources.row(), 
+         kernel, sources, targets )
+    {
+      assert( targets.row() == d );
+      double beg = omp_get_wtime();
+
+      /** separate row and column trees */
+      Partition( rtree, targets, m, s, stol );
+      Partition( ctree, sources, m, s, stol );
+      Bounds( rtree, targets, rcenter, rradius );
+      Bounds( ctree, sources, ccenter, cradius );
+
+      /** interaction lists */
+      Interact( rtree.treelist[ 0 ], ctree.treelist[ 0 ] );
+
+      /** row and column skeletons, bottom up */
+      for ( int l = ctree.depth; l >= 0; l -- )
+        TraverseLevel( ctree, l, [ & ] ( NODE *node ) { Skeletonize( node, true ); } );
+      for ( int l = rtree.depth; l >= 0; l -- )
+        TraverseLevel( rtree, l, [ & ] ( NODE *node ) { Skeletonize( node, false ); } );
+
+      /** cache K( alpha skels, Far( alpha ) skels ) and K( alpha, Near( alpha ) ) */
+      size_t n_far = 0, n_near = 0;
+      #pragma omp parallel for schedule( dynamic ) reduction( +:n_far,n_near )
+      for ( size_t i = 0; i < rtree.treelist.size(); i ++ )
+      {
+        auto *node = rtree.treelist[ i ];
+        auto &data = node->data;
+        if ( data.isskel )
+        {
+          std::vector<size_t> bmap;
+          data.FarOffset.clear();
+          for ( auto *beta : node->FarList )
+          {
+            assert( beta->data.isskel );
+            data.FarOffset.push_back( bmap.size() );
+            bmap.insert( bmap.end(), beta->data.skels.begin(), beta->data.skels.end() );
+          }
+          data.FarKab = K( data.skels, bmap );
+        }
+        if ( node->isleaf )
+        {
+          std::vector<size_t> bmap;
+          data.NearOffset.clear();
+          for ( auto *beta : node->NearList )
+          {
+            data.NearOffset.push_back( bmap.size() );
+            bmap.insert( bmap.end(), beta->lids.begin(), beta->lids.end() );
+          }
+          data.NearKab = K( node->lids, bmap );
+        }
+        n_far += node->FarList.size();
+        n_near += node->NearList.size();
+      }
+
+      printf( "CrossKernel: %lu targets %lu sources, %lu far %lu near pairs, %.2lfs\n", 
+          M, N, n_far, n_near, omp_get_wtime() - beg ); fflush( stdout );
+    };
+
+    /** nrhs-by-N weights on the sources, return nrhs-by-M potentials */
+    hmlp::Data<T> Evaluate( hmlp::Data<T> &weights )
+    {
+      assert( weights.col() == N );
+      size_t nrhs = weights.row();
+      hmlp::Data<T> potentials( nrhs, M );
+
+      /** N2S: column skeleton weights, bottom up */
+      for ( int l = ctree.depth; l >= 0; l -- )
+      {
+        TraverseLevel( ctree, l, [ & ] ( NODE *node ) 
+        {
+          auto &data = node->data;
+          auto &proj = data.proj;
+          auto &w_skel = data.w_skel;
+          if ( node->isleaf ) weights.GatherColumns( true, node->lids, data.w_leaf );
+          if ( !data.isskel ) return;
+          w_skel.resize( data.skels.size(), nrhs );
+          if ( node->isleaf )
+          {
+            auto &w_leaf = data.w_leaf;
+            xgemm( "N", "N", w_skel.row(), nrhs, w_leaf.row(),
+              1.0, proj.data(), proj.row(), w_leaf.data(), w_leaf.row(),
+              0.0, w_skel.data(), w_skel.row() );
+          }
+          else
+          {
+            auto &w_lskel = node->lchild->data.w_skel;
+            auto &w_rskel = node->rchild->data.w_skel;
+            xgemm( "N", "N", w_skel.row(), nrhs, w_lskel.row(),
+              1.0, proj.data(), proj.row(), w_lskel.data(), w_lskel.row(),
+              0.0, w_skel.data(), w_skel.row() );
+            xgemm( "N", "N", w_skel.row(), nrhs, w_rskel.row(),
+              1.0, proj.data() + proj.row() * w_lskel.row(), proj.row(), 
+                   w_rskel.data(), w_rskel.row(),
+              1.0, w_skel.data(), w_skel.row() );
+          }
+        } );
+      }
+
+      /** S2S and L2L on all row nodes */
+      #pragma omp parallel for schedule( dynamic )
+      for ( size_t i = 0; i < rtree.treelist.size(); i ++ )
+      {
+        auto *node = rtree.treelist[ i ];
+        auto &data = node->data;
+        if ( data.isskel )
+        {
+          auto &u_skel = data.u_skel;
+          u_skel.resize( 0, 0 );
+          u_skel.resize( data.skels.size(), nrhs, 0.0 );
+          std::vector<T*> Barray;
+          std::vector<size_t> karray;
+          for ( auto *beta : node->FarList )
+          {
+            Barray.push_back( beta->data.w_skel.data() );
+            karray.push_back( beta->data.w_skel.row() );
+          }
+          GroupedGemm( u_skel.row(), nrhs, data.FarKab.data(), data.FarKab.row(),
+              Barray, karray, data.FarOffset, u_skel.data(), u_skel.row() );
+        }
+        if ( node->isleaf )
+        {
+          auto &u_leaf = data.u_leaf[ 0 ];
+          u_leaf.resize( 0, 0 );
+          u_leaf.resize( node->lids.size(), nrhs, 0.0 );
+          std::vector<T*> Barray;
+          std::vector<size_t> karray;
+          for ( auto *beta : node->NearList )
+          {
+            Barray.push_back( beta->data.w_leaf.data() );
+            karray.push_back( beta->data.w_leaf.row() );
+          }
+          GroupedGemm( u_leaf.row(), nrhs, data.NearKab.data(), data.NearKab.row(),
+              Barray, karray, data.NearOffset, u_leaf.data(), u_leaf.row() );
+        }
+      }
+
+      /** S2N: row skeleton potentials, top down */
+      for ( size_t l = 0; l <= rtree.depth; l ++ )
+      {
+        TraverseLevel( rtree, l, [ & ] ( NODE *node ) 
+        {
+          auto &data = node->data;
+          auto &proj = data.proj;
+          auto &u_skel = data.u_skel;
+          if ( data.isskel && node->isleaf )
+          {
+            auto &u_leaf = data.u_leaf[ 0 ];
+            xgemm( "T", "N", u_leaf.row(), nrhs, u_skel.row(),
+              1.0, proj.data(), proj.row(), u_skel.data(), u_skel.row(),
+              1.0, u_leaf.data(), u_leaf.row() );
+          }
+          else if ( data.isskel )
+          {
+            auto &u_lskel = node->lchild->data.u_skel;
+            auto &u_rskel = node->rchild->data.u_skel;
+            xgemm( "T", "N", u_lskel.row(), nrhs, u_skel.row(),
+              1.0, proj.data(), proj.row(), u_skel.data(), u_skel.row(),
+              1.0, u_lskel.data(), u_lskel.row() );
+            xgemm( "T", "N", u_rskel.row(), nrhs, u_skel.row(),
+              1.0, proj.data() + proj.row() * u_lskel.row(), proj.row(), 
+                   u_skel.data(), u_skel.row(),
+              1.0, u_rskel.data(), u_rskel.row() );
+          }
+          /** u_leaf is complete, assemble it back to the targets */
+          if ( node->isleaf )
+          {
+            auto &lids = node->lids;
+            auto &u_leaf = data.u_leaf[ 0 ];
+            for ( size_t j = 0; j < lids.size(); j ++ )
+              for ( size_t i = 0; i < nrhs; i ++ )
+                potentials( i, lids[ j ] ) = u_leaf( j, i );
+          }
+        } );
+      }
+
+      return potentials;
+    };
+
+    /** row (target) and column (source) trees */
+    TREE rtree;
+    TREE ctree;
+
+  private:
+
+    /** number of targets, sources and the dimension */
+    size_t M = 0;
+    size_t N = 0;
+    size_t d = 0;
+
+    /** coordinates of the targets and sources, and K( targets, sources ) */
+    hmlp::Data<T> targets;
+    hmlp::Data<T> sources;
+    MATRIX K;
+
+    /** bounding balls of the tree nodes (indexed by treelist_id) */
+    std::vector<T> rcenter, rradius;
+    std::vector<T> ccenter, cradius;
+
+    template<typename FUNC>
+    void TraverseLevel( TREE &tree, size_t l, FUNC func )
+    {
+      int n_nodes = 1 << l;
+      auto level_beg = tree.treelist.begin() + n_nodes - 1;
+      #pragma omp parallel for schedule( dynamic )
+      for ( int node_ind = 0; node_ind < n_nodes; node_ind ++ )
+        func( *(level_beg + node_ind) );
+    };
+
+    void Partition( TREE &tree, hmlp::Data<T> &X, size_t m, size_t s, T stol )
+    {
+      std::vector<size_t> gids( X.col() ), lids( X.col() );
+      for ( size_t i = 0; i < X.col(); i ++ ) gids[ i ] = lids[ i ] = i;
+      tree.setup.X = &X;
+      tree.setup.K = &K;
+      tree.setup.NN = NULL;
+      tree.setup.splitter.Coordinate = &X;
+      tree.setup.m = m;
+      tree.setup.s = s;
+      tree.setup.stol = stol;
+      tree.TreePartition( gids, lids );
+    };
+
+    /** center and radius of the points of each node */
+    void Bounds( TREE &tree, hmlp::Data<T> &X, std::vector<T> &center, std::vector<T> &radius )
+    {
+      center.resize( d * tree.treelist.size() );
+      radius.resize( tree.treelist.size() );
+      #pragma omp parallel for schedule( dynamic )
+      for ( size_t i = 0; i < tree.treelist.size(); i ++ )
+      {
+        auto &lids = tree.treelist[ i ]->lids;
+        T *c = center.data() + i * d;
+        for ( size_t p = 0; p < d; p ++ ) c[ p ] = 0.0;
+        for ( auto j : lids )
+          for ( size_t p = 0; p < d; p ++ ) c[ p ] += X( p, j ) / lids.size();
+        T r2 = 0.0;
+        for ( auto j : lids )
+        {
+          T dist2 = 0.0;
+          for ( size_t p = 0; p < d; p ++ ) 
+            dist2 += ( X( p, j ) - c[ p ] ) * ( X( p, j ) - c[ p ] );
+          r2 = std::max( r2, dist2 );
+        }
+        radius[ i ] = std::sqrt( r2 );
+      }
+    };
+
+    /** 
+     *  Dual-tree traversal. The pair is far when the gap between the
+     *  balls exceeds half the larger radius; otherwise the larger node
+     *  is split.
+     */ 
+    void Interact( NODE *alpha, NODE *beta )
+    {
+      T ra = rradius[ alpha->treelist_id ];
+      T rb = cradius[ beta->treelist_id ];
+      T *ca = rcenter.data() + alpha->treelist_id * d;
+      T *cb = ccenter.data() + beta->treelist_id * d;
+      T dist2 = 0.0;
+      for ( size_t p = 0; p < d; p ++ ) dist2 += ( ca[ p ] - cb[ p ] ) * ( ca[ p ] - cb[ p ] );
+
+      if ( std::sqrt( dist2 ) - ra - rb > 0.5 * std::max( ra, rb ) )
+      {
+        alpha->FarList.push_back( beta );
+        beta->FarList.push_back( alpha );
+      }
+      else if ( alpha->isleaf && beta->isleaf )
+      {
+        alpha->NearList.push_back( beta );
+      }
+      else if ( beta->isleaf || ( !alpha->isleaf && ra >= rb ) )
+      {
+        Interact( alpha->lchild, beta );
+        Interact( alpha->rchild, beta );
+      }
+      else
+      {
+        Interact( alpha, beta->lchild );
+        Interact( alpha, beta->rchild );
+      }
+    };
+
+    /** 
+     *  Add up to count new random points of nodes (disjoint, of which
+     *  n_sampled are in sampled already) to amap. Return the number added.
+     */
+    size_t Sample( std::vector<NODE*> &nodes, size_t count, size_t n_sampled,
+        std::unordered_set<size_t> &sampled, std::vector<size_t> &amap )
+    {
+      size_t total = 0, n_added = amap.size();
+      for ( auto *node : nodes ) total += node->lids.size();
+      if ( total <= count + n_sampled )
+      {
+        for ( auto *node : nodes )
+          for ( auto j : node->lids )
+            if ( sampled.insert( j ).second ) amap.push_back( j );
+        return amap.size() - n_added;
+      }
+      size_t target = amap.size() + count;
+      while ( amap.size() < target )
+      {
+        size_t r = rand() % total;
+        for ( auto *node : nodes )
+        {
+          if ( r < node->lids.size() )
+          {
+            if ( sampled.insert( node->lids[ r ] ).second ) 
+              amap.push_back( node->lids[ r ] );
+            break;
+          }
+          r -= node->lids.size();
+        }
+      }
+      return count;
+    };
+
+    /** 
+     *  Column (row) skeletons of a ctree (rtree) node, candidates are the 
+     *  lids of a leaf or the skeletons of both children.
+     */ 
+    void Skeletonize( NODE *node, bool column )
+    {
+      auto &data = node->data;
+      data.isskel = false;
+      data.skels.clear();
+      data.proj.resize( 0, 0 );
+
+      /** far nodes (in the other tree) of the node and of its ancestors */
+      std::vector<NODE*> inherited;
+      for ( auto *a = node->parent; a; a = a->parent )
+        inherited.insert( inherited.end(), a->FarList.begin(), a->FarList.end() );
+      if ( !node->FarList.size() && !inherited.size() ) return;
+
+      std::vector<size_t> bmap;
+      if ( node->isleaf ) 
+      {
+        bmap = node->lids;
+      }
+      else
+      {
+        auto &lskels = node->lchild->data.skels;
+        auto &rskels = node->rchild->data.skels;
+        assert( node->lchild->data.isskel && node->rchild->data.isskel );
+        bmap = lskels;
+        bmap.insert( bmap.end(), rskels.begin(), rskels.end() );
+      }
+
+      /** half of the samples from my own far nodes, which are the closest */
+      size_t n_other = column ? M : N;
+      size_t n_own = column ? N : M;
+      size_t nsamples = std::max( 2 * bmap.size(), 2 * node->setup->m );
+      std::vector<size_t> amap;
+      std::unordered_set<size_t> sampled;
+      size_t n_near = Sample( node->FarList, nsamples / 2, 0, sampled, amap );
+      Sample( inherited, nsamples - amap.size(), 0, sampled, amap );
+      Sample( node->FarList, nsamples - amap.size(), n_near, sampled, amap );
+      /** the ID needs at least as many rows as candidates */
+      while ( amap.size() < bmap.size() ) amap.push_back( rand() % n_other );
+
+      /** Kab is samples-by-candidates */
+      hmlp::Data<T> Kab;
+      if ( column ) 
+      {
+        Kab = K( amap, bmap );
+      }
+      else
+      {
+        auto Kba = K( bmap, amap );
+        Kab.resize( amap.size(), bmap.size() );
+        for ( size_t j = 0; j < bmap.size(); j ++ )
+          for ( size_t i = 0; i < amap.size(); i ++ ) Kab( i, j ) = Kba( j, i );
+      }
+
+      /** scale the tolerance as in Skeletonize() */
+      size_t q = node->lids.size();
+      T scaled_stol = node->setup->stol 
+        * std::sqrt( (T)bmap.size() / q ) * std::sqrt( (T)amap.size() / n_other )
+        * std::sqrt( (T)q / n_own );
+
+      hmlp::lowrank::id<true, false>
+      ( 
+        amap.size(), bmap.size(), node->setup->s, scaled_stol,
+        Kab, data.skels, data.proj, data.jpvt
+      );
+      for ( auto &skel : data.skels ) skel = bmap[ skel ];
+      data.isskel = true;
+
+      /** proj = inv( R11 ) * [ R11 R12 ] */
+      Interpolate<NODE, T>( node );
+    };
+
+}; /** end class CrossKernel */
+
+
+
 
 
 ///**
@@ -187,9 +187,7 @@ void SkeletonsToNodes( DEVICE *dev, NODE *node )
 
   if ( node->isleaf )
   {
-    std::set<NODE*> *NearNodes;
-    if ( NNPRUNE ) NearNodes = &node->NNNearNodes;
-    else           NearNodes = &node->NearNodes;
+    auto *NearNodes = NNPRUNE ? &node->NNNearList : &node->NearList;
     auto &amap = node->lids;
     auto &u_leaf = node->data.u_leaf[ 0 ];
 
@@ -416,9 +414,7 @@ void LeavesToLeaves( DEVICE *dev, NODE *node )
   else
   {
     //printf( "cpu gemm begin\n" ); fflush( stdout );
-    std::set<NODE*> *NearNodes;
-    if ( NNPRUNE ) NearNodes = &node->NNNearNodes;
-    else           NearNodes = &node->NearNodes;
+    auto *NearNodes = NNPRUNE ? &node->NNNearList : &node->NearList;
 
     size_t n = w_leaf.col();
     size_t k = NearKab.row();
@@ -498,8 +494,7 @@ class LeavesToLeavesVer2Task : public hmlp::Task
       auto *node = arg;
       auto &data = node->data;
       auto &w_leaf = data.w_leaf;
-      auto *NearNodes = &node->NearNodes;
-      if ( NNPRUNE ) NearNodes = &node->NNNearNodes;
+      auto *NearNodes = NNPRUNE ? &node->NNNearList : &node->NearList;
       auto &amap = node->lids;
 
       if ( !CACHE )
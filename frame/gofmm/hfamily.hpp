@@ -109,8 +109,9 @@ class Factor
       assert( isleaf );
       assert( Kaa.row() == n ); assert( Kaa.col() == n );
 
-      /** initialize */
+      /** initialize (and drop the eigen factor if there is one) */
       Z = Kaa;
+      Sigma.resize( 0, 0 );
 
       /** LU or Cholesky factorization */
       if ( LU ) 
@@ -136,15 +137,168 @@ class Factor
         if ( 1.0 / rcond1 > 1E+6 )
           printf( "Warning! large 1-norm condition number %3.1E, nrm1( Z ) %3.1E\n", 
               1.0 / rcond1, nrm1 );
+
+        /** log| Kaa | */
+        LogDetLU();
       }
       else /** Cholesky factorization */ 
       {
-        xpotrf( "L", n, Z.data(), n );
+        ipiv.clear();
+
+        if ( xpotrf( "L", n, Z.data(), n ) )
+        {
+          /** not SPD, use the symmetric square root of | Kaa | instead */
+          printf( "Warning! leaf Kaa is not SPD, use | Kaa |\n" );
+          EigenFactorize( Kaa );
+          EigenShift( 0.0 );
+          return;
+        }
+
+        /** log| Kaa | = 2 * sum( log( diag( L ) ) ) */
+        logdet = 0.0; detsign = 1.0;
+        for ( size_t i = 0; i < n; i ++ ) 
+          logdet += 2.0 * std::log( Z( i, i ) );
       }
     }; /** end Factorize() */
 
 
-    /** generate symmetric factorization I + UCU' = ( I + UXU' )( I + UXU' )' */
+    /**
+     *  @brief log| det( Z ) | and sign( det( Z ) ) from the pivoted LU 
+     *         factors of Z.
+     */ 
+    void LogDetLU()
+    {
+      assert( ipiv.size() == Z.row() );
+      logdet = 0.0; detsign = 1.0;
+      for ( size_t i = 0; i < Z.row(); i ++ )
+      {
+        T zii = Z( i, i );
+        logdet += std::log( std::abs( zii ) );
+        if ( zii < 0.0 ) detsign = -detsign;
+        /** ipiv is 1-base */
+        if ( ipiv[ i ] != (int)( i + 1 ) ) detsign = -detsign;
+      }
+    }; /** end LogDetLU() */
+
+
+    /**
+     *  @brief Leaf factorization by eigendecomposition Kaa = Q * Sigma * Q',
+     *         where Q overwrites Z. This does not depend on lambda, so it is
+     *         only computed once. EigenShift() then sets the regularization.
+     */ 
+    void EigenFactorize( hmlp::Data<T> &Kaa )
+    {
+      assert( isleaf );
+      assert( Kaa.row() == n ); assert( Kaa.col() == n );
+
+      /** initialize */
+      Z = Kaa;
+      Sigma.resize( n, 1, 0.0 );
+      ipiv.clear();
+
+      /** symmetric eigendecomposition (only the lower triangle is read) */
+      SymmetricEigen( n, Z.data(), Sigma.data() );
+    }; /** end EigenFactorize() */
+
+
+    /**
+     *  @brief A = Q * diag( w ) * Q' for an m-by-m symmetric A (Q overwrites A).
+     *         The workspace size comes from an lwork = -1 query, which is 
+     *         only repeated when m changes.
+     */ 
+    void SymmetricEigen( size_t m, T *A, T *w )
+    {
+      if ( syevwork_m != m )
+      {
+        T query = 0.0;
+        xsyev( "V", "L", m, A, m, w, &query, -1 );
+        syevwork.resize( std::max( (size_t)1, (size_t)query ), 1 );
+        syevwork_m = m;
+      }
+      xsyev( "V", "L", m, A, m, w, syevwork.data(), syevwork.size() );
+    }; /** end SymmetricEigen() */
+
+
+    /**
+     *  @brief Shift the eigen factor to inv( Q * ( Sigma + lambda * I ) * Q' ). 
+     *         This is O( n ) and replaces the O( n^3 ) LU for a new lambda.
+     */ 
+    void EigenShift( T lambda )
+    {
+      assert( isleaf && Sigma.size() == n );
+
+      shift = lambda;
+
+      /** 2-norm condition number of Sigma + lambda * I */
+      T smin = std::numeric_limits<T>::max(), smax = 0.0;
+      for ( size_t i = 0; i < n; i ++ )
+      {
+        T sigma = std::abs( Sigma[ i ] + shift );
+        smin = std::min( smin, sigma );
+        smax = std::max( smax, sigma );
+      }
+      if ( smax > 1E+6 * smin )
+        printf( "Warning! large 2-norm condition number %3.1E, lambda %3.1E\n", 
+            smax / smin, lambda );
+
+      /** log| Kaa + lambda * I | = sum( log( Sigma + lambda ) ) */
+      logdet = 0.0; detsign = 1.0;
+      for ( size_t i = 0; i < n; i ++ )
+      {
+        logdet += std::log( std::abs( Sigma[ i ] + shift ) );
+        if ( Sigma[ i ] + shift < 0.0 ) detsign = -detsign;
+      }
+    }; /** end EigenShift() */
+
+
+    /**
+     *  @brief B = Q * ( Sigma + lambda * I )^{-1} * Q' * B (LU) or 
+     *         B = Q * | Sigma + lambda * I |^{-1/2} * Q' * B (Cholesky).
+     *         The symmetric square root plays the role of both L and L'.
+     */ 
+    void EigenSolve( bool LU, T *B, size_t ldb, size_t nrhs )
+    {
+      assert( isleaf && Sigma.size() == n );
+
+      /** the buffer is kept, so a lambda sweep does not reallocate it */
+      auto &QtB = eigbuff;
+      QtB.resize( n, nrhs );
+
+      /** QtB = Q' * B */
+      xgemm( "T", "N", n, nrhs, n, 
+          1.0,   Z.data(), n, 
+                        B, ldb, 
+          0.0, QtB.data(), n );
+
+      /** QtB = ( Sigma + lambda * I )^{-1} * QtB */
+      for ( size_t j = 0; j < nrhs; j ++ )
+      {
+        for ( size_t i = 0; i < n; i ++ )
+        {
+          T sigma = Sigma[ i ] + shift;
+          if ( LU ) QtB( i, j ) /= sigma;
+          else      QtB( i, j ) /= std::sqrt( std::abs( sigma ) );
+        }
+      }
+
+      /** B = Q * QtB */
+      xgemm( "N", "N", n, nrhs, n, 
+          1.0,   Z.data(), n, 
+               QtB.data(), n, 
+          0.0,          B, ldb );
+    }; /** end EigenSolve() */
+
+
+    /** 
+     *  @brief Symmetric SMW factorization diag( Dl, Dr ) + VCV' = W * W',
+     *         where Dl = Wl * Wl', Dr = Wr * Wr', U = inv( diag( Wl, Wr ) ) * V
+     *         and C = [ 0 Crl'; Crl 0 ]. With U'U = L * L' (block diagonal) 
+     *         and I + L'CL = M * M', W = diag( Wl, Wr ) * ( I + UXU' ) for 
+     *         X = inv( L' ) * ( M - I ) * inv( L ). Only L and M are kept 
+     *         (see SolveSMW()). If the compressed matrix is not SPD, then 
+     *         I + L'CL is indefinite, and M is the Cholesky factor of 
+     *         | I + L'CL | instead, so W * W' is still SPD but not exact.
+     */
     void Factorize
     (
       /** Ul,  nl-by-sl */
@@ -160,107 +314,134 @@ class Factor
       /** skeleton rows and columns of lower triangular  */
       assert( Crl.row() == sr ); assert( Crl.col() == sl );
 
-      /**  inv( L' ) * ( M - I ) * inv( L ) */
-      Z.resize( sl + sr, sl + sr, 0.0 );
-
-      /** pivoting row indices */
-      ipiv.resize( Z.row(), 0 );
-
-      for ( size_t j = 0; j < sl + sr; j ++ )
-      {
-        for ( size_t i = 0; i < sl + sr; i ++ ) 
-        {
-          if ( i == j ) Z[ j * Z.row() + i ] = 1.0;
-        }
-      }
-
-      /** U'U */
-      std::vector<T> UltUl( sl * sl, 0.0 );
-      std::vector<T> UrtUr( sr * sr, 0.0 );
-
-      /** Lr * Crl * Ll' */
-      auto LrCrlLlt = Crl;
+      size_t sa = sl + sr;
 
-      /** UltUl, TODO: syrk */
+      /** Ll = POTRF( Ul'Ul ), TODO: syrk */
+      Ll.resize( 0, 0 );
+      Ll.resize( sl, sl, 0.0 );
       xgemm( "T", "N", sl, sl, nl, 
           1.0, Ul.data(), nl, Ul.data(), nl, 
-          0.0, UltUl.data(), sl );
-      /** UrtUr, TODO: syrk */
+          0.0, Ll.data(), sl );
+      /** Lr = POTRF( Ur'Ur ), TODO: syrk */
+      Lr.resize( 0, 0 );
+      Lr.resize( sr, sr, 0.0 );
       xgemm( "T", "N", sr, sr, nr, 
           1.0, Ur.data(), nr, Ur.data(), nr, 
-          0.0, UrtUr.data(), sr );
-      /** Ll = POTRF( UltUl ) */
-      xpotrf( "L", sl, UltUl.data(), sl );
-      /** Lr = POTRF( UrtUr ) */
-      xpotrf( "L", sr, UrtUr.data(), sr );
-      /** Lr * Crl */
-      xtrmm( "L", "L", "N", "N", sr, sl, 
-          1.0, UrtUr.data(), sr, LrCrlLlt.data(), sr );
-      /** Crl * Ll' */
-      xtrmm( "R", "L", "T", "N", sr, sl, 
-          1.0, UltUl.data(), sl, LrCrlLlt.data(), sr );
-      /** Z = I */
-      for ( size_t i = 0; i < sl + sr; i ++ ) 
-            Z[ i * Z.row() + i ] = 1.0;
-      /** Zrl = LrCrlLlt */
-      for ( size_t j = 0; j < sl; j ++ )
-        for ( size_t i = sl; i < sl + sr; i ++ ) 
-          Z[ j * Z.row() + i ] = LrCrlLlt( i - sl, j );
-
-      /** 
-       *  X = L^{-T}( M - I )L^{1}, to solve ( I + UXU')^{-1},
-       *  Z = X^{-1} + U'U = L( M - I )^{-1}L' + LL'
-       *  Z = L( ( M - I )^{-1} + I )L'
-       */
+          0.0, Lr.data(), sr );
+      if ( xpotrf( "L", sl, Ll.data(), sl ) || xpotrf( "L", sr, Lr.data(), sr ) )
+        printf( "Warning! U'U is singular\n" );
 
-
-      /** M = POTRF( Z ) */
-      xpotrf( "L", sl + sr, Z.data(), sl + sr );
-      printf( "potrf\n" ); fflush( stdout );
-
-      /** Z = ( M - I ), lower triangular */
-      for ( size_t j = 0; j < Z.col(); j ++ )
-        for ( size_t i = 0; i < Z.row(); i ++ )
-          Z( i, j ) -= 1.0;
-
-      /** M = Z, Z = identity  */
-      hmlp::Data<T> M = Z;
-      for ( size_t j = 0; j < Z.col(); j ++ )
+      /** Z = I + L'CL = [ I ( Lr'CrlLl )'; Lr'CrlLl I ], lower triangle only */
+      Z.resize( 0, 0 );
+      Z.resize( sa, sa, 0.0 );
+      for ( size_t i = 0; i < sa; i ++ ) Z( i, i ) = 1.0;
+      for ( size_t j = 0; j < sl; j ++ )
+        for ( size_t i = 0; i < sr; i ++ )
+          Z( sl + i, j ) = Crl( i, j );
+      /** Lr' * Crl */
+      xtrmm( "L", "L", "T", "N", sr, sl, 
+          1.0, Lr.data(), sr, Z.data() + sl, sa );
+      /** Lr' * Crl * Ll */
+      xtrmm( "R", "L", "N", "N", sr, sl, 
+          1.0, Ll.data(), sl, Z.data() + sl, sa );
+
+      /** M = POTRF( I + L'CL ) */
+      hmlp::Data<T> A = Z;
+      detsign = 1.0;
+      if ( xpotrf( "L", sa, Z.data(), sa ) )
       {
-        for ( size_t i = 0; i < Z.row(); i ++ )
+        /** I + L'CL = Q * Lambda * Q' */
+        std::vector<T> lambda( sa, 0.0 );
+        SymmetricEigen( sa, A.data(), lambda.data() );
+
+        /** QL = Q * | Lambda | (clamped away from zero) */
+        T lmax = 0.0;
+        for ( size_t i = 0; i < sa; i ++ ) 
         {
-          if ( i == j ) Z( i, j ) = 1.0;
-          else          Z( i, j ) = 0.0;
+          lmax = std::max( lmax, std::abs( lambda[ i ] ) );
+          if ( lambda[ i ] < 0.0 ) detsign = -detsign;
         }
+        hmlp::Data<T> QL = A;
+        for ( size_t j = 0; j < sa; j ++ )
+        {
+          T absj = std::max( std::abs( lambda[ j ] ), 
+              std::numeric_limits<T>::epsilon() * lmax );
+          for ( size_t i = 0; i < sa; i ++ ) QL( i, j ) *= absj;
+        }
+
+        /** M = POTRF( Q * | Lambda | * Q' ) */
+        xgemm( "N", "T", sa, sa, sa, 
+            1.0, QL.data(), sa, A.data(), sa, 
+            0.0,  Z.data(), sa );
+        if ( xpotrf( "L", sa, Z.data(), sa ) )
+          printf( "Warning! | I + L'CL | is singular\n" );
       }
 
-      /** Z = inv( M - I ), lower trianular */
-      xtrsm( "L", "L", "N", "N", sl + sr, sl + sr, 
-          1.0, M.data(), sl + sr, Z.data(),                   sl + sr );
-
-      /** ( M - I )^{-1} + I */
-      for ( size_t j = 0; j < Z.col(); j ++ )
-        for ( size_t i = 0; i < Z.row(); i ++ )
-          Z( i, j ) += 1.0;
-
-      /** L * Z */
-      xtrmm( "L", "L", "N", "N", sl, sl + sr, 
-          1.0, UltUl.data(), sl, Z.data(),                    sl + sr );
-      xtrmm( "L", "L", "N", "N", sr, sl + sr, 
-          1.0, UrtUr.data(), sr, Z.data() + sl,               sl + sr );
-      /** Z * L' */
-      xtrmm( "R", "L", "T", "N", sl + sr, sl, 
-          1.0, UltUl.data(), sl, Z.data(),                    sl + sr );
-      xtrmm( "R", "L", "T", "N", sl + sr, sr, 
-          1.0, UrtUr.data(), sr, Z.data() + ( sl + sr ) * sl, sl + sr );
-
-      /** LU( Z ) */
-      ipiv.resize( Z.row(), 0 );
-      xgetrf( sl + sr, sl + sr, Z.data(), sl + sr, ipiv.data() );
+      /** log| I + UXU' |^2 = log| M |^2, the children add theirs */
+      logdet = 0.0;
+      for ( size_t i = 0; i < sa; i ++ ) 
+        logdet += 2.0 * std::log( Z( i, i ) );
+
+      /** record points of children factors */
+      ipiv.clear();
+      this->Ul = &Ul;
+      this->Ur = &Ur;
 
     }; /** end Factorize() */
 
 
+    /**
+     *  @brief [ bl; br ] = inv( I + UXU' ) * [ bl; br ] (or the transpose) 
+     *         for the symmetric SMW factorization, where
+     *         inv( I + UXU' ) = I - U * inv( L' ) * ( I - inv( M ) ) * inv( L ) * U'.
+     */ 
+    void SolveSMW( bool TRANS, size_t nrhs, T *bl, size_t ldl, T *br, size_t ldr )
+    {
+      assert( !isleaf && Ul && Ur );
+
+      size_t sa = sl + sr;
+      std::vector<T> ta( sa * nrhs );
+
+      /** ta = U' * b */
+      xgemm( "T", "N", sl, nrhs, nl,
+          1.0, Ul->data(), nl, 
+                       bl, ldl, 
+          0.0,  ta.data(), sa );
+      xgemm( "T", "N", sr, nrhs, nr,
+          1.0, Ur->data(), nr, 
+                       br, ldr, 
+          0.0,  ta.data() + sl, sa );
+
+      /** ta = inv( L ) * ta */
+      xtrsm( "L", "L", "N", "N", sl, nrhs, 
+          1.0, Ll.data(), sl, ta.data(), sa );
+      xtrsm( "L", "L", "N", "N", sr, nrhs, 
+          1.0, Lr.data(), sr, ta.data() + sl, sa );
+
+      /** ta = ( I - inv( M ) ) * ta, or inv( M' ) with TRANS */
+      std::vector<T> tm = ta;
+      xtrsm( "L", "L", TRANS ? "T" : "N", "N", sa, nrhs, 
+          1.0, Z.data(), sa, tm.data(), sa );
+      for ( size_t i = 0; i < ta.size(); i ++ ) ta[ i ] -= tm[ i ];
+
+      /** ta = inv( L' ) * ta */
+      xtrsm( "L", "L", "T", "N", sl, nrhs, 
+          1.0, Ll.data(), sl, ta.data(), sa );
+      xtrsm( "L", "L", "T", "N", sr, nrhs, 
+          1.0, Lr.data(), sr, ta.data() + sl, sa );
+
+      /** b -= U * ta */
+      xgemm( "N", "N", nl, nrhs, sl,
+         -1.0, Ul->data(), nl, 
+                ta.data(), sa, 
+          1.0,         bl, ldl );
+      xgemm( "N", "N", nr, nrhs, sr,
+         -1.0, Ur->data(), nr, 
+                ta.data() + sl, sa, 
+          1.0,         br, ldr );
+    }; /** end SolveSMW() */
+
+
     /**    
      *   two-sided UCVt   one-sided UBt
      *   
@@ -402,6 +583,9 @@ class Factor
         printf( "Warning! large 1-norm condition number %3.1E\n", 
             1.0 / rcond1 ); fflush( stdout );
 
+      /** log| I + CV'U |, the children add theirs in Factorize( node ) */
+      LogDetLU();
+
     }; /** end Factorize() */
 
 
@@ -481,7 +665,12 @@ class Factor
 
       size_t nrhs = rhs.col();
 
-      if ( LU )
+      if ( Sigma.size() )
+      {
+        /** eigen factor (TRANS does not matter) */
+        EigenSolve( LU, rhs.data(), rhs.ld(), nrhs );
+      }
+      else if ( LU )
       {
         assert( ipiv.data() );
         /** LU solver */
@@ -518,6 +707,14 @@ class Factor
       assert( bl.col() == br.col() );
       assert( bl.row() == nl );
       assert( br.row() == nr );
+
+      /** symmetric SMW factorization */
+      if ( !LU )
+      {
+        SolveSMW( TRANS, nrhs, bl.data(), bl.ld(), br.data(), br.ld() );
+        return;
+      }
+
       assert( Ul && Ur && Vl && Vr );
 
       /** buffer */
@@ -540,68 +737,47 @@ class Factor
       //  xr, sl
       //);
 
-      if ( LU )
-      {
-        /** Vl' * bl */
-        xgemm( "T", "N", sl, nrhs, nl,
-            1.0, Vl->data(), nl, 
-                  bl.data(), bl.ld(), 
-            0.0,  tl.data(), sl );
-        /** Vr' * br */
-        xgemm( "T", "N", sr, nrhs, nr,
-            1.0, Vr->data(), nr, 
-                  br.data(), br.ld(), 
-            0.0,  tr.data(), sr );
-
-
-        /** Crl * Vl' * bl */
-        xgemm( "N", "N", sr, nrhs, sl,
-            1.0, Crl.data(), sr, 
-            tl.data(), sl, 
-            0.0,  ta.data() + sl, sl + sr );
+      /** Vl' * bl */
+      xgemm( "T", "N", sl, nrhs, nl,
+          1.0, Vl->data(), nl, 
+                bl.data(), bl.ld(), 
+          0.0,  tl.data(), sl );
+      /** Vr' * br */
+      xgemm( "T", "N", sr, nrhs, nr,
+          1.0, Vr->data(), nr, 
+                br.data(), br.ld(), 
+          0.0,  tr.data(), sr );
 
-        if ( SYMMETRIC )
-        {
-          /** Crl' * Vr' * br */
-          xgemm( "T", "N", sl, nrhs, sr,
-              1.0, Crl.data(), sr, 
-              tr.data(), sr, 
-              0.0,  ta.data(), sl + sr );
-        }
-        else
-        {
-          printf( "bug here !!!!!\n" ); fflush( stdout ); exit( 1 );
-          /** Clr * Vr' * br */
-          xgemm( "N", "N", sl, nrhs, sr,
-              1.0, Clr.data(), sl, 
-              tr.data(), sr, 
-              0.0,  ta.data(), sl + sr );
-        }
 
-        /** inv( Z ) * x */
-        xgetrs( "N", sl + sr, nrhs, 
-            Z.data(), Z.row(), ipiv.data(), 
-            ta.data(), sl + sr );
+      /** Crl * Vl' * bl */
+      xgemm( "N", "N", sr, nrhs, sl,
+          1.0, Crl.data(), sr, 
+          tl.data(), sl, 
+          0.0,  ta.data() + sl, sl + sr );
+
+      if ( SYMMETRIC )
+      {
+        /** Crl' * Vr' * br */
+        xgemm( "T", "N", sl, nrhs, sr,
+            1.0, Crl.data(), sr, 
+            tr.data(), sr, 
+            0.0,  ta.data(), sl + sr );
       }
       else
       {
-        /** Ul' * bl */
-        xgemm( "T", "N", sl, nrhs, nl,
-            1.0, Ul->data(), nl, 
-            bl.data(), bl.ld(), 
+        printf( "bug here !!!!!\n" ); fflush( stdout ); exit( 1 );
+        /** Clr * Vr' * br */
+        xgemm( "N", "N", sl, nrhs, sr,
+            1.0, Clr.data(), sl, 
+            tr.data(), sr, 
             0.0,  ta.data(), sl + sr );
-        /** Ur' * br */
-        xgemm( "T", "N", sr, nrhs, nr,
-            1.0, Ur->data(), nr, 
-            br.data(), br.ld(), 
-            0.0,  tr.data() + sl, sl + sr );
-
-        /** inv( Z ) * x */
-        xgetrs( "N", sl + sr, nrhs, 
-            Z.data(), Z.row(), ipiv.data(), 
-            ta.data(), sl + sr );
       }
 
+      /** inv( Z ) * x */
+      xgetrs( "N", sl + sr, nrhs, 
+          Z.data(), Z.row(), ipiv.data(), 
+          ta.data(), sl + sr );
+
       /** bl -= Ul * xl */
       xgemm( "N", "N", nl, nrhs, sl,
           -1.0, Ul->data(), nl, 
@@ -644,7 +820,11 @@ class Factor
 
       if ( DO_INVERSE )
       {
-        if ( LU )
+        if ( Sigma.size() )
+        {
+          EigenSolve( LU, Pa.data(), n, s );
+        }
+        else if ( LU )
         {
           assert( ipiv.size() );
           /** LU solver */
@@ -785,6 +965,8 @@ class Factor
           }
           else
           {
+            /** Pa = inv( I + UXU' ) * Pa */
+            SolveSMW( false, s, Pa.data(), n, Pa.data() + nl, n );
           }
         } /** end if ( DO_INVERSE ) */
       }
@@ -814,6 +996,28 @@ class Factor
 
     /** pivoting rows */
     std::vector<int> ipiv;
+
+    /** Cholesky factors of Ul'Ul and Ur'Ur (symmetric SMW only) */
+    hmlp::Data<T> Ll;
+    hmlp::Data<T> Lr;
+
+    /** leaf K( amap, amap ) without lambda, cached across Factorize() */
+    hmlp::Data<T> Kaa;
+
+    /** eigenvalues of the leaf Kaa (Z holds the eigenvectors) */
+    hmlp::Data<T> Sigma;
+
+    /** lambda of the eigen factor */
+    T shift = 0.0;
+
+    /** xsyev workspace of an m-by-m problem and the EigenSolve() buffer */
+    hmlp::Data<T> syevwork;
+    size_t syevwork_m = 0;
+    hmlp::Data<T> eigbuff;
+
+    /** log| det | of the subtree (log| Kaa | at leaves) and its sign */
+    T logdet = 0.0;
+    T detsign = 1.0;
     
     /** U, n-by-s */
     hmlp::Data<T> U;
@@ -1094,7 +1298,7 @@ void Apply( NODE *node )
   {
     auto &bl = node->lchild->data.view;
     auto &br = node->rchild->data.view;
-    data.Apply<true>( bl, br );
+    data.template Apply<true>( bl, br );
   }
 }; /** end Apply() */
 
@@ -1119,14 +1323,14 @@ void Solve( NODE *node )
   if ( node->isleaf )
   {
     auto &b = data.view;
-    data.Solve<LU, TRANS>( b );
+    data.template Solve<LU, TRANS>( b );
     //printf( "Solve %lu, m %lu n %lu\n", node->treelist_id, b.row(), b.col() );
   }
   else
   {
     auto &bl = node->lchild->data.view;
     auto &br = node->rchild->data.view;
-    data.Solve<LU, TRANS, true>( bl, br );
+    data.template Solve<LU, TRANS, true>( bl, br );
     //printf( "Solve %lu, m %lu n %lu\n", node->treelist_id, bl.row(), bl.col() );
   }
 
@@ -1213,8 +1417,8 @@ void Solve( TREE &tree, hmlp::Data<T> &input )
   TreeViewTask<NODE>             treeviewtask;
   MatrixPermuteTask<true,  NODE> forwardpermutetask;
   MatrixPermuteTask<false, NODE> inversepermutetask;
-  SolveTask<LU, false, NODE, T>      solvetask1;
-  //SolveTask<true,  NODE, T>      solvetask2;
+  SolveTask<LU, false, NODE, T>  solvetask1;
+  SolveTask<LU, true,  NODE, T>  solvetask2;
 
   /** attach the pointer to the tree structure */
   tree.setup.input  = &input;
@@ -1229,9 +1433,10 @@ void Solve( TREE &tree, hmlp::Data<T> &input )
   /** */
   tree.template TraverseDown <AUTO_DEPENDENCY, USE_RUNTIME>( treeviewtask );
   tree.template TraverseLeafs<AUTO_DEPENDENCY, USE_RUNTIME>( forwardpermutetask );
+  /** LU: inv( D ) upward; Cholesky: inv( W ) upward then inv( W' ) downward */
   tree.template TraverseUp   <AUTO_DEPENDENCY, USE_RUNTIME>( solvetask1 );
-  //tree.template TraverseDown<AUTO_DEPENDENCY, USE_RUNTIME>( solvetask2 );
-  //printf( "SolveTask\n" ); fflush( stdout );
+  if ( !LU ) 
+    tree.template TraverseDown<AUTO_DEPENDENCY, USE_RUNTIME>( solvetask2 );
 
   hmlp_run();
   //printf( "Execute Solve\n" ); fflush( stdout );
@@ -1302,26 +1507,55 @@ void Factorize( NODE *node )
   auto &K = *setup->K;
   auto &proj = data.proj;
 
+  /** in the mixed-precision mode only the low-precision proj is kept */
+  if ( !proj.size() && data.lproj.size() )
+  {
+    proj.resize( data.lproj.row(), data.lproj.col() );
+    for ( size_t i = 0; i < proj.size(); i ++ ) proj[ i ] = data.lproj[ i ];
+  }
+
   if ( node->isleaf )
   {
     auto lambda = setup->lambda;
     auto &amap = node->lids;
 
-    /** evaluate the diagonal block */
-    hmlp::Data<T> Kaa = K( amap, amap );
-
-    /** apply the regularization */
-    for ( size_t j = 0; j < Kaa.col(); j ++ )
+    if ( setup->leaf_eig )
     {
-      for ( size_t i = 0; i < Kaa.row(); i ++ )
+      /** 
+       *  Kaa = Q * Sigma * Q' is computed once for all lambda. A cached Kaa 
+       *  means the factor came from Factorize<LU>( Kaa ), whose non-SPD
+       *  fallback leaves a shifted Sigma, so it is recomputed.
+       */
+      if ( data.Sigma.size() != amap.size() || data.Kaa.row() == amap.size() )
       {
-        if ( !LU ) assert( Kaa( i, j ) == Kaa( j, i ) );
-        if ( i == j ) Kaa( i, j ) += lambda;
+        if ( data.Kaa.row() != amap.size() ) data.Kaa = K( amap, amap );
+        data.EigenFactorize( data.Kaa );
+        data.Kaa.resize( 0, 0 );
+        data.Kaa.shrink_to_fit();
       }
+
+      /** only the diagonal depends on lambda */
+      data.EigenShift( lambda );
     }
+    else
+    {
+      /** evaluate the diagonal block once and cache it */
+      if ( data.Kaa.row() != amap.size() ) data.Kaa = K( amap, amap );
+      hmlp::Data<T> Kaa = data.Kaa;
 
-    /** LU factorization */
-    data.Factorize<LU>( Kaa );
+      /** apply the regularization */
+      for ( size_t j = 0; j < Kaa.col(); j ++ )
+      {
+        for ( size_t i = 0; i < Kaa.row(); i ++ )
+        {
+          if ( !LU ) assert( Kaa( i, j ) == Kaa( j, i ) );
+          if ( i == j ) Kaa( i, j ) += lambda;
+        }
+      }
+
+      /** LU factorization */
+      data.template Factorize<LU>( Kaa );
+    }
 
     /** U = inv( Kaa ) * proj' */
     data.Telescope( LU, true, data.U, proj );
@@ -1342,13 +1576,24 @@ void Factorize( NODE *node )
     auto &amap = node->lchild->data.skels;
     auto &bmap = node->rchild->data.skels;
 
-    /** get the skeleton rows and columns */
-    node->data.Crl = K( bmap, amap );
+    /** get the skeleton rows and columns (independent of lambda) */
+    bool crl_cached = ( data.Crl.row() == bmap.size() && 
+                        data.Crl.col() == amap.size() );
+    if ( !crl_cached ) data.Crl = K( bmap, amap );
     //printf( "end get Crl\n" ); fflush( stdout );
 
     /** SMW factorization (LU or Cholesky) */
-    if ( LU ) data.Factorize<true>( Ul, Ur, Vl, Vr );
+    if ( LU ) data.template Factorize<true>( Ul, Ur, Vl, Vr );
     else      data.Factorize( Ul, Ur );
+
+    /** 
+     *  log| D | = log| Dl | + log| Dr | + log| I + CV'U | (Sylvester), where
+     *  D = diag( Dl, Dr ) + VCV' and U = inv( diag( Dl, Dr ) ) * V. For the
+     *  Cholesky SMW, U = inv( diag( Wl, Wr ) ) * V and the last term is
+     *  log| I + L'CL | = log| M |^2.
+     */
+    data.logdet  += node->lchild->data.logdet  + node->rchild->data.logdet;
+    data.detsign *= node->lchild->data.detsign * node->rchild->data.detsign;
     //printf( "end factorization\n" ); fflush( stdout );
 
     /** telescope U and V */
@@ -1420,8 +1665,8 @@ void Factorize( NODE *node )
     }
     //printf( "end inner forward telescoping\n" ); fflush( stdout );
 
-    /** check the offdiagonal block VrCrlVl' accuracy */
-    if ( LU ) LowRankError<NODE, T>( node );
+    /** check the offdiagonal block VrCrlVl' accuracy (first call only) */
+    if ( LU && !crl_cached ) LowRankError<NODE, T>( node );
   }
 
 }; /** end void Factorize() */
@@ -1487,7 +1732,11 @@ class FactorizeTask : public hmlp::Task
 
 
 /**
- *  @biref Top level factorization routine.
+ *  @biref Top level factorization routine. K( amap, amap ) and Crl are 
+ *         cached in the tree, so calling it again with another lambda
+ *         only redoes the LU and the SMW updates. With setup.leaf_eig
+ *         the leaf LU is replaced by a one-time eigendecomposition,
+ *         and a new lambda only costs the telescoping and SMW updates.
  */ 
 template<bool LU, typename NODE, typename T, typename TREE>
 void Factorize( TREE &tree, T lambda )
@@ -1516,6 +1765,66 @@ void Factorize( TREE &tree, T lambda )
 }; /** end Factorize() */
 
 
+/**
+ *  @brief Return log| K + lambda * I | accumulated by Factorize(). A negative
+ *         sign means the compressed matrix is not SPD; the Cholesky 
+ *         factorization then returns log| W * W' | of its SPD modification.
+ */ 
+template<typename NODE, typename T, typename TREE>
+T LogDet( TREE &tree )
+{
+  auto &data = tree.treelist[ 0 ]->data;
+  if ( data.detsign < 0.0 )
+    printf( "Warning! negative determinant, K + lambda * I is not SPD\n" );
+  return data.logdet;
+}; /** end LogDet() */
+
+
+/**
+ *  @brief Hutchinson estimate of trace( inv( K + lambda * I ) * B ) using
+ *         the factorization. Z is n-by-p (one probe per column) and 
+ *         BZ = B * Z is provided by the caller, e.g. dK/dh * Z from 
+ *         another compressed matrix, or Z itself for B = I. Since 
+ *         K is symmetric, z' * inv( K + lambda * I ) * B * z is
+ *         ( inv( K + lambda * I ) * z )' * ( B * z ).
+ */ 
+template<bool LU, typename NODE, typename T, typename TREE>
+T Trace( TREE &tree, hmlp::Data<T> &Z, hmlp::Data<T> &BZ )
+{
+  assert( Z.row() == BZ.row() && Z.col() == BZ.col() );
+
+  /** X = inv( K + lambda * I ) * Z */
+  hmlp::Data<T> X = Z;
+  Solve<LU, NODE, T>( tree, X );
+
+  T trace = 0.0;
+  for ( size_t j = 0; j < X.col(); j ++ )
+    for ( size_t i = 0; i < X.row(); i ++ )
+      trace += X( i, j ) * BZ( i, j );
+
+  return trace / X.col();
+}; /** end Trace() */
+
+
+/**
+ *  @brief Estimate trace( inv( K + lambda * I ) ), i.e. d/dlambda of 
+ *         log| K + lambda * I |, with p Rademacher probes.
+ */ 
+template<bool LU, typename NODE, typename T, typename TREE>
+T Trace( TREE &tree, size_t p )
+{
+  std::mt19937 generator( 0 );
+  std::bernoulli_distribution coin( 0.5 );
+
+  /** n-by-p random +1 or -1 */
+  hmlp::Data<T> Z( tree.n, p );
+  for ( size_t i = 0; i < Z.size(); i ++ ) 
+    Z[ i ] = coin( generator ) ? 1.0 : -1.0;
+
+  return Trace<LU, NODE, T>( tree, Z, Z );
+}; /** end Trace() */
+
+
 
 /**
  *  @brief Compute the average 2-norm error. That is given
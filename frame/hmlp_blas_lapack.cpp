@@ -356,30 +356,32 @@ void xtrmm
 /**
  *  @brief DPOTRF wrapper
  */ 
-void xpotrf( const char *uplo, int n, double *A, int lda )
+int xpotrf( const char *uplo, int n, double *A, int lda )
 {
+  int info = 0;
 #ifdef USE_BLAS
-  int info;
   dpotrf_( uplo, &n, A, &lda, &info );
 #else
   printf( "xpotrf must enables USE_BLAS.\n" );
   exit( 1 );
 #endif
+  return info;
 }; /** end xpotrf() */
 
 
 /**
  *  @brief SPOTRF wrapper
  */ 
-void xpotrf( const char *uplo, int n, float *A, int lda )
+int xpotrf( const char *uplo, int n, float *A, int lda )
 {
+  int info = 0;
 #ifdef USE_BLAS
-  int info;
   spotrf_( uplo, &n, A, &lda, &info );
 #else
   printf( "xpotrf must enables USE_BLAS.\n" );
   exit( 1 );
 #endif
+  return info;
 }; /** end xpotrf() */
 
 
@@ -531,6 +533,72 @@ void xgecon
 }; /** end xgecon() */
 
 
+/**
+ *  @brief DSYEV wrapper
+ */ 
+void xsyev
+(
+  const char *jobz, const char *uplo,
+  int n,
+  double *A, int lda, 
+  double *w, 
+  double *work, int lwork 
+)
+{
+#ifdef USE_BLAS
+  int info;
+  dsyev_
+  (
+    jobz, uplo,
+    &n,
+    A, &lda,
+    w,
+    work, &lwork, &info
+  );
+  if ( info ) 
+  {
+    printf( "xsyev fails with info %d\n", info );
+  }
+#else
+  printf( "xsyev must enables USE_BLAS.\n" );
+  exit( 1 );
+#endif
+}; /** end xsyev() */
+
+
+/**
+ *  @brief SSYEV wrapper
+ */ 
+void xsyev
+(
+  const char *jobz, const char *uplo,
+  int n,
+  float *A, int lda, 
+  float *w, 
+  float *work, int lwork 
+)
+{
+#ifdef USE_BLAS
+  int info;
+  ssyev_
+  (
+    jobz, uplo,
+    &n,
+    A, &lda,
+    w,
+    work, &lwork, &info
+  );
+  if ( info ) 
+  {
+    printf( "xsyev fails with info %d\n", info );
+  }
+#else
+  printf( "xsyev must enables USE_BLAS.\n" );
+  exit( 1 );
+#endif
+}; /** end xsyev() */
+
+
 /**
  *  @brief DGEQRF wrapper
  */ 
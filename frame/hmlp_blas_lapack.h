@@ -85,13 +85,14 @@ void xtrmm
                 double *B, int ldb 
 );
 
-void xpotrf
+/** returns info, i.e. 0 or the order of the leading minor that is not SPD */
+int xpotrf
 (
   const char *uplo, 
   int n, double *A, int lda
 );
 
-void xpotrf
+int xpotrf
 (
   const char *uplo, 
   int n, float *A, int lda
@@ -247,6 +248,24 @@ void xgecon
   double *work, int *iwork 
 );
 
+void xsyev
+(
+  const char *jobz, const char *uplo,
+  int n,
+  double *A, int lda, 
+  double *w, 
+  double *work, int lwork 
+);
+
+void xsyev
+(
+  const char *jobz, const char *uplo,
+  int n,
+  float *A, int lda, 
+  float *w, 
+  float *work, int lwork 
+);
+
 double xdot
 (
   int n,
@@ -31,6 +31,7 @@
 #endif
 
 #define MAX_BATCH_SIZE 4
+#define MAX_PREFETCH_DEPTH 4
 
 // #define DEBUG_RUNTIME 1
 // #define DEBUG_SCHEDULER 1
@@ -870,7 +871,8 @@ void* Scheduler::EntryPoint( void* arg )
   {
     size_t batch_size = 0;
     Task *batch = NULL;
-    Task *nexttask = NULL;
+    Task *nexttask[ MAX_PREFETCH_DEPTH ];
+    size_t n_prefetch = 0;
 
     scheduler->ready_queue_lock[ me->tid ].Acquire();
     {
@@ -901,15 +903,24 @@ void* Scheduler::EntryPoint( void* arg )
         scheduler->time_remaining[ me->tid ] = 0.0;
       }
 
-      if ( scheduler->ready_queue[ me->tid ].size() )
+      /** 
+       *  look ahead of the next few tasks such that their prefetch
+       *  (e.g. out-of-core reads) overlaps the current task
+       */
+      for ( auto it  = scheduler->ready_queue[ me->tid ].begin();
+                 it != scheduler->ready_queue[ me->tid ].end() && 
+                 n_prefetch < MAX_PREFETCH_DEPTH; it ++ )
       {
-        /** try to prefetch the next task */
-        nexttask = scheduler->ready_queue[ me->tid ].front();
+        if ( !(*it)->is_prefetched )
+        {
+          (*it)->is_prefetched = true;
+          nexttask[ n_prefetch ++ ] = *it;
+        }
       }
     }
     scheduler->ready_queue_lock[ me->tid ].Release();
 
-    if ( nexttask ) nexttask->Prefetch( me );
+    for ( size_t p = 0; p < n_prefetch; p ++ ) nexttask[ p ]->Prefetch( me );
 
 
     /** if there is some jobs to do */
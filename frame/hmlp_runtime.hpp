@@ -249,6 +249,9 @@ class Task
     /** the next task in the batch job */
     Task *next = NULL;
 
+    /** Prefetch() has been issued (once) by the worker that owns it */
+    bool is_prefetched = false;
+
   private:
 
     volatile TaskStatus status;
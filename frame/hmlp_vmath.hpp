@@ -0,0 +1,612 @@
+/**
+ *  HMLP (High-Performance Machine Learning Primitives)
+ *
+ *  Copyright (C) 2014-2017, The University of Texas at Austin
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program. If not, see the LICENSE file.
+ *
+ **/
+
+
+#ifndef HMLP_VMATH_HPP
+#define HMLP_VMATH_HPP
+
+#include <stdio.h>
+#include <stdint.h>
+#include <cmath>
+#include <limits>
+
+#if defined( __AVX512F__ ) || defined( __AVX__ )
+#include <immintrin.h>
+#define HMLP_VMATH_SIMD 1
+#endif
+
+
+/**
+ *  @brief Vectorized exp, tanh, sqrt, rsqrt and pow on arrays (in place is
+ *         fine), for AVX, AVX2/FMA and AVX-512. Without these instruction
+ *         sets the routines fall back to std::.
+ *
+ *         The template flag FAST selects the accuracy:
+ *
+ *         FAST = false  exp and rsqrt are within 2 ulps, tanh within 3
+ *                       ulps and sqrt is correctly rounded. Results of exp
+ *                       below the normal range are flushed to zero.
+ *                       pow( x, p ) with integer |p| <= 64 squares
+ *                       repeatedly and is within |p| ulps, otherwise it
+ *                       is within 4 + 2 |p * log( x )| ulps.
+ *         FAST = true   relative error below 2E-7 in double (below 1E-5
+ *                       in single) with shorter polynomials and rsqrt with
+ *                       one Newton step. The fast rsqrt converts double
+ *                       to single precision, so its argument has to be in
+ *                       the single precision range.
+ *
+ *         Like the exp_int_d8x4 segment, exp reduces x = k * ln2 + r and
+ *         scales a polynomial in r by 2^k, which is built in the exponent
+ *         bits. tanh uses expm1 from the same reduction, so it does not
+ *         lose digits near zero.
+ */
+namespace hmlp
+{
+namespace vmath
+{
+
+/** 1 / i! */
+static const double inv_factorial[ 14 ] =
+{
+  1.0, 1.0, 1.0 / 2.0, 1.0 / 6.0, 1.0 / 24.0, 1.0 / 120.0, 1.0 / 720.0,
+  1.0 / 5040.0, 1.0 / 40320.0, 1.0 / 362880.0, 1.0 / 3628800.0,
+  1.0 / 39916800.0, 1.0 / 479001600.0, 1.0 / 6227020800.0
+};
+
+/** 1 / ( 2i + 1 ) */
+static const double inv_odd[ 12 ] =
+{
+  1.0, 1.0 / 3.0, 1.0 / 5.0, 1.0 / 7.0, 1.0 / 9.0, 1.0 / 11.0, 1.0 / 13.0,
+  1.0 / 15.0, 1.0 / 17.0, 1.0 / 19.0, 1.0 / 21.0, 1.0 / 23.0
+};
+
+
+/** polynomial degrees and Newton steps of each accuracy */
+template<typename T, bool FAST> struct degree;
+
+template<> struct degree<double, false>
+{ static const int exp = 13; static const int log = 10; static const int newton = 2; };
+
+template<> struct degree<double, true>
+{ static const int exp = 7;  static const int log = 4;  static const int newton = 1; };
+
+template<> struct degree<float, false>
+{ static const int exp = 7;  static const int log = 5;  static const int newton = 1; };
+
+template<> struct degree<float, true>
+{ static const int exp = 5;  static const int log = 3;  static const int newton = 1; };
+
+
+/** range reduction constants */
+template<typename T> struct constants;
+
+template<> struct constants<double>
+{
+  /** exp( x ) overflows above exp_hi and is flushed to zero below exp_lo */
+  static constexpr double exp_hi = 709.43;
+  static constexpr double exp_lo = -708.3964;
+  /** tanh( x ) rounds to 1 beyond tanh_hi / 2 */
+  static constexpr double tanh_hi = 40.0;
+  static constexpr double log2e = 1.44269504088896338700e+00;
+  /** ln2 = ln2hi + ln2lo, where k * ln2hi is exact */
+  static constexpr double ln2hi = 6.93147180369123816490e-01;
+  static constexpr double ln2lo = 1.90821492927058770002e-10;
+  static constexpr double sqrt2 = 1.41421356237309504880e+00;
+};
+
+template<> struct constants<float>
+{
+  static constexpr float exp_hi = 88.37f;
+  static constexpr float exp_lo = -87.3365f;
+  static constexpr float tanh_hi = 18.0f;
+  static constexpr float log2e = 1.44269504088896341f;
+  static constexpr float ln2hi = 0.693359375f;
+  static constexpr float ln2lo = -2.12194440e-4f;
+  static constexpr float sqrt2 = 1.41421356237309505f;
+};
+
+
+#ifdef HMLP_VMATH_SIMD
+
+/**
+ *  @brief Register type and the few operations the algorithms need.
+ *         pow2( k ) returns 2^k for integral k in the normal range,
+ *         exponent( x ) and mantissa( x ) split a positive normal x into
+ *         2^e * m with m in [ 1, 2 ).
+ */
+template<typename T> struct simd;
+
+#if defined( __AVX512F__ )
+
+template<>
+struct simd<double>
+{
+  typedef __m512d reg;
+  typedef __mmask8 mask;
+  static const size_t width = 8;
+
+  static inline reg set1( double a ) { return _mm512_set1_pd( a ); };
+  static inline reg load( const double *x ) { return _mm512_loadu_pd( x ); };
+  static inline void store( double *y, reg a ) { _mm512_storeu_pd( y, a ); };
+  static inline reg add( reg a, reg b ) { return _mm512_add_pd( a, b ); };
+  static inline reg sub( reg a, reg b ) { return _mm512_sub_pd( a, b ); };
+  static inline reg mul( reg a, reg b ) { return _mm512_mul_pd( a, b ); };
+  static inline reg div( reg a, reg b ) { return _mm512_div_pd( a, b ); };
+  static inline reg fmadd( reg a, reg b, reg c ) { return _mm512_fmadd_pd( a, b, c ); };
+  static inline reg fnmadd( reg a, reg b, reg c ) { return _mm512_fnmadd_pd( a, b, c ); };
+  static inline reg min( reg a, reg b ) { return _mm512_min_pd( a, b ); };
+  static inline reg max( reg a, reg b ) { return _mm512_max_pd( a, b ); };
+  static inline reg round( reg a )
+  { return _mm512_roundscale_pd( a, _MM_FROUND_TO_NEAREST_INT | _MM_FROUND_NO_EXC ); };
+  static inline reg sqrt( reg a ) { return _mm512_sqrt_pd( a ); };
+  static inline reg rsqrt( reg a ) { return _mm512_rsqrt14_pd( a ); };
+  static inline reg abs( reg a ) { return _mm512_abs_pd( a ); };
+  static inline reg copysign( reg a, reg s )
+  {
+    __m512i sign = _mm512_set1_epi64( 0x8000000000000000LL );
+    return _mm512_castsi512_pd( _mm512_or_epi64(
+          _mm512_andnot_epi64( sign, _mm512_castpd_si512( a ) ),
+          _mm512_and_epi64( sign, _mm512_castpd_si512( s ) ) ) );
+  };
+  static inline reg pow2( reg k ) { return _mm512_scalef_pd( set1( 1.0 ), k ); };
+  static inline reg exponent( reg a ) { return _mm512_getexp_pd( a ); };
+  static inline reg mantissa( reg a )
+  { return _mm512_getmant_pd( a, _MM_MANT_NORM_1_2, _MM_MANT_SIGN_zero ); };
+  static inline mask lt( reg a, reg b ) { return _mm512_cmp_pd_mask( a, b, _CMP_LT_OQ ); };
+  static inline mask eq( reg a, reg b ) { return _mm512_cmp_pd_mask( a, b, _CMP_EQ_OQ ); };
+  static inline reg select( mask m, reg a, reg b ) { return _mm512_mask_blend_pd( m, b, a ); };
+}; /** end struct simd<double> */
+
+template<>
+struct simd<float>
+{
+  typedef __m512 reg;
+  typedef __mmask16 mask;
+  static const size_t width = 16;
+
+  static inline reg set1( float a ) { return _mm512_set1_ps( a ); };
+  static inline reg load( const float *x ) { return _mm512_loadu_ps( x ); };
+  static inline void store( float *y, reg a ) { _mm512_storeu_ps( y, a ); };
+  static inline reg add( reg a, reg b ) { return _mm512_add_ps( a, b ); };
+  static inline reg sub( reg a, reg b ) { return _mm512_sub_ps( a, b ); };
+  static inline reg mul( reg a, reg b ) { return _mm512_mul_ps( a, b ); };
+  static inline reg div( reg a, reg b ) { return _mm512_div_ps( a, b ); };
+  static inline reg fmadd( reg a, reg b, reg c ) { return _mm512_fmadd_ps( a, b, c ); };
+  static inline reg fnmadd( reg a, reg b, reg c ) { return _mm512_fnmadd_ps( a, b, c ); };
+  static inline reg min( reg a, reg b ) { return _mm512_min_ps( a, b ); };
+  static inline reg max( reg a, reg b ) { return _mm512_max_ps( a, b ); };
+  static inline reg round( reg a )
+  { return _mm512_roundscale_ps( a, _MM_FROUND_TO_NEAREST_INT | _MM_FROUND_NO_EXC ); };
+  static inline reg sqrt( reg a ) { return _mm512_sqrt_ps( a ); };
+  static inline reg rsqrt( reg a ) { return _mm512_rsqrt14_ps( a ); };
+  static inline reg abs( reg a ) { return _mm512_abs_ps( a ); };
+  static inline reg copysign( reg a, reg s )
+  {
+    __m512i sign = _mm512_set1_epi32( 0x80000000 );
+    return _mm512_castsi512_ps( _mm512_or_epi32(
+          _mm512_andnot_epi32( sign, _mm512_castps_si512( a ) ),
+          _mm512_and_epi32( sign, _mm512_castps_si512( s ) ) ) );
+  };
+  static inline reg pow2( reg k ) { return _mm512_scalef_ps( set1( 1.0f ), k ); };
+  static inline reg exponent( reg a ) { return _mm512_getexp_ps( a ); };
+  static inline reg mantissa( reg a )
+  { return _mm512_getmant_ps( a, _MM_MANT_NORM_1_2, _MM_MANT_SIGN_zero ); };
+  static inline mask lt( reg a, reg b ) { return _mm512_cmp_ps_mask( a, b, _CMP_LT_OQ ); };
+  static inline mask eq( reg a, reg b ) { return _mm512_cmp_ps_mask( a, b, _CMP_EQ_OQ ); };
+  static inline reg select( mask m, reg a, reg b ) { return _mm512_mask_blend_ps( m, b, a ); };
+}; /** end struct simd<float> */
+
+#else /** AVX and AVX2 */
+
+template<>
+struct simd<double>
+{
+  typedef __m256d reg;
+  typedef __m256d mask;
+  static const size_t width = 4;
+
+  static inline reg set1( double a ) { return _mm256_set1_pd( a ); };
+  static inline reg load( const double *x ) { return _mm256_loadu_pd( x ); };
+  static inline void store( double *y, reg a ) { _mm256_storeu_pd( y, a ); };
+  static inline reg add( reg a, reg b ) { return _mm256_add_pd( a, b ); };
+  static inline reg sub( reg a, reg b ) { return _mm256_sub_pd( a, b ); };
+  static inline reg mul( reg a, reg b ) { return _mm256_mul_pd( a, b ); };
+  static inline reg div( reg a, reg b ) { return _mm256_div_pd( a, b ); };
+#ifdef __FMA__
+  static inline reg fmadd( reg a, reg b, reg c ) { return _mm256_fmadd_pd( a, b, c ); };
+  static inline reg fnmadd( reg a, reg b, reg c ) { return _mm256_fnmadd_pd( a, b, c ); };
+#else
+  static inline reg fmadd( reg a, reg b, reg c ) { return add( mul( a, b ), c ); };
+  static inline reg fnmadd( reg a, reg b, reg c ) { return sub( c, mul( a, b ) ); };
+#endif
+  static inline reg min( reg a, reg b ) { return _mm256_min_pd( a, b ); };
+  static inline reg max( reg a, reg b ) { return _mm256_max_pd( a, b ); };
+  static inline reg round( reg a )
+  { return _mm256_round_pd( a, _MM_FROUND_TO_NEAREST_INT | _MM_FROUND_NO_EXC ); };
+  static inline reg sqrt( reg a ) { return _mm256_sqrt_pd( a ); };
+  /** 12 bits from the single precision estimate */
+  static inline reg rsqrt( reg a )
+  { return _mm256_cvtps_pd( _mm_rsqrt_ps( _mm256_cvtpd_ps( a ) ) ); };
+  static inline reg abs( reg a ) { return _mm256_andnot_pd( set1( -0.0 ), a ); };
+  static inline reg copysign( reg a, reg s )
+  {
+    reg sign = set1( -0.0 );
+    return _mm256_or_pd( _mm256_andnot_pd( sign, a ), _mm256_and_pd( sign, s ) );
+  };
+  static inline reg pow2( reg k )
+  {
+    /** the low bits of k + 0x1.8p52 hold k, shift k + 1023 into the exponent */
+    __m256i i = _mm256_castpd_si256( add( k, set1( 6755399441055744.0 ) ) );
+#ifdef __AVX2__
+    i = _mm256_slli_epi64( _mm256_add_epi64( i, _mm256_set1_epi64x( 1023 ) ), 52 );
+#else
+    __m128i bias = _mm_set1_epi64x( 1023 );
+    __m128i lo = _mm256_castsi256_si128( i );
+    __m128i hi = _mm256_extractf128_si256( i, 1 );
+    lo = _mm_slli_epi64( _mm_add_epi64( lo, bias ), 52 );
+    hi = _mm_slli_epi64( _mm_add_epi64( hi, bias ), 52 );
+    i = _mm256_insertf128_si256( _mm256_castsi128_si256( lo ), hi, 1 );
+#endif
+    return _mm256_castsi256_pd( i );
+  };
+  static inline reg exponent( reg a )
+  {
+    /** exponent bits below 0x1p52 give 0x1p52 + biased exponent */
+    __m256i i = _mm256_castpd_si256( a );
+#ifdef __AVX2__
+    i = _mm256_srli_epi64( i, 52 );
+#else
+    __m128i lo = _mm_srli_epi64( _mm256_castsi256_si128( i ), 52 );
+    __m128i hi = _mm_srli_epi64( _mm256_extractf128_si256( i, 1 ), 52 );
+    i = _mm256_insertf128_si256( _mm256_castsi128_si256( lo ), hi, 1 );
+#endif
+    reg e = _mm256_or_pd( _mm256_castsi256_pd( i ), set1( 4503599627370496.0 ) );
+    return sub( e, set1( 4503599627370496.0 + 1023.0 ) );
+  };
+  static inline reg mantissa( reg a )
+  {
+    reg bits = _mm256_castsi256_pd( _mm256_set1_epi64x( 0x000FFFFFFFFFFFFFLL ) );
+    return _mm256_or_pd( _mm256_and_pd( a, bits ), set1( 1.0 ) );
+  };
+  static inline mask lt( reg a, reg b ) { return _mm256_cmp_pd( a, b, _CMP_LT_OQ ); };
+  static inline mask eq( reg a, reg b ) { return _mm256_cmp_pd( a, b, _CMP_EQ_OQ ); };
+  static inline reg select( mask m, reg a, reg b )
+  { return _mm256_or_pd( _mm256_and_pd( m, a ), _mm256_andnot_pd( m, b ) ); };
+}; /** end struct simd<double> */
+
+template<>
+struct simd<float>
+{
+  typedef __m256 reg;
+  typedef __m256 mask;
+  static const size_t width = 8;
+
+  static inline reg set1( float a ) { return _mm256_set1_ps( a ); };
+  static inline reg load( const float *x ) { return _mm256_loadu_ps( x ); };
+  static inline void store( float *y, reg a ) { _mm256_storeu_ps( y, a ); };
+  static inline reg add( reg a, reg b ) { return _mm256_add_ps( a, b ); };
+  static inline reg sub( reg a, reg b ) { return _mm256_sub_ps( a, b ); };
+  static inline reg mul( reg a, reg b ) { return _mm256_mul_ps( a, b ); };
+  static inline reg div( reg a, reg b ) { return _mm256_div_ps( a, b ); };
+#ifdef __FMA__
+  static inline reg fmadd( reg a, reg b, reg c ) { return _mm256_fmadd_ps( a, b, c ); };
+  static inline reg fnmadd( reg a, reg b, reg c ) { return _mm256_fnmadd_ps( a, b, c ); };
+#else
+  static inline reg fmadd( reg a, reg b, reg c ) { return add( mul( a, b ), c ); };
+  static inline reg fnmadd( reg a, reg b, reg c ) { return sub( c, mul( a, b ) ); };
+#endif
+  static inline reg min( reg a, reg b ) { return _mm256_min_ps( a, b ); };
+  static inline reg max( reg a, reg b ) { return _mm256_max_ps( a, b ); };
+  static inline reg round( reg a )
+  { return _mm256_round_ps( a, _MM_FROUND_TO_NEAREST_INT | _MM_FROUND_NO_EXC ); };
+  static inline reg sqrt( reg a ) { return _mm256_sqrt_ps( a ); };
+  static inline reg rsqrt( reg a ) { return _mm256_rsqrt_ps( a ); };
+  static inline reg abs( reg a ) { return _mm256_andnot_ps( set1( -0.0f ), a ); };
+  static inline reg copysign( reg a, reg s )
+  {
+    reg sign = set1( -0.0f );
+    return _mm256_or_ps( _mm256_andnot_ps( sign, a ), _mm256_and_ps( sign, s ) );
+  };
+  static inline reg pow2( reg k )
+  {
+    /** the low bits of k + 0x1.8p23 hold k, shift k + 127 into the exponent */
+    __m256i i = _mm256_castps_si256( add( k, set1( 12582912.0f ) ) );
+#ifdef __AVX2__
+    i = _mm256_slli_epi32( _mm256_add_epi32( i, _mm256_set1_epi32( 127 ) ), 23 );
+#else
+    __m128i bias = _mm_set1_epi32( 127 );
+    __m128i lo = _mm256_castsi256_si128( i );
+    __m128i hi = _mm256_extractf128_si256( i, 1 );
+    lo = _mm_slli_epi32( _mm_add_epi32( lo, bias ), 23 );
+    hi = _mm_slli_epi32( _mm_add_epi32( hi, bias ), 23 );
+    i = _mm256_insertf128_si256( _mm256_castsi128_si256( lo ), hi, 1 );
+#endif
+    return _mm256_castsi256_ps( i );
+  };
+  static inline reg exponent( reg a )
+  {
+    /** exponent bits below 0x1p23 give 0x1p23 + biased exponent */
+    __m256i i = _mm256_castps_si256( a );
+#ifdef __AVX2__
+    i = _mm256_srli_epi32( i, 23 );
+#else
+    __m128i lo = _mm_srli_epi32( _mm256_castsi256_si128( i ), 23 );
+    __m128i hi = _mm_srli_epi32( _mm256_extractf128_si256( i, 1 ), 23 );
+    i = _mm256_insertf128_si256( _mm256_castsi128_si256( lo ), hi, 1 );
+#endif
+    reg e = _mm256_or_ps( _mm256_castsi256_ps( i ), set1( 8388608.0f ) );
+    return sub( e, set1( 8388608.0f + 127.0f ) );
+  };
+  static inline reg mantissa( reg a )
+  {
+    reg bits = _mm256_castsi256_ps( _mm256_set1_epi32( 0x007FFFFF ) );
+    return _mm256_or_ps( _mm256_and_ps( a, bits ), set1( 1.0f ) );
+  };
+  static inline mask lt( reg a, reg b ) { return _mm256_cmp_ps( a, b, _CMP_LT_OQ ); };
+  static inline mask eq( reg a, reg b ) { return _mm256_cmp_ps( a, b, _CMP_EQ_OQ ); };
+  static inline reg select( mask m, reg a, reg b )
+  { return _mm256_or_ps( _mm256_and_ps( m, a ), _mm256_andnot_ps( m, b ) ); };
+}; /** end struct simd<float> */
+
+#endif /** ifdef __AVX512F__ */
+
+
+/**
+ *  @brief Reduce x = k * ln2 + r with |r| <= ln2 / 2 and return s = 2^k
+ *         and q = e^r - 1, so exp( x ) = s + s * q. x is clamped to the
+ *         normal range; NaN propagates through q.
+ */
+template<bool FAST, typename T>
+inline void ExpReduce( typename simd<T>::reg x,
+    typename simd<T>::reg &s, typename simd<T>::reg &q )
+{
+  typedef simd<T> V;
+  typedef constants<T> C;
+
+  /** the second operand is returned for NaN */
+  x = V::min( V::set1( C::exp_hi ), x );
+  x = V::max( V::set1( C::exp_lo ), x );
+
+  auto k = V::round( V::mul( x, V::set1( C::log2e ) ) );
+  auto r = V::fnmadd( k, V::set1( C::ln2hi ), x );
+  r = V::fnmadd( k, V::set1( C::ln2lo ), r );
+
+  /** e^r - 1 = r + r^2 * ( 1 / 2! + r / 3! + ... + r^( N - 2 ) / N! ) */
+  const int N = degree<T, FAST>::exp;
+  auto p = V::set1( (T)inv_factorial[ N ] );
+  for ( int i = N - 1; i >= 2; i -- )
+    p = V::fmadd( p, r, V::set1( (T)inv_factorial[ i ] ) );
+
+  q = V::fmadd( V::mul( r, r ), p, r );
+  s = V::pow2( k );
+}; /** end ExpReduce() */
+
+
+template<bool FAST, typename T>
+inline typename simd<T>::reg vexp( typename simd<T>::reg x )
+{
+  typedef simd<T> V;
+  typedef constants<T> C;
+  typename V::reg s, q;
+  ExpReduce<FAST, T>( x, s, q );
+  auto y = V::fmadd( s, q, s );
+  y = V::select( V::lt( x, V::set1( C::exp_lo ) ), V::set1( 0.0 ), y );
+  y = V::select( V::lt( V::set1( C::exp_hi ), x ),
+      V::set1( std::numeric_limits<T>::infinity() ), y );
+  return y;
+}; /** end vexp() */
+
+
+/** tanh( x ) = sign( x ) * e / ( e + 2 ), where e = expm1( 2|x| ) */
+template<bool FAST, typename T>
+inline typename simd<T>::reg vtanh( typename simd<T>::reg x )
+{
+  typedef simd<T> V;
+  typedef constants<T> C;
+  typename V::reg s, q;
+  auto a = V::min( V::set1( C::tanh_hi ), V::add( V::abs( x ), V::abs( x ) ) );
+  ExpReduce<FAST, T>( a, s, q );
+  auto e = V::fmadd( s, q, V::sub( s, V::set1( 1.0 ) ) );
+  return V::copysign( V::div( e, V::add( e, V::set1( 2.0 ) ) ), x );
+}; /** end vtanh() */
+
+
+/** 1 / sqrt( x ) from the hardware estimate and Newton steps */
+template<bool FAST, typename T>
+inline typename simd<T>::reg vrsqrt( typename simd<T>::reg x )
+{
+  typedef simd<T> V;
+  if ( !FAST ) return V::div( V::set1( 1.0 ), V::sqrt( x ) );
+  auto y = V::rsqrt( x );
+  auto h = V::mul( x, V::set1( 0.5 ) );
+  for ( int it = 0; it < degree<T, FAST>::newton; it ++ )
+    y = V::mul( y, V::fnmadd( h, V::mul( y, y ), V::set1( 1.5 ) ) );
+  /** the Newton step is NaN at zero */
+  return V::select( V::eq( x, V::set1( 0.0 ) ), 
+      V::set1( std::numeric_limits<T>::infinity() ), y );
+}; /** end vrsqrt() */
+
+
+template<bool FAST, typename T>
+inline typename simd<T>::reg vsqrt( typename simd<T>::reg x )
+{
+  typedef simd<T> V;
+  if ( !FAST ) return V::sqrt( x );
+  /** x * rsqrt( x ) without the zero check of vrsqrt(), NaN at zero */
+  auto r = V::rsqrt( x );
+  auto h = V::mul( x, V::set1( 0.5 ) );
+  for ( int it = 0; it < degree<T, FAST>::newton; it ++ )
+    r = V::mul( r, V::fnmadd( h, V::mul( r, r ), V::set1( 1.5 ) ) );
+  auto y = V::mul( x, r );
+  return V::select( V::eq( x, V::set1( 0.0 ) ), x, y );
+}; /** end vsqrt() */
+
+
+/**
+ *  @brief log( x ) for positive normal x. With x = 2^e * m, m in
+ *         [ sqrt( 1/2 ), sqrt( 2 ) ) and s = ( m - 1 ) / ( m + 1 ),
+ *         log( m ) = 2s + 2s * ( s^2 / 3 + s^4 / 5 + ... ).
+ */
+template<bool FAST, typename T>
+inline typename simd<T>::reg vlog( typename simd<T>::reg x )
+{
+  typedef simd<T> V;
+  typedef constants<T> C;
+  auto e = V::exponent( x );
+  auto m = V::mantissa( x );
+  auto big = V::lt( V::set1( C::sqrt2 ), m );
+  m = V::select( big, V::mul( m, V::set1( 0.5 ) ), m );
+  e = V::select( big, V::add( e, V::set1( 1.0 ) ), e );
+
+  auto f = V::sub( m, V::set1( 1.0 ) );
+  auto s = V::div( f, V::add( f, V::set1( 2.0 ) ) );
+  auto z = V::mul( s, s );
+  const int N = degree<T, FAST>::log;
+  auto R = V::set1( (T)inv_odd[ N ] );
+  for ( int i = N - 1; i >= 1; i -- )
+    R = V::fmadd( R, z, V::set1( (T)inv_odd[ i ] ) );
+  auto s2 = V::add( s, s );
+  auto logm = V::fmadd( V::mul( s2, z ), R, s2 );
+
+  return V::fmadd( e, V::set1( C::ln2hi ), V::fmadd( e, V::set1( C::ln2lo ), logm ) );
+}; /** end vlog() */
+
+
+/** x^p by repeated squaring for an integer exponent */
+template<typename T>
+inline typename simd<T>::reg vpowi( typename simd<T>::reg x, int p )
+{
+  typedef simd<T> V;
+  auto y = V::set1( 1.0 );
+  for ( unsigned e = ( p < 0 ) ? -p : p; e; e >>= 1 )
+  {
+    if ( e & 1 ) y = V::mul( y, x );
+    x = V::mul( x, x );
+  }
+  if ( p < 0 ) y = V::div( V::set1( 1.0 ), y );
+  return y;
+}; /** end vpowi() */
+
+
+/** y = f( x ) with full registers, the remainder goes through a buffer */
+template<typename T, typename FUNC>
+inline void Map( size_t n, const T *x, T *y, FUNC f )
+{
+  typedef simd<T> V;
+  size_t i = 0;
+  for ( ; i + V::width <= n; i += V::width )
+    V::store( y + i, f( V::load( x + i ) ) );
+  if ( i < n )
+  {
+    T buff[ V::width ];
+    for ( size_t t = 0; t < V::width; t ++ )
+      buff[ t ] = ( i + t < n ) ? x[ i + t ] : 1.0;
+    V::store( buff, f( V::load( buff ) ) );
+    for ( size_t t = 0; i + t < n; t ++ ) y[ i + t ] = buff[ t ];
+  }
+}; /** end Map() */
+
+#endif /** ifdef HMLP_VMATH_SIMD */
+
+
+/** y = exp( x ) */
+template<bool FAST = false, typename T>
+void Exp( size_t n, const T *x, T *y )
+{
+#ifdef HMLP_VMATH_SIMD
+  Map( n, x, y, []( typename simd<T>::reg v ) { return vexp<FAST, T>( v ); } );
+#else
+  for ( size_t i = 0; i < n; i ++ ) y[ i ] = std::exp( x[ i ] );
+#endif
+}; /** end Exp() */
+
+
+/** y = tanh( x ) */
+template<bool FAST = false, typename T>
+void Tanh( size_t n, const T *x, T *y )
+{
+#ifdef HMLP_VMATH_SIMD
+  Map( n, x, y, []( typename simd<T>::reg v ) { return vtanh<FAST, T>( v ); } );
+#else
+  for ( size_t i = 0; i < n; i ++ ) y[ i ] = std::tanh( x[ i ] );
+#endif
+}; /** end Tanh() */
+
+
+/** y = sqrt( x ) */
+template<bool FAST = false, typename T>
+void Sqrt( size_t n, const T *x, T *y )
+{
+#ifdef HMLP_VMATH_SIMD
+  Map( n, x, y, []( typename simd<T>::reg v ) { return vsqrt<FAST, T>( v ); } );
+#else
+  for ( size_t i = 0; i < n; i ++ ) y[ i ] = std::sqrt( x[ i ] );
+#endif
+}; /** end Sqrt() */
+
+
+/** y = 1 / sqrt( x ) */
+template<bool FAST = false, typename T>
+void RSqrt( size_t n, const T *x, T *y )
+{
+#ifdef HMLP_VMATH_SIMD
+  Map( n, x, y, []( typename simd<T>::reg v ) { return vrsqrt<FAST, T>( v ); } );
+#else
+  for ( size_t i = 0; i < n; i ++ ) y[ i ] = 1.0 / std::sqrt( x[ i ] );
+#endif
+}; /** end RSqrt() */
+
+
+/**
+ *  @brief y = x^p. Integer exponents up to 64 use repeated squaring and
+ *         accept negative x, otherwise y = exp( p * log( x ) ) for x > 0.
+ */
+template<bool FAST = false, typename T>
+void Pow( size_t n, const T *x, T p, T *y )
+{
+#ifdef HMLP_VMATH_SIMD
+  typedef simd<T> V;
+  if ( p == std::floor( p ) && std::abs( p ) <= 64 )
+  {
+    int ip = p;
+    Map( n, x, y, [ ip ]( typename V::reg v ) { return vpowi<T>( v, ip ); } );
+  }
+  else
+  {
+    Map( n, x, y, [ p ]( typename V::reg v )
+    {
+      auto zero = V::set1( 0.0 );
+      auto y = vexp<FAST, T>( V::mul( V::set1( p ), vlog<FAST, T>( v ) ) );
+      y = V::select( V::eq( v, zero ),
+          V::set1( ( p > 0 ) ? 0.0 : std::numeric_limits<T>::infinity() ), y );
+      return V::select( V::lt( v, zero ),
+          V::set1( std::numeric_limits<T>::quiet_NaN() ), y );
+    } );
+  }
+#else
+  for ( size_t i = 0; i < n; i ++ ) y[ i ] = std::pow( x[ i ], p );
+#endif
+}; /** end Pow() */
+
+
+}; /** end namespace vmath */
+}; /** end namespace hmlp */
+
+#endif /** define HMLP_VMATH_HPP */
@@ -36,6 +36,7 @@
 #include <hmlp_blas_lapack.h>
 #include <hmlp_packing.hpp>
 #include <hmlp_util.hpp>
+#include <hmlp_vmath.hpp>
 #include <hmlp_thread.hpp>
 #include <hmlp_runtime.hpp>
 
@@ -822,10 +823,7 @@ void gsks_ref
 #ifdef USE_VML
           vdExp( m, C.data() + j * m, C.data() + j * m );
 #else
-          for ( int i = 0; i < m; i ++ ) 
-          {
-            C[ j * m + i ] = exp( C[ j * m + i ] );
-          }
+          hmlp::vmath::Exp( m, C.data() + j * m, C.data() + j * m );
 #endif
         }
         break;
@@ -846,10 +844,7 @@ void gsks_ref
 #ifdef USE_VML
           vdExp( m, C.data() + j * m, C.data() + j * m );
 #else
-          for ( int i = 0; i < m; i ++ ) 
-          {
-            C[ j * m + i ] = exp( C[ j * m + i ] );
-          }
+          hmlp::vmath::Exp( m, C.data() + j * m, C.data() + j * m );
 #endif
         }
         break;
@@ -125,6 +125,18 @@ void dconv2d_ref
 
 
 
+/** 
+ *  Kernel functions of KernelMatrix, where r2 = || x - y ||^2:
+ *
+ *  KS_GAUSSIAN               exp( scal * r2 )
+ *  KS_POLYNOMIAL             ( scal * x'y + cons )^powe
+ *  KS_LAPLACE                exp( scal * sqrt( r2 ) )
+ *  KS_GAUSSIAN_VAR_BANDWIDTH exp( -0.5 * hi[ i ] * hj[ j ] * r2 )
+ *  KS_TANH                   tanh( scal * x'y + cons )
+ *  KS_QUARTIC                ( 1 - scal * r2 )^2 if scal * r2 < 1, else 0
+ *  KS_MULTIQUADRATIC         sqrt( r2 + cons^2 )
+ *  KS_EPANECHNIKOV           1 - scal * r2 if scal * r2 < 1, else 0
+ */ 
 typedef enum
 {
   KS_GAUSSIAN,
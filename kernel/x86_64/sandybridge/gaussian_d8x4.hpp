@@ -5,6 +5,7 @@
 #include <hmlp.h>
 #include <hmlp_internal.hpp>
 #include <avx_type.h> // self-defined vector type
+#include <hmlp_vmath.hpp>
 
 // #define DEBUG_MICRO 1
 
@@ -72,9 +73,9 @@ struct gaussian_ref_d8x4
         c_reg[ j * 8 + i ] *= -2.0;
         c_reg[ j * 8 + i ] += a2[ i ] + b2[ j ];
         c_reg[ j * 8 + i ] *= kernel->scal;
-        c_reg[ j * 8 + i ]  = exp( c_reg[ j * 8 + i ] );
       }
     }
+    hmlp::vmath::Exp( 8 * 4, c_reg, c_reg );
 
     #pragma unroll
     for ( int j = 0; j < 4; j ++ )
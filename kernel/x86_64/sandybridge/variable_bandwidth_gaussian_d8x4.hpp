@@ -5,6 +5,7 @@
 #include <hmlp.h>
 #include <hmlp_internal.hpp>
 #include <avx_type.h> // self-defined vector type
+#include <hmlp_vmath.hpp>
 
 // #define DEBUG_MICRO 1
 
@@ -76,9 +77,9 @@ struct variable_bandwidth_gaussian_ref_d8x4
         c_reg[ j * 8 + i ] *= -0.5;
         c_reg[ j * 8 + i ] *= aux->hi[ i ];
         c_reg[ j * 8 + i ] *= aux->hj[ j ];
-        c_reg[ j * 8 + i ]  = exp( c_reg[ j * 8 + i ] );
       }
     }
+    hmlp::vmath::Exp( 8 * 4, c_reg, c_reg );
 
     #pragma unroll
     for ( int j = 0; j < 4; j ++ )
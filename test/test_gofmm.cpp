@@ -68,6 +68,195 @@ using namespace hmlp::tree;
 using namespace hmlp::gofmm;
 
 
+/** 
+ *  independent reference of K( i, j ) in double precision from the exact
+ *  ( x - y )^2 and x'y of target x = X( :, i ) and source y = X( :, j )
+ */
+template<typename T>
+double KernelReference( kernel_s<T> &kernel, size_t d, T *X, size_t i, size_t j )
+{
+  double r2 = 0.0, xty = 0.0;
+  for ( size_t p = 0; p < d; p ++ )
+  {
+    double x = X[ i * d + p ], y = X[ j * d + p ];
+    r2  += ( x - y ) * ( x - y );
+    xty += x * y;
+  }
+  double u2 = kernel.scal * r2;
+  switch ( kernel.type )
+  {
+    case KS_GAUSSIAN:               return std::exp( kernel.scal * r2 );
+    case KS_POLYNOMIAL:             return std::pow( kernel.scal * xty + kernel.cons, kernel.powe );
+    case KS_LAPLACE:                return std::exp( kernel.scal * std::sqrt( r2 ) );
+    case KS_GAUSSIAN_VAR_BANDWIDTH: return std::exp( -0.5 * kernel.hi[ i ] * kernel.hj[ j ] * r2 );
+    case KS_TANH:                   return std::tanh( kernel.scal * xty + kernel.cons );
+    case KS_QUARTIC:                return ( u2 < 1.0 ) ? ( 1.0 - u2 ) * ( 1.0 - u2 ) : 0.0;
+    case KS_MULTIQUADRATIC:         return std::sqrt( r2 + kernel.cons * kernel.cons );
+    case KS_EPANECHNIKOV:           return ( u2 < 1.0 ) ? 1.0 - u2 : 0.0;
+    default:                        return 0.0;
+  }
+}; /** end KernelReference() */
+
+
+/** stop the driver if a check fails */
+void test_check( bool pass, const char *what )
+{
+  if ( !pass )
+  {
+    printf( "test_gofmm: check failed: %s\n", what );
+    exit( 1 );
+  }
+}; /** end test_check() */
+
+
+/** |y - ref| in ulps of T at ref */
+template<typename T>
+double UlpError( T y, long double ref )
+{
+  long double r = std::abs( (T)ref );
+  long double ulp = std::nextafter( (T)r, std::numeric_limits<T>::infinity() ) - r;
+  return std::abs( (long double)y - ref ) / ulp;
+}; /** end UlpError() */
+
+
+/**
+ *  @brief Check hmlp::vmath against the long double std:: functions with
+ *         the bounds documented in hmlp_vmath.hpp.
+ */
+template<typename T>
+void VMathTest()
+{
+  const size_t n = 1 << 16;
+  const bool single = std::is_same<T, float>::value;
+  const double fastbound = single ? 1E-5 : 2E-7;
+  std::vector<T> x( n ), y( n ), z( n );
+  /** max ulp error of y (accurate) and max relative error of z (fast) */
+  auto Error = [ & ]( const char *name, double ulpbound,
+      std::function<long double(long double)> f )
+  {
+    double ulperr = 0.0, fasterr = 0.0;
+    for ( size_t i = 0; i < n; i ++ )
+    {
+      long double ref = f( x[ i ] );
+      if ( ref == 0.0 ) continue;
+      ulperr = std::max( ulperr, UlpError( y[ i ], ref ) );
+      fasterr = std::max( fasterr, (double)std::abs( ( z[ i ] - ref ) / ref ) );
+    }
+    printf( "vmath %-8s %s %4.2lf ulps (bound %4.2lf), fast %3.1E (bound %3.1E)\n",
+        name, single ? "float " : "double", ulperr, ulpbound, fasterr, fastbound );
+    test_check( ulperr <= ulpbound, "hmlp::vmath accurate ulp bound" );
+    test_check( fasterr <= fastbound, "hmlp::vmath fast relative error bound" );
+  };
+
+  /** exp over the whole normal range of the result */
+  T lo = std::log( std::numeric_limits<T>::min() ) * 0.99;
+  T hi = std::log( std::numeric_limits<T>::max() ) * 0.99;
+  for ( size_t i = 0; i < n; i ++ ) x[ i ] = lo + ( hi - lo ) * i / ( n - 1 );
+  hmlp::vmath::Exp<false>( n, x.data(), y.data() );
+  hmlp::vmath::Exp<true>( n, x.data(), z.data() );
+  Error( "exp", 2.0, []( long double v ) { return std::exp( v ); } );
+
+  for ( size_t i = 0; i < n; i ++ ) x[ i ] = -20.0 + 40.0 * i / ( n - 1 );
+  hmlp::vmath::Tanh<false>( n, x.data(), y.data() );
+  hmlp::vmath::Tanh<true>( n, x.data(), z.data() );
+  Error( "tanh", 3.0, []( long double v ) { return std::tanh( v ); } );
+
+  /** sqrt is correctly rounded (within half an ulp) */
+  for ( size_t i = 0; i < n; i ++ ) 
+    x[ i ] = std::pow( (T)10.0, (T)( -30.0 + 60.0 * i / ( n - 1 ) ) );
+  hmlp::vmath::Sqrt<false>( n, x.data(), y.data() );
+  hmlp::vmath::Sqrt<true>( n, x.data(), z.data() );
+  Error( "sqrt", 0.5, []( long double v ) { return std::sqrt( v ); } );
+  hmlp::vmath::RSqrt<false>( n, x.data(), y.data() );
+  hmlp::vmath::RSqrt<true>( n, x.data(), z.data() );
+  Error( "rsqrt", 2.0, []( long double v ) { return 1.0 / std::sqrt( v ); } );
+
+  /** integer p within |p| ulps, otherwise 4 + 2 |p * log( x )| ulps */
+  for ( size_t i = 0; i < n; i ++ ) x[ i ] = 0.5 + 1.5 * i / ( n - 1 );
+  for ( T p : { 2.0, -3.0, 7.0, 64.0, -64.0, 0.5, 2.5, -1.3 } )
+  {
+    bool integer = ( p == std::floor( p ) );
+    double ulpbound = integer ? std::abs( p ) : 4.0 + 2.0 * std::abs( p * std::log( 2.0 ) );
+    hmlp::vmath::Pow<false>( n, x.data(), p, y.data() );
+    hmlp::vmath::Pow<true>( n, x.data(), p, z.data() );
+    /** the fast pow shares the integer path, so it is as accurate */
+    char name[ 16 ];
+    snprintf( name, sizeof( name ), "pow %g", (double)p );
+    Error( name, ulpbound, [ p ]( long double v ) { return std::pow( v, (long double)p ); } );
+  }
+}; /** end VMathTest() */
+
+
+/**
+ *  @brief Check the leaf kNN (direct distances for d <= 8, GEMM or
+ *         dgsknn otherwise) against a brute-force double precision kNN.
+ *         n queries B search m references A (the dgsknn convention),
+ *         with m < n and m > n.
+ */
+template<typename T>
+void LeafGSKNNTest()
+{
+  const int r = 16;
+  for ( auto mn : { std::make_pair( 64, 300 ), std::make_pair( 300, 64 ) } )
+  for ( int d : { 1, 2, 3, 5, 8, 12, 20 } )
+  {
+    int m = mn.first, n = mn.second;
+    hmlp::Data<T> A( d, m ), B( d, n );
+    A.randn( 0.0, 1.0 ); B.randn( 0.0, 1.0 );
+    std::vector<T> A2( m, 0.0 ), B2( n, 0.0 );
+    for ( int i = 0; i < m; i ++ )
+      for ( int p = 0; p < d; p ++ ) A2[ i ] += A( p, i ) * A( p, i );
+    for ( int j = 0; j < n; j ++ )
+      for ( int p = 0; p < d; p ++ ) B2[ j ] += B( p, j ) * B( p, j );
+    std::vector<T> D( r * n, std::numeric_limits<T>::max() );
+    std::vector<int> I( r * n, -1 );
+    hmlp::gofmm::LeafGSKNN( m, n, d, r, A.data(), A2.data(), 
+        B.data(), B2.data(), D.data(), I.data() );
+
+    double maxerr = 0.0;
+    bool valid = true;
+    for ( int j = 0; j < n; j ++ )
+    {
+      /** brute force, sorted */
+      std::vector<double> dist( m );
+      for ( int i = 0; i < m; i ++ )
+      {
+        dist[ i ] = 0.0;
+        for ( int p = 0; p < d; p ++ )
+        {
+          double tmp = (double)A( p, i ) - B( p, j );
+          dist[ i ] += tmp * tmp;
+        }
+      }
+      std::vector<double> knn( dist );
+      std::sort( knn.begin(), knn.end() );
+
+      /** the heap is unordered; indices must be distinct and in range */
+      std::vector<int> ids( &I[ j * r ], &I[ j * r ] + r );
+      std::sort( ids.begin(), ids.end() );
+      if ( ids.front() < 0 || ids.back() >= m ||
+           std::adjacent_find( ids.begin(), ids.end() ) != ids.end() ) valid = false;
+      if ( !valid ) break;
+
+      /** distances against their neighbor and the r smallest */
+      std::vector<double> Dj( &D[ j * r ], &D[ j * r ] + r );
+      std::sort( Dj.begin(), Dj.end() );
+      double scale = B2[ j ] + *std::max_element( A2.begin(), A2.end() );
+      for ( int q = 0; q < r; q ++ )
+      {
+        maxerr = std::max( maxerr, std::abs( D[ j * r + q ] - dist[ I[ j * r + q ] ] ) / scale );
+        maxerr = std::max( maxerr, std::abs( Dj[ q ] - knn[ q ] ) / scale );
+      }
+    }
+    printf( "LeafGSKNN m %3d n %3d d %2d %s, relative distance error %3.1E\n",
+        m, n, d, std::is_same<T, float>::value ? "float " : "double", maxerr );
+    test_check( valid, "LeafGSKNN neighbors are distinct and in range" );
+    test_check( maxerr <= 1E+2 * std::numeric_limits<T>::epsilon(),
+        "LeafGSKNN against brute-force kNN" );
+  }
+}; /** end LeafGSKNNTest() */
+
+
 
 template<
   bool        ADAPTIVE, 
@@ -102,6 +291,7 @@ void test_gofmm
 
 	/** creatgin configuration for all user-define arguments */
 	Configuration<T> config( metric, n, m, k, s, stol, budget );
+  config.SetTreeOrder( true );
 
   /** compress K */
   auto *tree_ptr = Compress<ADAPTIVE, LEVELRESTRICTION, SPLITTER, RKDTSPLITTER, T>
@@ -215,6 +405,86 @@ void test_gofmm
   // ------------------------------------------------------------------------
 
 
+  /** panels of 5 (7) right hand sides, 2 (4) in flight, reproduce one plain Evaluate */
+  auto *w_setup = tree.setup.w;
+  auto *u_setup = tree.setup.u;
+  auto PanelError = [ & ] ( size_t panel_size, size_t n_inflight )
+  {
+    auto u_panels = EvaluatePanels<true, false, true, true, CACHE>
+                    ( tree, w, panel_size, n_inflight );
+    T panel_diff = 0.0, u_nrm = 0.0;
+    for ( size_t i = 0; i < u.size(); i ++ )
+    {
+      panel_diff += ( u_panels[ i ] - u[ i ] ) * ( u_panels[ i ] - u[ i ] );
+      u_nrm += u[ i ] * u[ i ];
+    }
+    printf( "EvaluatePanels (%lu rhs per panel, %lu in flight) against Evaluate %3.1E\n", 
+        panel_size, n_inflight, std::sqrt( panel_diff / u_nrm ) );
+    return std::sqrt( panel_diff / u_nrm );
+  };
+  test_check( PanelError( 5, 2 ) <= 1E+3 * std::numeric_limits<T>::epsilon(),
+      "EvaluatePanels against one plain Evaluate" );
+  test_check( PanelError( 7, 4 ) <= 1E+3 * std::numeric_limits<T>::epsilon(),
+      "EvaluatePanels (4 panels in flight) against one plain Evaluate" );
+  test_check( tree.setup.w == w_setup && tree.setup.u == u_setup,
+      "EvaluatePanels restores setup.w and setup.u" );
+
+
+  /** keep only half of the cached Kab, the rest is evaluated on demand */
+  auto CachedBytes = [ & ] ()
+  {
+    size_t bytes = 0;
+    for ( size_t i = 0; i < tree.treelist.size(); i ++ )
+    {
+      auto &data = tree.treelist[ i ]->data;
+      bytes += sizeof( T ) * ( data.NearKab.size() + data.FarKab.size() );
+    }
+    return bytes;
+  };
+  auto BudgetError = [ & ] ()
+  {
+    auto u_budget = Evaluate<true, false, true, true, CACHE>( tree, w );
+    T budgeterr_avg = 0.0;
+    for ( size_t i = 0; i < ntest; i ++ )
+    {
+      hmlp::Data<T> potentials( 1, nrhs );
+      for ( size_t p = 0; p < potentials.col(); p ++ )
+      {
+        potentials[ p ] = u_budget( p, i );
+      }
+      budgeterr_avg += ComputeError( tree, i, potentials );
+    }
+    return budgeterr_avg / ntest;
+  };
+  auto SameError = [ & ] ( T err ) 
+  { 
+    return std::abs( err - fmmerr_avg / ntest ) <= 1E-2 * ( fmmerr_avg / ntest ) + 1E-6;
+  };
+  size_t cache_bytes = CachedBytes();
+  SetCacheBudget( tree, cache_bytes / 2 );
+  /** the first evaluation evicts blocks, the second one admits measured blocks */
+  T budgeterr1 = BudgetError();
+  size_t kept1 = CachedBytes();
+  T budgeterr2 = BudgetError();
+  size_t kept2 = CachedBytes();
+  /** the whole cache fits again, so every evicted block is admitted */
+  SetCacheBudget( tree, cache_bytes );
+  T budgeterr3 = BudgetError();
+  size_t kept3 = CachedBytes();
+  SetCacheBudget( tree, 0 );
+  printf( "========================================================\n");
+  printf( "GOFMM %3.1E, Kab cache %.1lfMB %3.1E %3.1E (%.1lfMB %.1lfMB), %.1lfMB %3.1E\n",
+      fmmerr_avg / ntest, cache_bytes / 2E+6, budgeterr1, budgeterr2, 
+      kept1 / 1E+6, kept2 / 1E+6, kept3 / 1E+6, budgeterr3 );
+  printf( "========================================================\n");
+  test_check( kept1 <= cache_bytes / 2 && kept1 < cache_bytes && kept1 > 0,
+      "the Kab cache evicts down to the budget" );
+  test_check( kept2 <= cache_bytes / 2, "the Kab cache stays within the budget" );
+  test_check( kept3 == cache_bytes, "the Kab cache admits all blocks within a full budget" );
+  test_check( SameError( budgeterr1 ) && SameError( budgeterr2 ) && SameError( budgeterr3 ),
+      "the budgeted Kab cache matches the fully cached GOFMM error" );
+
+
   /** Factorization */
   const bool LU = true;
   T lambda = 10.0;
@@ -226,6 +496,129 @@ void test_gofmm
   /** compute error */
   hmlp::hfamily::ComputeError<LU, NODE>( tree, lambda, w, u );
 
+  /** dense Cholesky reference L * L' = K + shift * I */
+  std::vector<size_t> all( n );
+  for ( size_t i = 0; i < n; i ++ ) all[ i ] = i;
+  auto DenseCholesky = [ & ]( T shift, T &logdet ) 
+  {
+    hmlp::Data<T> L = K( all, all );
+    for ( size_t i = 0; i < n; i ++ ) L( i, i ) += shift;
+    hmlp::xpotrf( "L", n, L.data(), n );
+    logdet = 0.0;
+    for ( size_t i = 0; i < n; i ++ ) 
+      logdet += 2.0 * std::log( L( i, i ) );
+    return L;
+  };
+
+  /** log| K + lambda * I | and trace( inv( K + lambda * I ) ) */
+  T logdet = hmlp::hfamily::LogDet<NODE, T>( tree );
+  T trace = hmlp::hfamily::Trace<LU, NODE, T>( tree, 32 );
+  T logdet_dense = 0.0, trace_dense = 0.0;
+  if ( n <= 8192 )
+  {
+    auto L = DenseCholesky( lambda, logdet_dense );
+    /** trace( inv( LL' ) ) = || inv( L ) ||_F^2 */
+    hmlp::Data<T> Linv( n, n, 0.0 );
+    for ( size_t i = 0; i < n; i ++ ) Linv( i, i ) = 1.0;
+    hmlp::xtrsm( "L", "L", "N", "N", n, n, 1.0, L.data(), n, Linv.data(), n );
+    for ( size_t i = 0; i < Linv.size(); i ++ ) 
+      trace_dense += Linv[ i ] * Linv[ i ];
+  }
+  printf( "logdet %.4E (dense %.4E), trace %.4E (dense %.4E)\n", 
+      logdet, logdet_dense, trace, trace_dense );
+  printf( "========================================================\n");
+  /**
+   *  The 32 probe estimate is only as good as the factorization it solves
+   *  with, so compare against the dense trace only when the factorization
+   *  is SPD and inverts K * w + lambda * w back to w with relative error
+   *  below 1 (the float random SPD cases at lambda = 10 can be far off).
+   */
+  if ( n <= 8192 )
+  {
+    hmlp::Data<T> x( n, w.row() );
+    for ( size_t j = 0; j < w.row(); j ++ )
+      for ( size_t i = 0; i < n; i ++ )
+        x( i, j ) = u( j, i ) + lambda * w( j, i );
+    hmlp::hfamily::Solve<LU, NODE, T>( tree, x );
+    T solve_err = 0.0, solve_nrm = 0.0;
+    for ( size_t j = 0; j < w.row(); j ++ )
+      for ( size_t i = 0; i < n; i ++ )
+      {
+        solve_err += ( x( i, j ) - w( j, i ) ) * ( x( i, j ) - w( j, i ) );
+        solve_nrm += w( j, i ) * w( j, i );
+      }
+    bool spd = ( tree.treelist[ 0 ]->data.detsign > 0.0 );
+    if ( spd && std::sqrt( solve_err / solve_nrm ) < 1.0 )
+      test_check( std::abs( trace - trace_dense ) <= 1E-1 * trace_dense,
+          "stochastic trace ( 32 probes ) within 10% of the dense trace" );
+    else
+      printf( "skip the dense trace check: factorization error %3.1E, detsign %.0f\n",
+          std::sqrt( solve_err / solve_nrm ), tree.treelist[ 0 ]->data.detsign );
+  }
+
+  /** 
+   *  Krylov solvers on ( K + mu * I ) x = K * w + mu * w, whose solution is
+   *  w since the rhs uses the same compressed matvec. With mu = lambda the
+   *  compressed random SPD matrix is indefinite, so CG can not converge.
+   *  GMRES takes the LU factorization; PCG needs the symmetric one.
+   */
+  T mu = 10.0 * lambda;
+  auto rhs = Evaluate<true, false, true, true, CACHE>( tree, w );
+  for ( size_t i = 0; i < rhs.size(); i ++ ) rhs[ i ] += mu * w[ i ];
+  hmlp::hfamily::Factorize<LU, NODE, T>( tree, mu );
+  T logdet_lu = hmlp::hfamily::LogDet<NODE, T>( tree );
+  bool spd_lu = ( tree.treelist[ 0 ]->data.detsign > 0.0 );
+  auto x_gmres = GMRES<LU>( tree, tree, mu, rhs, (T)1E-5, 50, 10 );
+  hmlp::hfamily::Factorize<false, NODE, T>( tree, mu );
+  {
+    /** 
+     *  log| K + mu * I | = log| W * W' | of the Cholesky factorization is 
+     *  the LU log| det | of the same approximation if it is SPD. The dense
+     *  reference also sees the off-diagonal approximation error.
+     */
+    T logdet_chol = hmlp::hfamily::LogDet<NODE, T>( tree ), logdet_mu = 0.0;
+    if ( n <= 8192 ) DenseCholesky( mu, logdet_mu );
+    printf( "Cholesky logdet %.4E (LU %.4E, dense %.4E) at mu %.1E\n", 
+        logdet_chol, logdet_lu, logdet_mu, mu );
+    if ( spd_lu )
+      test_check( std::abs( logdet_chol - logdet_lu ) <= 1E-4 * std::abs( logdet_lu ),
+          "Cholesky hfamily log| K + mu * I | against LU" );
+    if ( n <= 8192 )
+      test_check( std::abs( logdet_chol - logdet_mu ) <= 5E-2 * std::abs( logdet_mu ),
+          "Cholesky hfamily log| K + mu * I | against dense Cholesky" );
+  }
+  auto x_pcg = PCG( tree, tree, mu, rhs, (T)1E-5, 50 );
+  auto x_bpcg = BlockPCG( tree, tree, mu, rhs, (T)1E-5, 50 );
+  std::vector<hmlp::Data<T>*> x_krylov = { &x_gmres, &x_pcg, &x_bpcg };
+  std::vector<T> krylov_res, krylov_err;
+  for ( auto *x_ptr : x_krylov )
+  {
+    hmlp::Data<T> Ax;
+    ShiftedEvaluate( tree, mu, *x_ptr, Ax );
+    T res2 = 0.0, rhs2 = 0.0, err2 = 0.0, w2 = 0.0;
+    for ( size_t i = 0; i < w.size(); i ++ )
+    {
+      res2 += ( rhs[ i ] - Ax[ i ] ) * ( rhs[ i ] - Ax[ i ] );
+      rhs2 += rhs[ i ] * rhs[ i ];
+      err2 += ( (*x_ptr)[ i ] - w[ i ] ) * ( (*x_ptr)[ i ] - w[ i ] );
+      w2   += w[ i ] * w[ i ];
+    }
+    krylov_res.push_back( std::sqrt( res2 / rhs2 ) );
+    krylov_err.push_back( std::sqrt( err2 / w2 ) );
+  }
+  printf( "========================================================\n");
+  printf( "residual (error) GMRES %3.1E (%3.1E), PCG %3.1E (%3.1E), BlockPCG %3.1E (%3.1E)\n",
+      krylov_res[ 0 ], krylov_err[ 0 ], krylov_res[ 1 ], krylov_err[ 1 ], 
+      krylov_res[ 2 ], krylov_err[ 2 ] );
+  printf( "========================================================\n");
+  /** 
+   *  The error is up to cond( K + mu * I ) times the residual, 1E+4 to 1E+5
+   *  in float, so it only has to stay below that of x = 0.
+   */
+  test_check( krylov_res[ 0 ] <= 1E-4 && krylov_err[ 0 ] < 1.0, "GMRES" );
+  test_check( krylov_res[ 1 ] <= 1E-4 && krylov_err[ 1 ] < 1.0, "PCG" );
+  test_check( krylov_res[ 2 ] <= 1E-4 && krylov_err[ 2 ] < 1.0, "BlockPCG" );
+
   //#ifdef DUMP_ANALYSIS_DATA
   hmlp::gofmm::Summary<NODE> summary;
   tree.Summary( summary );
@@ -305,6 +698,140 @@ void test_gofmm_setup
 
 
 
+/**
+ *  @brief Tests that need T = double on their own tree. The lambda sweep
+ *         with eigen leaves is compared against a fresh factorization.
+ *         At lambda = 10 the SMW blocks reach condition numbers of 1E+11
+ *         even in double, so the sweep ends at lambda = 1000, where two 
+ *         factorizations must agree to rounding. Mixed precision comes last, since
+ *         the conversion is permanent; only double is demoted. The cached 
+ *         matvec is timed before and after the conversion; its traffic
+ *         is dominated by the cached Kab and proj.
+ */ 
+template<bool ADAPTIVE, bool LEVELRESTRICTION, typename T, typename SPDMATRIX>
+void test_gofmm_double
+( 
+  SPDMATRIX &K, DistanceMetric metric,
+  size_t n, size_t m, size_t k, size_t s, 
+  double stol, double budget, size_t nrhs
+)
+{
+  using SPLITTER     = hmlp::gofmm::centersplit<SPDMATRIX, N_CHILDREN, T>;
+  using RKDTSPLITTER = hmlp::gofmm::randomsplit<SPDMATRIX, N_CHILDREN, T>;
+  using TL = typename hmlp::gofmm::Data<T>::TL;
+  const bool CACHE = true;
+
+  SPLITTER splitter;
+  splitter.Kptr = &K;
+  splitter.metric = metric;
+  RKDTSPLITTER rkdtsplitter;
+  rkdtsplitter.Kptr = &K;
+  rkdtsplitter.metric = metric;
+  hmlp::Data<T> *X = NULL;
+  hmlp::Data<std::pair<T, std::size_t>> NN;
+  Configuration<T> config( metric, n, m, k, s, stol, budget );
+  auto *tree_ptr = Compress<ADAPTIVE, LEVELRESTRICTION, SPLITTER, RKDTSPLITTER, T>
+    ( X, K, NN, splitter, rkdtsplitter, config );
+  auto &tree = *tree_ptr;
+  using NODE = typename std::remove_pointer<
+    typename decltype( tree.treelist )::value_type>::type;
+
+  /** regularization sweep with eigen leaves, ending at lambda */
+  {
+    const bool LU = true;
+    T lambda = 1000.0;
+    size_t nsweep = 10;
+    hmlp::Data<T> b( n, nrhs ); b.rand();
+
+    double fact_beg = omp_get_wtime();
+    hmlp::hfamily::Factorize<LU, NODE, T>( tree, lambda ); 
+    double fact_time = omp_get_wtime() - fact_beg;
+    auto x_fresh = b;
+    hmlp::hfamily::Solve<LU, NODE, T>( tree, x_fresh );
+
+    tree.setup.leaf_eig = true;
+    double sweep_beg = omp_get_wtime();
+    for ( size_t p = nsweep; p > 0; p -- )
+      hmlp::hfamily::Factorize<LU, NODE, T>( tree, lambda * p ); 
+    double sweep_time = omp_get_wtime() - sweep_beg;
+    auto x_sweep = b;
+    hmlp::hfamily::Solve<LU, NODE, T>( tree, x_sweep );
+    tree.setup.leaf_eig = false;
+
+    T sweep_err = 0.0, sweep_nrm = 0.0;
+    for ( size_t i = 0; i < x_fresh.size(); i ++ )
+    {
+      sweep_err += ( x_sweep[ i ] - x_fresh[ i ] ) * ( x_sweep[ i ] - x_fresh[ i ] );
+      sweep_nrm += x_fresh[ i ] * x_fresh[ i ];
+    }
+    sweep_err = std::sqrt( sweep_err / sweep_nrm );
+    printf( "========================================================\n");
+    printf( "Factorize %5.2lfs, %lu lambda sweep %5.2lfs, against fresh %3.1E\n",
+        fact_time, nsweep, sweep_time, sweep_err );
+    printf( "========================================================\n");
+    test_check( sweep_err <= 1E-10,
+        "solve after the lambda sweep matches a fresh Factorize( lambda )" );
+  }
+
+  /** bytes of proj and the cached Kab */
+  auto StoredBytes = [ & ] ()
+  {
+    double bytes = 0.0;
+    for ( size_t i = 0; i < tree.treelist.size(); i ++ )
+    {
+      auto &data = tree.treelist[ i ]->data;
+      bytes += sizeof( T ) * ( data.proj.size() + data.NearKab.size() + data.FarKab.size() );
+      bytes += sizeof( TL ) * ( data.lproj.size() + data.lNearKab.size() + data.lFarKab.size() );
+    }
+    return bytes;
+  };
+
+  /** average error of 100 rows, and the best of 3 cached matvecs */
+  size_t ntest = 100;
+  hmlp::Data<T> w( nrhs, n ); w.rand();
+  auto Measure = [ & ] ( T &err, double &time )
+  {
+    auto u = Evaluate<true, false, true, true, CACHE>( tree, w );
+    time = 1E+30;
+    for ( size_t rep = 0; rep < 3; rep ++ )
+    {
+      double beg = omp_get_wtime();
+      u = Evaluate<true, false, true, true, CACHE>( tree, w );
+      time = std::min( time, omp_get_wtime() - beg );
+    }
+    err = 0.0;
+    for ( size_t i = 0; i < ntest; i ++ )
+    {
+      hmlp::Data<T> potentials( 1, nrhs );
+      for ( size_t p = 0; p < potentials.col(); p ++ ) potentials[ p ] = u( p, i );
+      err += ComputeError( tree, i, potentials ) / ntest;
+    }
+  };
+
+  T fmmerr, mixederr;
+  double fmm_time, mixed_time;
+  Measure( fmmerr, fmm_time );
+  double fmm_bytes = StoredBytes();
+  ConvertToMixedPrecision( tree );
+  Measure( mixederr, mixed_time );
+  double mixed_bytes = StoredBytes();
+
+  printf( "========================================================\n");
+  printf( "GOFMM %3.1E, %.1lfMB, matvec %.3lfs %.1lfGB/s\n", 
+      fmmerr, fmm_bytes / 1E+6, fmm_time, fmm_bytes / ( fmm_time * 1E+9 ) );
+  printf( "GOFMM (mixed precision) %3.1E, %.1lfMB, matvec %.3lfs %.1lfGB/s\n", 
+      mixederr, mixed_bytes / 1E+6, mixed_time, mixed_bytes / ( mixed_time * 1E+9 ) );
+  printf( "========================================================\n");
+  test_check( tree.setup.mixed && mixed_bytes <= 0.5 * fmm_bytes + 1.0,
+      "ConvertToMixedPrecision stores proj and the cached Kab in float" );
+  test_check( mixederr <= fmmerr + 1E-4,
+      "mixed precision adds at most 1E-4 to the GOFMM error" );
+
+  delete tree_ptr;
+}; /** end test_gofmm_double() */
+
+
+
 /**
  *  @brief Top level driver that reads arguments from the command line.
  */ 
@@ -448,7 +975,6 @@ int main( int argc, char *argv[] )
     {
       /** dense spd matrix format */
       hmlp::gofmm::SPDMatrix<T> K;
-      K.resize( n, n );
       K.read( n, n, user_matrix_filename );
 
       /** (optional) provide neighbors, leave uninitialized otherwise */
@@ -546,6 +1072,14 @@ int main( int argc, char *argv[] )
 				( X, K, NN, metric, n, m, k, s, stol, budget, nrhs );
 		}
 		{
+      /** hfamily sweep and mixed precision (float is not demoted) in double */
+			hmlp::gofmm::SPDMatrix<double> K;
+			K.resize( n, n );
+			K.randspd<USE_LOWRANK>( 0.0, 1.0 );
+      test_gofmm_double<ADAPTIVE, LEVELRESTRICTION, double>
+        ( K, metric, n, m, k, s, stol, budget, nrhs );
+		}
+		{
       d = 4;
 			/** generate coordinates from normal(0,1) distribution */
 			hmlp::Data<T> X( d, n ); X.randn( 0.0, 1.0 );
@@ -561,6 +1095,336 @@ int main( int argc, char *argv[] )
       test_gofmm_setup<ADAPTIVE, LEVELRESTRICTION, T>
       ( &X, K, NN, metric, n, m, k, s, stol, budget, nrhs );
 		}
+		{
+      /** 
+       *  cross kernel: n / 2 targets against n sources in 2D, drawn from
+       *  the same distribution or shifted by 4 (mostly far pairs)
+       */
+      size_t ntar = n / 2, d = 2;
+      for ( T shift : { 0.0, 4.0 } )
+      {
+        hmlp::Data<T> sources( d, n ); sources.randn( 0.0, 1.0 );
+        hmlp::Data<T> targets( d, ntar ); targets.randn( 0.0, 1.0 );
+        for ( size_t j = 0; j < ntar; j ++ ) targets( (size_t)0, j ) += shift;
+        kernel_s<T> kernel;
+        kernel.type = KS_GAUSSIAN;
+        kernel.scal = -0.5 / ( h * h );
+        CrossKernel<T> Kts( kernel, targets, sources, m, s, stol );
+        hmlp::Data<T> w( nrhs, n ); w.rand();
+        auto u = Kts.Evaluate( w );
+        /** compare all targets with the dense K( targets, sources ) * w */
+        hmlp::KernelMatrix<T> Kexact( ntar, n, d, kernel, sources, targets );
+        std::vector<size_t> jall( n );
+        for ( size_t j = 0; j < n; j ++ ) jall[ j ] = j;
+        double err = 0.0, nrm = 0.0;
+        for ( size_t i = 0; i < ntar; i ++ )
+        {
+          std::vector<size_t> irow( 1, i );
+          auto Ki = Kexact( irow, jall );
+          for ( size_t p = 0; p < nrhs; p ++ )
+          {
+            T uexact = 0.0;
+            for ( size_t j = 0; j < n; j ++ ) uexact += Ki[ j ] * w( p, j );
+            err += ( u( p, i ) - uexact ) * ( u( p, i ) - uexact );
+            nrm += uexact * uexact;
+          }
+        }
+        printf( "Cross kernel K( targets, sources ) GOFMM (shift %.0lf) %3.1E\n", 
+            (double)shift, std::sqrt( err / nrm ) );
+        test_check( std::sqrt( err / nrm ) <= 1E-2, "CrossKernel against dense K( targets, sources ) * w" );
+        /** the shifted targets are well separated from most sources */
+        size_t n_far = 0;
+        for ( auto *node : Kts.rtree.treelist ) n_far += node->FarList.size();
+        if ( shift > 0.0 ) test_check( n_far > 0, "CrossKernel uses row and column skeletons" );
+      }
+		}
+		{
+      /** 
+       *  fused Kab and K( i, j ) against an independent reference for all 
+       *  kernel types, including a coincident pair ( r2 = 0 ) and a close
+       *  pair, for the packed ( d <= 256 ) and the xgemm path
+       */
+      std::vector<T> bandwidth( n );
+      for ( size_t i = 0; i < n; i ++ ) bandwidth[ i ] = 1.0 / ( h * h ) + i % 2;
+      std::vector<size_t> imap( std::min( n, (size_t)1024 ) ), jmap( imap.size() );
+      for ( size_t i = 0; i < imap.size(); i ++ ) imap[ i ] = std::rand() % n;
+      for ( size_t j = 0; j < jmap.size(); j ++ ) jmap[ j ] = std::rand() % n;
+      imap[ 0 ] = jmap[ 0 ];
+      /** the vmath routines behind the fused Kab, in both precisions */
+      VMathTest<float>();
+      VMathTest<double>();
+      /** the leaf kNN behind the neighbor search, in both precisions */
+      LeafGSKNNTest<float>();
+      LeafGSKNNTest<double>();
+      for ( size_t dd : { d, (size_t)300 } )
+      {
+      /** the same spread of distances in all dimensions */
+      hmlp::Data<T> X( dd, n ); X.randn( 0.0, std::sqrt( (T)d / dd ) );
+      if ( imap[ 1 ] != jmap[ 1 ] )
+        for ( size_t p = 0; p < dd; p ++ )
+          X( p, imap[ 1 ] ) = X( p, jmap[ 1 ] ) + 1E-3 * std::sqrt( (T)d / dd );
+      for ( int type = KS_GAUSSIAN; type <= KS_EPANECHNIKOV; type ++ )
+      {
+        kernel_s<T> kernel;
+        kernel.type = (ks_type)type;
+        kernel.scal = -0.5 / ( h * h );
+        kernel.cons = 1.0;
+        kernel.powe = 4.0;
+        kernel.hi = bandwidth.data();
+        kernel.hj = bandwidth.data();
+        if ( type == KS_POLYNOMIAL || type == KS_TANH ) kernel.scal = 0.1;
+        if ( type == KS_QUARTIC || type == KS_EPANECHNIKOV ) kernel.scal = 0.1 / ( h * h );
+        hmlp::KernelMatrix<T> K( n, n, dd, kernel, X );
+        double beg = omp_get_wtime();
+        auto Kab = K( imap, jmap );
+        double kab_time = omp_get_wtime() - beg;
+        T maxerr = 0.0, maxval = 0.0, scalarerr = 0.0;
+        for ( size_t j = 0; j < jmap.size(); j ++ )
+        {
+          for ( size_t i = 0; i < imap.size(); i ++ )
+          {
+            T Kij = KernelReference( kernel, dd, X.data(), imap[ i ], jmap[ j ] );
+            maxerr = std::max( maxerr, std::abs( Kab( i, j ) - Kij ) );
+            scalarerr = std::max( scalarerr, std::abs( K( imap[ i ], jmap[ j ] ) - Kij ) );
+            maxval = std::max( maxval, std::abs( Kij ) );
+          }
+        }
+        /** the same block with the fast hmlp::vmath routines */
+        K.SetFastMath( true );
+        beg = omp_get_wtime();
+        auto Kfast = K( imap, jmap );
+        double fast_time = omp_get_wtime() - beg;
+        T fasterr = 0.0;
+        for ( size_t i = 0; i < Kab.size(); i ++ )
+          fasterr = std::max( fasterr, std::abs( Kfast[ i ] - Kab[ i ] ) );
+        printf( "Kab type %d, d %lu, %lux%lu, relative error %3.1E, %5.2lf GFLOPS (fast %3.1E, %5.2lf GFLOPS), K( i, j ) %3.1E\n", 
+            type, dd, imap.size(), jmap.size(), maxerr / maxval, 
+            K.flops( imap.size(), jmap.size() ) / ( kab_time * 1E+9 ),
+            fasterr / maxval,
+            K.flops( imap.size(), jmap.size() ) / ( fast_time * 1E+9 ),
+            scalarerr / maxval );
+        /** both use ( x - y )^2 where x'x + y'y - 2x'y would cancel */
+        T scalartol = ( dd > 256 ) ? 1E-5 : 1E-6;
+        test_check( scalarerr <= scalartol * maxval, "K( i, j ) against the ( x - y )^2 reference" );
+        test_check( maxerr <= 1E-5 * maxval && fasterr <= 1E-5 * maxval, 
+            "fused K( imap, jmap ) against the ( x - y )^2 reference" );
+      }
+      }
+      /** points in (reversed) tree order, contiguous blocks and d > 256 */
+      for ( size_t dd : { d, (size_t)300 } )
+      {
+        hmlp::Data<T> Y( dd, n ); Y.randn( 0.0, 1.0 );
+        kernel_s<T> kernel;
+        kernel.type = KS_GAUSSIAN;
+        kernel.scal = -0.5 / ( h * h * dd );
+        hmlp::KernelMatrix<T> K( n, n, dd, kernel, Y );
+        std::vector<size_t> perm( n );
+        for ( size_t i = 0; i < n; i ++ ) perm[ i ] = n - 1 - i;
+        K.Permute( perm );
+        for ( size_t i = 0; i < imap.size(); i ++ ) imap[ i ] = perm[ i ];
+        T maxerr = 0.0;
+        auto Kab = K( imap, jmap );
+        for ( size_t j = 0; j < jmap.size(); j ++ )
+          for ( size_t i = 0; i < imap.size(); i ++ )
+            maxerr = std::max( maxerr, std::abs( Kab( i, j ) - K( imap[ i ], jmap[ j ] ) ) );
+        printf( "Kab tree order d %lu, max error %3.1E\n", dd, maxerr );
+        /** Gaussian entries are at most 1, so the error is relative */
+        test_check( maxerr <= ( ( dd > 256 ) ? 1E-5 : 1E-6 ), 
+            "permuted K( imap, jmap ) against K( i, j ) in tree order" );
+      }
+		}
+		{
+      /** out-of-core: write a dense spd matrix to disk and read it back */
+			hmlp::gofmm::SPDMatrix<T> K;
+			K.resize( n, n );
+			K.randspd<USE_LOWRANK>( 0.0, 1.0 );
+      std::string filename( "test_gofmm_ooc.bin" );
+      std::ofstream file( filename.data(), std::ios::out|std::ios::binary );
+      file.write( (char*)K.data(), K.size() * sizeof(T) );
+      file.close();
+      /** the tile cache only holds 1/8 of the matrix */
+      hmlp::OOC<T> Kooc( n, n, filename, K.size() * sizeof(T) / 8 );
+      hmlp::OOC<T> Kmap( n, n, filename, 0, true );
+      std::vector<size_t> imap( std::min( n, (size_t)1024 ) ), jmap( imap.size() );
+      for ( size_t i = 0; i < imap.size(); i ++ ) imap[ i ] = std::rand() % n;
+      for ( size_t j = 0; j < jmap.size(); j ++ ) jmap[ j ] = std::rand() % n;
+      double beg = omp_get_wtime();
+      auto Kab = Kooc( imap, jmap );
+      double ooc_time = omp_get_wtime() - beg;
+      beg = omp_get_wtime();
+      auto Kab_mmap = Kmap( imap, jmap );
+      double mmap_time = omp_get_wtime() - beg;
+      /** background reads race with the foreground reads of the same tiles */
+      hmlp::OOC<T> Kpre( n, n, filename, K.size() * sizeof(T) / 8 );
+      Kpre.Prefetch( imap, jmap );
+      auto Kab_pre = Kpre( imap, jmap );
+      T maxerr = 0.0, mmaperr = 0.0, preerr = 0.0;
+      for ( size_t j = 0; j < jmap.size(); j ++ )
+      {
+        for ( size_t i = 0; i < imap.size(); i ++ )
+        {
+          maxerr  = std::max( maxerr,  std::abs( Kab( i, j )      - K( imap[ i ], jmap[ j ] ) ) );
+          mmaperr = std::max( mmaperr, std::abs( Kab_mmap( i, j ) - K( imap[ i ], jmap[ j ] ) ) );
+          preerr  = std::max( preerr,  std::abs( Kab_pre( i, j )  - K( imap[ i ], jmap[ j ] ) ) );
+        }
+      }
+      printf( "OOC K( imap, jmap ) %lux%lu, max error %3.1E (mmap %3.1E, prefetch %3.1E), %5.2lfs (mmap %5.2lfs)\n",
+          imap.size(), jmap.size(), maxerr, mmaperr, preerr, ooc_time, mmap_time );
+      /** all paths copy the bytes written above */
+      test_check( maxerr == 0.0, "OOC K( imap, jmap ) with pread against the dense K" );
+      test_check( mmaperr == 0.0, "OOC K( imap, jmap ) with mmap against the dense K" );
+      test_check( preerr == 0.0, "OOC K( imap, jmap ) after Prefetch() against the dense K" );
+      /** GOFMM reads all entries through the tile cache */
+			hmlp::Data<T> *X = NULL;
+			hmlp::Data<std::pair<T, std::size_t>> NN;
+      test_gofmm_setup<ADAPTIVE, LEVELRESTRICTION, T>
+        ( X, Kooc, NN, metric, n, m, k, s, stol, budget, nrhs );
+      /** tiled format: convert, read back, and permute tiles to the tree order */
+      std::string tiledname( "test_gofmm_tiled.bin" );
+      hmlp::TiledMatrix<T>::Convert( n, n, filename, tiledname, 256 );
+      hmlp::TiledMatrix<T> Ktiled( tiledname, K.size() * sizeof(T) / 8 );
+      auto Kab_tiled = Ktiled( imap, jmap );
+      maxerr = 0.0;
+      for ( size_t j = 0; j < jmap.size(); j ++ )
+        for ( size_t i = 0; i < imap.size(); i ++ )
+          maxerr = std::max( maxerr, std::abs( Kab_tiled( i, j ) - K( imap[ i ], jmap[ j ] ) ) );
+      printf( "Tiled K( imap, jmap ) %lux%lu, max error %3.1E\n",
+          imap.size(), jmap.size(), maxerr );
+      test_check( maxerr == 0.0, "TiledMatrix K( imap, jmap ) against the dense K" );
+      /** the tree order only writes the permuted copy if asked to */
+      hmlp::Data<std::pair<T, std::size_t>> NNtiled;
+      Ktiled.SetTreeOrderCopy( true );
+      test_gofmm_setup<ADAPTIVE, LEVELRESTRICTION, T>
+        ( X, Ktiled, NNtiled, metric, n, m, k, s, stol, budget, nrhs );
+      test_check( std::ifstream( ( tiledname + ".tree" ).data() ).good(),
+          "TiledMatrix::SetTreeOrderCopy() writes the tree order copy" );
+      /** the cache holds 1/8 of the matrix, so the permutation takes 8 blocks */
+      Kab_tiled = Ktiled( imap, jmap );
+      maxerr = 0.0;
+      for ( size_t j = 0; j < jmap.size(); j ++ )
+        for ( size_t i = 0; i < imap.size(); i ++ )
+          maxerr = std::max( maxerr, std::abs( Kab_tiled( i, j ) - K( imap[ i ], jmap[ j ] ) ) );
+      for ( size_t i = 0; i < imap.size(); i ++ )
+        maxerr = std::max( maxerr, std::abs( Ktiled( imap[ i ], jmap[ i ] ) - K( imap[ i ], jmap[ i ] ) ) );
+      printf( "Tiled (tree order) K( imap, jmap ) and K( i, j ), max error %3.1E\n", maxerr );
+      test_check( maxerr == 0.0, "TiledMatrix in tree order against the dense K" );
+      std::remove( filename.data() );
+      std::remove( tiledname.data() );
+      std::remove( ( tiledname + ".tree" ).data() );
+		}
+		{
+      /** sparse K( imap, jmap ) (merge-join) against K( i, j ) (binary search) */
+      std::vector<size_t> col_ptr( n + 1, 0 ), row_ind;
+      std::vector<T> val;
+      for ( size_t j = 0; j < n; j ++ )
+      {
+        std::set<size_t> rows;
+        rows.insert( j );
+        for ( size_t p = 0; p < 16; p ++ ) rows.insert( j + std::rand() % ( n - j ) );
+        for ( auto i : rows ) { row_ind.push_back( i ); val.push_back( i + 1.0 / ( j + 1 ) ); }
+        col_ptr[ j + 1 ] = row_ind.size();
+      }
+      hmlp::CSC<true, T> Ksym( n, n, row_ind.size(), val.data(), row_ind.data(), col_ptr.data() );
+      hmlp::CSC<false, T> Kgen( n, n, row_ind.size(), val.data(), row_ind.data(), col_ptr.data() );
+      std::vector<size_t> imap( 256 ), jmap( 256 );
+      for ( size_t i = 0; i < imap.size(); i ++ ) imap[ i ] = std::rand() % n;
+      for ( size_t j = 0; j < jmap.size(); j ++ ) jmap[ j ] = std::rand() % n;
+      /** repeated rows and columns */
+      imap[ 1 ] = imap[ 0 ]; jmap[ 1 ] = jmap[ 0 ]; jmap[ 2 ] = imap[ 3 ];
+      auto Ksab = Ksym( imap, jmap );
+      auto Kgab = Kgen( imap, jmap );
+      T maxerr = 0.0;
+      for ( size_t j = 0; j < jmap.size(); j ++ )
+      {
+        for ( size_t i = 0; i < imap.size(); i ++ )
+        {
+          maxerr = std::max( maxerr, std::abs( Ksab( i, j ) - Ksym( imap[ i ], jmap[ j ] ) ) );
+          maxerr = std::max( maxerr, std::abs( Kgab( i, j ) - Kgen( imap[ i ], jmap[ j ] ) ) );
+        }
+      }
+      printf( "CSC K( imap, jmap ) %lux%lu, max error %3.1E\n", imap.size(), jmap.size(), maxerr );
+      test_check( maxerr == 0.0, "CSC merge-join K( imap, jmap ) against K( i, j )" );
+      /** the repeated rows and columns hold the same entries */
+      T reperr = 0.0;
+      for ( size_t j = 0; j < jmap.size(); j ++ )
+      {
+        reperr = std::max( reperr, std::abs( Ksab( (size_t)1, j ) - Ksab( (size_t)0, j ) ) );
+        reperr = std::max( reperr, std::abs( Kgab( (size_t)1, j ) - Kgab( (size_t)0, j ) ) );
+      }
+      for ( size_t i = 0; i < imap.size(); i ++ )
+      {
+        reperr = std::max( reperr, std::abs( Ksab( i, (size_t)1 ) - Ksab( i, (size_t)0 ) ) );
+        reperr = std::max( reperr, std::abs( Kgab( i, (size_t)1 ) - Kgab( i, (size_t)0 ) ) );
+      }
+      test_check( reperr == 0.0, "CSC merge-join K( imap, jmap ) with repeated rows and columns" );
+
+      /** the lower triangle of Ksym in matrix market format, read (mirrored) twice */
+      std::string filename = std::string( "test_gofmm_csc.mtx" );
+      FILE *mtx = fopen( filename.data(), "w" );
+      fprintf( mtx, "%%%%MatrixMarket matrix coordinate real symmetric\n%% comment\n" );
+      fprintf( mtx, "%lu %lu %lu\n", n, n, row_ind.size() );
+      for ( size_t j = 0; j < n; j ++ )
+        for ( size_t p = col_ptr[ j ]; p < col_ptr[ j + 1 ]; p ++ )
+          fprintf( mtx, "%lu %lu %.17g\n", row_ind[ p ] + 1, j + 1, (double)val[ p ] );
+      fclose( mtx );
+      std::remove( ( filename + ".csc" ).data() );
+      T mtxerr[ 2 ] = { 0.0, 0.0 };
+      bool mapped[ 2 ] = { false, false };
+      for ( size_t pass = 0; pass < 2; pass ++ )
+      {
+        /** the second pass maps the binary cache */
+        hmlp::CSC<false, T> Kmtx( n, n, row_ind.size() );
+        Kmtx.readmtx<true, false>( filename );
+        mapped[ pass ] = Kmtx.IsMapped();
+        auto Kmab = Kmtx( imap, jmap );
+        for ( size_t j = 0; j < jmap.size(); j ++ )
+          for ( size_t i = 0; i < imap.size(); i ++ )
+            mtxerr[ pass ] = std::max( mtxerr[ pass ], std::abs( Kmab( i, j ) - Ksab( i, j ) ) );
+      }
+      printf( "CSC readmtx (parsed, cached) K( imap, jmap ), max error %3.1E %3.1E\n", 
+          mtxerr[ 0 ], mtxerr[ 1 ] );
+      test_check( mtxerr[ 0 ] == 0.0, "CSC readmtx (parsed) against the CSC it was written from" );
+      test_check( mtxerr[ 1 ] == 0.0, "CSC readmtx (cached) against the CSC it was written from" );
+      test_check( !mapped[ 0 ] && mapped[ 1 ], "CSC readmtx parses once and then maps the .csc cache" );
+      std::remove( filename.data() );
+      std::remove( ( filename + ".csc" ).data() );
+		}
+		{
+      /** Data files are mapped copy-on-write: with a header, raw, and copies */
+      hmlp::Data<T> A( 37, 53 );
+      A.randn();
+      std::string dataname( "test_gofmm_data.bin" ), rawname( "test_gofmm_data.raw" );
+      A.write( dataname );
+      std::ofstream raw( rawname.data(), std::ios::out|std::ios::binary );
+      raw.write( (char*)A.data(), A.size() * sizeof(T) );
+      raw.close();
+      hmlp::Data<T> B( dataname ), C( A.row(), A.col(), rawname );
+      hmlp::Data<T> D( B );
+      auto MaxError = [ & ] ( hmlp::Data<T> &X )
+      {
+        if ( X.row() != A.row() || X.col() != A.col() ) return (T)1.0;
+        T maxerr = 0.0;
+        for ( size_t i = 0; i < A.size(); i ++ ) 
+          maxerr = std::max( maxerr, std::abs( X[ i ] - A[ i ] ) );
+        return maxerr;
+      };
+      T headererr = MaxError( B ), rawerr = MaxError( C ), copyerr = MaxError( D );
+      /** writes stay private: neither the file nor the copy sees them */
+      T b00 = A( 0, 0 ) + 1.0;
+      B( 0, 0 ) = b00;
+      hmlp::Data<T> E( dataname );
+      T privateerr = std::max( MaxError( D ), MaxError( E ) );
+      bool written = ( B( 0, 0 ) == b00 );
+      printf( "Data read (mapped) %lux%lu, max error %3.1E (raw %3.1E, copy %3.1E, private %3.1E)\n", 
+          E.row(), E.col(), headererr, rawerr, copyerr, privateerr );
+      test_check( headererr == 0.0, "Data read with a header against the written Data" );
+      test_check( rawerr == 0.0, "Data read from a raw file against the written Data" );
+      test_check( copyerr == 0.0, "copy of a mapped Data against the written Data" );
+      test_check( written && privateerr == 0.0, 
+          "writes to a mapped Data are private to it" );
+      std::remove( dataname.data() );
+      std::remove( rawname.data() );
+		}
   }
 
 